@@ -75,6 +75,16 @@ int String_ToIntegerHex(const char * str, char ** endptr) {
 
 // Engine/Log.cpp
 
+static char *mprintf_valist(int size, const char *fmt, va_list args);
+
+static Log_ErrorHandler s_errorHandler = NULL;
+
+Log_ErrorHandler Log_SetErrorHandler(Log_ErrorHandler handler) {
+    Log_ErrorHandler previous = s_errorHandler;
+    s_errorHandler = handler;
+    return previous;
+}
+
 void Log_Error(const char * format, ...) {
     va_list args;
     va_start(args, format);
@@ -83,10 +93,17 @@ void Log_Error(const char * format, ...) {
 }
 
 void Log_ErrorArgList(const char * format, va_list args) {
+    if (s_errorHandler != NULL) {
+        char * message = mprintf_valist(256, format, args);
+        s_errorHandler(message);
+        delete [] message;
+        return;
+    }
+
 #if 1 // @@ Don't we need to do this?
     va_list tmp;
     va_copy(tmp, args);
-    vprintf( format, args );
+    vfprintf( stderr, format, args );
     va_end(tmp);
 
     try
@@ -98,7 +115,7 @@ void Log_ErrorArgList(const char * format, va_list args) {
         
     }
 #else
-    vprintf( format, args );
+    vfprintf( stderr, format, args );
 #endif
 }
 
@@ -115,15 +132,15 @@ StringPool::~StringPool() {
 }
 
 const char * StringPool::AddString(const char * string) {
-    for (size_t i = 0; i < stringArray.size(); i++) {
-        if (String_Equal(stringArray[i], string)) return stringArray[i];
-    }
+    auto it = stringSet.find(string);
+    if (it != stringSet.end()) return it->data();
 #if _MSC_VER
     const char * dup = _strdup(string);
 #else
     const char * dup = strdup(string);
 #endif
     stringArray.push_back(dup);
+    stringSet.insert(dup);
     return dup;
 }
 
@@ -164,14 +181,14 @@ const char * StringPool::AddStringFormatList(const char * format, va_list args)
     const char * string = mprintf_valist(256, format, tmp);
     va_end(tmp);
 
-    for (size_t i = 0; i < stringArray.size(); i++) {
-        if (String_Equal(stringArray[i], string)) {
-            delete [] string;
-            return stringArray[i];
-        }
+    auto it = stringSet.find(string);
+    if (it != stringSet.end()) {
+        delete [] string;
+        return it->data();
     }
 
     stringArray.push_back(string);
+    stringSet.insert(string);
     return string;
 }
 
@@ -185,10 +202,7 @@ const char * StringPool::AddStringFormat(const char * format, ...) {
 }
 
 bool StringPool::GetContainsString(const char * string) const {
-    for (size_t i = 0; i < stringArray.size(); i++) {
-        if (String_Equal(stringArray[i], string)) return true;
-    }
-    return false;
+    return stringSet.count(string) != 0;
 }
 
 } // M4 namespace
@@ -3,6 +3,8 @@
 
 #include <stdarg.h> // va_list, vsnprintf
 #include <vector>
+#include <string_view>
+#include <unordered_set>
 #include <stdexcept>
 
 #ifndef _MSC_VER 
@@ -11,11 +13,7 @@
 #define fopen_s(file, path, ...) *file = fopen(path, __VA_ARGS__)
 #endif
 
-#define MAGIC_ENUM_RANGE_MIN 0
-#define MAGIC_ENUM_RANGE_MAX 512
-
 #include "json.hpp"
-#include "magic_enum.hpp"
 
 #ifndef NULL
 #define NULL    0
@@ -51,10 +49,13 @@ int String_ToInteger(const char * str, char ** end);
 void Log_Error(const char * format, ...);
 void Log_ErrorArgList(const char * format, va_list args);
 
+/** Receives the formatted errors instead of stderr while set. Not thread safe, set it while nothing logs. Returns the previous handler. */
+typedef void (*Log_ErrorHandler)(const char * message);
+Log_ErrorHandler Log_SetErrorHandler(Log_ErrorHandler handler);
+
 
 // Engine/StringPool.h
 
-// @@ Implement this with a hash table!
 struct StringPool {
     StringPool();
     ~StringPool();
@@ -65,6 +66,7 @@ struct StringPool {
     bool GetContainsString(const char * string) const;
 
     std::vector<const char *> stringArray;
+    std::unordered_set<std::string_view> stringSet;   // Views of stringArray, for the lookups.
 };
 
 
@@ -0,0 +1,275 @@
+#ifndef HLSL_ENUM_NAMES_H
+#define HLSL_ENUM_NAMES_H
+
+#include "HLSLTree.h"
+
+#include <string_view>
+
+namespace M4
+{
+
+/*
+ * Names of the HLSL enumerators, as written in the analysis output. The tables
+ * are built from the enumerator identifiers and checked at compile time to
+ * list every enumerator up to the enum's Count sentinel in declaration order,
+ * so GetEnumName is a plain array lookup. The sentinel and values outside of
+ * the table have an empty name. GetEnumValue does the reverse lookup and
+ * returns false for unknown names.
+ */
+
+template <class E>
+struct EnumName
+{
+    E                   value;
+    std::string_view    name;
+};
+
+#define HLSL_ENUM_NAME(type, enumerator) { type::enumerator, #enumerator }
+
+template <class E, size_t N>
+constexpr bool IsEnumNameTableInOrder(const EnumName<E> (&table)[N], size_t count)
+{
+    if (N != count)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < N; ++i)
+    {
+        if ((size_t)table[i].value != i)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class E, size_t N>
+constexpr std::string_view LookupEnumName(const EnumName<E> (&table)[N], E value)
+{
+    return (size_t)value < N ? table[(size_t)value].name : std::string_view();
+}
+
+template <class E, size_t N>
+bool FindEnumValue(const EnumName<E> (&table)[N], std::string_view name, E& value)
+{
+    for (const EnumName<E>& entry : table)
+    {
+        if (entry.name == name)
+        {
+            value = entry.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static constexpr EnumName<HLSLNodeType> _nodeTypeNames[] =
+{
+    HLSL_ENUM_NAME(HLSLNodeType, Root),
+    HLSL_ENUM_NAME(HLSLNodeType, Declaration),
+    HLSL_ENUM_NAME(HLSLNodeType, Struct),
+    HLSL_ENUM_NAME(HLSLNodeType, StructField),
+    HLSL_ENUM_NAME(HLSLNodeType, Buffer),
+    HLSL_ENUM_NAME(HLSLNodeType, BufferField),
+    HLSL_ENUM_NAME(HLSLNodeType, Function),
+    HLSL_ENUM_NAME(HLSLNodeType, Argument),
+    HLSL_ENUM_NAME(HLSLNodeType, ExpressionStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, Expression),
+    HLSL_ENUM_NAME(HLSLNodeType, ReturnStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, DiscardStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, BreakStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, ContinueStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, IfStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, ForStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, BlockStatement),
+    HLSL_ENUM_NAME(HLSLNodeType, UnaryExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, BinaryExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, ConditionalExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, CastingExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, LiteralExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, IdentifierExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, ConstructorExpression),
+    HLSL_ENUM_NAME(HLSLNodeType, MemberAccess),
+    HLSL_ENUM_NAME(HLSLNodeType, ArrayAccess),
+    HLSL_ENUM_NAME(HLSLNodeType, FunctionCall),
+    HLSL_ENUM_NAME(HLSLNodeType, StateAssignment),
+    HLSL_ENUM_NAME(HLSLNodeType, SamplerState),
+    HLSL_ENUM_NAME(HLSLNodeType, Pass),
+    HLSL_ENUM_NAME(HLSLNodeType, Technique),
+    HLSL_ENUM_NAME(HLSLNodeType, Attribute),
+    HLSL_ENUM_NAME(HLSLNodeType, Pipeline),
+    HLSL_ENUM_NAME(HLSLNodeType, Stage)
+};
+static_assert(IsEnumNameTableInOrder(_nodeTypeNames, (size_t)HLSLNodeType::Count), "HLSLNodeType names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLNodeType value) { return LookupEnumName(_nodeTypeNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLNodeType& value) { return FindEnumValue(_nodeTypeNames, name, value); }
+
+static constexpr EnumName<HLSLBaseType> _baseTypeNames[] =
+{
+    HLSL_ENUM_NAME(HLSLBaseType, Unknown),
+    HLSL_ENUM_NAME(HLSLBaseType, Void),
+    HLSL_ENUM_NAME(HLSLBaseType, Float),
+    HLSL_ENUM_NAME(HLSLBaseType, Float2),
+    HLSL_ENUM_NAME(HLSLBaseType, Float3),
+    HLSL_ENUM_NAME(HLSLBaseType, Float4),
+    HLSL_ENUM_NAME(HLSLBaseType, Float2x2),
+    HLSL_ENUM_NAME(HLSLBaseType, Float3x3),
+    HLSL_ENUM_NAME(HLSLBaseType, Float4x4),
+    HLSL_ENUM_NAME(HLSLBaseType, Float4x3),
+    HLSL_ENUM_NAME(HLSLBaseType, Float4x2),
+    HLSL_ENUM_NAME(HLSLBaseType, Half),
+    HLSL_ENUM_NAME(HLSLBaseType, Half2),
+    HLSL_ENUM_NAME(HLSLBaseType, Half3),
+    HLSL_ENUM_NAME(HLSLBaseType, Half4),
+    HLSL_ENUM_NAME(HLSLBaseType, Half2x2),
+    HLSL_ENUM_NAME(HLSLBaseType, Half3x3),
+    HLSL_ENUM_NAME(HLSLBaseType, Half4x4),
+    HLSL_ENUM_NAME(HLSLBaseType, Half4x3),
+    HLSL_ENUM_NAME(HLSLBaseType, Half4x2),
+    HLSL_ENUM_NAME(HLSLBaseType, Bool),
+    HLSL_ENUM_NAME(HLSLBaseType, Bool2),
+    HLSL_ENUM_NAME(HLSLBaseType, Bool3),
+    HLSL_ENUM_NAME(HLSLBaseType, Bool4),
+    HLSL_ENUM_NAME(HLSLBaseType, Int),
+    HLSL_ENUM_NAME(HLSLBaseType, Int2),
+    HLSL_ENUM_NAME(HLSLBaseType, Int3),
+    HLSL_ENUM_NAME(HLSLBaseType, Int4),
+    HLSL_ENUM_NAME(HLSLBaseType, Uint),
+    HLSL_ENUM_NAME(HLSLBaseType, Uint2),
+    HLSL_ENUM_NAME(HLSLBaseType, Uint3),
+    HLSL_ENUM_NAME(HLSLBaseType, Uint4),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture),
+    HLSL_ENUM_NAME(HLSLBaseType, Sampler),
+    HLSL_ENUM_NAME(HLSLBaseType, Sampler2D),
+    HLSL_ENUM_NAME(HLSLBaseType, Sampler3D),
+    HLSL_ENUM_NAME(HLSLBaseType, SamplerCube),
+    HLSL_ENUM_NAME(HLSLBaseType, Sampler2DShadow),
+    HLSL_ENUM_NAME(HLSLBaseType, Sampler2DMS),
+    HLSL_ENUM_NAME(HLSLBaseType, Sampler2DArray),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture1D),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture1DArray),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture2D),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture2DArray),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture2DMS),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture2DMSArray),
+    HLSL_ENUM_NAME(HLSLBaseType, Texture3D),
+    HLSL_ENUM_NAME(HLSLBaseType, TextureCube),
+    HLSL_ENUM_NAME(HLSLBaseType, TextureCubeArray),
+    HLSL_ENUM_NAME(HLSLBaseType, SamplerState),
+    HLSL_ENUM_NAME(HLSLBaseType, UserDefined),
+    HLSL_ENUM_NAME(HLSLBaseType, Expression),
+    HLSL_ENUM_NAME(HLSLBaseType, Auto)
+};
+static_assert(IsEnumNameTableInOrder(_baseTypeNames, (size_t)HLSLBaseType::Count), "HLSLBaseType names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLBaseType value) { return LookupEnumName(_baseTypeNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLBaseType& value) { return FindEnumValue(_baseTypeNames, name, value); }
+
+static constexpr EnumName<HLSLBinaryOp> _binaryOpNames[] =
+{
+    HLSL_ENUM_NAME(HLSLBinaryOp, And),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Or),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Add),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Sub),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Mul),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Div),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Less),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Greater),
+    HLSL_ENUM_NAME(HLSLBinaryOp, LessEqual),
+    HLSL_ENUM_NAME(HLSLBinaryOp, GreaterEqual),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Equal),
+    HLSL_ENUM_NAME(HLSLBinaryOp, NotEqual),
+    HLSL_ENUM_NAME(HLSLBinaryOp, BitAnd),
+    HLSL_ENUM_NAME(HLSLBinaryOp, BitOr),
+    HLSL_ENUM_NAME(HLSLBinaryOp, BitXor),
+    HLSL_ENUM_NAME(HLSLBinaryOp, Assign),
+    HLSL_ENUM_NAME(HLSLBinaryOp, AddAssign),
+    HLSL_ENUM_NAME(HLSLBinaryOp, SubAssign),
+    HLSL_ENUM_NAME(HLSLBinaryOp, MulAssign),
+    HLSL_ENUM_NAME(HLSLBinaryOp, DivAssign)
+};
+static_assert(IsEnumNameTableInOrder(_binaryOpNames, (size_t)HLSLBinaryOp::Count), "HLSLBinaryOp names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLBinaryOp value) { return LookupEnumName(_binaryOpNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLBinaryOp& value) { return FindEnumValue(_binaryOpNames, name, value); }
+
+static constexpr EnumName<HLSLUnaryOp> _unaryOpNames[] =
+{
+    HLSL_ENUM_NAME(HLSLUnaryOp, Negative),
+    HLSL_ENUM_NAME(HLSLUnaryOp, Positive),
+    HLSL_ENUM_NAME(HLSLUnaryOp, Not),
+    HLSL_ENUM_NAME(HLSLUnaryOp, PreIncrement),
+    HLSL_ENUM_NAME(HLSLUnaryOp, PreDecrement),
+    HLSL_ENUM_NAME(HLSLUnaryOp, PostIncrement),
+    HLSL_ENUM_NAME(HLSLUnaryOp, PostDecrement),
+    HLSL_ENUM_NAME(HLSLUnaryOp, BitNot)
+};
+static_assert(IsEnumNameTableInOrder(_unaryOpNames, (size_t)HLSLUnaryOp::Count), "HLSLUnaryOp names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLUnaryOp value) { return LookupEnumName(_unaryOpNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLUnaryOp& value) { return FindEnumValue(_unaryOpNames, name, value); }
+
+static constexpr EnumName<HLSLArgumentModifier> _argumentModifierNames[] =
+{
+    HLSL_ENUM_NAME(HLSLArgumentModifier, None),
+    HLSL_ENUM_NAME(HLSLArgumentModifier, In),
+    HLSL_ENUM_NAME(HLSLArgumentModifier, Out),
+    HLSL_ENUM_NAME(HLSLArgumentModifier, Inout),
+    HLSL_ENUM_NAME(HLSLArgumentModifier, Uniform),
+    HLSL_ENUM_NAME(HLSLArgumentModifier, Const)
+};
+static_assert(IsEnumNameTableInOrder(_argumentModifierNames, (size_t)HLSLArgumentModifier::Count), "HLSLArgumentModifier names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLArgumentModifier value) { return LookupEnumName(_argumentModifierNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLArgumentModifier& value) { return FindEnumValue(_argumentModifierNames, name, value); }
+
+static constexpr EnumName<HLSLAttributeType> _attributeTypeNames[] =
+{
+    HLSL_ENUM_NAME(HLSLAttributeType, Unknown),
+    HLSL_ENUM_NAME(HLSLAttributeType, Unroll),
+    HLSL_ENUM_NAME(HLSLAttributeType, Branch),
+    HLSL_ENUM_NAME(HLSLAttributeType, Flatten),
+    HLSL_ENUM_NAME(HLSLAttributeType, NoFastMath)
+};
+static_assert(IsEnumNameTableInOrder(_attributeTypeNames, (size_t)HLSLAttributeType::Count), "HLSLAttributeType names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLAttributeType value) { return LookupEnumName(_attributeTypeNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLAttributeType& value) { return FindEnumValue(_attributeTypeNames, name, value); }
+
+static constexpr EnumName<HLSLAddressSpace> _addressSpaceNames[] =
+{
+    HLSL_ENUM_NAME(HLSLAddressSpace, Undefined),
+    HLSL_ENUM_NAME(HLSLAddressSpace, Constant),
+    HLSL_ENUM_NAME(HLSLAddressSpace, Device),
+    HLSL_ENUM_NAME(HLSLAddressSpace, Thread),
+    HLSL_ENUM_NAME(HLSLAddressSpace, Shared)
+};
+static_assert(IsEnumNameTableInOrder(_addressSpaceNames, (size_t)HLSLAddressSpace::Count), "HLSLAddressSpace names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLAddressSpace value) { return LookupEnumName(_addressSpaceNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLAddressSpace& value) { return FindEnumValue(_addressSpaceNames, name, value); }
+
+static constexpr EnumName<HLSLTypeDimension> _typeDimensionNames[] =
+{
+    HLSL_ENUM_NAME(HLSLTypeDimension, None),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Scalar),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Vector2),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Vector3),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Vector4),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Matrix2x2),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Matrix3x3),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Matrix4x4),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Matrix4x3),
+    HLSL_ENUM_NAME(HLSLTypeDimension, Matrix4x2)
+};
+static_assert(IsEnumNameTableInOrder(_typeDimensionNames, (size_t)HLSLTypeDimension::Count), "HLSLTypeDimension names are out of sync with the enum");
+
+inline std::string_view GetEnumName(HLSLTypeDimension value) { return LookupEnumName(_typeDimensionNames, value); }
+inline bool GetEnumValue(std::string_view name, HLSLTypeDimension& value) { return FindEnumValue(_typeDimensionNames, name, value); }
+
+#undef HLSL_ENUM_NAME
+
+} // M4
+
+#endif
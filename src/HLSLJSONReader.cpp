@@ -0,0 +1,1221 @@
+//#include "Engine/Assert.h"
+#include "Engine.h"
+
+#include "HLSLJSONReader.h"
+#include "HLSLEnumNames.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace M4
+{
+
+/*
+ * The analysis is read with the SAX interface of nlohmann::json, so no
+ * document is built: every object gets a frame holding its members, and the
+ * node is created once the object ends. Lists are collected on a shared
+ * element stack and linked together when their array ends.
+ *
+ * Functions are referenced by name, calls and prototypes are bound once the
+ * whole tree is read.
+ */
+
+// Object members written by WriteJSON, in sorted key order.
+enum class Member
+{
+    AddressSpace,
+    Arguments,
+    Array,
+    ArraySize,
+    Assignments,
+    AttributeType,
+    Attributes,
+    BaseType,
+    BinaryOp,
+    BValue,
+    Condition,
+    D3DRenderState,
+    DefaultValue,
+    ElseStatement,
+    Expression,
+    Expression1,
+    Expression2,
+    FValue,
+    FalseExpression,
+    Field,
+    Fields,
+    FileName,
+    Flags,
+    Forward,
+    Function,
+    Global,
+    IValue,
+    Increment,
+    Index,
+    Initialization,
+    Inputs,
+    IsStatic,
+    Line,
+    LiteralType,
+    Modifier,
+    Name,
+    NextDeclaration,
+    NodeType,
+    Object,
+    Outputs,
+    Passes,
+    RegisterName,
+    ReturnType,
+    SamplerType,
+    Semantic,
+    SpaceName,
+    StateAssignments,
+    StateName,
+    Statement,
+    Statements,
+    SvSemantic,
+    Swizzle,
+    TextureType,
+    TrueExpression,
+    Type,
+    TypeName,
+    UnaryOp,
+    Count,
+    Unknown = Count,    // Members of other tools, skipped with their value.
+};
+
+static_assert((int)Member::Count <= 64, "Member presence doesn't fit in a 64 bit mask");
+
+struct MemberKey
+{
+    std::string_view    key;
+    Member              member;
+};
+
+static constexpr MemberKey _memberKeys[] =
+{
+    { "addressSpace",       Member::AddressSpace },
+    { "arguments",          Member::Arguments },
+    { "array",              Member::Array },
+    { "arraySize",          Member::ArraySize },
+    { "assignments",        Member::Assignments },
+    { "attributeType",      Member::AttributeType },
+    { "attributes",         Member::Attributes },
+    { "baseType",           Member::BaseType },
+    { "binaryOp",           Member::BinaryOp },
+    { "bvalue",             Member::BValue },
+    { "condition",          Member::Condition },
+    { "d3dRenderState",     Member::D3DRenderState },
+    { "defaultValue",       Member::DefaultValue },
+    { "elseStatement",      Member::ElseStatement },
+    { "expression",         Member::Expression },
+    { "expression1",        Member::Expression1 },
+    { "expression2",        Member::Expression2 },
+    { "fValue",             Member::FValue },
+    { "falseExpression",    Member::FalseExpression },
+    { "field",              Member::Field },
+    { "fields",             Member::Fields },
+    { "fileName",           Member::FileName },
+    { "flags",              Member::Flags },
+    { "forward",            Member::Forward },
+    { "function",           Member::Function },
+    { "global",             Member::Global },
+    { "iValue",             Member::IValue },
+    { "increment",          Member::Increment },
+    { "index",              Member::Index },
+    { "initialization",     Member::Initialization },
+    { "inputs",             Member::Inputs },
+    { "isStatic",           Member::IsStatic },
+    { "line",               Member::Line },
+    { "literaltype",        Member::LiteralType },
+    { "modifier",           Member::Modifier },
+    { "name",               Member::Name },
+    { "nextDeclaration",    Member::NextDeclaration },
+    { "nodeType",           Member::NodeType },
+    { "object",             Member::Object },
+    { "outputs",            Member::Outputs },
+    { "passes",             Member::Passes },
+    { "registerName",       Member::RegisterName },
+    { "returnType",         Member::ReturnType },
+    { "samplerType",        Member::SamplerType },
+    { "semantic",           Member::Semantic },
+    { "spaceName",          Member::SpaceName },
+    { "stateAssignments",   Member::StateAssignments },
+    { "stateName",          Member::StateName },
+    { "statement",          Member::Statement },
+    { "statements",         Member::Statements },
+    { "sv_semantic",        Member::SvSemantic },
+    { "swizzle",            Member::Swizzle },
+    { "textureType",        Member::TextureType },
+    { "trueExpression",     Member::TrueExpression },
+    { "type",               Member::Type },
+    { "typeName",           Member::TypeName },
+    { "unaryOp",            Member::UnaryOp },
+};
+
+static constexpr bool IsMemberKeyTableValid()
+{
+    for (size_t i = 0; i < (size_t)Member::Count; ++i)
+    {
+        if ((size_t)_memberKeys[i].member != i) return false;
+        if (i > 0 && !(_memberKeys[i - 1].key < _memberKeys[i].key)) return false;
+    }
+    return true;
+}
+
+static_assert(sizeof(_memberKeys) / sizeof(_memberKeys[0]) == (size_t)Member::Count, "Every member needs a key");
+static_assert(IsMemberKeyTableValid(), "Member keys must be sorted and listed in enum order");
+
+static Member FindMember(std::string_view key)
+{
+    size_t first = 0;
+    size_t last = (size_t)Member::Count;
+    while (first < last)
+    {
+        size_t middle = (first + last) / 2;
+        int order = _memberKeys[middle].key.compare(key);
+        if (order == 0) return _memberKeys[middle].member;
+        if (order < 0) first = middle + 1;
+        else last = middle;
+    }
+    return Member::Unknown;
+}
+
+// Members holding a list of statements, written as an array even with a single statement.
+static bool IsStatementList(Member member)
+{
+    return member == Member::Statements || member == Member::Statement || member == Member::ElseStatement;
+}
+
+static bool IsSameType(const HLSLType& a, const HLSLType& b)
+{
+    return a.baseType == b.baseType && a.array == b.array &&
+        (a.typeName == b.typeName || (a.typeName != NULL && b.typeName != NULL && String_Equal(a.typeName, b.typeName)));
+}
+
+class TreeJSONReader : public nlohmann::json_sax<nlohmann::json>
+{
+
+public:
+
+    explicit TreeJSONReader(HLSLTree* tree)
+    {
+        m_tree = tree;
+        m_depth = 0;
+        m_skipDepth = 0;
+        m_member = Member::Unknown;
+        m_error = false;
+        m_done = false;
+    }
+
+    /** Binds prototypes and calls once the statements are read. */
+    bool Finish();
+
+    // nlohmann::json_sax
+    bool null() override;
+    bool boolean(bool value) override;
+    bool number_integer(number_integer_t value) override;
+    bool number_unsigned(number_unsigned_t value) override;
+    bool number_float(number_float_t value, const string_t& text) override;
+    bool string(string_t& value) override;
+    bool binary(binary_t& value) override;
+    bool start_object(std::size_t elements) override;
+    bool key(string_t& value) override;
+    bool end_object() override;
+    bool start_array(std::size_t elements) override;
+    bool end_array() override;
+    bool parse_error(std::size_t position, const std::string& token, const nlohmann::detail::exception& ex) override;
+
+private:
+
+    // Members of an object or elements of an array being read.
+    struct Frame
+    {
+        Member          member;         // Member of the enclosing object holding this value.
+        bool            isArray;
+        size_t          firstElement;   // Of the array in m_elements.
+        uint64_t        present;        // Bit mask of the object members read.
+        HLSLNode*       nodes[(int)Member::Count];
+        const char*     strings[(int)Member::Count];
+        int             ints[(int)Member::Count];   // Integers, booleans and enumerators.
+        double          floatValue;
+        HLSLType        type;
+        HLSLType        returnType;
+    };
+
+    Frame* PushFrame(bool isArray);
+    Frame* GetObjectFrame();
+    void SetPresent(Frame* frame, Member member);
+    bool SetInt(int value);
+    bool SetFloat(double value);
+    bool SetNode(HLSLNode* node, Member member);
+
+    template <class E>
+    bool SetEnum(Frame* frame, std::string_view name);
+
+    static bool IsPresent(const Frame& frame, Member member);
+    static const char* GetString(const Frame& frame, Member member);
+    static int GetInt(const Frame& frame, Member member);
+
+    template <class T>
+    T* GetNode(const Frame& frame, Member member);
+
+    HLSLType ReadType(const Frame& frame);
+    HLSLNode* ReadNode(const Frame& frame);
+    void ReadStatement(const Frame& frame, HLSLStatement* statement);
+    void ReadExpression(const Frame& frame, HLSLExpression* expression);
+    bool LinkElements(size_t firstElement, HLSLNode*& head);
+
+    HLSLFunction* FindFunction(const char* name, const HLSLFunctionCall* call) const;
+    HLSLFunction* AddIntrinsic(const char* name, const HLSLFunctionCall* call);
+
+private:
+
+    HLSLTree*                   m_tree;
+    std::vector<Frame>          m_frames;       // Reused, m_depth are in use.
+    size_t                      m_depth;
+    size_t                      m_skipDepth;    // Nesting within a skipped value.
+    Member                      m_member;       // Of the value that follows a key.
+    std::vector<HLSLNode*>      m_elements;
+    bool                        m_error;
+    bool                        m_done;
+
+    // Top level functions by name, overloads in order.
+    std::unordered_map<std::string_view, std::vector<HLSLFunction*>> m_functions;
+    std::vector<HLSLFunction*>  m_prototypes;   // Forward is the copy of the definition.
+    std::vector<std::pair<HLSLFunctionCall*, const char*>> m_calls;    // With the function name.
+    std::unordered_map<std::string, HLSLFunction*> m_intrinsics;
+
+};
+
+TreeJSONReader::Frame* TreeJSONReader::PushFrame(bool isArray)
+{
+    Member member = m_member;
+    if (m_depth == 0)
+    {
+        member = Member::Statements;
+    }
+    else if (m_frames[m_depth - 1].isArray)
+    {
+        member = m_frames[m_depth - 1].member;
+    }
+
+    if (m_depth == m_frames.size())
+    {
+        m_frames.emplace_back();
+    }
+    Frame* frame = &m_frames[m_depth++];
+    frame->member = member;
+    frame->isArray = isArray;
+    frame->firstElement = m_elements.size();
+    frame->present = 0;
+    return frame;
+}
+
+// Returns the object receiving a scalar value, or NULL if the value is misplaced.
+TreeJSONReader::Frame* TreeJSONReader::GetObjectFrame()
+{
+    if (m_depth == 0 || m_frames[m_depth - 1].isArray)
+    {
+        return NULL;
+    }
+    return &m_frames[m_depth - 1];
+}
+
+void TreeJSONReader::SetPresent(Frame* frame, Member member)
+{
+    // A member holds a single kind of value, clear the others.
+    frame->present |= uint64_t(1) << (int)member;
+    frame->nodes[(int)member] = NULL;
+    frame->strings[(int)member] = NULL;
+    frame->ints[(int)member] = 0;
+}
+
+bool TreeJSONReader::IsPresent(const Frame& frame, Member member)
+{
+    return (frame.present & (uint64_t(1) << (int)member)) != 0;
+}
+
+const char* TreeJSONReader::GetString(const Frame& frame, Member member)
+{
+    return IsPresent(frame, member) ? frame.strings[(int)member] : NULL;
+}
+
+int TreeJSONReader::GetInt(const Frame& frame, Member member)
+{
+    return IsPresent(frame, member) ? frame.ints[(int)member] : 0;
+}
+
+template <class T>
+T* TreeJSONReader::GetNode(const Frame& frame, Member member)
+{
+    HLSLNode* node = IsPresent(frame, member) ? frame.nodes[(int)member] : NULL;
+    if (node != NULL && !IsNodeOfType<T>(node->nodeType))
+    {
+        m_error = true;
+        return NULL;
+    }
+    return static_cast<T*>(node);
+}
+
+template <class E>
+bool TreeJSONReader::SetEnum(Frame* frame, std::string_view name)
+{
+    E value;
+    if (!GetEnumValue(name, value))
+    {
+        return false;
+    }
+    SetPresent(frame, m_member);
+    frame->ints[(int)m_member] = (int)value;
+    return true;
+}
+
+bool TreeJSONReader::SetInt(int value)
+{
+    if (m_skipDepth > 0) return true;
+
+    // Scalars are only found in objects, members of other tools are skipped.
+    Frame* frame = GetObjectFrame();
+    if (frame == NULL) return false;
+    if (m_member == Member::Unknown) return true;
+
+    switch (m_member)
+    {
+    case Member::D3DRenderState:
+    case Member::Flags:
+    case Member::IValue:
+    case Member::Line:
+        SetPresent(frame, m_member);
+        frame->ints[(int)m_member] = value;
+        return true;
+    case Member::FValue:
+        SetPresent(frame, m_member);
+        frame->floatValue = value;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool TreeJSONReader::SetFloat(double value)
+{
+    if (m_skipDepth > 0) return true;
+
+    Frame* frame = GetObjectFrame();
+    if (frame == NULL) return false;
+    if (m_member == Member::Unknown) return true;
+    if (m_member != Member::FValue) return false;
+
+    SetPresent(frame, m_member);
+    frame->floatValue = value;
+    return true;
+}
+
+bool TreeJSONReader::SetNode(HLSLNode* node, Member member)
+{
+    Frame& parent = m_frames[m_depth - 1];
+    if (parent.isArray)
+    {
+        m_elements.push_back(node);
+    }
+    else
+    {
+        SetPresent(&parent, member);
+        parent.nodes[(int)member] = node;
+    }
+    return true;
+}
+
+bool TreeJSONReader::null()
+{
+    // Non finite floats are written as null.
+    return SetFloat(NAN);
+}
+
+bool TreeJSONReader::boolean(bool value)
+{
+    if (m_skipDepth > 0) return true;
+
+    // Scalars are only found in objects, members of other tools are skipped.
+    Frame* frame = GetObjectFrame();
+    if (frame == NULL) return false;
+    if (m_member == Member::Unknown) return true;
+
+    switch (m_member)
+    {
+    case Member::Array:
+    case Member::BValue:
+    case Member::Global:
+    case Member::IsStatic:
+    case Member::Swizzle:
+        SetPresent(frame, m_member);
+        frame->ints[(int)m_member] = value;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool TreeJSONReader::number_integer(number_integer_t value)
+{
+    if (value < INT32_MIN || value > INT32_MAX) return SetFloat((double)value);
+    return SetInt((int)value);
+}
+
+bool TreeJSONReader::number_unsigned(number_unsigned_t value)
+{
+    if (value > INT32_MAX) return SetFloat((double)value);
+    return SetInt((int)value);
+}
+
+bool TreeJSONReader::number_float(number_float_t value, const string_t& text)
+{
+    return SetFloat(value);
+}
+
+bool TreeJSONReader::string(string_t& value)
+{
+    if (m_skipDepth > 0) return true;
+
+    // Scalars are only found in objects, members of other tools are skipped.
+    Frame* frame = GetObjectFrame();
+    if (frame == NULL) return false;
+    if (m_member == Member::Unknown) return true;
+
+    switch (m_member)
+    {
+    case Member::Field:
+    case Member::FileName:
+    case Member::Function:
+    case Member::Name:
+    case Member::RegisterName:
+    case Member::Semantic:
+    case Member::SpaceName:
+    case Member::StateName:
+    case Member::SvSemantic:
+    case Member::TypeName:
+        SetPresent(frame, m_member);
+        frame->strings[(int)m_member] = m_tree->AddString(value.c_str());
+        return true;
+    case Member::NodeType:
+        return SetEnum<HLSLNodeType>(frame, value);
+    case Member::BaseType:
+    case Member::LiteralType:
+    case Member::SamplerType:
+    case Member::TextureType:
+        return SetEnum<HLSLBaseType>(frame, value);
+    case Member::AddressSpace:
+        return SetEnum<HLSLAddressSpace>(frame, value);
+    case Member::AttributeType:
+        return SetEnum<HLSLAttributeType>(frame, value);
+    case Member::BinaryOp:
+        return SetEnum<HLSLBinaryOp>(frame, value);
+    case Member::Modifier:
+        return SetEnum<HLSLArgumentModifier>(frame, value);
+    case Member::UnaryOp:
+        return SetEnum<HLSLUnaryOp>(frame, value);
+    default:
+        return false;
+    }
+}
+
+bool TreeJSONReader::binary(binary_t& value)
+{
+    return false;
+}
+
+bool TreeJSONReader::start_object(std::size_t elements)
+{
+    if (m_depth == 0) return false;
+
+    bool inArray = m_frames[m_depth - 1].isArray;
+    if (m_skipDepth > 0 || (!inArray && m_member == Member::Unknown))
+    {
+        ++m_skipDepth;
+        return true;
+    }
+
+    PushFrame(false);
+    return true;
+}
+
+bool TreeJSONReader::key(string_t& value)
+{
+    if (m_skipDepth == 0)
+    {
+        m_member = FindMember(value);
+    }
+    return true;
+}
+
+bool TreeJSONReader::end_object()
+{
+    if (m_skipDepth > 0)
+    {
+        --m_skipDepth;
+        return true;
+    }
+
+    Frame& frame = m_frames[--m_depth];
+    Frame& parent = m_frames[m_depth - 1];
+
+    if (frame.member == Member::Type || frame.member == Member::ReturnType)
+    {
+        if (parent.isArray) return false;
+
+        HLSLType type = ReadType(frame);
+        SetPresent(&parent, frame.member);
+        if (frame.member == Member::Type) parent.type = type;
+        else parent.returnType = type;
+        return !m_error;
+    }
+
+    if (!parent.isArray && IsStatementList(frame.member))
+    {
+        return false;
+    }
+
+    HLSLNode* node = ReadNode(frame);
+    if (node == NULL || m_error)
+    {
+        return false;
+    }
+    return SetNode(node, frame.member);
+}
+
+bool TreeJSONReader::start_array(std::size_t elements)
+{
+    if (m_done) return false;
+
+    if (m_depth > 0)
+    {
+        bool inArray = m_frames[m_depth - 1].isArray;
+        if (m_skipDepth > 0 || (!inArray && m_member == Member::Unknown))
+        {
+            ++m_skipDepth;
+            return true;
+        }
+        // Lists are never nested.
+        if (inArray) return false;
+    }
+
+    PushFrame(true);
+    return true;
+}
+
+bool TreeJSONReader::end_array()
+{
+    if (m_skipDepth > 0)
+    {
+        --m_skipDepth;
+        return true;
+    }
+
+    Frame& frame = m_frames[--m_depth];
+
+    HLSLNode* head = NULL;
+    if (!LinkElements(frame.firstElement, head))
+    {
+        return false;
+    }
+    m_elements.resize(frame.firstElement);
+
+    if (m_depth == 0)
+    {
+        if (head != NULL && !IsStatementNode(head->nodeType)) return false;
+        m_tree->GetRoot()->statement = static_cast<HLSLStatement*>(head);
+        m_done = true;
+        return true;
+    }
+
+    return SetNode(head, frame.member);
+}
+
+bool TreeJSONReader::parse_error(std::size_t position, const std::string& token, const nlohmann::detail::exception& ex)
+{
+    return false;
+}
+
+// Chains the elements of a list through the next pointer of their kind.
+bool TreeJSONReader::LinkElements(size_t firstElement, HLSLNode*& head)
+{
+    HLSLNode* next = NULL;
+    for (size_t i = m_elements.size(); i > firstElement; --i)
+    {
+        HLSLNode* node = m_elements[i - 1];
+        if (IsStatementNode(node->nodeType))
+        {
+            if (next != NULL && !IsStatementNode(next->nodeType)) return false;
+            static_cast<HLSLStatement*>(node)->nextStatement = static_cast<HLSLStatement*>(next);
+        }
+        else if (IsExpressionNode(node->nodeType))
+        {
+            if (next != NULL && !IsExpressionNode(next->nodeType)) return false;
+            static_cast<HLSLExpression*>(node)->nextExpression = static_cast<HLSLExpression*>(next);
+        }
+        else
+        {
+            if (next != NULL && next->nodeType != node->nodeType) return false;
+            switch (node->nodeType)
+            {
+            case HLSLNodeType::Attribute:
+                static_cast<HLSLAttribute*>(node)->nextAttribute = static_cast<HLSLAttribute*>(next);
+                break;
+            case HLSLNodeType::StructField:
+                static_cast<HLSLStructField*>(node)->nextField = static_cast<HLSLStructField*>(next);
+                break;
+            case HLSLNodeType::Argument:
+                static_cast<HLSLArgument*>(node)->nextArgument = static_cast<HLSLArgument*>(next);
+                break;
+            case HLSLNodeType::StateAssignment:
+                static_cast<HLSLStateAssignment*>(node)->nextStateAssignment = static_cast<HLSLStateAssignment*>(next);
+                break;
+            case HLSLNodeType::Pass:
+                static_cast<HLSLPass*>(node)->nextPass = static_cast<HLSLPass*>(next);
+                break;
+            default:
+                return false;
+            }
+        }
+        next = node;
+    }
+    head = next;
+    return true;
+}
+
+HLSLType TreeJSONReader::ReadType(const Frame& frame)
+{
+    HLSLType type;
+    if (IsPresent(frame, Member::BaseType))     type.baseType = (HLSLBaseType)GetInt(frame, Member::BaseType);
+    if (IsPresent(frame, Member::SamplerType))  type.samplerType = (HLSLBaseType)GetInt(frame, Member::SamplerType);
+    if (IsPresent(frame, Member::TextureType))  type.textureType = (HLSLBaseType)GetInt(frame, Member::TextureType);
+    type.typeName = GetString(frame, Member::TypeName);
+    type.array = GetInt(frame, Member::Array) != 0;
+    type.arraySize = GetNode<HLSLExpression>(frame, Member::ArraySize);
+    type.flags = GetInt(frame, Member::Flags);
+    type.addressSpace = (HLSLAddressSpace)GetInt(frame, Member::AddressSpace);
+    return type;
+}
+
+void TreeJSONReader::ReadStatement(const Frame& frame, HLSLStatement* statement)
+{
+    statement->attributes = GetNode<HLSLAttribute>(frame, Member::Attributes);
+}
+
+void TreeJSONReader::ReadExpression(const Frame& frame, HLSLExpression* expression)
+{
+    expression->expressionType = m_tree->AddType(IsPresent(frame, Member::Type) ? frame.type : HLSLType());
+}
+
+static int CountStateAssignments(const HLSLStateAssignment* stateAssignment)
+{
+    int count = 0;
+    for (; stateAssignment != NULL; stateAssignment = stateAssignment->nextStateAssignment) ++count;
+    return count;
+}
+
+HLSLNode* TreeJSONReader::ReadNode(const Frame& frame)
+{
+    HLSLNodeType nodeType;
+    if (IsPresent(frame, Member::NodeType))
+    {
+        nodeType = (HLSLNodeType)GetInt(frame, Member::NodeType);
+    }
+    else if (frame.member == Member::Arguments)
+    {
+        // Function arguments and structure fields are written without their node type.
+        nodeType = HLSLNodeType::Argument;
+    }
+    else if (frame.member == Member::Fields)
+    {
+        nodeType = HLSLNodeType::StructField;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    const char* fileName = GetString(frame, Member::FileName);
+    int line = GetInt(frame, Member::Line);
+
+    switch (nodeType)
+    {
+    case HLSLNodeType::Declaration:
+    {
+        HLSLDeclaration* declaration = m_tree->AddNode<HLSLDeclaration>(fileName, line);
+        ReadStatement(frame, declaration);
+        declaration->name = GetString(frame, Member::Name);
+        declaration->type = frame.type;
+        declaration->registerName = GetString(frame, Member::RegisterName);
+        declaration->spaceName = GetString(frame, Member::SpaceName);
+        declaration->semantic = GetString(frame, Member::Semantic);
+        declaration->nextDeclaration = GetNode<HLSLDeclaration>(frame, Member::NextDeclaration);
+        declaration->assignment = GetNode<HLSLExpression>(frame, Member::Assignments);
+        return declaration;
+    }
+    case HLSLNodeType::Struct:
+    {
+        HLSLStruct* structure = m_tree->AddNode<HLSLStruct>(fileName, line);
+        ReadStatement(frame, structure);
+        structure->name = GetString(frame, Member::Name);
+        structure->field = GetNode<HLSLStructField>(frame, Member::Fields);
+        return structure;
+    }
+    case HLSLNodeType::StructField:
+    {
+        HLSLStructField* field = m_tree->AddNode<HLSLStructField>(fileName, line);
+        field->name = GetString(frame, Member::Name);
+        field->type = frame.type;
+        field->semantic = GetString(frame, Member::Semantic);
+        field->sv_semantic = GetString(frame, Member::SvSemantic);
+        return field;
+    }
+    case HLSLNodeType::Buffer:
+    {
+        HLSLBuffer* buffer = m_tree->AddNode<HLSLBuffer>(fileName, line);
+        ReadStatement(frame, buffer);
+        buffer->name = GetString(frame, Member::Name);
+        buffer->registerName = GetString(frame, Member::RegisterName);
+        buffer->spaceName = GetString(frame, Member::SpaceName);
+        buffer->field = GetNode<HLSLDeclaration>(frame, Member::Fields);
+        for (HLSLStatement* field = buffer->field; field != NULL; field = field->nextStatement)
+        {
+            if (field->nodeType != HLSLNodeType::Declaration)
+            {
+                m_error = true;
+                return NULL;
+            }
+            static_cast<HLSLDeclaration*>(field)->buffer = buffer;
+        }
+        return buffer;
+    }
+    case HLSLNodeType::Function:
+    {
+        HLSLFunction* function = m_tree->AddNode<HLSLFunction>(fileName, line);
+        ReadStatement(frame, function);
+        function->name = GetString(frame, Member::Name);
+        function->returnType = frame.returnType;
+        function->semantic = GetString(frame, Member::Semantic);
+        function->sv_semantic = GetString(frame, Member::SvSemantic);
+        function->argument = GetNode<HLSLArgument>(frame, Member::Arguments);
+        function->statement = GetNode<HLSLStatement>(frame, Member::Statements);
+        function->forward = GetNode<HLSLFunction>(frame, Member::Forward);
+        for (HLSLArgument* argument = function->argument; argument != NULL; argument = argument->nextArgument)
+        {
+            ++function->numArguments;
+            if (argument->modifier == HLSLArgumentModifier::Out || argument->modifier == HLSLArgumentModifier::Inout)
+            {
+                ++function->numOutputArguments;
+            }
+        }
+        if (m_depth == 1)
+        {
+            m_functions[function->name != NULL ? function->name : ""].push_back(function);
+            if (function->forward != NULL)
+            {
+                m_prototypes.push_back(function);
+            }
+        }
+        return function;
+    }
+    case HLSLNodeType::Argument:
+    {
+        HLSLArgument* argument = m_tree->AddNode<HLSLArgument>(fileName, line);
+        argument->name = GetString(frame, Member::Name);
+        argument->modifier = (HLSLArgumentModifier)GetInt(frame, Member::Modifier);
+        argument->type = frame.type;
+        argument->semantic = GetString(frame, Member::Semantic);
+        argument->sv_semantic = GetString(frame, Member::SvSemantic);
+        argument->defaultValue = GetNode<HLSLExpression>(frame, Member::DefaultValue);
+        return argument;
+    }
+    case HLSLNodeType::ExpressionStatement:
+    {
+        HLSLExpressionStatement* statement = m_tree->AddNode<HLSLExpressionStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        statement->expression = GetNode<HLSLExpression>(frame, Member::Expression);
+        return statement;
+    }
+    case HLSLNodeType::ReturnStatement:
+    {
+        HLSLReturnStatement* statement = m_tree->AddNode<HLSLReturnStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        statement->expression = GetNode<HLSLExpression>(frame, Member::Expression);
+        return statement;
+    }
+    case HLSLNodeType::DiscardStatement:
+    {
+        HLSLDiscardStatement* statement = m_tree->AddNode<HLSLDiscardStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        return statement;
+    }
+    case HLSLNodeType::BreakStatement:
+    {
+        HLSLBreakStatement* statement = m_tree->AddNode<HLSLBreakStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        return statement;
+    }
+    case HLSLNodeType::ContinueStatement:
+    {
+        HLSLContinueStatement* statement = m_tree->AddNode<HLSLContinueStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        return statement;
+    }
+    case HLSLNodeType::IfStatement:
+    {
+        HLSLIfStatement* statement = m_tree->AddNode<HLSLIfStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        statement->condition = GetNode<HLSLExpression>(frame, Member::Condition);
+        statement->statement = GetNode<HLSLStatement>(frame, Member::Statement);
+        statement->elseStatement = GetNode<HLSLStatement>(frame, Member::ElseStatement);
+        statement->isStatic = GetInt(frame, Member::IsStatic) != 0;
+        return statement;
+    }
+    case HLSLNodeType::ForStatement:
+    {
+        HLSLForStatement* statement = m_tree->AddNode<HLSLForStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        statement->initialization = GetNode<HLSLDeclaration>(frame, Member::Initialization);
+        statement->condition = GetNode<HLSLExpression>(frame, Member::Condition);
+        statement->increment = GetNode<HLSLExpression>(frame, Member::Increment);
+        statement->statement = GetNode<HLSLStatement>(frame, Member::Statement);
+        return statement;
+    }
+    case HLSLNodeType::BlockStatement:
+    {
+        HLSLBlockStatement* statement = m_tree->AddNode<HLSLBlockStatement>(fileName, line);
+        ReadStatement(frame, statement);
+        statement->statement = GetNode<HLSLStatement>(frame, Member::Statements);
+        return statement;
+    }
+    case HLSLNodeType::Expression:
+    {
+        HLSLExpression* expression = m_tree->AddNode<HLSLExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        return expression;
+    }
+    case HLSLNodeType::UnaryExpression:
+    {
+        HLSLUnaryExpression* expression = m_tree->AddNode<HLSLUnaryExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->unaryOp = (HLSLUnaryOp)GetInt(frame, Member::UnaryOp);
+        expression->expression = GetNode<HLSLExpression>(frame, Member::Expression);
+        return expression;
+    }
+    case HLSLNodeType::BinaryExpression:
+    {
+        HLSLBinaryExpression* expression = m_tree->AddNode<HLSLBinaryExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->binaryOp = (HLSLBinaryOp)GetInt(frame, Member::BinaryOp);
+        expression->expression1 = GetNode<HLSLExpression>(frame, Member::Expression1);
+        expression->expression2 = GetNode<HLSLExpression>(frame, Member::Expression2);
+        return expression;
+    }
+    case HLSLNodeType::ConditionalExpression:
+    {
+        HLSLConditionalExpression* expression = m_tree->AddNode<HLSLConditionalExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->condition = GetNode<HLSLExpression>(frame, Member::Condition);
+        expression->trueExpression = GetNode<HLSLExpression>(frame, Member::TrueExpression);
+        expression->falseExpression = GetNode<HLSLExpression>(frame, Member::FalseExpression);
+        return expression;
+    }
+    case HLSLNodeType::CastingExpression:
+    {
+        HLSLCastingExpression* expression = m_tree->AddNode<HLSLCastingExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->type = *expression->expressionType;
+        expression->expression = GetNode<HLSLExpression>(frame, Member::Expression);
+        return expression;
+    }
+    case HLSLNodeType::LiteralExpression:
+    {
+        HLSLLiteralExpression* expression = m_tree->AddNode<HLSLLiteralExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->type = (HLSLBaseType)GetInt(frame, Member::LiteralType);
+        expression->iValue = 0;
+        if (expression->type == HLSLBaseType::Bool)
+        {
+            expression->bValue = GetInt(frame, Member::BValue) != 0;
+        }
+        else if (expression->type == HLSLBaseType::Float || expression->type == HLSLBaseType::Half)
+        {
+            expression->fValue = IsPresent(frame, Member::FValue) ? (float)frame.floatValue : 0.0f;
+        }
+        else
+        {
+            expression->iValue = GetInt(frame, Member::IValue);
+        }
+        return expression;
+    }
+    case HLSLNodeType::IdentifierExpression:
+    {
+        HLSLIdentifierExpression* expression = m_tree->AddNode<HLSLIdentifierExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->name = GetString(frame, Member::Name);
+        expression->global = GetInt(frame, Member::Global) != 0;
+        return expression;
+    }
+    case HLSLNodeType::ConstructorExpression:
+    {
+        HLSLConstructorExpression* expression = m_tree->AddNode<HLSLConstructorExpression>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->type = *expression->expressionType;
+        expression->argument = GetNode<HLSLExpression>(frame, Member::Arguments);
+        return expression;
+    }
+    case HLSLNodeType::MemberAccess:
+    {
+        HLSLMemberAccess* expression = m_tree->AddNode<HLSLMemberAccess>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->object = GetNode<HLSLExpression>(frame, Member::Object);
+        expression->field = GetString(frame, Member::Field);
+        expression->swizzle = GetInt(frame, Member::Swizzle) != 0;
+        return expression;
+    }
+    case HLSLNodeType::ArrayAccess:
+    {
+        HLSLArrayAccess* expression = m_tree->AddNode<HLSLArrayAccess>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->array = GetNode<HLSLExpression>(frame, Member::Array);
+        expression->index = GetNode<HLSLExpression>(frame, Member::Index);
+        return expression;
+    }
+    case HLSLNodeType::FunctionCall:
+    {
+        const char* name = GetString(frame, Member::Function);
+        if (name == NULL)
+        {
+            return NULL;
+        }
+        HLSLFunctionCall* call = m_tree->AddNode<HLSLFunctionCall>(fileName, line);
+        ReadExpression(frame, call);
+        call->argument = GetNode<HLSLExpression>(frame, Member::Arguments);
+        for (HLSLExpression* argument = call->argument; argument != NULL; argument = argument->nextExpression)
+        {
+            ++call->numArguments;
+        }
+        m_calls.push_back({ call, name });
+        return call;
+    }
+    case HLSLNodeType::StateAssignment:
+    {
+        HLSLStateAssignment* stateAssignment = m_tree->AddNode<HLSLStateAssignment>(fileName, line);
+        stateAssignment->stateName = GetString(frame, Member::StateName);
+        stateAssignment->d3dRenderState = GetInt(frame, Member::D3DRenderState);
+        stateAssignment->iValue = GetInt(frame, Member::IValue);
+        return stateAssignment;
+    }
+    case HLSLNodeType::SamplerState:
+    {
+        HLSLSamplerState* expression = m_tree->AddNode<HLSLSamplerState>(fileName, line);
+        ReadExpression(frame, expression);
+        expression->stateAssignments = GetNode<HLSLStateAssignment>(frame, Member::StateAssignments);
+        expression->numStateAssignments = CountStateAssignments(expression->stateAssignments);
+        return expression;
+    }
+    case HLSLNodeType::Pass:
+    {
+        HLSLPass* pass = m_tree->AddNode<HLSLPass>(fileName, line);
+        pass->name = GetString(frame, Member::Name);
+        pass->stateAssignments = GetNode<HLSLStateAssignment>(frame, Member::StateAssignments);
+        pass->numStateAssignments = CountStateAssignments(pass->stateAssignments);
+        return pass;
+    }
+    case HLSLNodeType::Technique:
+    {
+        HLSLTechnique* technique = m_tree->AddNode<HLSLTechnique>(fileName, line);
+        ReadStatement(frame, technique);
+        technique->name = GetString(frame, Member::Name);
+        technique->passes = GetNode<HLSLPass>(frame, Member::Passes);
+        for (HLSLPass* pass = technique->passes; pass != NULL; pass = pass->nextPass)
+        {
+            ++technique->numPasses;
+        }
+        return technique;
+    }
+    case HLSLNodeType::Attribute:
+    {
+        HLSLAttribute* attribute = m_tree->AddNode<HLSLAttribute>(fileName, line);
+        attribute->attributeType = (HLSLAttributeType)GetInt(frame, Member::AttributeType);
+        attribute->argument = GetNode<HLSLExpression>(frame, Member::Arguments);
+        return attribute;
+    }
+    case HLSLNodeType::Pipeline:
+    {
+        HLSLPipeline* pipeline = m_tree->AddNode<HLSLPipeline>(fileName, line);
+        ReadStatement(frame, pipeline);
+        pipeline->name = GetString(frame, Member::Name);
+        pipeline->stateAssignments = GetNode<HLSLStateAssignment>(frame, Member::StateAssignments);
+        pipeline->numStateAssignments = CountStateAssignments(pipeline->stateAssignments);
+        return pipeline;
+    }
+    case HLSLNodeType::Stage:
+    {
+        HLSLStage* stage = m_tree->AddNode<HLSLStage>(fileName, line);
+        ReadStatement(frame, stage);
+        stage->name = GetString(frame, Member::Name);
+        stage->statement = GetNode<HLSLStatement>(frame, Member::Statements);
+        stage->inputs = GetNode<HLSLDeclaration>(frame, Member::Inputs);
+        stage->outputs = GetNode<HLSLDeclaration>(frame, Member::Outputs);
+        return stage;
+    }
+    default:
+        return NULL;
+    }
+}
+
+// Close to the parser's selection: the argument count has to fit and exact
+// argument types are preferred. Like the parser, a prototype is found before
+// its definition.
+HLSLFunction* TreeJSONReader::FindFunction(const char* name, const HLSLFunctionCall* call) const
+{
+    auto overloads = m_functions.find(name);
+    if (overloads == m_functions.end())
+    {
+        return NULL;
+    }
+
+    HLSLFunction* candidate = NULL;
+    for (HLSLFunction* function : overloads->second)
+    {
+        int numRequired = 0;
+        for (HLSLArgument* argument = function->argument; argument != NULL; argument = argument->nextArgument)
+        {
+            if (argument->defaultValue == NULL) ++numRequired;
+        }
+        if (call->numArguments < numRequired || call->numArguments > function->numArguments)
+        {
+            continue;
+        }
+
+        bool exact = true;
+        const HLSLArgument* argument = function->argument;
+        for (const HLSLExpression* expression = call->argument; expression != NULL; expression = expression->nextExpression)
+        {
+            if (!IsSameType(*expression->expressionType, argument->type))
+            {
+                exact = false;
+                break;
+            }
+            argument = argument->nextArgument;
+        }
+        if (exact)
+        {
+            return function;
+        }
+        if (candidate == NULL)
+        {
+            candidate = function;
+        }
+    }
+    return candidate;
+}
+
+// Intrinsics are not part of the tree, calls get a declaration matching their types.
+HLSLFunction* TreeJSONReader::AddIntrinsic(const char* name, const HLSLFunctionCall* call)
+{
+    std::string key = name;
+    for (const HLSLExpression* expression = call->argument; expression != NULL; expression = expression->nextExpression)
+    {
+        key += ',';
+        key += std::to_string((int)expression->expressionType->baseType);
+    }
+
+    HLSLFunction*& intrinsic = m_intrinsics[key];
+    if (intrinsic != NULL)
+    {
+        return intrinsic;
+    }
+
+    intrinsic = m_tree->AddNode<HLSLFunction>(NULL, 0);
+    intrinsic->name = name;
+    intrinsic->returnType = *call->expressionType;
+    HLSLArgument** lastArgument = &intrinsic->argument;
+    for (const HLSLExpression* expression = call->argument; expression != NULL; expression = expression->nextExpression)
+    {
+        HLSLArgument* argument = m_tree->AddNode<HLSLArgument>(NULL, 0);
+        argument->type = *expression->expressionType;
+        *lastArgument = argument;
+        lastArgument = &argument->nextArgument;
+        ++intrinsic->numArguments;
+    }
+    return intrinsic;
+}
+
+bool TreeJSONReader::Finish()
+{
+    if (!m_done || m_error)
+    {
+        return false;
+    }
+
+    // The prototype holds a copy of the definition, which follows it.
+    for (HLSLFunction* prototype : m_prototypes)
+    {
+        const HLSLFunction* copy = prototype->forward;
+        prototype->forward = NULL;
+        const std::vector<HLSLFunction*>& overloads = m_functions[prototype->name != NULL ? prototype->name : ""];
+        for (auto it = std::find(overloads.begin(), overloads.end(), prototype) + 1; it != overloads.end(); ++it)
+        {
+            HLSLFunction* function = *it;
+            if (function->numArguments != copy->numArguments)
+            {
+                continue;
+            }
+            bool match = true;
+            const HLSLArgument* argument = function->argument;
+            for (const HLSLArgument* other = copy->argument; other != NULL; other = other->nextArgument)
+            {
+                match = match && IsSameType(argument->type, other->type);
+                argument = argument->nextArgument;
+            }
+            if (match)
+            {
+                prototype->forward = function;
+                break;
+            }
+        }
+        if (prototype->forward == NULL)
+        {
+            return false;
+        }
+    }
+
+    for (const auto& call : m_calls)
+    {
+        HLSLFunction* function = FindFunction(call.second, call.first);
+        call.first->function = function != NULL ? function : AddIntrinsic(call.second, call.first);
+    }
+    return true;
+}
+
+bool ReadTreeJSON(HLSLTree* tree, const void* data, size_t size, JSONFormat format)
+{
+    ASSERT(tree->GetRoot()->statement == NULL);
+
+    nlohmann::json::input_format_t inputFormat = nlohmann::json::input_format_t::json;
+    switch (format)
+    {
+    case JSONFormat::Text:          inputFormat = nlohmann::json::input_format_t::json; break;
+    case JSONFormat::CBOR:          inputFormat = nlohmann::json::input_format_t::cbor; break;
+    case JSONFormat::MessagePack:   inputFormat = nlohmann::json::input_format_t::msgpack; break;
+    }
+
+    const char* begin = static_cast<const char*>(data);
+    TreeJSONReader reader(tree);
+    if (!nlohmann::json::sax_parse(begin, begin + size, &reader, inputFormat))
+    {
+        return false;
+    }
+    tree->InvalidateIndex();
+    return reader.Finish();
+}
+
+} // M4
@@ -0,0 +1,29 @@
+#ifndef HLSL_JSON_READER_H
+#define HLSL_JSON_READER_H
+
+#include "Engine.h"
+
+#include "HLSLTree.h"
+#include "JSONWriter.h"
+
+namespace M4
+{
+
+/**
+ * Rebuilds a tree from an analysis written with WriteJSON: an array of top
+ * level statements, in any JSONFormat. Compact output can be read as well.
+ * Function bodies and expressions are only part of full tree output, other
+ * analyses give a tree made of declarations and function prototypes.
+ *
+ * Calls are bound to the function of the tree with the same name and
+ * matching arguments. Calls to intrinsics get a function node which isn't
+ * part of the statements, with the argument and return types of the call.
+ *
+ * The tree must be empty. Returns false if the data is malformed or does not
+ * describe a tree, e.g. when members were filtered out.
+ */
+bool ReadTreeJSON(HLSLTree* tree, const void* data, size_t size, JSONFormat format = JSONFormat::Text);
+
+} // M4
+
+#endif
@@ -28,6 +28,13 @@ enum class CompareFunctionsResult
 };
 
     
+/** Intrinsic nodes aren't added to a tree, so their node type is set here. */
+template <class T>
+struct IntrinsicNode : public T
+{
+    IntrinsicNode() { this->nodeType = T::s_type; }
+};
+
 /** This structure stores a HLSLFunction-like declaration for an intrinsic function */
 struct Intrinsic
 {
@@ -96,8 +103,8 @@ struct Intrinsic
         argument[3].type.baseType       = arg4;
         argument[3].type.flags          = (int)HLSLTypeFlags::Const;
     }
-    HLSLFunction    function;
-    HLSLArgument    argument[4];
+    IntrinsicNode<HLSLFunction> function;
+    IntrinsicNode<HLSLArgument> argument[4];
 };
     
 Intrinsic SamplerIntrinsic(const char* name, HLSLBaseType returnType, HLSLBaseType arg1, HLSLBaseType samplerType, HLSLBaseType arg2)
@@ -119,7 +126,7 @@ enum class NumericType
     NaN,
 };
 
-static const int _numberTypeRank[(int)NumericType::Count][(int)NumericType::Count] =
+static constexpr int _numberTypeRank[(int)NumericType::Count][(int)NumericType::Count] =
 {
     //F  H  B  I  U    
     { 0, 4, 4, 4, 4 },  // NumericType::Float
@@ -647,7 +654,7 @@ const int _binaryOpPriority[] =
         5, 3, 4, // &, |, ^
     };
 
-const BaseTypeDescription _baseTypeDescriptions[(int)HLSLBaseType::Count] = 
+static constexpr BaseTypeDescription _baseTypeDescriptions[(int)HLSLBaseType::Count] = 
     {
         { "unknown type",       NumericType::NaN,        0, 0, 0, -1 },      // HLSLBaseType::Unknown
         { "void",               NumericType::NaN,        0, 0, 0, -1 },      // HLSLBaseType::Void
@@ -980,6 +987,70 @@ static const char* GetBinaryOpName(HLSLBinaryOp binaryOp)
  * 5.) Truncation (vector -> scalar or lower component vector, matrix -> scalar or lower component matrix)
  * 6.) Conversion + truncation
  */    
+static constexpr int GetBaseTypeCastRank(HLSLBaseType srcType, HLSLBaseType dstType)
+{
+    if (srcType == dstType)
+    {
+        return 0;
+    }
+
+    const BaseTypeDescription& srcDesc = _baseTypeDescriptions[(int)srcType];
+    const BaseTypeDescription& dstDesc = _baseTypeDescriptions[(int)dstType];
+    if (srcDesc.numericType == NumericType::NaN || dstDesc.numericType == NumericType::NaN)
+    {
+        return -1;
+    }
+
+    // Result bits: T R R R P (T = truncation, R = conversion rank, P = dimension promotion)
+    int result = _numberTypeRank[(int)srcDesc.numericType][(int)dstDesc.numericType] << 1;
+
+    if (srcDesc.numDimensions == 0 && dstDesc.numDimensions > 0)
+    {
+        // Scalar dimension promotion
+        result |= (1 << 0);
+    }
+    else if ((srcDesc.numDimensions == dstDesc.numDimensions && (srcDesc.numComponents > dstDesc.numComponents || srcDesc.height > dstDesc.height)) ||
+             (srcDesc.numDimensions > 0 && dstDesc.numDimensions == 0))
+    {
+        // Truncation
+        result |= (1 << 4);
+    }
+    else if (srcDesc.numDimensions != dstDesc.numDimensions ||
+             srcDesc.numComponents != dstDesc.numComponents ||
+             srcDesc.height != dstDesc.height)
+    {
+        // Can't convert
+        return -1;
+    }
+    
+    return result;
+    
+}
+
+/** Cast ranks between base types, see GetBaseTypeCastRank. */
+struct BaseTypeCastRankTable
+{
+    signed char rank[(int)HLSLBaseType::Count][(int)HLSLBaseType::Count];
+};
+
+static constexpr BaseTypeCastRankTable BuildBaseTypeCastRankTable()
+{
+    BaseTypeCastRankTable table = {};
+    for (int src = 0; src < (int)HLSLBaseType::Count; ++src)
+    {
+        for (int dst = 0; dst < (int)HLSLBaseType::Count; ++dst)
+        {
+            table.rank[src][dst] = (signed char)GetBaseTypeCastRank((HLSLBaseType)src, (HLSLBaseType)dst);
+        }
+    }
+    return table;
+}
+
+// Evaluated at compile time. Parsing gains nothing measurable over computing the
+// ranks: the ParseOverloadedCalls benchmark of tests/ parses as fast either way,
+// overload resolution being dominated by building the candidate lists.
+static constexpr BaseTypeCastRankTable _baseTypeCastRank = BuildBaseTypeCastRankTable();
+
 static int GetTypeCastRank(HLSLTree * tree, const HLSLType& srcType, const HLSLType& dstType)
 {
     /*if (srcType.array != dstType.array || srcType.arraySize != dstType.arraySize)
@@ -1021,37 +1092,7 @@ static int GetTypeCastRank(HLSLTree * tree, const HLSLType& srcType, const HLSLT
         return 0;
     }
 
-    const BaseTypeDescription& srcDesc = _baseTypeDescriptions[(int)srcType.baseType];
-    const BaseTypeDescription& dstDesc = _baseTypeDescriptions[(int)dstType.baseType];
-    if (srcDesc.numericType == NumericType::NaN || dstDesc.numericType == NumericType::NaN)
-    {
-        return -1;
-    }
-
-    // Result bits: T R R R P (T = truncation, R = conversion rank, P = dimension promotion)
-    int result = _numberTypeRank[(int)srcDesc.numericType][(int)dstDesc.numericType] << 1;
-
-    if (srcDesc.numDimensions == 0 && dstDesc.numDimensions > 0)
-    {
-        // Scalar dimension promotion
-        result |= (1 << 0);
-    }
-    else if ((srcDesc.numDimensions == dstDesc.numDimensions && (srcDesc.numComponents > dstDesc.numComponents || srcDesc.height > dstDesc.height)) ||
-             (srcDesc.numDimensions > 0 && dstDesc.numDimensions == 0))
-    {
-        // Truncation
-        result |= (1 << 4);
-    }
-    else if (srcDesc.numDimensions != dstDesc.numDimensions ||
-             srcDesc.numComponents != dstDesc.numComponents ||
-             srcDesc.height != dstDesc.height)
-    {
-        // Can't convert
-        return -1;
-    }
-    
-    return result;
-    
+    return _baseTypeCastRank.rank[(int)srcType.baseType][(int)dstType.baseType];
 }
 
 static bool GetFunctionCallCastRanks(HLSLTree* tree, const HLSLFunctionCall* call, const HLSLFunction* function, int* rankBuffer)
@@ -1068,7 +1109,7 @@ static bool GetFunctionCallCastRanks(HLSLTree* tree, const HLSLFunctionCall* cal
    
     for (int i = 0; i < call->numArguments; ++i)
     {
-        int rank = GetTypeCastRank(tree, expression->expressionType, argument->type);
+        int rank = GetTypeCastRank(tree, *expression->expressionType, argument->type);
         if (rank == -1)
         {
             return false;
@@ -1247,6 +1288,13 @@ bool HLSLParser::Expect(const char * token)
 }
 
 
+const HLSLType* HLSLParser::AddLiteralType(HLSLBaseType baseType)
+{
+    HLSLType type(baseType);
+    type.flags = (int)HLSLTypeFlags::Const;
+    return m_tree->AddType(type);
+}
+
 bool HLSLParser::AcceptIdentifier(const char*& identifier)
 {
     if (m_tokenizer.GetToken() == (int)HLSLToken::Identifier)
@@ -1468,7 +1516,10 @@ bool HLSLParser::ParseTopLevel(HLSLStatement*& statement)
                 return false;
             }
             DeclareVariable( field->name, field->type );
-            field->buffer = buffer;
+            for (HLSLDeclaration* declaration = field; declaration != NULL; declaration = declaration->nextDeclaration)
+            {
+                declaration->buffer = buffer;
+            }
             if (buffer->field == NULL)
             {
                 buffer->field = field;
@@ -1743,7 +1794,7 @@ bool HLSLParser::ParseStatement(HLSLStatement*& statement, const HLSLType& retur
             }
             m_allowUndeclaredIdentifiers = false;
             
-            if ((condition->expressionType.flags & HLSLTypeFlags::Const) == 0)
+            if ((condition->expressionType->flags & HLSLTypeFlags::Const) == 0)
             {
                 m_tokenizer.Error("Syntax error: @if condition is not constant");
                 return false;
@@ -1796,20 +1847,37 @@ bool HLSLParser::ParseStatement(HLSLStatement*& statement, const HLSLType& retur
     {
         HLSLIfStatement* ifStatement = m_tree->AddNode<HLSLIfStatement>(fileName, line);
         ifStatement->attributes = attributes;
-        if (!Expect('(') || !ParseExpression(ifStatement->condition) || !Expect(')'))
-        {
-            return false;
-        }
         statement = ifStatement;
-        if (!ParseStatementOrBlock(ifStatement->statement, returnType))
-        {
-            return false;
-        }
-        if (Accept(HLSLToken::Else))
+
+        // "else if" chains are parsed in a loop rather than recursively, generated
+        // code can make them long. The nested if statements have no scope of their
+        // own, since they declare nothing in it.
+        while (true)
         {
-            return ParseStatementOrBlock(ifStatement->elseStatement, returnType);
+            if (!Expect('(') || !ParseExpression(ifStatement->condition) || !Expect(')'))
+            {
+                return false;
+            }
+            if (!ParseStatementOrBlock(ifStatement->statement, returnType))
+            {
+                return false;
+            }
+            if (!Accept(HLSLToken::Else))
+            {
+                return true;
+            }
+
+            fileName = GetFileName();
+            line     = GetLineNumber();
+            if (!Accept(HLSLToken::If))
+            {
+                return ParseStatementOrBlock(ifStatement->elseStatement, returnType);
+            }
+
+            HLSLIfStatement* elseIfStatement = m_tree->AddNode<HLSLIfStatement>(fileName, line);
+            ifStatement->elseStatement = elseIfStatement;
+            ifStatement = elseIfStatement;
         }
-        return true;
     }
     
     // For statement.
@@ -1899,7 +1967,7 @@ bool HLSLParser::ParseStatement(HLSLStatement*& statement, const HLSLType& retur
         }
         // Check that the return expression can be cast to the return type of the function.
         HLSLType voidType(HLSLBaseType::Void);
-        if (!CheckTypeCast(returnStatement->expression ? returnStatement->expression->expressionType : voidType, returnType))
+        if (!CheckTypeCast(returnStatement->expression ? *returnStatement->expression->expressionType : voidType, returnType))
         {
             return false;
         }
@@ -2073,6 +2141,22 @@ bool HLSLParser::CheckTypeCast(const HLSLType& srcType, const HLSLType& dstType)
 }
 
 bool HLSLParser::ParseExpression(HLSLExpression*& expression)
+{
+    // Nested parentheses, calls and subscripts recurse through here: refuse
+    // them before they can overflow the stack, like compilers limit bracket depth.
+    if (m_expressionDepth >= s_maxExpressionDepth)
+    {
+        m_tokenizer.Error("Expression nested too deeply, the limit is %d levels", s_maxExpressionDepth);
+        return false;
+    }
+
+    ++m_expressionDepth;
+    bool result = ParseAssignmentExpression(expression);
+    --m_expressionDepth;
+    return result;
+}
+
+bool HLSLParser::ParseAssignmentExpression(HLSLExpression*& expression)
 {
     if (!ParseBinaryExpression(0, expression))
     {
@@ -2095,10 +2179,10 @@ bool HLSLParser::ParseExpression(HLSLExpression*& expression)
         // However, for our usage of the types it should be sufficient.
         binaryExpression->expressionType = expression->expressionType;
 
-        if (!CheckTypeCast(expression2->expressionType, expression->expressionType))
+        if (!CheckTypeCast(*expression2->expressionType, *expression->expressionType))
         {
-            const char* srcTypeName = GetTypeName(expression2->expressionType);
-            const char* dstTypeName = GetTypeName(expression->expressionType);
+            const char* srcTypeName = GetTypeName(*expression2->expressionType);
+            const char* dstTypeName = GetTypeName(*expression->expressionType);
             m_tokenizer.Error("Cannot implicitly convert from '%s' to '%s'", srcTypeName, dstTypeName);
             return false;
         }
@@ -2236,10 +2320,11 @@ bool HLSLParser::ParseBinaryExpression(int priority, HLSLExpression*& expression
             binaryExpression->binaryOp    = binaryOp;
             binaryExpression->expression1 = expression;
             binaryExpression->expression2 = expression2;
-            if (!GetBinaryOpResultType( binaryOp, expression->expressionType, expression2->expressionType, binaryExpression->expressionType ))
+            HLSLType resultType;
+            if (!GetBinaryOpResultType( binaryOp, *expression->expressionType, *expression2->expressionType, resultType ))
             {
-                const char* typeName1 = GetTypeName( binaryExpression->expression1->expressionType );
-                const char* typeName2 = GetTypeName( binaryExpression->expression2->expressionType );
+                const char* typeName1 = GetTypeName( *binaryExpression->expression1->expressionType );
+                const char* typeName2 = GetTypeName( *binaryExpression->expression2->expressionType );
                 m_tokenizer.Error("binary '%s' : no global operator found which takes types '%s' and '%s' (or there is no acceptable conversion)",
                     GetBinaryOpName(binaryOp), typeName1, typeName2);
 
@@ -2247,7 +2332,8 @@ bool HLSLParser::ParseBinaryExpression(int priority, HLSLExpression*& expression
             }
             
             // Propagate constness.
-            binaryExpression->expressionType.flags = (expression->expressionType.flags | expression2->expressionType.flags) & (int)HLSLTypeFlags::Const;
+            resultType.flags = (expression->expressionType->flags | expression2->expressionType->flags) & (int)HLSLTypeFlags::Const;
+            binaryExpression->expressionType = m_tree->AddType(resultType);
             
             expression = binaryExpression;
         }
@@ -2264,11 +2350,12 @@ bool HLSLParser::ParseBinaryExpression(int priority, HLSLExpression*& expression
                 return false;
             }
 
-            // Make sure both cases have compatible types.
-            if (GetTypeCastRank(m_tree, expression1->expressionType, expression2->expressionType) == -1)
+            // Make sure both cases have compatible types. Expression types are interned, the same instance is the same type.
+            if (expression1->expressionType != expression2->expressionType &&
+                GetTypeCastRank(m_tree, *expression1->expressionType, *expression2->expressionType) == -1)
             {
-                const char* srcTypeName = GetTypeName(expression2->expressionType);
-                const char* dstTypeName = GetTypeName(expression1->expressionType);
+                const char* srcTypeName = GetTypeName(*expression2->expressionType);
+                const char* dstTypeName = GetTypeName(*expression1->expressionType);
                 m_tokenizer.Error("':' no possible conversion from from '%s' to '%s'", srcTypeName, dstTypeName);
                 return false;
             }
@@ -2308,8 +2395,9 @@ bool HLSLParser::ParsePartialConstructor(HLSLExpression*& expression, HLSLBaseTy
     {
         return false;
     }    
-    constructorExpression->expressionType = constructorExpression->type;
-    constructorExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+    HLSLType expressionType = constructorExpression->type;
+    expressionType.flags = (int)HLSLTypeFlags::Const;
+    constructorExpression->expressionType = m_tree->AddType(expressionType);
     expression = constructorExpression;
     return true;
 }
@@ -2324,34 +2412,58 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
     HLSLUnaryOp unaryOp;
     if (AcceptUnaryOperator(true, unaryOp))
     {
-        HLSLUnaryExpression* unaryExpression = m_tree->AddNode<HLSLUnaryExpression>(fileName, line);
-        unaryExpression->unaryOp = unaryOp;
-        if (!ParseTerminalExpression(unaryExpression->expression, needsEndParen))
+        // Prefix operators are chained in a loop rather than recursively. Until
+        // the operand is parsed, each one points to the operator before it.
+        HLSLUnaryExpression* unaryExpression = NULL;
+        do
+        {
+            HLSLUnaryExpression* nextUnaryExpression = m_tree->AddNode<HLSLUnaryExpression>(fileName, line);
+            nextUnaryExpression->unaryOp = unaryOp;
+            nextUnaryExpression->expression = unaryExpression;
+            unaryExpression = nextUnaryExpression;
+
+            fileName = GetFileName();
+            line     = GetLineNumber();
+        }
+        while (AcceptUnaryOperator(true, unaryOp));
+
+        if (!ParseTerminalExpression(expression, needsEndParen))
         {
             return false;
         }
-        if (unaryOp == HLSLUnaryOp::BitNot)
+
+        // From the innermost operator out.
+        while (unaryExpression != NULL)
         {
-            if (unaryExpression->expression->expressionType.baseType < HLSLBaseType::FirstInteger || 
-                unaryExpression->expression->expressionType.baseType > HLSLBaseType::LastInteger)
+            HLSLUnaryExpression* previousUnaryExpression = static_cast<HLSLUnaryExpression*>(unaryExpression->expression);
+            unaryExpression->expression = expression;
+
+            if (unaryExpression->unaryOp == HLSLUnaryOp::BitNot)
             {
-                const char * typeName = GetTypeName(unaryExpression->expression->expressionType);
-                m_tokenizer.Error("unary '~' : no global operator found which takes type '%s' (or there is no acceptable conversion)", typeName);
-                return false;
+                if (unaryExpression->expression->expressionType->baseType < HLSLBaseType::FirstInteger || 
+                    unaryExpression->expression->expressionType->baseType > HLSLBaseType::LastInteger)
+                {
+                    const char * typeName = GetTypeName(*unaryExpression->expression->expressionType);
+                    m_tokenizer.Error("unary '~' : no global operator found which takes type '%s' (or there is no acceptable conversion)", typeName);
+                    return false;
+                }
             }
+            if (unaryExpression->unaryOp == HLSLUnaryOp::Not)
+            {
+                HLSLType boolType(HLSLBaseType::Bool);
+                
+                // Propagate constness.
+                boolType.flags = unaryExpression->expression->expressionType->flags & (int)HLSLTypeFlags::Const;
+                unaryExpression->expressionType = m_tree->AddType(boolType);
+            }
+            else
+            {
+                unaryExpression->expressionType = unaryExpression->expression->expressionType;
+            }
+
+            expression = unaryExpression;
+            unaryExpression = previousUnaryExpression;
         }
-        if (unaryOp == HLSLUnaryOp::Not)
-        {
-            unaryExpression->expressionType = HLSLType(HLSLBaseType::Bool);
-            
-            // Propagate constness.
-            unaryExpression->expressionType.flags = unaryExpression->expression->expressionType.flags & (int)HLSLTypeFlags::Const;
-        }
-        else
-        {
-            unaryExpression->expressionType = unaryExpression->expression->expressionType;
-        }
-        expression = unaryExpression;
         return true;
     }
     
@@ -2371,7 +2483,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             HLSLCastingExpression* castingExpression = m_tree->AddNode<HLSLCastingExpression>(fileName, line);
             castingExpression->type = type;
             expression = castingExpression;
-            castingExpression->expressionType = type;
+            castingExpression->expressionType = m_tree->AddType(type);
             return Expect(')') && ParseExpression(castingExpression->expression);
         }
         
@@ -2391,8 +2503,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             HLSLLiteralExpression* literalExpression = m_tree->AddNode<HLSLLiteralExpression>(fileName, line);
             literalExpression->type   = HLSLBaseType::Float;
             literalExpression->fValue = fValue;
-            literalExpression->expressionType.baseType = literalExpression->type;
-            literalExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+            literalExpression->expressionType = AddLiteralType(literalExpression->type);
             expression = literalExpression;
             return true;
         }
@@ -2401,8 +2512,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
 			HLSLLiteralExpression* literalExpression = m_tree->AddNode<HLSLLiteralExpression>( fileName, line );
 			literalExpression->type = HLSLBaseType::Half;
 			literalExpression->fValue = fValue;
-			literalExpression->expressionType.baseType = literalExpression->type;
-			literalExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+			literalExpression->expressionType = AddLiteralType(literalExpression->type);
 			expression = literalExpression;
 			return true;
 		}
@@ -2411,8 +2521,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             HLSLLiteralExpression* literalExpression = m_tree->AddNode<HLSLLiteralExpression>(fileName, line);
             literalExpression->type   = HLSLBaseType::Int;
             literalExpression->iValue = iValue;
-            literalExpression->expressionType.baseType = literalExpression->type;
-            literalExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+            literalExpression->expressionType = AddLiteralType(literalExpression->type);
             expression = literalExpression;
             return true;
         }
@@ -2421,8 +2530,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             HLSLLiteralExpression* literalExpression = m_tree->AddNode<HLSLLiteralExpression>(fileName, line);
             literalExpression->type   = HLSLBaseType::Bool;
             literalExpression->bValue = true;
-            literalExpression->expressionType.baseType = literalExpression->type;
-            literalExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+            literalExpression->expressionType = AddLiteralType(literalExpression->type);
             expression = literalExpression;
             return true;
         }
@@ -2431,8 +2539,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             HLSLLiteralExpression* literalExpression = m_tree->AddNode<HLSLLiteralExpression>(fileName, line);
             literalExpression->type   = HLSLBaseType::Bool;
             literalExpression->bValue = false;
-            literalExpression->expressionType.baseType = literalExpression->type;
-            literalExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+            literalExpression->expressionType = AddLiteralType(literalExpression->type);
             expression = literalExpression;
             return true;
         }
@@ -2460,7 +2567,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             const HLSLType* identifierType = FindVariable(identifierExpression->name, identifierExpression->global);
             if (identifierType != NULL)
             {
-                identifierExpression->expressionType = *identifierType;
+                identifierExpression->expressionType = m_tree->AddType(*identifierType);
             }
             else
             {
@@ -2482,8 +2589,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
                     HLSLLiteralExpression* literalExpression = m_tree->AddNode<HLSLLiteralExpression>(fileName, line);
                     literalExpression->bValue = false;
                     literalExpression->type = HLSLBaseType::Bool;
-                    literalExpression->expressionType.baseType = literalExpression->type;
-                    literalExpression->expressionType.flags = (int)HLSLTypeFlags::Const;
+                    literalExpression->expressionType = AddLiteralType(literalExpression->type);
                     expression = literalExpression;
                 }
                 else
@@ -2526,7 +2632,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
                 return false;
             }
 
-            if (!GetMemberType( expression->expressionType, memberAccess))
+            if (!GetMemberType( *expression->expressionType, memberAccess))
             {
                 m_tokenizer.Error("Couldn't access '%s'", memberAccess->field);
                 return false;
@@ -2546,71 +2652,73 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
                 return false;
             }
 
-            if (expression->expressionType.array)
+            HLSLType elementType;
+            if (expression->expressionType->array)
             {
-                arrayAccess->expressionType = expression->expressionType;
-                arrayAccess->expressionType.array     = false;
-                arrayAccess->expressionType.arraySize = NULL;
+                elementType = *expression->expressionType;
+                elementType.array     = false;
+                elementType.arraySize = NULL;
             }
             else
             {
-                switch (expression->expressionType.baseType)
+                switch (expression->expressionType->baseType)
                 {
                 case HLSLBaseType::Float2:
                 case HLSLBaseType::Float3:
                 case HLSLBaseType::Float4:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Float;
+                    elementType.baseType = HLSLBaseType::Float;
                     break;
 				case HLSLBaseType::Float2x2:
-					arrayAccess->expressionType.baseType = HLSLBaseType::Float2;
+					elementType.baseType = HLSLBaseType::Float2;
 					break;
                 case HLSLBaseType::Float3x3:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Float3;
+                    elementType.baseType = HLSLBaseType::Float3;
                     break;
                 case HLSLBaseType::Float4x4:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Float4;
+                    elementType.baseType = HLSLBaseType::Float4;
                     break;
                 case HLSLBaseType::Float4x3:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Float3;
+                    elementType.baseType = HLSLBaseType::Float3;
                     break;
                 case HLSLBaseType::Float4x2:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Float2;
+                    elementType.baseType = HLSLBaseType::Float2;
                     break;
                 case HLSLBaseType::Half2:
                 case HLSLBaseType::Half3:
                 case HLSLBaseType::Half4:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Half;
+                    elementType.baseType = HLSLBaseType::Half;
                     break;
 				case HLSLBaseType::Half2x2:
-					arrayAccess->expressionType.baseType = HLSLBaseType::Half2;
+					elementType.baseType = HLSLBaseType::Half2;
 					break;
                 case HLSLBaseType::Half3x3:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Half3;
+                    elementType.baseType = HLSLBaseType::Half3;
                     break;
                 case HLSLBaseType::Half4x4:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Half4;
+                    elementType.baseType = HLSLBaseType::Half4;
                     break;
                 case HLSLBaseType::Half4x3:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Half3;
+                    elementType.baseType = HLSLBaseType::Half3;
                     break;
                 case HLSLBaseType::Half4x2:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Half2;
+                    elementType.baseType = HLSLBaseType::Half2;
                     break;
                 case HLSLBaseType::Int2:
                 case HLSLBaseType::Int3:
                 case HLSLBaseType::Int4:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Int;
+                    elementType.baseType = HLSLBaseType::Int;
                     break;
                 case HLSLBaseType::Uint2:
                 case HLSLBaseType::Uint3:
                 case HLSLBaseType::Uint4:
-                    arrayAccess->expressionType.baseType = HLSLBaseType::Uint;
+                    elementType.baseType = HLSLBaseType::Uint;
                     break;
                 default:
                     m_tokenizer.Error("array, matrix, vector, or indexable object type expected in index expression");
                     return false;
                 }
             }
+            arrayAccess->expressionType = m_tree->AddType(elementType);
 
             expression = arrayAccess;
             done = false;
@@ -2643,7 +2751,7 @@ bool HLSLParser::ParseTerminalExpression(HLSLExpression*& expression, bool& need
             }
 
             functionCall->function = function;
-            functionCall->expressionType = function->returnType;
+            functionCall->expressionType = m_tree->AddType(function->returnType);
             expression = functionCall;
         }
 
@@ -2768,6 +2876,7 @@ bool HLSLParser::ParseSamplerState(HLSLExpression*& expression)
     int         line     = GetLineNumber();
 
     HLSLSamplerState* samplerState = m_tree->AddNode<HLSLSamplerState>(fileName, line);
+    samplerState->expressionType = m_tree->AddType(HLSLType());
 
     if (!Expect('{'))
     {
@@ -3333,6 +3442,7 @@ bool HLSLParser::Parse(HLSLTree* tree)
             while (lastStatement->nextStatement) lastStatement = lastStatement->nextStatement;
         }
     }
+    m_tree->InvalidateIndex();
     return true;
 }
 
@@ -3773,6 +3883,11 @@ const HLSLFunction* HLSLParser::FindFunction(const char* name) const
     return NULL;
 }
 
+/**
+ * Argument and return types are held by value, not interned. Declarations also
+ * match when their flags differ or when they give the same array size in
+ * different expressions, which interned instances tell apart.
+ */
 static bool AreTypesEqual(HLSLTree* tree, const HLSLType& lhs, const HLSLType& rhs)
 {
     return GetTypeCastRank(tree, lhs, rhs) == 0;
@@ -3939,7 +4054,7 @@ bool HLSLParser::GetMemberType(const HLSLType& objectType, HLSLMemberAccess * me
         {
             if (field->name == fieldName)
             {
-                memberAccess->expressionType = field->type;
+                memberAccess->expressionType = m_tree->AddType(field->type);
                 return true;
             }
             field = field->nextField;
@@ -3964,7 +4079,7 @@ bool HLSLParser::GetMemberType(const HLSLType& objectType, HLSLMemberAccess * me
             return false;
         }
 
-        memberAccess->expressionType = function->returnType;
+        memberAccess->expressionType = m_tree->AddType(function->returnType);
 
         return true;
     }
@@ -4043,27 +4158,29 @@ bool HLSLParser::GetMemberType(const HLSLType& objectType, HLSLMemberAccess * me
     static const HLSLBaseType uintType[]  = { HLSLBaseType::Uint,  HLSLBaseType::Uint2,  HLSLBaseType::Uint3,  HLSLBaseType::Uint4  };
     static const HLSLBaseType boolType[]  = { HLSLBaseType::Bool,  HLSLBaseType::Bool2,  HLSLBaseType::Bool3,  HLSLBaseType::Bool4  };
     
+    HLSLType swizzleType;
     switch (_baseTypeDescriptions[(int)objectType.baseType].numericType)
     {
     case NumericType::Float:
-        memberAccess->expressionType.baseType = floatType[swizzleLength - 1];
+        swizzleType.baseType = floatType[swizzleLength - 1];
         break;
     case NumericType::Half:
-        memberAccess->expressionType.baseType = halfType[swizzleLength - 1];
+        swizzleType.baseType = halfType[swizzleLength - 1];
         break;
     case NumericType::Int:
-        memberAccess->expressionType.baseType = intType[swizzleLength - 1];
+        swizzleType.baseType = intType[swizzleLength - 1];
         break;
     case NumericType::Uint:
-        memberAccess->expressionType.baseType = uintType[swizzleLength - 1];
+        swizzleType.baseType = uintType[swizzleLength - 1];
             break;
     case NumericType::Bool:
-        memberAccess->expressionType.baseType = boolType[swizzleLength - 1];
+        swizzleType.baseType = boolType[swizzleLength - 1];
             break;
     default:
         ASSERT(0);
     }
 
+    memberAccess->expressionType = m_tree->AddType(swizzleType);
     memberAccess->swizzle = true;
     
     return true;
@@ -74,6 +74,7 @@ private:
     bool ParseFieldDeclaration(HLSLStructField*& field);
     //bool ParseBufferFieldDeclaration(HLSLBufferField*& field);
     bool ParseExpression(HLSLExpression*& expression);
+    bool ParseAssignmentExpression(HLSLExpression*& expression);
     bool ParseBinaryExpression(int priority, HLSLExpression*& expression);
     bool ParseTerminalExpression(HLSLExpression*& expression, bool& needsEndParen);
     bool ParseExpressionList(int endToken, bool allowEmptyEnd, HLSLExpression*& firstExpression, int& numExpressions);
@@ -119,6 +120,9 @@ private:
 
     bool CheckTypeCast(const HLSLType& srcType, const HLSLType& dstType);
 
+    /** Returns the interned const type of a literal of the specified base type. */
+    const HLSLType* AddLiteralType(HLSLBaseType baseType);
+
     const char* GetFileName();
     int GetLineNumber() const;
 
@@ -139,6 +143,10 @@ private:
     HLSLTree*               m_tree;
     
     bool                    m_allowUndeclaredIdentifiers = false;
+
+    /** Expressions being parsed, each nested in the previous one. */
+    int                     m_expressionDepth = 0;
+    static const int        s_maxExpressionDepth = 256;
     //bool                    m_disableSemanticValidation = false;
 };
 
@@ -0,0 +1,348 @@
+//#include "Engine/Assert.h"
+#include "Engine.h"
+
+#include "HLSLPassManager.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <thread>
+
+namespace M4
+{
+
+// Below this many functions, starting threads costs more than it saves.
+static const size_t s_minParallelFunctions = 16;
+
+HLSLPassManager::HLSLPassManager(HLSLTree* tree)
+{
+    m_tree      = tree;
+    m_jobCount  = 1;
+    m_revision  = 0;
+}
+
+void HLSLPassManager::SetJobCount(unsigned int jobCount)
+{
+    m_jobCount = jobCount > 0 ? jobCount : 1;
+}
+
+void HLSLPassManager::AddTreePass(const char* name, std::function<bool(HLSLTree*)> run, bool idempotent)
+{
+    AddTreePass(name, [run](HLSLTree* tree, HLSLPassStatistics&) { return run(tree); }, idempotent);
+}
+
+void HLSLPassManager::AddTreePass(const char* name, std::function<bool(HLSLTree*, HLSLPassStatistics&)> run, bool idempotent)
+{
+    Pass pass;
+    pass.name       = name;
+    pass.runTree    = std::move(run);
+    pass.idempotent = idempotent;
+    pass.hasRun     = false;
+    pass.changed    = false;
+    pass.revision   = 0;
+    m_passes.push_back(std::move(pass));
+}
+
+void HLSLPassManager::AddFunctionPass(const char* name, std::function<HLSLFunctionStatistics(HLSLTree*, HLSLFunction*)> run, bool idempotent,
+    std::function<void(HLSLTree*)> prepare/*=nullptr*/)
+{
+    Pass pass;
+    pass.name               = name;
+    pass.runFunction        = std::move(run);
+    pass.prepareFunctions   = std::move(prepare);
+    pass.idempotent         = idempotent;
+    pass.hasRun             = false;
+    pass.changed            = false;
+    pass.revision           = 0;
+    m_passes.push_back(std::move(pass));
+}
+
+void HLSLPassManager::AddPruneTree(const char* const* entryNames, int entryCount)
+{
+    std::vector<std::string> names(entryNames, entryNames + entryCount);
+    AddTreePass("PruneTree", [names](HLSLTree* tree)
+    {
+        std::vector<const char*> entryNames;
+        for (const std::string& name : names)
+        {
+            entryNames.push_back(name.c_str());
+        }
+        PruneTree(tree, entryNames.data(), (int)entryNames.size());
+        return true;
+    }, true);
+}
+
+void HLSLPassManager::AddSortTree()
+{
+    AddTreePass("SortTree", [](HLSLTree* tree) { SortTree(tree); return true; }, true);
+}
+
+void HLSLPassManager::AddGroupParameters()
+{
+    // Adds the per_item and per_pass buffers again on each run.
+    AddTreePass("GroupParameters", [](HLSLTree* tree) { GroupParameters(tree); return true; }, false);
+}
+
+void HLSLPassManager::AddHideUnusedArguments()
+{
+    AddFunctionPass("HideUnusedArguments", [](HLSLTree* tree, HLSLFunction* function) { HideUnusedArguments(function); return HLSLFunctionStatistics(); }, true);
+}
+
+void HLSLPassManager::AddEmulateAlphaTest(const char* entryName, float alphaRef/*=0.5f*/)
+{
+    // Inserts another test on each run.
+    std::string name = entryName;
+    AddTreePass("EmulateAlphaTest", [name, alphaRef](HLSLTree* tree) { return EmulateAlphaTest(tree, name.c_str(), alphaRef); }, false);
+}
+
+void HLSLPassManager::AddFlattenExpressions()
+{
+    // Temporaries holding calls with output arguments are flattened again on each run.
+    AddFunctionPass("FlattenExpressions", [](HLSLTree* tree, HLSLFunction* function) { FlattenExpressions(tree, function); return HLSLFunctionStatistics(); }, false);
+}
+
+void HLSLPassManager::AddFoldConstants()
+{
+    AddTreePass("FoldConstants", [](HLSLTree* tree) { FoldConstants(tree); return true; }, true);
+}
+
+void HLSLPassManager::AddEliminateDeadCode()
+{
+    // The calls are checked for side effects against the functions gathered before the threads change their bodies.
+    std::shared_ptr<HLSLFunctionSet> shaderFunctions = std::make_shared<HLSLFunctionSet>();
+    AddFunctionPass("EliminateDeadCode", [shaderFunctions](HLSLTree* tree, HLSLFunction* function)
+    {
+        HLSLFunctionStatistics statistics = HLSLFunctionStatistics();
+        statistics.removedStatements = EliminateDeadCode(tree, function, *shaderFunctions);
+        return statistics;
+    }, true, [shaderFunctions](HLSLTree* tree) { GetShaderFunctions(tree, *shaderFunctions); });
+}
+
+void HLSLPassManager::AddEliminateCommonSubexpressions()
+{
+    // The values the temporaries hold are not repeated anymore.
+    std::shared_ptr<HLSLFunctionSet> shaderFunctions = std::make_shared<HLSLFunctionSet>();
+    AddFunctionPass("EliminateCommonSubexpressions", [shaderFunctions](HLSLTree* tree, HLSLFunction* function)
+    {
+        HLSLFunctionStatistics statistics = HLSLFunctionStatistics();
+        statistics.eliminatedExpressions = EliminateCommonSubexpressions(tree, function, *shaderFunctions);
+        return statistics;
+    }, true, [shaderFunctions](HLSLTree* tree) { GetShaderFunctions(tree, *shaderFunctions); });
+}
+
+void HLSLPassManager::AddInlineFunctions(int maxNodeCount/*=40*/)
+{
+    // Calls left in the bodies inlined may be inlined by the next run, where the locals hiding their globals are renamed.
+    AddTreePass("InlineFunctions", [maxNodeCount](HLSLTree* tree, HLSLPassStatistics& statistics)
+    {
+        statistics.inlinedCalls = InlineFunctions(tree, maxNodeCount);
+        return true;
+    }, false);
+}
+
+bool HLSLPassManager::Run()
+{
+    m_statistics.clear();
+
+    Fingerprint fingerprint = GetFingerprint();
+    for (Pass& pass : m_passes)
+    {
+        HLSLPassStatistics statistics;
+        statistics.name                  = pass.name.c_str();
+        statistics.skipped               = pass.hasRun && pass.revision == m_revision && (pass.idempotent || !pass.changed);
+        statistics.changed               = false;
+        statistics.milliseconds          = 0.0;
+        statistics.nodeCount             = fingerprint.nodeCount;
+        statistics.addedNodes            = 0;
+        statistics.removedStatements     = 0;
+        statistics.eliminatedExpressions = 0;
+        statistics.inlinedCalls          = 0;
+        statistics.visibleStatements     = fingerprint.visibleStatements;
+
+        if (!statistics.skipped)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool succeeded = true;
+            if (pass.runTree)
+            {
+                succeeded = pass.runTree(m_tree, statistics);
+            }
+            else
+            {
+                RunFunctionPass(pass, statistics);
+            }
+            statistics.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            Fingerprint previous = fingerprint;
+            fingerprint = GetFingerprint();
+            statistics.changed              = fingerprint.nodeCount != previous.nodeCount || fingerprint.hash != previous.hash ||
+                statistics.removedStatements > 0 || statistics.eliminatedExpressions > 0 || statistics.inlinedCalls > 0;
+            statistics.nodeCount            = fingerprint.nodeCount;
+            statistics.addedNodes           = fingerprint.nodeCount - previous.nodeCount;
+            statistics.visibleStatements    = fingerprint.visibleStatements;
+
+            if (statistics.changed)
+            {
+                ++m_revision;
+            }
+            pass.hasRun     = true;
+            pass.changed    = statistics.changed;
+            pass.revision   = m_revision;
+
+            if (!succeeded)
+            {
+                m_statistics.push_back(statistics);
+                return false;
+            }
+        }
+
+        m_statistics.push_back(statistics);
+    }
+
+    return true;
+}
+
+void HLSLPassManager::Invalidate()
+{
+    ++m_revision;
+}
+
+const std::vector<HLSLPassStatistics>& HLSLPassManager::GetStatistics() const
+{
+    return m_statistics;
+}
+
+HLSLPassManager::Fingerprint HLSLPassManager::GetFingerprint() const
+{
+    Fingerprint fingerprint;
+    fingerprint.nodeCount           = m_tree->GetNodeCount();
+    fingerprint.hash                = 14695981039346656037ull;
+    fingerprint.visibleStatements   = 0;
+
+    auto add = [&](const void* node, bool hidden)
+    {
+        fingerprint.hash = (fingerprint.hash ^ (uint64_t)(uintptr_t)node) * 1099511628211ull;
+        fingerprint.hash = (fingerprint.hash ^ (uint64_t)hidden) * 1099511628211ull;
+    };
+
+    for (HLSLStatement* statement = m_tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        add(statement, statement->hidden);
+        if (!statement->hidden)
+        {
+            ++fingerprint.visibleStatements;
+        }
+
+        if (statement->nodeType == HLSLNodeType::Buffer)
+        {
+            for (HLSLStatement* field = ((HLSLBuffer*)statement)->field; field != NULL; field = field->nextStatement)
+            {
+                for (HLSLDeclaration* declaration = (HLSLDeclaration*)field; declaration != NULL; declaration = declaration->nextDeclaration)
+                {
+                    add(declaration, declaration->hidden);
+                }
+            }
+        }
+        else if (statement->nodeType == HLSLNodeType::Function)
+        {
+            for (HLSLArgument* argument = ((HLSLFunction*)statement)->argument; argument != NULL; argument = argument->nextArgument)
+            {
+                add(argument, argument->hidden);
+            }
+        }
+    }
+
+    return fingerprint;
+}
+
+void HLSLPassManager::RunFunctionPass(const Pass& pass, HLSLPassStatistics& statistics)
+{
+    if (pass.prepareFunctions)
+    {
+        pass.prepareFunctions(m_tree);
+    }
+
+    std::vector<HLSLFunction*> functions;
+    for (HLSLStatement* statement = m_tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        // Prototypes are left alone, their definition is transformed.
+        if (statement->nodeType == HLSLNodeType::Function && ((HLSLFunction*)statement)->statement != NULL)
+        {
+            functions.push_back((HLSLFunction*)statement);
+        }
+    }
+
+    // Each function has its own entry, the threads don't share them.
+    std::vector<HLSLFunctionStatistics> results(functions.size());
+    if (m_jobCount <= 1 || functions.size() < s_minParallelFunctions)
+    {
+        for (size_t index = 0; index < functions.size(); ++index)
+        {
+            results[index] = pass.runFunction(m_tree, functions[index]);
+        }
+    }
+    else
+    {
+        std::atomic<size_t> nextFunction(0);
+        std::exception_ptr error;
+        std::atomic_flag errorSet = ATOMIC_FLAG_INIT;
+
+        auto run = [&]()
+        {
+            try
+            {
+                size_t index;
+                while ((index = nextFunction++) < functions.size())
+                {
+                    results[index] = pass.runFunction(m_tree, functions[index]);
+                }
+            }
+            catch (...)
+            {
+                // Stop the other threads and report the first failure on the calling thread.
+                nextFunction = functions.size();
+                if (!errorSet.test_and_set())
+                {
+                    error = std::current_exception();
+                }
+            }
+        };
+
+        m_tree->SetThreadSafe(true);
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < m_jobCount; ++i)
+        {
+            workers.emplace_back(run);
+        }
+        run();
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+        m_tree->SetThreadSafe(false);
+
+        if (error)
+        {
+            m_tree->InvalidateIndex();
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Function bodies may have changed under the references.
+    m_tree->InvalidateIndex();
+
+    for (size_t index = 0; index < functions.size(); ++index)
+    {
+        HLSLFunctionStatistics& result = results[index];
+        if (result.removedStatements > 0 || result.eliminatedExpressions > 0)
+        {
+            result.name = functions[index]->name;
+            statistics.removedStatements        += result.removedStatements;
+            statistics.eliminatedExpressions    += result.eliminatedExpressions;
+            statistics.functions.push_back(result);
+        }
+    }
+}
+
+} // M4
@@ -0,0 +1,139 @@
+#ifndef HLSL_PASS_MANAGER_H
+#define HLSL_PASS_MANAGER_H
+
+#include "Engine.h"
+
+#include "HLSLTree.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace M4
+{
+
+/** What a function pass did to one function, see HLSLPassManager::AddFunctionPass. */
+struct HLSLFunctionStatistics
+{
+    const char*     name;                   // Of the function, set by the pass manager.
+    size_t          removedStatements;
+    size_t          eliminatedExpressions;  // Replaced by a local holding the same value.
+};
+
+/** What a pass did during the last HLSLPassManager::Run. */
+struct HLSLPassStatistics
+{
+    const char*     name;
+    bool            skipped;            // Its last run already gave the current tree.
+    bool            changed;
+    double          milliseconds;       // Wall time.
+    size_t          nodeCount;          // Nodes added to the tree, after the pass.
+    size_t          addedNodes;
+    size_t          removedStatements;  // From function bodies, as reported by the pass.
+    size_t          eliminatedExpressions;
+    size_t          inlinedCalls;
+    size_t          visibleStatements;  // Top level statements not hidden, after the pass.
+    std::vector<HLSLFunctionStatistics> functions;  // Those with statements removed or expressions eliminated, in tree order.
+};
+
+/**
+ * Runs tree transformations in order, recording the time each takes and the
+ * nodes it adds.
+ *
+ * A pass has changed the tree when it added nodes, removed statements from
+ * function bodies, eliminated expressions or inlined calls, reordered the top level
+ * statements or buffer fields, or changed which of them or of the function
+ * arguments are hidden. A pass is skipped when no pass changed the tree since
+ * it last ran, if it is idempotent or its last run changed nothing. Changes
+ * made to the tree outside the passes must be reported with Invalidate.
+ *
+ * Function passes transform each function definition on its own, on several
+ * threads with a job count above one.
+ */
+class HLSLPassManager
+{
+
+public:
+
+    explicit HLSLPassManager(HLSLTree* tree);
+
+    /** Threads running the function passes, one by default. */
+    void SetJobCount(unsigned int jobCount);
+
+    /**
+     * Adds a pass transforming the whole tree, which returns false if it
+     * failed. Idempotent passes change nothing when run on their own output.
+     */
+    void AddTreePass(const char* name, std::function<bool(HLSLTree*)> run, bool idempotent);
+
+    /**
+     * Adds a pass transforming a function definition. It may add nodes, strings
+     * and types to the tree, but must not look up names or touch other
+     * functions, since other definitions are transformed at the same time. It
+     * returns what it removed or eliminated from the function. What it needs
+     * from the other functions is gathered by prepare, run on the calling
+     * thread before the definitions are transformed.
+     */
+    void AddFunctionPass(const char* name, std::function<HLSLFunctionStatistics(HLSLTree*, HLSLFunction*)> run, bool idempotent,
+        std::function<void(HLSLTree*)> prepare = nullptr);
+
+    // The transformations of HLSLTree.h.
+    void AddPruneTree(const char* const* entryNames, int entryCount);
+    void AddSortTree();
+    void AddGroupParameters();
+    void AddHideUnusedArguments();
+    void AddEmulateAlphaTest(const char* entryName, float alphaRef = 0.5f);
+    void AddFlattenExpressions();
+    void AddFoldConstants();
+    void AddEliminateDeadCode();
+    void AddEliminateCommonSubexpressions();
+    void AddInlineFunctions(int maxNodeCount = 40);
+
+    /** Runs the passes in order. Returns false if one failed, the next ones aren't run. */
+    bool Run();
+
+    /** Reports changes made to the tree outside the passes, none is skipped by the next Run. */
+    void Invalidate();
+
+    /** One entry per pass run or skipped by the last Run. */
+    const std::vector<HLSLPassStatistics>& GetStatistics() const;
+
+private:
+
+    struct Pass
+    {
+        std::string                                                     name;
+        std::function<bool(HLSLTree*, HLSLPassStatistics&)>             runTree;
+        std::function<HLSLFunctionStatistics(HLSLTree*, HLSLFunction*)> runFunction;
+        std::function<void(HLSLTree*)>                                  prepareFunctions;
+        bool                                                            idempotent;
+        bool                                                            hasRun;
+        bool                                                            changed;
+        uint64_t                                                        revision;   // Of the tree it left.
+    };
+
+    /** Identifies the state of the tree, see the class comment. */
+    struct Fingerprint
+    {
+        size_t      nodeCount;
+        uint64_t    hash;
+        size_t      visibleStatements;
+    };
+
+    /** Adds a tree pass reporting what it did in the statistics of its run. */
+    void AddTreePass(const char* name, std::function<bool(HLSLTree*, HLSLPassStatistics&)> run, bool idempotent);
+
+    Fingerprint GetFingerprint() const;
+    void RunFunctionPass(const Pass& pass, HLSLPassStatistics& statistics);
+
+    HLSLTree*                           m_tree;
+    unsigned int                        m_jobCount;
+    uint64_t                            m_revision;
+    std::vector<Pass>                   m_passes;
+    std::vector<HLSLPassStatistics>     m_statistics;
+
+};
+
+} // M4
+
+#endif
@@ -0,0 +1,866 @@
+//#include "Engine/Assert.h"
+#include "Engine.h"
+
+#include "HLSLSerializer.h"
+
+#include <string.h>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace M4
+{
+
+/*
+ * Binary layout, all integers are LEB128 encoded:
+ *
+ *   "HLSB" version
+ *   numStrings  { bytes '\0' }
+ *   numNodes    { nodeType }          Node 0 is the root.
+ *   numTypes    { HLSLType }          Interned expression types.
+ *   { node fields }                   One record per node, see TransferNode.
+ *
+ * Strings, nodes and types are referenced by index + 1, 0 meaning NULL.
+ */
+
+static const unsigned char _binaryMagic[4] = { 'H', 'L', 'S', 'B' };
+
+static HLSLNode* AddNode(HLSLTree* tree, HLSLNodeType nodeType)
+{
+    switch (nodeType)
+    {
+    case HLSLNodeType::Declaration:             return tree->AddNode<HLSLDeclaration>(NULL, 0);
+    case HLSLNodeType::Struct:                  return tree->AddNode<HLSLStruct>(NULL, 0);
+    case HLSLNodeType::StructField:             return tree->AddNode<HLSLStructField>(NULL, 0);
+    case HLSLNodeType::Buffer:                  return tree->AddNode<HLSLBuffer>(NULL, 0);
+    case HLSLNodeType::Function:                return tree->AddNode<HLSLFunction>(NULL, 0);
+    case HLSLNodeType::Argument:                return tree->AddNode<HLSLArgument>(NULL, 0);
+    case HLSLNodeType::ExpressionStatement:     return tree->AddNode<HLSLExpressionStatement>(NULL, 0);
+    case HLSLNodeType::Expression:              return tree->AddNode<HLSLExpression>(NULL, 0);
+    case HLSLNodeType::ReturnStatement:         return tree->AddNode<HLSLReturnStatement>(NULL, 0);
+    case HLSLNodeType::DiscardStatement:        return tree->AddNode<HLSLDiscardStatement>(NULL, 0);
+    case HLSLNodeType::BreakStatement:          return tree->AddNode<HLSLBreakStatement>(NULL, 0);
+    case HLSLNodeType::ContinueStatement:       return tree->AddNode<HLSLContinueStatement>(NULL, 0);
+    case HLSLNodeType::IfStatement:             return tree->AddNode<HLSLIfStatement>(NULL, 0);
+    case HLSLNodeType::ForStatement:            return tree->AddNode<HLSLForStatement>(NULL, 0);
+    case HLSLNodeType::BlockStatement:          return tree->AddNode<HLSLBlockStatement>(NULL, 0);
+    case HLSLNodeType::UnaryExpression:         return tree->AddNode<HLSLUnaryExpression>(NULL, 0);
+    case HLSLNodeType::BinaryExpression:        return tree->AddNode<HLSLBinaryExpression>(NULL, 0);
+    case HLSLNodeType::ConditionalExpression:   return tree->AddNode<HLSLConditionalExpression>(NULL, 0);
+    case HLSLNodeType::CastingExpression:       return tree->AddNode<HLSLCastingExpression>(NULL, 0);
+    case HLSLNodeType::LiteralExpression:       return tree->AddNode<HLSLLiteralExpression>(NULL, 0);
+    case HLSLNodeType::IdentifierExpression:    return tree->AddNode<HLSLIdentifierExpression>(NULL, 0);
+    case HLSLNodeType::ConstructorExpression:   return tree->AddNode<HLSLConstructorExpression>(NULL, 0);
+    case HLSLNodeType::MemberAccess:            return tree->AddNode<HLSLMemberAccess>(NULL, 0);
+    case HLSLNodeType::ArrayAccess:             return tree->AddNode<HLSLArrayAccess>(NULL, 0);
+    case HLSLNodeType::FunctionCall:            return tree->AddNode<HLSLFunctionCall>(NULL, 0);
+    case HLSLNodeType::StateAssignment:         return tree->AddNode<HLSLStateAssignment>(NULL, 0);
+    case HLSLNodeType::SamplerState:            return tree->AddNode<HLSLSamplerState>(NULL, 0);
+    case HLSLNodeType::Pass:                    return tree->AddNode<HLSLPass>(NULL, 0);
+    case HLSLNodeType::Technique:               return tree->AddNode<HLSLTechnique>(NULL, 0);
+    case HLSLNodeType::Attribute:               return tree->AddNode<HLSLAttribute>(NULL, 0);
+    case HLSLNodeType::Pipeline:                return tree->AddNode<HLSLPipeline>(NULL, 0);
+    case HLSLNodeType::Stage:                   return tree->AddNode<HLSLStage>(NULL, 0);
+    default:
+        // The root is owned by the tree and there is no node for buffer fields.
+        return NULL;
+    }
+}
+
+// The same transfer functions drive the collector, the writer, the reader and
+// the checker, so the serialized layout can't get out of sync between them.
+// Only the reader modifies the transferred fields. Node links to a node the
+// linking node owns, Reference to a node owned elsewhere, followed or not by the
+// JSON output.
+
+template <class Archive>
+static void TransferType(Archive& ar, HLSLType& type)
+{
+    ar.Enum(type.baseType);
+    ar.Enum(type.samplerType);
+    ar.Enum(type.textureType);
+    ar.String(type.typeName);
+    ar.Bool(type.array);
+    ar.Reference(type.arraySize, true);
+    ar.Int(type.flags);
+    ar.Enum(type.addressSpace);
+}
+
+template <class Archive>
+static void TransferNode(Archive& ar, HLSLNode* node)
+{
+    ar.String(node->fileName);
+    ar.Int(node->line);
+
+    if (IsStatementNode(node->nodeType))
+    {
+        HLSLStatement* statement = static_cast<HLSLStatement*>(node);
+        ar.Node(statement->nextStatement);
+        ar.Node(statement->attributes);
+        ar.Bool(statement->hidden);
+    }
+    else if (IsExpressionNode(node->nodeType))
+    {
+        HLSLExpression* expression = static_cast<HLSLExpression*>(node);
+        ar.TypeRef(expression->expressionType);
+        ar.Node(expression->nextExpression);
+    }
+
+    switch (node->nodeType)
+    {
+    case HLSLNodeType::Root:
+        {
+            HLSLRoot* root = static_cast<HLSLRoot*>(node);
+            ar.Node(root->statement);
+        }
+        break;
+    case HLSLNodeType::Declaration:
+        {
+            HLSLDeclaration* declaration = static_cast<HLSLDeclaration*>(node);
+            ar.String(declaration->name);
+            TransferType(ar, declaration->type);
+            ar.String(declaration->registerName);
+            ar.String(declaration->spaceName);
+            ar.String(declaration->semantic);
+            ar.Node(declaration->nextDeclaration);
+            ar.Node(declaration->assignment);
+            ar.Reference(declaration->buffer, false);
+        }
+        break;
+    case HLSLNodeType::Struct:
+        {
+            HLSLStruct* structure = static_cast<HLSLStruct*>(node);
+            ar.String(structure->name);
+            ar.Node(structure->field);
+        }
+        break;
+    case HLSLNodeType::StructField:
+        {
+            HLSLStructField* field = static_cast<HLSLStructField*>(node);
+            ar.String(field->name);
+            TransferType(ar, field->type);
+            ar.String(field->semantic);
+            ar.String(field->sv_semantic);
+            ar.Node(field->nextField);
+            ar.Bool(field->hidden);
+        }
+        break;
+    case HLSLNodeType::Buffer:
+        {
+            HLSLBuffer* buffer = static_cast<HLSLBuffer*>(node);
+            ar.String(buffer->name);
+            ar.String(buffer->registerName);
+            ar.String(buffer->spaceName);
+            ar.Node(buffer->field);
+        }
+        break;
+    case HLSLNodeType::Function:
+        {
+            HLSLFunction* function = static_cast<HLSLFunction*>(node);
+            ar.String(function->name);
+            TransferType(ar, function->returnType);
+            ar.Enum(function->memberOfType);
+            ar.String(function->semantic);
+            ar.String(function->sv_semantic);
+            ar.Int(function->numArguments);
+            ar.Int(function->numOutputArguments);
+            ar.Node(function->argument);
+            ar.Node(function->statement);
+            ar.Reference(function->forward, true);
+        }
+        break;
+    case HLSLNodeType::Argument:
+        {
+            HLSLArgument* argument = static_cast<HLSLArgument*>(node);
+            ar.String(argument->name);
+            ar.Enum(argument->modifier);
+            TransferType(ar, argument->type);
+            ar.String(argument->semantic);
+            ar.String(argument->sv_semantic);
+            ar.Node(argument->defaultValue);
+            ar.Node(argument->nextArgument);
+            ar.Bool(argument->hidden);
+        }
+        break;
+    case HLSLNodeType::ExpressionStatement:
+        ar.Node(static_cast<HLSLExpressionStatement*>(node)->expression);
+        break;
+    case HLSLNodeType::ReturnStatement:
+        ar.Node(static_cast<HLSLReturnStatement*>(node)->expression);
+        break;
+    case HLSLNodeType::IfStatement:
+        {
+            HLSLIfStatement* ifStatement = static_cast<HLSLIfStatement*>(node);
+            ar.Node(ifStatement->condition);
+            ar.Node(ifStatement->statement);
+            ar.Node(ifStatement->elseStatement);
+            ar.Bool(ifStatement->isStatic);
+        }
+        break;
+    case HLSLNodeType::ForStatement:
+        {
+            HLSLForStatement* forStatement = static_cast<HLSLForStatement*>(node);
+            ar.Node(forStatement->initialization);
+            ar.Node(forStatement->condition);
+            ar.Node(forStatement->increment);
+            ar.Node(forStatement->statement);
+        }
+        break;
+    case HLSLNodeType::BlockStatement:
+        ar.Node(static_cast<HLSLBlockStatement*>(node)->statement);
+        break;
+    case HLSLNodeType::UnaryExpression:
+        {
+            HLSLUnaryExpression* unaryExpression = static_cast<HLSLUnaryExpression*>(node);
+            ar.Enum(unaryExpression->unaryOp);
+            ar.Node(unaryExpression->expression);
+        }
+        break;
+    case HLSLNodeType::BinaryExpression:
+        {
+            HLSLBinaryExpression* binaryExpression = static_cast<HLSLBinaryExpression*>(node);
+            ar.Enum(binaryExpression->binaryOp);
+            ar.Node(binaryExpression->expression1);
+            ar.Node(binaryExpression->expression2);
+        }
+        break;
+    case HLSLNodeType::ConditionalExpression:
+        {
+            HLSLConditionalExpression* conditionalExpression = static_cast<HLSLConditionalExpression*>(node);
+            ar.Node(conditionalExpression->condition);
+            ar.Node(conditionalExpression->trueExpression);
+            ar.Node(conditionalExpression->falseExpression);
+        }
+        break;
+    case HLSLNodeType::CastingExpression:
+        {
+            HLSLCastingExpression* castingExpression = static_cast<HLSLCastingExpression*>(node);
+            TransferType(ar, castingExpression->type);
+            ar.Node(castingExpression->expression);
+        }
+        break;
+    case HLSLNodeType::LiteralExpression:
+        {
+            // The raw bits of the value union are kept, all of its members are part of the JSON output.
+            HLSLLiteralExpression* literalExpression = static_cast<HLSLLiteralExpression*>(node);
+            ar.Enum(literalExpression->type);
+            ar.Raw32(&literalExpression->iValue);
+        }
+        break;
+    case HLSLNodeType::IdentifierExpression:
+        {
+            HLSLIdentifierExpression* identifierExpression = static_cast<HLSLIdentifierExpression*>(node);
+            ar.String(identifierExpression->name);
+            ar.Bool(identifierExpression->global);
+        }
+        break;
+    case HLSLNodeType::ConstructorExpression:
+        {
+            HLSLConstructorExpression* constructorExpression = static_cast<HLSLConstructorExpression*>(node);
+            TransferType(ar, constructorExpression->type);
+            ar.Node(constructorExpression->argument);
+        }
+        break;
+    case HLSLNodeType::MemberAccess:
+        {
+            HLSLMemberAccess* memberAccess = static_cast<HLSLMemberAccess*>(node);
+            ar.Node(memberAccess->object);
+            ar.String(memberAccess->field);
+            ar.Bool(memberAccess->swizzle);
+        }
+        break;
+    case HLSLNodeType::ArrayAccess:
+        {
+            HLSLArrayAccess* arrayAccess = static_cast<HLSLArrayAccess*>(node);
+            ar.Node(arrayAccess->array);
+            ar.Node(arrayAccess->index);
+        }
+        break;
+    case HLSLNodeType::FunctionCall:
+        {
+            HLSLFunctionCall* functionCall = static_cast<HLSLFunctionCall*>(node);
+            ar.Reference(functionCall->function, false);
+            ar.Node(functionCall->argument);
+            ar.Int(functionCall->numArguments);
+        }
+        break;
+    case HLSLNodeType::StateAssignment:
+        {
+            // The parser only ever stores iValue or fValue, sValue is never set.
+            HLSLStateAssignment* stateAssignment = static_cast<HLSLStateAssignment*>(node);
+            ar.String(stateAssignment->stateName);
+            ar.Int(stateAssignment->d3dRenderState);
+            ar.Raw32(&stateAssignment->iValue);
+            ar.Node(stateAssignment->nextStateAssignment);
+        }
+        break;
+    case HLSLNodeType::SamplerState:
+        {
+            HLSLSamplerState* samplerState = static_cast<HLSLSamplerState*>(node);
+            ar.Int(samplerState->numStateAssignments);
+            ar.Node(samplerState->stateAssignments);
+        }
+        break;
+    case HLSLNodeType::Pass:
+        {
+            HLSLPass* pass = static_cast<HLSLPass*>(node);
+            ar.String(pass->name);
+            ar.Int(pass->numStateAssignments);
+            ar.Node(pass->stateAssignments);
+            ar.Node(pass->nextPass);
+        }
+        break;
+    case HLSLNodeType::Technique:
+        {
+            HLSLTechnique* technique = static_cast<HLSLTechnique*>(node);
+            ar.String(technique->name);
+            ar.Int(technique->numPasses);
+            ar.Node(technique->passes);
+        }
+        break;
+    case HLSLNodeType::Attribute:
+        {
+            HLSLAttribute* attribute = static_cast<HLSLAttribute*>(node);
+            ar.Enum(attribute->attributeType);
+            ar.Node(attribute->argument);
+            ar.Node(attribute->nextAttribute);
+        }
+        break;
+    case HLSLNodeType::Pipeline:
+        {
+            HLSLPipeline* pipeline = static_cast<HLSLPipeline*>(node);
+            ar.String(pipeline->name);
+            ar.Int(pipeline->numStateAssignments);
+            ar.Node(pipeline->stateAssignments);
+        }
+        break;
+    case HLSLNodeType::Stage:
+        {
+            HLSLStage* stage = static_cast<HLSLStage*>(node);
+            ar.String(stage->name);
+            ar.Node(stage->statement);
+            ar.Node(stage->inputs);
+            ar.Node(stage->outputs);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/** Assigns an index to every node, string and type reachable from the root. */
+class TreeCollector
+{
+public:
+
+    void Collect(HLSLRoot* root)
+    {
+        HLSLRoot* node = root;
+        Node(node);
+
+        // Nodes are appended while they are transferred.
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            TransferNode(*this, m_nodes[i]);
+        }
+    }
+
+    void Int(int&) {}
+    void Bool(bool&) {}
+    template <class E> void Enum(E&) {}
+    void Raw32(void*) {}
+
+    void String(const char*& string)
+    {
+        if (string != NULL && m_stringIndex.emplace(string, (unsigned int)m_strings.size()).second)
+        {
+            m_strings.push_back(string);
+        }
+    }
+
+    template <class T>
+    void Node(T*& node)
+    {
+        if (node != NULL && m_nodeIndex.emplace(node, (unsigned int)m_nodes.size()).second)
+        {
+            m_nodes.push_back(const_cast<HLSLNode*>(static_cast<const HLSLNode*>(node)));
+        }
+    }
+
+    template <class T>
+    void Reference(T*& node, bool)
+    {
+        Node(node);
+    }
+
+    void TypeRef(const HLSLType*& type)
+    {
+        if (type != NULL && m_typeIndex.emplace(type, (unsigned int)m_types.size()).second)
+        {
+            m_types.push_back(type);
+            TransferType(*this, const_cast<HLSLType&>(*type));
+        }
+    }
+
+    std::vector<const char*>    m_strings;
+    std::vector<HLSLNode*>      m_nodes;
+    std::vector<const HLSLType*> m_types;
+
+    std::unordered_map<std::string_view, unsigned int>  m_stringIndex;
+    std::unordered_map<const void*, unsigned int>       m_nodeIndex;
+    std::unordered_map<const HLSLType*, unsigned int>   m_typeIndex;
+};
+
+class TreeWriter
+{
+public:
+
+    TreeWriter(const TreeCollector& collector, std::vector<unsigned char>& buffer) :
+        m_collector(collector),
+        m_buffer(buffer)
+    {
+    }
+
+    void UInt(unsigned int value)
+    {
+        while (value >= 0x80)
+        {
+            m_buffer.push_back((unsigned char)(value | 0x80));
+            value >>= 7;
+        }
+        m_buffer.push_back((unsigned char)value);
+    }
+
+    void Bytes(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    }
+
+    void Int(int& value)
+    {
+        // Zigzag encoding keeps small negative values small.
+        UInt(((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+    }
+
+    void Bool(bool& value)
+    {
+        m_buffer.push_back(value ? 1 : 0);
+    }
+
+    template <class E>
+    void Enum(E& value)
+    {
+        UInt((unsigned int)value);
+    }
+
+    void Raw32(void* value)
+    {
+        Bytes(value, 4);
+    }
+
+    void String(const char*& string)
+    {
+        UInt(string == NULL ? 0 : m_collector.m_stringIndex.at(string) + 1);
+    }
+
+    template <class T>
+    void Node(T*& node)
+    {
+        UInt(node == NULL ? 0 : m_collector.m_nodeIndex.at(node) + 1);
+    }
+
+    template <class T>
+    void Reference(T*& node, bool)
+    {
+        Node(node);
+    }
+
+    void TypeRef(const HLSLType*& type)
+    {
+        UInt(type == NULL ? 0 : m_collector.m_typeIndex.at(type) + 1);
+    }
+
+private:
+
+    const TreeCollector&            m_collector;
+    std::vector<unsigned char>&     m_buffer;
+};
+
+class TreeReader
+{
+public:
+
+    TreeReader(const void* data, size_t size)
+    {
+        m_data  = static_cast<const unsigned char*>(data);
+        m_end   = m_data + size;
+        m_error = false;
+    }
+
+    bool GetError() const
+    {
+        return m_error;
+    }
+
+    size_t GetRemaining() const
+    {
+        return m_end - m_data;
+    }
+
+    unsigned int UInt()
+    {
+        unsigned int value = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            if (m_data == m_end || shift > 28)
+            {
+                m_error = true;
+                return 0;
+            }
+            unsigned char byte = *m_data++;
+            value |= (unsigned int)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+    }
+
+    bool Bytes(void* data, size_t size)
+    {
+        if (GetRemaining() < size)
+        {
+            m_error = true;
+            return false;
+        }
+        memcpy(data, m_data, size);
+        m_data += size;
+        return true;
+    }
+
+    /** Returns the next null terminated string, which stays in the source buffer. */
+    const char* CString()
+    {
+        const void* terminator = memchr(m_data, 0, GetRemaining());
+        if (terminator == NULL)
+        {
+            m_error = true;
+            return NULL;
+        }
+        const char* string = reinterpret_cast<const char*>(m_data);
+        m_data = static_cast<const unsigned char*>(terminator) + 1;
+        return string;
+    }
+
+    void Int(int& value)
+    {
+        unsigned int encoded = UInt();
+        value = (int)(encoded >> 1) ^ -(int)(encoded & 1);
+    }
+
+    void Bool(bool& value)
+    {
+        unsigned char byte = 0;
+        Bytes(&byte, 1);
+        value = byte != 0;
+    }
+
+    template <class E>
+    void Enum(E& value)
+    {
+        value = (E)UInt();
+    }
+
+    void Enum(HLSLBaseType& value)
+    {
+        // Base types index lookup tables, don't trust them.
+        unsigned int index = UInt();
+        if (index >= (unsigned int)HLSLBaseType::Count)
+        {
+            m_error = true;
+            index = 0;
+        }
+        value = (HLSLBaseType)index;
+    }
+
+    void Raw32(void* value)
+    {
+        Bytes(value, 4);
+    }
+
+    void String(const char*& string)
+    {
+        string = Lookup(m_strings);
+    }
+
+    template <class T>
+    void Node(T*& node)
+    {
+        HLSLNode* result = Lookup(m_nodes);
+        if (result != NULL && !IsNodeOfType<typename std::remove_const<T>::type>(result->nodeType))
+        {
+            m_error = true;
+            result = NULL;
+        }
+        node = static_cast<T*>(result);
+    }
+
+    template <class T>
+    void Reference(T*& node, bool)
+    {
+        Node(node);
+    }
+
+    void TypeRef(const HLSLType*& type)
+    {
+        type = Lookup(m_types);
+    }
+
+    std::vector<const char*>        m_strings;
+    std::vector<HLSLNode*>          m_nodes;
+    std::vector<const HLSLType*>    m_types;
+
+private:
+
+    template <class T>
+    T Lookup(const std::vector<T>& table)
+    {
+        unsigned int index = UInt();
+        if (index == 0)
+        {
+            return NULL;
+        }
+        if (index > table.size())
+        {
+            m_error = true;
+            return NULL;
+        }
+        return table[index - 1];
+    }
+
+    const unsigned char*    m_data;
+    const unsigned char*    m_end;
+    bool                    m_error;
+};
+
+/**
+ * Checks that the nodes reachable from the root form a tree: each one is owned
+ * by a single link, and the references the JSON output follows, through array
+ * sizes and prototypes, don't lead back to a node being written. Well formed
+ * data read back may still link nodes any way it likes.
+ */
+class TreeChecker
+{
+public:
+
+    bool Check(HLSLRoot* root)
+    {
+        m_error = false;
+        m_owned.insert(root);
+
+        // A node expanded again while its links are still being walked is in a cycle.
+        std::vector<std::pair<HLSLNode*, bool>> stack(1, std::make_pair(static_cast<HLSLNode*>(root), false));
+        while (!stack.empty() && !m_error)
+        {
+            HLSLNode* node = stack.back().first;
+            bool done = stack.back().second;
+            stack.pop_back();
+
+            if (done)
+            {
+                m_open.erase(node);
+                continue;
+            }
+            if (m_open.count(node) > 0)
+            {
+                return false;
+            }
+            if (!m_walked.insert(node).second)
+            {
+                continue;
+            }
+
+            m_open.insert(node);
+            stack.emplace_back(node, true);
+            m_links.clear();
+            TransferNode(*this, node);
+            for (HLSLNode* link : m_links)
+            {
+                stack.emplace_back(link, false);
+            }
+        }
+        return !m_error;
+    }
+
+    void Int(int&) {}
+    void Bool(bool&) {}
+    template <class E> void Enum(E&) {}
+    void Raw32(void*) {}
+    void String(const char*&) {}
+
+    template <class T>
+    void Node(T*& node)
+    {
+        if (node != NULL)
+        {
+            m_error = m_error || !m_owned.insert(node).second;
+            m_links.push_back(const_cast<HLSLNode*>(static_cast<const HLSLNode*>(node)));
+        }
+    }
+
+    template <class T>
+    void Reference(T*& node, bool followed)
+    {
+        if (node != NULL && followed)
+        {
+            m_links.push_back(const_cast<HLSLNode*>(static_cast<const HLSLNode*>(node)));
+        }
+    }
+
+    void TypeRef(const HLSLType*& type)
+    {
+        // Every expression has a type.
+        if (type == NULL)
+        {
+            m_error = true;
+            return;
+        }
+        TransferType(*this, const_cast<HLSLType&>(*type));
+    }
+
+private:
+
+    bool                            m_error;
+    std::unordered_set<HLSLNode*>   m_owned;
+    std::unordered_set<HLSLNode*>   m_walked;
+    std::unordered_set<HLSLNode*>   m_open;     // Expanded, their links not all walked yet.
+    std::vector<HLSLNode*>          m_links;
+};
+
+void SerializeTree(HLSLTree* tree, std::vector<unsigned char>& buffer)
+{
+    TreeCollector collector;
+    collector.Collect(tree->GetRoot());
+
+    TreeWriter writer(collector, buffer);
+    writer.Bytes(_binaryMagic, sizeof(_binaryMagic));
+    writer.UInt(HLSLBinaryVersion);
+
+    writer.UInt((unsigned int)collector.m_strings.size());
+    for (const char* string : collector.m_strings)
+    {
+        writer.Bytes(string, strlen(string) + 1);
+    }
+
+    writer.UInt((unsigned int)collector.m_nodes.size());
+    for (const HLSLNode* node : collector.m_nodes)
+    {
+        writer.UInt((unsigned int)node->nodeType);
+    }
+
+    writer.UInt((unsigned int)collector.m_types.size());
+    for (const HLSLType* type : collector.m_types)
+    {
+        TransferType(writer, const_cast<HLSLType&>(*type));
+    }
+
+    for (HLSLNode* node : collector.m_nodes)
+    {
+        TransferNode(writer, node);
+    }
+}
+
+bool DeserializeTree(HLSLTree* tree, const void* data, size_t size)
+{
+    HLSLRoot* root = tree->GetRoot();
+    ASSERT(root->statement == NULL);
+
+    TreeReader reader(data, size);
+
+    unsigned char magic[sizeof(_binaryMagic)];
+    if (!reader.Bytes(magic, sizeof(magic)) || memcmp(magic, _binaryMagic, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+    if (reader.UInt() != HLSLBinaryVersion)
+    {
+        return false;
+    }
+
+    // Every entry takes at least one byte, this rejects bogus counts before allocating.
+    unsigned int numStrings = reader.UInt();
+    if (reader.GetError() || numStrings > reader.GetRemaining())
+    {
+        return false;
+    }
+    reader.m_strings.reserve(numStrings);
+    for (unsigned int i = 0; i < numStrings; ++i)
+    {
+        const char* string = reader.CString();
+        if (string == NULL)
+        {
+            return false;
+        }
+        reader.m_strings.push_back(tree->AddString(string));
+    }
+
+    unsigned int numNodes = reader.UInt();
+    if (reader.GetError() || numNodes == 0 || numNodes > reader.GetRemaining())
+    {
+        return false;
+    }
+    reader.m_nodes.reserve(numNodes);
+    for (unsigned int i = 0; i < numNodes; ++i)
+    {
+        HLSLNodeType nodeType = (HLSLNodeType)reader.UInt();
+        HLSLNode* node = NULL;
+        if (i == 0)
+        {
+            node = nodeType == HLSLNodeType::Root ? root : NULL;
+        }
+        else
+        {
+            node = AddNode(tree, nodeType);
+        }
+        if (node == NULL || reader.GetError())
+        {
+            return false;
+        }
+        reader.m_nodes.push_back(node);
+    }
+
+    unsigned int numTypes = reader.UInt();
+    if (reader.GetError() || numTypes > reader.GetRemaining())
+    {
+        return false;
+    }
+    reader.m_types.reserve(numTypes);
+    for (unsigned int i = 0; i < numTypes; ++i)
+    {
+        HLSLType type;
+        TransferType(reader, type);
+        reader.m_types.push_back(tree->AddType(type));
+    }
+
+    for (HLSLNode* node : reader.m_nodes)
+    {
+        TransferNode(reader, node);
+        if (reader.GetError())
+        {
+            return false;
+        }
+    }
+
+    tree->InvalidateIndex();
+    if (reader.GetError() || reader.GetRemaining() != 0)
+    {
+        return false;
+    }
+
+    TreeChecker checker;
+    return checker.Check(root);
+}
+
+} // M4
@@ -0,0 +1,31 @@
+#ifndef HLSL_SERIALIZER_H
+#define HLSL_SERIALIZER_H
+
+#include "Engine.h"
+
+#include "HLSLTree.h"
+
+namespace M4
+{
+
+/** Version of the binary tree format. Bump it whenever a node layout changes. */
+const unsigned int HLSLBinaryVersion = 1;
+
+/**
+ * Serializes the whole tree (nodes, strings, interned types and the links
+ * between functions) into a compact binary blob appended to the buffer.
+ * Functions that are referenced but not owned by the tree, like intrinsics,
+ * are serialized as regular nodes.
+ */
+void SerializeTree(HLSLTree* tree, std::vector<unsigned char>& buffer);
+
+/**
+ * Reconstructs a tree serialized with SerializeTree. The tree must be empty.
+ * Returns false if the data is truncated, corrupted, links the nodes in a way
+ * no tree does or was written with a different HLSLBinaryVersion.
+ */
+bool DeserializeTree(HLSLTree* tree, const void* data, size_t size);
+
+} // M4
+
+#endif
@@ -0,0 +1,602 @@
+#ifndef HLSL_STATIC_TREE_VISITOR_H
+#define HLSL_STATIC_TREE_VISITOR_H
+
+#include "Engine.h"
+
+#include "HLSLTree.h"
+
+#include <type_traits>
+#include <vector>
+
+namespace M4
+{
+
+/**
+ * Visits the tree like HLSLTreeVisitor, with the same hooks, but dispatched at
+ * compile time: Derived hides the Visit methods it wants to change, and the
+ * walk calls them directly, so they can be inlined. Call the hidden method
+ * with HLSLStaticTreeVisitor<Derived>::VisitX to carry on the walk.
+ *
+ *     class CallCounter : public HLSLStaticTreeVisitor<CallCounter>
+ *     {
+ *     public:
+ *         int count = 0;
+ *         void VisitFunctionCall(HLSLFunctionCall * node)
+ *         {
+ *             ++count;
+ *             HLSLStaticTreeVisitor<CallCounter>::VisitFunctionCall(node);
+ *         }
+ *     };
+ */
+template <class Derived>
+class HLSLStaticTreeVisitor
+{
+public:
+    void VisitType(const HLSLType & type) {}
+
+    void VisitRoot(HLSLRoot * root)
+    {
+        for (HLSLStatement * statement = root->statement; statement != NULL; statement = statement->nextStatement)
+        {
+            GetDerived().VisitTopLevelStatement(statement);
+        }
+    }
+
+    void VisitTopLevelStatement(HLSLStatement * node)
+    {
+        switch (node->nodeType)
+        {
+        case HLSLNodeType::Declaration: GetDerived().VisitDeclaration((HLSLDeclaration *)node); break;
+        case HLSLNodeType::Struct:      GetDerived().VisitStruct((HLSLStruct *)node); break;
+        case HLSLNodeType::Buffer:      GetDerived().VisitBuffer((HLSLBuffer *)node); break;
+        case HLSLNodeType::Function:    GetDerived().VisitFunction((HLSLFunction *)node); break;
+        case HLSLNodeType::Technique:   GetDerived().VisitTechnique((HLSLTechnique *)node); break;
+        case HLSLNodeType::Pipeline:    GetDerived().VisitPipeline((HLSLPipeline *)node); break;
+        default:                        ASSERT(0);
+        }
+    }
+
+    void VisitStatements(HLSLStatement * statement)
+    {
+        for (; statement != NULL; statement = statement->nextStatement)
+        {
+            GetDerived().VisitStatement(statement);
+        }
+    }
+
+    void VisitStatement(HLSLStatement * node)
+    {
+        // Function statements
+        switch (node->nodeType)
+        {
+        case HLSLNodeType::Declaration:         GetDerived().VisitDeclaration((HLSLDeclaration *)node); break;
+        case HLSLNodeType::ExpressionStatement: GetDerived().VisitExpressionStatement((HLSLExpressionStatement *)node); break;
+        case HLSLNodeType::ReturnStatement:     GetDerived().VisitReturnStatement((HLSLReturnStatement *)node); break;
+        case HLSLNodeType::DiscardStatement:    GetDerived().VisitDiscardStatement((HLSLDiscardStatement *)node); break;
+        case HLSLNodeType::BreakStatement:      GetDerived().VisitBreakStatement((HLSLBreakStatement *)node); break;
+        case HLSLNodeType::ContinueStatement:   GetDerived().VisitContinueStatement((HLSLContinueStatement *)node); break;
+        case HLSLNodeType::IfStatement:         GetDerived().VisitIfStatement((HLSLIfStatement *)node); break;
+        case HLSLNodeType::ForStatement:        GetDerived().VisitForStatement((HLSLForStatement *)node); break;
+        case HLSLNodeType::BlockStatement:      GetDerived().VisitBlockStatement((HLSLBlockStatement *)node); break;
+        default:                                ASSERT(0);
+        }
+    }
+
+    void VisitDeclaration(HLSLDeclaration * node)
+    {
+        GetDerived().VisitType(node->type);
+        // Array initializers are lists.
+        for (HLSLExpression * value = node->assignment; value != NULL; value = value->nextExpression)
+        {
+            GetDerived().VisitExpression(value);
+        }
+        if (node->nextDeclaration != NULL)
+        {
+            GetDerived().VisitDeclaration(node->nextDeclaration);
+        }
+    }
+
+    void VisitStruct(HLSLStruct * node)
+    {
+        for (HLSLStructField * field = node->field; field != NULL; field = field->nextField)
+        {
+            GetDerived().VisitStructField(field);
+        }
+    }
+
+    void VisitStructField(HLSLStructField * node)
+    {
+        GetDerived().VisitType(node->type);
+    }
+
+    void VisitBuffer(HLSLBuffer * node)
+    {
+        for (HLSLStatement * field = node->field; field != NULL; field = field->nextStatement)
+        {
+            ASSERT(field->nodeType == HLSLNodeType::Declaration);
+            GetDerived().VisitDeclaration((HLSLDeclaration *)field);    // Visits the other variables of "float a, b;" as well.
+        }
+    }
+
+    void VisitFunction(HLSLFunction * node)
+    {
+        GetDerived().VisitType(node->returnType);
+
+        for (HLSLArgument * argument = node->argument; argument != NULL; argument = argument->nextArgument)
+        {
+            GetDerived().VisitArgument(argument);
+        }
+
+        GetDerived().VisitStatements(node->statement);
+    }
+
+    void VisitArgument(HLSLArgument * node)
+    {
+        GetDerived().VisitType(node->type);
+        if (node->defaultValue != NULL)
+        {
+            GetDerived().VisitExpression(node->defaultValue);
+        }
+    }
+
+    void VisitExpressionStatement(HLSLExpressionStatement * node)
+    {
+        GetDerived().VisitExpression(node->expression);
+    }
+
+    void VisitExpression(HLSLExpression * node)
+    {
+        GetDerived().VisitType(*node->expressionType);
+
+        switch (node->nodeType)
+        {
+        case HLSLNodeType::UnaryExpression:         GetDerived().VisitUnaryExpression((HLSLUnaryExpression *)node); break;
+        case HLSLNodeType::BinaryExpression:        GetDerived().VisitBinaryExpression((HLSLBinaryExpression *)node); break;
+        case HLSLNodeType::ConditionalExpression:   GetDerived().VisitConditionalExpression((HLSLConditionalExpression *)node); break;
+        case HLSLNodeType::CastingExpression:       GetDerived().VisitCastingExpression((HLSLCastingExpression *)node); break;
+        case HLSLNodeType::LiteralExpression:       GetDerived().VisitLiteralExpression((HLSLLiteralExpression *)node); break;
+        case HLSLNodeType::IdentifierExpression:    GetDerived().VisitIdentifierExpression((HLSLIdentifierExpression *)node); break;
+        case HLSLNodeType::ConstructorExpression:   GetDerived().VisitConstructorExpression((HLSLConstructorExpression *)node); break;
+        case HLSLNodeType::MemberAccess:            GetDerived().VisitMemberAccess((HLSLMemberAccess *)node); break;
+        case HLSLNodeType::ArrayAccess:             GetDerived().VisitArrayAccess((HLSLArrayAccess *)node); break;
+        case HLSLNodeType::FunctionCall:            GetDerived().VisitFunctionCall((HLSLFunctionCall *)node); break;
+        case HLSLNodeType::SamplerState:            GetDerived().VisitSamplerState((HLSLSamplerState *)node); break;
+        default:                                    ASSERT(0);
+        }
+    }
+
+    void VisitReturnStatement(HLSLReturnStatement * node)
+    {
+        GetDerived().VisitExpression(node->expression);
+    }
+
+    void VisitDiscardStatement(HLSLDiscardStatement * node) {}
+    void VisitBreakStatement(HLSLBreakStatement * node) {}
+    void VisitContinueStatement(HLSLContinueStatement * node) {}
+
+    void VisitIfStatement(HLSLIfStatement * node)
+    {
+        GetDerived().VisitExpression(node->condition);
+        GetDerived().VisitStatements(node->statement);
+        if (node->elseStatement)
+        {
+            GetDerived().VisitStatements(node->elseStatement);
+        }
+    }
+
+    void VisitForStatement(HLSLForStatement * node)
+    {
+        if (node->initialization)
+        {
+            GetDerived().VisitDeclaration(node->initialization);
+        }
+        if (node->condition)
+        {
+            GetDerived().VisitExpression(node->condition);
+        }
+        if (node->increment)
+        {
+            GetDerived().VisitExpression(node->increment);
+        }
+        GetDerived().VisitStatements(node->statement);
+    }
+
+    void VisitBlockStatement(HLSLBlockStatement * node)
+    {
+        GetDerived().VisitStatements(node->statement);
+    }
+
+    void VisitUnaryExpression(HLSLUnaryExpression * node)
+    {
+        GetDerived().VisitExpression(node->expression);
+    }
+
+    void VisitBinaryExpression(HLSLBinaryExpression * node)
+    {
+        GetDerived().VisitExpression(node->expression1);
+        GetDerived().VisitExpression(node->expression2);
+    }
+
+    void VisitConditionalExpression(HLSLConditionalExpression * node)
+    {
+        GetDerived().VisitExpression(node->condition);
+        GetDerived().VisitExpression(node->falseExpression);
+        GetDerived().VisitExpression(node->trueExpression);
+    }
+
+    void VisitCastingExpression(HLSLCastingExpression * node)
+    {
+        GetDerived().VisitType(node->type);
+        GetDerived().VisitExpression(node->expression);
+    }
+
+    void VisitLiteralExpression(HLSLLiteralExpression * node) {}
+    void VisitIdentifierExpression(HLSLIdentifierExpression * node) {}
+
+    void VisitConstructorExpression(HLSLConstructorExpression * node)
+    {
+        for (HLSLExpression * argument = node->argument; argument != NULL; argument = argument->nextExpression)
+        {
+            GetDerived().VisitExpression(argument);
+        }
+    }
+
+    void VisitMemberAccess(HLSLMemberAccess * node)
+    {
+        GetDerived().VisitExpression(node->object);
+    }
+
+    void VisitArrayAccess(HLSLArrayAccess * node)
+    {
+        GetDerived().VisitExpression(node->array);
+        GetDerived().VisitExpression(node->index);
+    }
+
+    void VisitFunctionCall(HLSLFunctionCall * node)
+    {
+        for (HLSLExpression * argument = node->argument; argument != NULL; argument = argument->nextExpression)
+        {
+            GetDerived().VisitExpression(argument);
+        }
+    }
+
+    void VisitStateAssignment(HLSLStateAssignment * node) {}
+
+    void VisitSamplerState(HLSLSamplerState * node)
+    {
+        for (HLSLStateAssignment * stateAssignment = node->stateAssignments; stateAssignment != NULL; stateAssignment = stateAssignment->nextStateAssignment)
+        {
+            GetDerived().VisitStateAssignment(stateAssignment);
+        }
+    }
+
+    void VisitPass(HLSLPass * node)
+    {
+        for (HLSLStateAssignment * stateAssignment = node->stateAssignments; stateAssignment != NULL; stateAssignment = stateAssignment->nextStateAssignment)
+        {
+            GetDerived().VisitStateAssignment(stateAssignment);
+        }
+    }
+
+    void VisitTechnique(HLSLTechnique * node)
+    {
+        for (HLSLPass * pass = node->passes; pass != NULL; pass = pass->nextPass)
+        {
+            GetDerived().VisitPass(pass);
+        }
+    }
+
+    void VisitPipeline(HLSLPipeline * node)
+    {
+        // @@ ?
+    }
+
+    void VisitFunctions(HLSLRoot * root)
+    {
+        for (HLSLStatement * statement = root->statement; statement != NULL; statement = statement->nextStatement)
+        {
+            if (statement->nodeType == HLSLNodeType::Function)
+            {
+                GetDerived().VisitFunction((HLSLFunction *)statement);
+            }
+        }
+    }
+
+    void VisitParameters(HLSLRoot * root)
+    {
+        for (HLSLStatement * statement = root->statement; statement != NULL; statement = statement->nextStatement)
+        {
+            if (statement->nodeType == HLSLNodeType::Declaration)
+            {
+                GetDerived().VisitDeclaration((HLSLDeclaration *)statement);
+            }
+        }
+    }
+
+protected:
+
+    Derived& GetDerived() { return *static_cast<Derived *>(this); }
+
+};
+
+/**
+ * Walks the nodes below a node with a stack on the heap instead of the call
+ * stack, so that machine generated shaders with deeply nested expressions or
+ * very long chains can't overflow it. Nodes are entered in the order
+ * HLSLStaticTreeVisitor visits them; Derived hides the hooks it needs:
+ *
+ *     bool EnterNode(HLSLNode * node);       // Returns false to skip the nodes below.
+ *     void LeaveNode(HLSLNode * node);       // After the nodes below.
+ *     void VisitType(const HLSLType & type); // The types of an entered node.
+ *
+ * A hook may call Stop to end the walk. Walks don't nest.
+ */
+template <class Derived>
+class HLSLIterativeTreeVisitor
+{
+public:
+    bool EnterNode(HLSLNode * node) { return true; }
+    void LeaveNode(HLSLNode * node) {}
+    void VisitType(const HLSLType & type) {}
+
+    /** Walks node and the nodes below it. */
+    void Walk(HLSLNode * node)
+    {
+        m_stack.clear();
+        m_stopped = false;
+        Push(node, Action::Enter);
+        Run();
+    }
+
+    /** Walks node, the nodes following it in its list and the nodes below them. */
+    void WalkList(HLSLNode * node)
+    {
+        m_stack.clear();
+        m_stopped = false;
+        if (node != NULL)
+        {
+            Push(node, IsStatementNode(node->nodeType) ? Action::Statements : IsExpressionNode(node->nodeType) ? Action::Expressions : Action::List);
+            Run();
+        }
+    }
+
+    void Stop() { m_stopped = true; }
+
+private:
+
+    enum class Action
+    {
+        Enter,
+        Leave,
+        Statements,     // Enter the statement, then walk the list from the next one.
+        Expressions,    // Same for expressions.
+        List,           // Same for the other nodes.
+    };
+
+    struct Item
+    {
+        HLSLNode *  node;
+        Action      action;
+    };
+
+    // Leave items are only pushed when Derived hides LeaveNode.
+    static constexpr bool s_leavesNodes = !std::is_same<decltype(&Derived::LeaveNode), void (HLSLIterativeTreeVisitor::*)(HLSLNode *)>::value;
+
+    Derived& GetDerived() { return *static_cast<Derived *>(this); }
+
+    void Push(HLSLNode * node, Action action)
+    {
+        if (node != NULL)
+        {
+            m_stack.push_back({ node, action });
+        }
+    }
+
+    void Run()
+    {
+        while (!m_stack.empty() && !m_stopped)
+        {
+            Item item = m_stack.back();
+            m_stack.pop_back();
+
+            if (item.action == Action::Leave)
+            {
+                GetDerived().LeaveNode(item.node);
+                continue;
+            }
+            if (item.action != Action::Enter)
+            {
+                Push(GetNext(item.node, item.action), item.action);
+            }
+
+            // The first node below is entered right away rather than pushed.
+            for (HLSLNode * node = item.node; node != NULL && !m_stopped; )
+            {
+                node = Enter(node);
+            }
+        }
+    }
+
+    /** Pushes the rest of the list starting at node, and returns node. */
+    HLSLNode * First(HLSLNode * node, Action action)
+    {
+        if (node != NULL)
+        {
+            Push(GetNext(node, action), action);
+        }
+        return node;
+    }
+
+    static HLSLNode * GetNext(HLSLNode * node, Action action)
+    {
+        if (action == Action::Statements)
+        {
+            return static_cast<HLSLStatement *>(node)->nextStatement;
+        }
+        if (action == Action::Expressions)
+        {
+            return static_cast<HLSLExpression *>(node)->nextExpression;
+        }
+        switch (node->nodeType)
+        {
+        case HLSLNodeType::StructField:     return static_cast<HLSLStructField *>(node)->nextField;
+        case HLSLNodeType::Argument:        return static_cast<HLSLArgument *>(node)->nextArgument;
+        case HLSLNodeType::StateAssignment: return static_cast<HLSLStateAssignment *>(node)->nextStateAssignment;
+        case HLSLNodeType::Pass:            return static_cast<HLSLPass *>(node)->nextPass;
+        default:                            return NULL;
+        }
+    }
+
+    /**
+     * Visits the types of node and pushes the nodes below it in reverse order,
+     * so that they are entered in order. Returns the first one instead of
+     * pushing it.
+     */
+    HLSLNode * Enter(HLSLNode * node)
+    {
+        if (!GetDerived().EnterNode(node))
+        {
+            return NULL;
+        }
+        if (s_leavesNodes)
+        {
+            m_stack.push_back({ node, Action::Leave });
+        }
+
+        switch (node->nodeType)
+        {
+        case HLSLNodeType::Root:
+            return First(static_cast<HLSLRoot *>(node)->statement, Action::Statements);
+        case HLSLNodeType::Declaration:
+            {
+                HLSLDeclaration * declaration = static_cast<HLSLDeclaration *>(node);
+                GetDerived().VisitType(declaration->type);
+                Push(declaration->nextDeclaration, Action::Enter);
+                return First(declaration->assignment, Action::Expressions);
+            }
+        case HLSLNodeType::Struct:
+            return First(static_cast<HLSLStruct *>(node)->field, Action::List);
+        case HLSLNodeType::StructField:
+            GetDerived().VisitType(static_cast<HLSLStructField *>(node)->type);
+            break;
+        case HLSLNodeType::Buffer:
+            return First(static_cast<HLSLBuffer *>(node)->field, Action::Statements);
+        case HLSLNodeType::Function:
+            {
+                HLSLFunction * function = static_cast<HLSLFunction *>(node);
+                GetDerived().VisitType(function->returnType);
+                Push(function->statement, Action::Statements);
+                return First(function->argument, Action::List);
+            }
+        case HLSLNodeType::Argument:
+            {
+                HLSLArgument * argument = static_cast<HLSLArgument *>(node);
+                GetDerived().VisitType(argument->type);
+                return argument->defaultValue;
+            }
+        case HLSLNodeType::ExpressionStatement:
+            return static_cast<HLSLExpressionStatement *>(node)->expression;
+        case HLSLNodeType::ReturnStatement:
+            return static_cast<HLSLReturnStatement *>(node)->expression;
+        case HLSLNodeType::IfStatement:
+            {
+                HLSLIfStatement * ifStatement = static_cast<HLSLIfStatement *>(node);
+                Push(ifStatement->elseStatement, Action::Statements);
+                Push(ifStatement->statement, Action::Statements);
+                return ifStatement->condition;
+            }
+        case HLSLNodeType::ForStatement:
+            {
+                HLSLForStatement * forStatement = static_cast<HLSLForStatement *>(node);
+                Push(forStatement->statement, Action::Statements);
+                Push(forStatement->increment, Action::Enter);
+                Push(forStatement->condition, Action::Enter);
+                return forStatement->initialization;
+            }
+        case HLSLNodeType::BlockStatement:
+            return First(static_cast<HLSLBlockStatement *>(node)->statement, Action::Statements);
+        case HLSLNodeType::UnaryExpression:
+            {
+                HLSLUnaryExpression * unaryExpression = static_cast<HLSLUnaryExpression *>(node);
+                GetDerived().VisitType(*unaryExpression->expressionType);
+                return unaryExpression->expression;
+            }
+        case HLSLNodeType::BinaryExpression:
+            {
+                HLSLBinaryExpression * binaryExpression = static_cast<HLSLBinaryExpression *>(node);
+                GetDerived().VisitType(*binaryExpression->expressionType);
+                Push(binaryExpression->expression2, Action::Enter);
+                return binaryExpression->expression1;
+            }
+        case HLSLNodeType::ConditionalExpression:
+            {
+                HLSLConditionalExpression * conditionalExpression = static_cast<HLSLConditionalExpression *>(node);
+                GetDerived().VisitType(*conditionalExpression->expressionType);
+                Push(conditionalExpression->trueExpression, Action::Enter);
+                Push(conditionalExpression->falseExpression, Action::Enter);
+                return conditionalExpression->condition;
+            }
+        case HLSLNodeType::CastingExpression:
+            {
+                HLSLCastingExpression * castingExpression = static_cast<HLSLCastingExpression *>(node);
+                GetDerived().VisitType(*castingExpression->expressionType);
+                GetDerived().VisitType(castingExpression->type);
+                return castingExpression->expression;
+            }
+        case HLSLNodeType::LiteralExpression:
+        case HLSLNodeType::IdentifierExpression:
+            GetDerived().VisitType(*static_cast<HLSLExpression *>(node)->expressionType);
+            break;
+        case HLSLNodeType::ConstructorExpression:
+            {
+                HLSLConstructorExpression * constructorExpression = static_cast<HLSLConstructorExpression *>(node);
+                GetDerived().VisitType(*constructorExpression->expressionType);
+                return First(constructorExpression->argument, Action::Expressions);
+            }
+        case HLSLNodeType::MemberAccess:
+            {
+                HLSLMemberAccess * memberAccess = static_cast<HLSLMemberAccess *>(node);
+                GetDerived().VisitType(*memberAccess->expressionType);
+                return memberAccess->object;
+            }
+        case HLSLNodeType::ArrayAccess:
+            {
+                HLSLArrayAccess * arrayAccess = static_cast<HLSLArrayAccess *>(node);
+                GetDerived().VisitType(*arrayAccess->expressionType);
+                Push(arrayAccess->index, Action::Enter);
+                return arrayAccess->array;
+            }
+        case HLSLNodeType::FunctionCall:
+            {
+                HLSLFunctionCall * functionCall = static_cast<HLSLFunctionCall *>(node);
+                GetDerived().VisitType(*functionCall->expressionType);
+                return First(functionCall->argument, Action::Expressions);
+            }
+        case HLSLNodeType::SamplerState:
+            {
+                HLSLSamplerState * samplerState = static_cast<HLSLSamplerState *>(node);
+                GetDerived().VisitType(*samplerState->expressionType);
+                return First(samplerState->stateAssignments, Action::List);
+            }
+        case HLSLNodeType::Technique:
+            return First(static_cast<HLSLTechnique *>(node)->passes, Action::List);
+        case HLSLNodeType::Pass:
+            return First(static_cast<HLSLPass *>(node)->stateAssignments, Action::List);
+        default:
+            if (IsExpressionNode(node->nodeType))
+            {
+                GetDerived().VisitType(*static_cast<HLSLExpression *>(node)->expressionType);
+            }
+            break;
+        }
+        return NULL;
+    }
+
+    std::vector<Item>   m_stack;
+    bool                m_stopped = false;
+
+};
+
+} // M4
+
+#endif
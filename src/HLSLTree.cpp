@@ -2,29 +2,36 @@
 #include "Engine.h"
 
 #include "HLSLTree.h"
+#include "HLSLEnumNames.h"
+#include "HLSLStaticTreeVisitor.h"
+#include "JSONWriter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
 
 namespace M4
 {
-    nlohmann::json      HLSLType::ConvertToJSON()
+    nlohmann::json      HLSLType::ConvertToJSON() const
     {
         nlohmann::json output = nlohmann::json::object();
 
-        output["baseType"] = magic_enum::enum_name(baseType);
-        if(IsSamplerType(baseType)) output["samplerType"] = magic_enum::enum_name(samplerType);
+        output["baseType"] = GetEnumName(baseType);
+        if(IsSamplerType(baseType)) output["samplerType"] = GetEnumName(samplerType);
         if (typeName != NULL) output["typeName"] = typeName;
         output["array"] = array;
         if (arraySize != NULL) output["arraySize"] = arraySize->ConvertToJSON();
         if(flags != 0) output["flags"] = flags;
-        if(addressSpace != HLSLAddressSpace::Undefined) output["addressSpace"] = magic_enum::enum_name(addressSpace);
-        output["textureType"] = magic_enum::enum_name(textureType);
-        output["samplerType"] = magic_enum::enum_name(samplerType);
+        if(addressSpace != HLSLAddressSpace::Undefined) output["addressSpace"] = GetEnumName(addressSpace);
+        output["textureType"] = GetEnumName(textureType);
+        output["samplerType"] = GetEnumName(samplerType);
         return output;
     }
 
     nlohmann::json      HLSLNode::ConvertToJSON(bool bNodeType)
     {
         nlohmann::json output = nlohmann::json::object();
-        if(bNodeType) output["nodeType"] = magic_enum::enum_name(nodeType);
+        if(bNodeType) output["nodeType"] = GetEnumName(nodeType);
 
         /*if (fileName != NULL)
         {
@@ -75,7 +82,7 @@ namespace M4
     {
         nlohmann::json output = HLSLNode::ConvertToJSON(bNodeType);
 
-        output["attributeType"] = magic_enum::enum_name(attributeType);
+        output["attributeType"] = GetEnumName(attributeType);
         output["arguments"] = nlohmann::json::array();
 
         HLSLExpression* nextargument = argument;
@@ -202,7 +209,7 @@ namespace M4
         nlohmann::json output = HLSLNode::ConvertToJSON(bNodeType);
 
         if (name != NULL) output["name"] = name;
-        output["modifier"] = magic_enum::enum_name(modifier);
+        output["modifier"] = GetEnumName(modifier);
         output["type"] = type.ConvertToJSON();
         if (semantic != NULL) output["semantic"] = semantic;
         if (sv_semantic != NULL) output["sv_semantic"] = sv_semantic;
@@ -225,7 +232,7 @@ namespace M4
     {
         nlohmann::json output = HLSLNode::ConvertToJSON(bNodeType);
 
-        output["type"] = expressionType.ConvertToJSON();
+        output["type"] = expressionType->ConvertToJSON();
 
         return output;
     }
@@ -234,7 +241,7 @@ namespace M4
     {
         nlohmann::json output = HLSLExpression::ConvertToJSON(bNodeType);
 
-        output["literaltype"] = magic_enum::enum_name(type);
+        output["literaltype"] = GetEnumName(type);
 
         output["bvalue"] = bValue;
         output["fValue"] = fValue;
@@ -243,1972 +250,5347 @@ namespace M4
         return output;
     }
 
-const HLSLTypeDimension BaseTypeDimension[(int)HLSLBaseType::Count] =
-{
-    HLSLTypeDimension::None,     // HLSLBaseType::Unknown,
-    HLSLTypeDimension::None,     // HLSLBaseType::Void,
-    HLSLTypeDimension::Scalar,   // HLSLBaseType::Float,
-    HLSLTypeDimension::Vector2,  // HLSLBaseType::Float2,
-    HLSLTypeDimension::Vector3,  // HLSLBaseType::Float3,
-    HLSLTypeDimension::Vector4,  // HLSLBaseType::Float4,
-    HLSLTypeDimension::Matrix2x2,// HLSLBaseType::Float2x2,
-    HLSLTypeDimension::Matrix3x3,// HLSLBaseType::Float3x3,
-    HLSLTypeDimension::Matrix4x4,// HLSLBaseType::Float4x4,
-    HLSLTypeDimension::Matrix4x3,// HLSLBaseType::Float4x3,
-    HLSLTypeDimension::Matrix4x2,// HLSLBaseType::Float4x2,
-    HLSLTypeDimension::Scalar,   // HLSLBaseType::Half,
-    HLSLTypeDimension::Vector2,  // HLSLBaseType::Half2,
-    HLSLTypeDimension::Vector3,  // HLSLBaseType::Half3,
-    HLSLTypeDimension::Vector4,  // HLSLBaseType::Half4,
-    HLSLTypeDimension::Matrix2x2,// HLSLBaseType::Half2x2,
-    HLSLTypeDimension::Matrix3x3,// HLSLBaseType::Half3x3,
-    HLSLTypeDimension::Matrix4x4,// HLSLBaseType::Half4x4,
-    HLSLTypeDimension::Matrix4x3,// HLSLBaseType::Half4x3,
-    HLSLTypeDimension::Matrix4x2,// HLSLBaseType::Half4x2,
-    HLSLTypeDimension::Scalar,   // HLSLBaseType::Bool,
-    HLSLTypeDimension::Vector2,  // HLSLBaseType::Bool2,
-    HLSLTypeDimension::Vector3,  // HLSLBaseType::Bool3,
-    HLSLTypeDimension::Vector4,  // HLSLBaseType::Bool4,
-    HLSLTypeDimension::Scalar,   // HLSLBaseType::Int,
-    HLSLTypeDimension::Vector2,  // HLSLBaseType::Int2,
-    HLSLTypeDimension::Vector3,  // HLSLBaseType::Int3,
-    HLSLTypeDimension::Vector4,  // HLSLBaseType::Int4,
-    HLSLTypeDimension::Scalar,   // HLSLBaseType::Uint,
-    HLSLTypeDimension::Vector2,  // HLSLBaseType::Uint2,
-    HLSLTypeDimension::Vector3,  // HLSLBaseType::Uint3,
-    HLSLTypeDimension::Vector4,  // HLSLBaseType::Uint4,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture,
-    HLSLTypeDimension::None,     // HLSLBaseType::Sampler,           // @@ use type inference to determine sampler type.
-    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2D,
-    HLSLTypeDimension::None,     // HLSLBaseType::Sampler3D,
-    HLSLTypeDimension::None,     // HLSLBaseType::SamplerCube,
-    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2DShadow,
-    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2DMS,
-    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2DArray,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture1D,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture1DArray,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture2D,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture2DArray,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture2DMS,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture2DMSArray,
-    HLSLTypeDimension::None,     // HLSLBaseType::Texture3D,
-    HLSLTypeDimension::None,     // HLSLBaseType::TextureCube,
-    HLSLTypeDimension::None,     // HLSLBaseType::TextureCubeArray,
-    HLSLTypeDimension::None,     // HLSLBaseType::SamplerState,
-    HLSLTypeDimension::None,     // HLSLBaseType::UserDefined,       // struct
-    HLSLTypeDimension::None,     // HLSLBaseType::Expression,        // type argument for defined() sizeof() and typeof().
-    HLSLTypeDimension::None,     // HLSLBaseType::Auto,
-};
-
-const HLSLBaseType ScalarBaseType[(int)HLSLBaseType::Count] = {
-    HLSLBaseType::Unknown,       // HLSLBaseType::Unknown,
-    HLSLBaseType::Void,          // HLSLBaseType::Void,
-    HLSLBaseType::Float,         // HLSLBaseType::Float,
-    HLSLBaseType::Float,         // HLSLBaseType::Float2,
-    HLSLBaseType::Float,         // HLSLBaseType::Float3,
-    HLSLBaseType::Float,         // HLSLBaseType::Float4,
-    HLSLBaseType::Float,         // HLSLBaseType::Float2x2,
-    HLSLBaseType::Float,         // HLSLBaseType::Float3x3,
-    HLSLBaseType::Float,         // HLSLBaseType::Float4x4,
-    HLSLBaseType::Float,         // HLSLBaseType::Float4x3,
-    HLSLBaseType::Float,         // HLSLBaseType::Float4x2,
-    HLSLBaseType::Half,          // HLSLBaseType::Half,
-    HLSLBaseType::Half,          // HLSLBaseType::Half2,
-    HLSLBaseType::Half,          // HLSLBaseType::Half3,
-    HLSLBaseType::Half,          // HLSLBaseType::Half4,
-    HLSLBaseType::Half,          // HLSLBaseType::Half2x2,
-    HLSLBaseType::Half,          // HLSLBaseType::Half3x3,
-    HLSLBaseType::Half,          // HLSLBaseType::Half4x4,
-    HLSLBaseType::Half,          // HLSLBaseType::Half4x3,
-    HLSLBaseType::Half,          // HLSLBaseType::Half4x2,
-    HLSLBaseType::Bool,          // HLSLBaseType::Bool,
-    HLSLBaseType::Bool,          // HLSLBaseType::Bool2,
-    HLSLBaseType::Bool,          // HLSLBaseType::Bool3,
-    HLSLBaseType::Bool,          // HLSLBaseType::Bool4,
-    HLSLBaseType::Int,           // HLSLBaseType::Int,
-    HLSLBaseType::Int,           // HLSLBaseType::Int2,
-    HLSLBaseType::Int,           // HLSLBaseType::Int3,
-    HLSLBaseType::Int,           // HLSLBaseType::Int4,
-    HLSLBaseType::Uint,          // HLSLBaseType::Uint,
-    HLSLBaseType::Uint,          // HLSLBaseType::Uint2,
-    HLSLBaseType::Uint,          // HLSLBaseType::Uint3,
-    HLSLBaseType::Uint,          // HLSLBaseType::Uint4,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler,           // @@ use type inference to determine sampler type.
-    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2D,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler3D,
-    HLSLBaseType::Unknown,       // HLSLBaseType::SamplerCube,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2DShadow,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2DMS,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2DArray,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture1D,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture1DArray,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2D,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2DArray,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2DMS,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2DMSArray,
-    HLSLBaseType::Unknown,       // HLSLBaseType::Texture3D,
-    HLSLBaseType::Unknown,       // HLSLBaseType::TextureCube,
-    HLSLBaseType::Unknown,       // HLSLBaseType::TextureCubeArray,
-    HLSLBaseType::Unknown,       // HLSLBaseType::SamplerState,
-    HLSLBaseType::Unknown,       // HLSLBaseType::UserDefined,       // struct
-    HLSLBaseType::Unknown,       // HLSLBaseType::Expression,        // type argument for defined() sizeof() and typeof().
-    HLSLBaseType::Unknown,       // HLSLBaseType::Auto,
-};
-
-#define MAX_NODE_PAGES 4096
-
-HLSLTree::HLSLTree() : m_stringPool()
-{
-    m_NodePages.reserve(MAX_NODE_PAGES);
-
-    m_NodePages.emplace_back();
-    m_firstPage         = &m_NodePages.back();
-
-    m_currentPage       = m_firstPage;
-    m_currentPageOffset = 0;
+    // WriteJSON streams the same output as ConvertToJSON().dump(). Members are
+    // written in sorted key order, matching the ordered maps of nlohmann::json.
+    // In compact mode, members holding default values are left out. Full tree
+    // output adds members that ConvertToJSON doesn't have, in the same order.
 
-    m_root              = AddNode<HLSLRoot>(NULL, 1);
-}
+    static void WriteNodeType(JSONWriter& writer, HLSLNodeType nodeType)
+    {
+        writer.Key("nodeType");
+        writer.String(GetEnumName(nodeType));
+    }
 
-void HLSLTree::AllocatePage()
-{
-    m_NodePages.emplace_back();
+    // The source location is written as two members, as "fileName" and "line"
+    // are not adjacent in sorted key order.
 
-    ASSERT(m_NodePages.size() <= MAX_NODE_PAGES);
+    static void WriteFileName(JSONWriter& writer, const HLSLNode* node)
+    {
+        if (!writer.GetFullTree() || node->fileName == NULL) return;
 
-    NodePage* newPage    = &m_NodePages.back();
-    m_currentPage->next  = newPage;
-    m_currentPageOffset  = 0;
-    m_currentPage        = newPage;
-}
+        writer.Key("fileName");
+        writer.String(node->fileName);
+    }
 
-const char* HLSLTree::AddString(const char* string)
-{   
-    return m_stringPool.AddString(string);
-}
+    static void WriteLine(JSONWriter& writer, const HLSLNode* node)
+    {
+        if (!writer.GetFullTree()) return;
 
-const char* HLSLTree::AddStringFormat(const char* format, ...)
-{
-    va_list args;
-    va_start(args, format);
-    const char * string = m_stringPool.AddStringFormatList(format, args);
-    va_end(args);
-    return string;
-}
+        writer.Key("line");
+        writer.Int(node->line);
+    }
 
-bool HLSLTree::GetContainsString(const char* string) const
-{
-    return m_stringPool.GetContainsString(string);
-}
+    static void WriteAttributes(JSONWriter& writer, HLSLAttribute* attribute)
+    {
+        if (attribute == NULL) return;
 
-HLSLRoot* HLSLTree::GetRoot() const
-{
-    return m_root;
-}
+        writer.Key("attributes");
+        writer.BeginArray();
+        for (; attribute != NULL; attribute = attribute->nextAttribute)
+        {
+            attribute->WriteJSON(writer);
+        }
+        writer.EndArray();
+    }
 
-void* HLSLTree::AllocateMemory(size_t size)
-{
-    if (m_currentPageOffset + size > s_nodePageSize)
+    static void WriteExpressions(JSONWriter& writer, const char* key, HLSLExpression* expression)
     {
-        AllocatePage();
+        if (expression == NULL && writer.GetCompact()) return;
+
+        writer.Key(key);
+        writer.BeginArray();
+        for (; expression != NULL; expression = expression->nextExpression)
+        {
+            expression->WriteJSON(writer);
+        }
+        writer.EndArray();
     }
-    void* buffer = m_currentPage->buffer + m_currentPageOffset;
-    m_currentPageOffset += size;
-    return buffer;
-}
 
-// @@ This doesn't do any parameter matching. Simply returns the first function with that name.
-HLSLFunction * HLSLTree::FindFunction(const char * name)
-{
-    HLSLStatement * statement = m_root->statement;
-    while (statement != NULL)
+    static void WriteStatements(JSONWriter& writer, const char* key, HLSLStatement* statement)
     {
-        if (statement->nodeType == HLSLNodeType::Function)
+        if (statement == NULL && writer.GetCompact()) return;
+
+        writer.Key(key);
+        writer.BeginArray();
+        for (; statement != NULL; statement = statement->nextStatement)
         {
-            HLSLFunction * function = (HLSLFunction *)statement;
-            if (String_Equal(name, function->name))
+            // Statements unused by the entry points are hidden by PruneTree.
+            if (!statement->hidden)
             {
-                return function;
+                statement->WriteJSON(writer);
             }
         }
-
-        statement = statement->nextStatement;
+        writer.EndArray();
     }
 
-    return NULL;
-}
-
-HLSLDeclaration * HLSLTree::FindGlobalDeclaration(const char * name, HLSLBuffer ** buffer_out/*=NULL*/)
-{
-    HLSLStatement * statement = m_root->statement;
-    while (statement != NULL)
+    static void WriteStateAssignments(JSONWriter& writer, HLSLStateAssignment* stateAssignment)
     {
-        if (statement->nodeType == HLSLNodeType::Declaration)
+        if (stateAssignment == NULL && writer.GetCompact()) return;
+
+        writer.Key("stateAssignments");
+        writer.BeginArray();
+        for (; stateAssignment != NULL; stateAssignment = stateAssignment->nextStateAssignment)
         {
-            HLSLDeclaration * declaration = (HLSLDeclaration *)statement;
-            if (String_Equal(name, declaration->name))
-            {
-                if (buffer_out) *buffer_out = NULL;
-                return declaration;
-            }
+            stateAssignment->WriteJSON(writer);
         }
-        else if (statement->nodeType == HLSLNodeType::Buffer)
-        {
-            HLSLBuffer* buffer = (HLSLBuffer*)statement;
+        writer.EndArray();
+    }
 
-            HLSLDeclaration* field = buffer->field;
-            while (field != NULL)
-            {
-                ASSERT(field->nodeType == HLSLNodeType::Declaration);
-                if (String_Equal(name, field->name))
-                {
-                    if (buffer_out) *buffer_out = buffer;
-                    return field;
-                }
-                field = (HLSLDeclaration*)field->nextStatement;
-            }
-        }
+    /** Writes a single child node, which is left out when NULL. */
+    static void WriteChild(JSONWriter& writer, const char* key, HLSLNode* node)
+    {
+        if (node == NULL) return;
 
-        statement = statement->nextStatement;
+        writer.Key(key);
+        node->WriteJSON(writer);
     }
 
-    if (buffer_out) *buffer_out = NULL;
-    return NULL;
-}
+    static void WriteString(JSONWriter& writer, const char* key, const char* value)
+    {
+        if (value == NULL) return;
 
-HLSLStruct * HLSLTree::FindGlobalStruct(const char * name)
-{
-    HLSLStatement * statement = m_root->statement;
-    while (statement != NULL)
+        writer.Key(key);
+        writer.String(value);
+    }
+
+    void                HLSLType::WriteJSON(JSONWriter& writer) const
     {
-        if (statement->nodeType == HLSLNodeType::Struct)
+        writer.BeginObject();
+        if (addressSpace != HLSLAddressSpace::Undefined)
         {
-            HLSLStruct * declaration = (HLSLStruct *)statement;
-            if (String_Equal(name, declaration->name))
-            {
-                return declaration;
-            }
+            writer.Key("addressSpace");
+            writer.String(GetEnumName(addressSpace));
         }
-
-        statement = statement->nextStatement;
+        if (array || !writer.GetCompact())
+        {
+            writer.Key("array");
+            writer.Bool(array);
+        }
+        if (arraySize != NULL)
+        {
+            writer.Key("arraySize");
+            arraySize->WriteJSON(writer);
+        }
+        writer.Key("baseType");
+        writer.String(GetEnumName(baseType));
+        if (flags != 0)
+        {
+            writer.Key("flags");
+            writer.Int(flags);
+        }
+        if (IsSamplerType(baseType) || !writer.GetCompact())
+        {
+            writer.Key("samplerType");
+            writer.String(GetEnumName(samplerType));
+        }
+        if (IsTextureType(baseType) || !writer.GetCompact())
+        {
+            writer.Key("textureType");
+            writer.String(GetEnumName(textureType));
+        }
+        WriteString(writer, "typeName", typeName);
+        writer.EndObject();
     }
 
-    return NULL;
-}
+    void                HLSLNode::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        writer.BeginObject();
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.EndObject();
+    }
 
-HLSLTechnique * HLSLTree::FindTechnique(const char * name)
-{
-    HLSLStatement * statement = m_root->statement;
-    while (statement != NULL)
+    void                HLSLRoot::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        if (statement->nodeType == HLSLNodeType::Technique)
+        writer.BeginObject();
+        if (statement != NULL)
         {
-            HLSLTechnique * technique = (HLSLTechnique *)statement;
-            if (String_Equal(name, technique->name))
+            // ConvertToJSON collects the statements under "attributes".
+            writer.Key("attributes");
+            writer.BeginArray();
+            for (HLSLStatement* nextstatement = statement; nextstatement != NULL; nextstatement = nextstatement->nextStatement)
             {
-                return technique;
+                nextstatement->WriteJSON(writer);
             }
+            writer.EndArray();
         }
-
-        statement = statement->nextStatement;
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("statements");
+        writer.BeginArray();
+        writer.EndArray();
+        writer.EndObject();
     }
 
-    return NULL;
-}
+    void                HLSLStatement::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.EndObject();
+    }
 
-HLSLPipeline * HLSLTree::FindFirstPipeline()
-{
-    return FindNextPipeline(NULL);
-}
+    void                HLSLAttribute::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        writer.BeginObject();
+        WriteExpressions(writer, "arguments", argument);
+        writer.Key("attributeType");
+        writer.String(GetEnumName(attributeType));
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.EndObject();
+    }
 
-HLSLPipeline * HLSLTree::FindNextPipeline(HLSLPipeline * current)
-{
-    HLSLStatement * statement = current ? current : m_root->statement;
-    while (statement != NULL)
+    void                HLSLDeclaration::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        if (statement->nodeType == HLSLNodeType::Pipeline)
+        writer.BeginObject();
+        WriteExpressions(writer, "assignments", assignment);
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (writer.GetFullTree() && buffer == NULL)
         {
-            return (HLSLPipeline *)statement;
+            // The other variables of "float a, b;", buffers list them as fields instead.
+            WriteChild(writer, "nextDeclaration", nextDeclaration);
         }
-
-        statement = statement->nextStatement;
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteString(writer, "registerName", registerName);
+        WriteString(writer, "semantic", semantic);
+        WriteString(writer, "spaceName", spaceName);
+        writer.Key("type");
+        type.WriteJSON(writer);
+        writer.EndObject();
     }
 
-    return NULL;
-}
+    void                HLSLStruct::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        writer.Key("fields");
+        writer.BeginArray();
+        for (HLSLStructField* nextfield = field; nextfield != NULL; nextfield = nextfield->nextField)
+        {
+            nextfield->WriteJSON(writer, false);
+        }
+        writer.EndArray();
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.EndObject();
+    }
 
-HLSLPipeline * HLSLTree::FindPipeline(const char * name)
-{
-    HLSLStatement * statement = m_root->statement;
-    while (statement != NULL)
+    void                HLSLStructField::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        if (statement->nodeType == HLSLNodeType::Pipeline)
+        writer.BeginObject();
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteString(writer, "semantic", semantic);
+        WriteString(writer, "sv_semantic", sv_semantic);
+        writer.Key("type");
+        type.WriteJSON(writer);
+        writer.EndObject();
+    }
+
+    void                HLSLBuffer::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        if (writer.GetFullTree())
         {
-            HLSLPipeline * pipeline = (HLSLPipeline *)statement;
-            if (String_Equal(name, pipeline->name))
+            // The parser chains the fields with nextStatement, and the other variables
+            // of "float a, b;" with nextDeclaration.
+            writer.Key("fields");
+            writer.BeginArray();
+            for (HLSLStatement* statement = field; statement != NULL; statement = statement->nextStatement)
             {
-                return pipeline;
+                for (HLSLDeclaration* declaration = (HLSLDeclaration*)statement; declaration != NULL; declaration = declaration->nextDeclaration)
+                {
+                    // Fields unused by the entry points are hidden by PruneTree.
+                    if (!declaration->hidden)
+                    {
+                        declaration->WriteJSON(writer);
+                    }
+                }
             }
+            writer.EndArray();
         }
-
-        statement = statement->nextStatement;
+        else
+        {
+            writer.Key("fields");
+            writer.BeginArray();
+            for (HLSLDeclaration* nextdeclaration = field; nextdeclaration != NULL; nextdeclaration = nextdeclaration->nextDeclaration)
+            {
+                // Fields unused by the entry points are hidden by PruneTree.
+                if (!nextdeclaration->hidden)
+                {
+                    nextdeclaration->WriteJSON(writer);
+                }
+            }
+            writer.EndArray();
+        }
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteString(writer, "registerName", registerName);
+        WriteString(writer, "spaceName", spaceName);
+        writer.EndObject();
     }
 
-    return NULL;
-}
-
-HLSLBuffer * HLSLTree::FindBuffer(const char * name)
-{
-    HLSLStatement * statement = m_root->statement;
-    while (statement != NULL)
+    void                HLSLFunction::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        if (statement->nodeType == HLSLNodeType::Buffer)
+        writer.BeginObject();
+        if (argument != NULL || !writer.GetCompact())
         {
-            HLSLBuffer * buffer = (HLSLBuffer *)statement;
-            if (String_Equal(name, buffer->name))
+            writer.Key("arguments");
+            writer.BeginArray();
+            for (HLSLArgument* nextargument = argument; nextargument != NULL; nextargument = nextargument->nextArgument)
             {
-                return buffer;
+                nextargument->WriteJSON(writer, false);
             }
+            writer.EndArray();
         }
-
-        statement = statement->nextStatement;
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        if (forward != NULL)
+        {
+            writer.Key("forward");
+            forward->WriteJSON(writer);
+        }
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("returnType");
+        returnType.WriteJSON(writer);
+        WriteString(writer, "semantic", semantic);
+        if (writer.GetFullTree())
+        {
+            WriteStatements(writer, "statements", statement);
+        }
+        WriteString(writer, "sv_semantic", sv_semantic);
+        writer.EndObject();
     }
 
-    return NULL;
-}
-
-
-
-bool HLSLTree::GetExpressionValue(HLSLExpression * expression, int & value)
-{
-    ASSERT (expression != NULL);
-
-    // Expression must be constant.
-    if ((expression->expressionType.flags & (int)HLSLTypeFlags::Const) == 0)
+    void                HLSLArgument::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        return false;
+        writer.BeginObject();
+        WriteExpressions(writer, "defaultValue", defaultValue);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (modifier != HLSLArgumentModifier::None || !writer.GetCompact())
+        {
+            writer.Key("modifier");
+            writer.String(GetEnumName(modifier));
+        }
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteString(writer, "semantic", semantic);
+        WriteString(writer, "sv_semantic", sv_semantic);
+        writer.Key("type");
+        type.WriteJSON(writer);
+        writer.EndObject();
     }
 
-    // We are expecting an integer scalar. @@ Add support for type conversion from other scalar types.
-    if (expression->expressionType.baseType != HLSLBaseType::Int &&
-        expression->expressionType.baseType != HLSLBaseType::Bool)
+    void                HLSLExpressionStatement::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        return false;
+        if (!writer.GetFullTree())
+        {
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
+        }
+
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteChild(writer, "expression", expression);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.EndObject();
     }
 
-    if (expression->expressionType.array) 
+    void                HLSLReturnStatement::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        return false;
+        if (!writer.GetFullTree())
+        {
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
+        }
+
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteChild(writer, "expression", expression);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.EndObject();
     }
 
-    if (expression->nodeType == HLSLNodeType::BinaryExpression) 
+    void                HLSLIfStatement::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        HLSLBinaryExpression * binaryExpression = (HLSLBinaryExpression *)expression;
-
-        int value1, value2;
-        if (!GetExpressionValue(binaryExpression->expression1, value1) ||
-            !GetExpressionValue(binaryExpression->expression2, value2))
+        if (!writer.GetFullTree())
         {
-            return false;
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
         }
 
-        switch(binaryExpression->binaryOp)
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteChild(writer, "condition", condition);
+        WriteStatements(writer, "elseStatement", elseStatement);
+        WriteFileName(writer, this);
+        if (isStatic || !writer.GetCompact())
         {
-            case HLSLBinaryOp::And:
-                value = value1 && value2;
-                return true;
-            case HLSLBinaryOp::Or:
-                value = value1 || value2;
-                return true;
-            case HLSLBinaryOp::Add:
-                value = value1 + value2;
-                return true;
-            case HLSLBinaryOp::Sub:
-                value = value1 - value2;
-                return true;
-            case HLSLBinaryOp::Mul:
-                value = value1 * value2;
-                return true;
-            case HLSLBinaryOp::Div:
-                value = value1 / value2;
-                return true;
-            case HLSLBinaryOp::Less:
-                value = value1 < value2;
-                return true;
-            case HLSLBinaryOp::Greater:
-                value = value1 > value2;
-                return true;
-            case HLSLBinaryOp::LessEqual:
-                value = value1 <= value2;
-                return true;
-            case HLSLBinaryOp::GreaterEqual:
-                value = value1 >= value2;
-                return true;
-            case HLSLBinaryOp::Equal:
-                value = value1 == value2;
-                return true;
-            case HLSLBinaryOp::NotEqual:
-                value = value1 != value2;
-                return true;
-            case HLSLBinaryOp::BitAnd:
-                value = value1 & value2;
-                return true;
-            case HLSLBinaryOp::BitOr:
-                value = value1 | value2;
-                return true;
-            case HLSLBinaryOp::BitXor:
-                value = value1 ^ value2;
-                return true;
-            case HLSLBinaryOp::Assign:
-            case HLSLBinaryOp::AddAssign:
-            case HLSLBinaryOp::SubAssign:
-            case HLSLBinaryOp::MulAssign:
-            case HLSLBinaryOp::DivAssign:
-                // IC: These are not valid on non-constant expressions and should fail earlier when querying expression value.
-                return false;
+            writer.Key("isStatic");
+            writer.Bool(isStatic);
         }
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStatements(writer, "statement", statement);
+        writer.EndObject();
     }
-    else if (expression->nodeType == HLSLNodeType::UnaryExpression) 
-    {
-        HLSLUnaryExpression * unaryExpression = (HLSLUnaryExpression *)expression;
 
-        if (!GetExpressionValue(unaryExpression->expression, value))
+    void                HLSLForStatement::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
         {
-            return false;
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
         }
 
-        switch(unaryExpression->unaryOp)
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteChild(writer, "condition", condition);
+        WriteFileName(writer, this);
+        WriteChild(writer, "increment", increment);
+        WriteChild(writer, "initialization", initialization);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStatements(writer, "statement", statement);
+        writer.EndObject();
+    }
+
+    void                HLSLBlockStatement::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
         {
-            case HLSLUnaryOp::Negative:
-                value = -value;
-                return true;
-            case HLSLUnaryOp::Positive:
-                // nop.
-                return true;
-            case HLSLUnaryOp::Not:
-                value = !value;
-                return true;
-            case HLSLUnaryOp::BitNot:
-                value = ~value;
-                return true;
-            case HLSLUnaryOp::PostDecrement:
-            case HLSLUnaryOp::PostIncrement:
-            case HLSLUnaryOp::PreDecrement:
-            case HLSLUnaryOp::PreIncrement:
-                // IC: These are not valid on non-constant expressions and should fail earlier when querying expression value.
-                return false;
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
         }
+
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStatements(writer, "statements", statement);
+        writer.EndObject();
     }
-    else if (expression->nodeType == HLSLNodeType::IdentifierExpression)
+
+    void                HLSLExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        HLSLIdentifierExpression * identifier = (HLSLIdentifierExpression *)expression;
+        writer.BeginObject();
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
+    }
 
-        HLSLDeclaration * declaration = FindGlobalDeclaration(identifier->name);
-        if (declaration == NULL) 
+    void                HLSLUnaryExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
         {
-            return false;
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
         }
-        if ((declaration->type.flags & (int)HLSLTypeFlags::Const) == 0)
+
+        writer.BeginObject();
+        WriteChild(writer, "expression", expression);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.Key("unaryOp");
+        writer.String(GetEnumName(unaryOp));
+        writer.EndObject();
+    }
+
+    void                HLSLBinaryExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
         {
-            return false;
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
         }
 
-        return GetExpressionValue(declaration->assignment, value);
+        writer.BeginObject();
+        writer.Key("binaryOp");
+        writer.String(GetEnumName(binaryOp));
+        WriteChild(writer, "expression1", expression1);
+        WriteChild(writer, "expression2", expression2);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
-    else if (expression->nodeType == HLSLNodeType::LiteralExpression) 
+
+    void                HLSLConditionalExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        HLSLLiteralExpression * literal = (HLSLLiteralExpression *)expression;
-   
-        if (literal->expressionType.baseType == HLSLBaseType::Int) value = literal->iValue;
-        else if (literal->expressionType.baseType == HLSLBaseType::Bool) value = (int)literal->bValue;
-        else return false;
-        
-        return true;
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
+
+        writer.BeginObject();
+        WriteChild(writer, "condition", condition);
+        WriteChild(writer, "falseExpression", falseExpression);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteChild(writer, "trueExpression", trueExpression);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
 
-    return false;
-}
+    void                HLSLCastingExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
 
-bool HLSLTree::NeedsFunction(const char* name)
-{
-    // Early out
-    if (!GetContainsString(name))
-        return false;
+        // The type cast to is the expression type as well.
+        writer.BeginObject();
+        WriteChild(writer, "expression", expression);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
+    }
 
-    struct NeedsFunctionVisitor: HLSLTreeVisitor
+    void                HLSLLiteralExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        const char* name;
-        bool result;
+        // Compact output only has the member of the union matching the literal type.
+        bool compact = writer.GetCompact();
+        bool isBool = type == HLSLBaseType::Bool;
+        bool isFloat = type == HLSLBaseType::Float || type == HLSLBaseType::Half;
 
-        virtual void VisitTopLevelStatement(HLSLStatement * node)
+        writer.BeginObject();
+        if (isBool || !compact)
         {
-            if (!node->hidden)
-                HLSLTreeVisitor::VisitTopLevelStatement(node);
+            // The union may hold an int or a float, so bValue can't be trusted to be 0 or 1.
+            unsigned char bValueByte;
+            memcpy(&bValueByte, &bValue, sizeof(bValueByte));
+            writer.Key("bvalue");
+            writer.Bool(bValueByte != 0);
         }
-
-        virtual void VisitFunctionCall(HLSLFunctionCall * node)
+        if (isFloat || !compact)
         {
-            result = result || String_Equal(name, node->function->name);
-
-            HLSLTreeVisitor::VisitFunctionCall(node);
+            writer.Key("fValue");
+            writer.Float(fValue);
         }
-    };
-
-    NeedsFunctionVisitor visitor;
-    visitor.name = name;
-    visitor.result = false;
+        WriteFileName(writer, this);
+        if ((!isBool && !isFloat) || !compact)
+        {
+            writer.Key("iValue");
+            writer.Int(iValue);
+        }
+        WriteLine(writer, this);
+        writer.Key("literaltype");
+        writer.String(GetEnumName(type));
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
+    }
 
-    visitor.VisitRoot(m_root);
+    void                HLSLIdentifierExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
 
-    return visitor.result;
-}
+        writer.BeginObject();
+        WriteFileName(writer, this);
+        if (global || !writer.GetCompact())
+        {
+            writer.Key("global");
+            writer.Bool(global);
+        }
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
+    }
 
-int GetVectorDimension(HLSLType & type)
-{
-    if (type.baseType >= HLSLBaseType::FirstNumeric &&
-        type.baseType <= HLSLBaseType::LastNumeric)
+    void                HLSLConstructorExpression::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        if (type.baseType == HLSLBaseType::Float || type.baseType == HLSLBaseType::Half) return 1;
-        if (type.baseType == HLSLBaseType::Float2 || type.baseType == HLSLBaseType::Half2) return 2;
-        if (type.baseType == HLSLBaseType::Float3 || type.baseType == HLSLBaseType::Half3) return 3;
-        if (type.baseType == HLSLBaseType::Float4 || type.baseType == HLSLBaseType::Half4) return 4;
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
 
+        // The constructed type is the expression type as well.
+        writer.BeginObject();
+        WriteExpressions(writer, "arguments", argument);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
-    return 0;
-}
-
-// Returns dimension, 0 if invalid.
-int HLSLTree::GetExpressionValue(HLSLExpression * expression, float values[4])
-{
-    ASSERT (expression != NULL);
 
-    // Expression must be constant.
-    if ((expression->expressionType.flags & (int)HLSLTypeFlags::Const) == 0)
+    void                HLSLMemberAccess::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        return 0;
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
+
+        writer.BeginObject();
+        WriteString(writer, "field", field);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteChild(writer, "object", object);
+        if (swizzle || !writer.GetCompact())
+        {
+            writer.Key("swizzle");
+            writer.Bool(swizzle);
+        }
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
 
-    if (expression->expressionType.baseType == HLSLBaseType::Int ||
-        expression->expressionType.baseType == HLSLBaseType::Bool)
+    void                HLSLArrayAccess::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        int int_value;
-        if (GetExpressionValue(expression, int_value)) {
-            for (int i = 0; i < 4; i++) values[i] = (float)int_value;   // @@ Warn if conversion is not exact.
-            return 1;
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
         }
 
-        return 0;
+        writer.BeginObject();
+        WriteChild(writer, "array", array);
+        WriteFileName(writer, this);
+        WriteChild(writer, "index", index);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
-    if (expression->expressionType.baseType >= HLSLBaseType::FirstInteger && expression->expressionType.baseType <= HLSLBaseType::LastInteger)
+
+    void                HLSLFunctionCall::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        // @@ Add support for uints?
-        // @@ Add support for int vectors?
-        return 0;
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
+
+        // The function is referenced by name, its declaration is a top level statement
+        // unless it is an intrinsic.
+        writer.BeginObject();
+        WriteExpressions(writer, "arguments", argument);
+        WriteFileName(writer, this);
+        if (function != NULL)
+        {
+            WriteString(writer, "function", function->name);
+        }
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
-    if (expression->expressionType.baseType > HLSLBaseType::LastNumeric)
+
+    void                HLSLStateAssignment::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        return 0;
-    }
+        if (!writer.GetFullTree())
+        {
+            HLSLNode::WriteJSON(writer, bNodeType);
+            return;
+        }
 
-    // @@ Not supported yet, but we may need it?
-    if (expression->expressionType.array) 
+        // Which member of the union holds the value depends on the state, so both are written.
+        int intValue;
+        float floatValue;
+        memcpy(&intValue, &iValue, sizeof(intValue));
+        memcpy(&floatValue, &iValue, sizeof(floatValue));
+
+        writer.BeginObject();
+        writer.Key("d3dRenderState");
+        writer.Int(d3dRenderState);
+        writer.Key("fValue");
+        writer.Float(floatValue);
+        WriteFileName(writer, this);
+        writer.Key("iValue");
+        writer.Int(intValue);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteString(writer, "stateName", stateName);
+        writer.EndObject();
+    }
+
+    void                HLSLSamplerState::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        return false;
+        if (!writer.GetFullTree())
+        {
+            HLSLExpression::WriteJSON(writer, bNodeType);
+            return;
+        }
+
+        writer.BeginObject();
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStateAssignments(writer, stateAssignments);
+        writer.Key("type");
+        expressionType->WriteJSON(writer);
+        writer.EndObject();
     }
 
-    if (expression->nodeType == HLSLNodeType::BinaryExpression) 
+    void                HLSLPass::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        HLSLBinaryExpression * binaryExpression = (HLSLBinaryExpression *)expression;
-        int dim = GetVectorDimension(binaryExpression->expressionType);
+        if (!writer.GetFullTree())
+        {
+            HLSLNode::WriteJSON(writer, bNodeType);
+            return;
+        }
 
-        float values1[4], values2[4];
-        int dim1 = GetExpressionValue(binaryExpression->expression1, values1);
-        int dim2 = GetExpressionValue(binaryExpression->expression2, values2);
+        writer.BeginObject();
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStateAssignments(writer, stateAssignments);
+        writer.EndObject();
+    }
 
-        if (dim1 == 0 || dim2 == 0)
+    void                HLSLTechnique::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
         {
-            return 0;
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
         }
 
-        if (dim1 != dim2)
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        if (passes != NULL || !writer.GetCompact())
         {
-            // Brodacast scalar to vector size.
-            if (dim1 == 1)
-            {
-                for (int i = 1; i < dim2; i++) values1[i] = values1[0];
-                dim1 = dim2;
-            }
-            else if (dim2 == 1)
-            {
-                for (int i = 1; i < dim1; i++) values2[i] = values2[0];
-                dim2 = dim1;
-            }
-            else
+            writer.Key("passes");
+            writer.BeginArray();
+            for (HLSLPass* pass = passes; pass != NULL; pass = pass->nextPass)
             {
-                return 0;
+                pass->WriteJSON(writer);
             }
+            writer.EndArray();
         }
-        ASSERT(dim == dim1);
-
-        switch(binaryExpression->binaryOp)
-        {
-            case HLSLBinaryOp::Add:
-                for (int i = 0; i < dim; i++) values[i] = values1[i] + values2[i];
-                return dim;
-            case HLSLBinaryOp::Sub:
-                for (int i = 0; i < dim; i++) values[i] = values1[i] - values2[i];
-                return dim;
-            case HLSLBinaryOp::Mul:
-                for (int i = 0; i < dim; i++) values[i] = values1[i] * values2[i];
-                return dim;
-            case HLSLBinaryOp::Div:
-                for (int i = 0; i < dim; i++) values[i] = values1[i] / values2[i];
-                return dim;
-            default:
-                return 0;
-        }
+        writer.EndObject();
     }
-    else if (expression->nodeType == HLSLNodeType::UnaryExpression) 
-    {
-        HLSLUnaryExpression * unaryExpression = (HLSLUnaryExpression *)expression;
-        int dim = GetVectorDimension(unaryExpression->expressionType);
-
-        int dim1 = GetExpressionValue(unaryExpression->expression, values);
-        if (dim1 == 0)
-        {
-            return 0;
-        }
-        ASSERT(dim == dim1);
 
-        switch(unaryExpression->unaryOp)
-        {
-            case HLSLUnaryOp::Negative:
-                for (int i = 0; i < dim; i++) values[i] = -values[i];
-                return dim;
-            case HLSLUnaryOp::Positive:
-                // nop.
-                return dim;
-            default:
-                return 0;
-        }
-    }
-    else if (expression->nodeType == HLSLNodeType::ConstructorExpression)
+    void                HLSLPipeline::WriteJSON(JSONWriter& writer, bool bNodeType)
     {
-        HLSLConstructorExpression * constructor = (HLSLConstructorExpression *)expression;
-
-        int dim = GetVectorDimension(constructor->expressionType);
-
-        int idx = 0;
-        HLSLExpression * arg = constructor->argument;
-        while (arg != NULL)
+        if (!writer.GetFullTree())
         {
-            float tmp[4];
-            int n = GetExpressionValue(arg, tmp);
-            for (int i = 0; i < n; i++) values[idx + i] = tmp[i];
-            idx += n;
-
-            arg = arg->nextExpression;
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
         }
-        ASSERT(dim == idx);
 
-        return dim;
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStateAssignments(writer, stateAssignments);
+        writer.EndObject();
     }
-    else if (expression->nodeType == HLSLNodeType::IdentifierExpression)
-    {
-        HLSLIdentifierExpression * identifier = (HLSLIdentifierExpression *)expression;
 
-        HLSLDeclaration * declaration = FindGlobalDeclaration(identifier->name);
-        if (declaration == NULL) 
-        {
-            return 0;
-        }
-        if ((declaration->type.flags & (int)HLSLTypeFlags::Const) == 0)
+    void                HLSLStage::WriteJSON(JSONWriter& writer, bool bNodeType)
+    {
+        if (!writer.GetFullTree())
         {
-            return 0;
+            HLSLStatement::WriteJSON(writer, bNodeType);
+            return;
         }
 
-        return GetExpressionValue(declaration->assignment, values);
+        writer.BeginObject();
+        WriteAttributes(writer, attributes);
+        WriteFileName(writer, this);
+        WriteStatements(writer, "inputs", inputs);
+        WriteLine(writer, this);
+        WriteString(writer, "name", name);
+        if (bNodeType) WriteNodeType(writer, nodeType);
+        WriteStatements(writer, "outputs", outputs);
+        WriteStatements(writer, "statements", statement);
+        writer.EndObject();
     }
-    else if (expression->nodeType == HLSLNodeType::LiteralExpression)
-    {
-        HLSLLiteralExpression * literal = (HLSLLiteralExpression *)expression;
 
-        if (literal->expressionType.baseType == HLSLBaseType::Float) values[0] = literal->fValue;
-        else if (literal->expressionType.baseType == HLSLBaseType::Half) values[0] = literal->fValue;
-        else if (literal->expressionType.baseType == HLSLBaseType::Bool) values[0] = literal->bValue;
-        else if (literal->expressionType.baseType == HLSLBaseType::Int) values[0] = (float)literal->iValue;  // @@ Warn if conversion is not exact.
-        else return 0;
+const HLSLTypeDimension BaseTypeDimension[(int)HLSLBaseType::Count] =
+{
+    HLSLTypeDimension::None,     // HLSLBaseType::Unknown,
+    HLSLTypeDimension::None,     // HLSLBaseType::Void,
+    HLSLTypeDimension::Scalar,   // HLSLBaseType::Float,
+    HLSLTypeDimension::Vector2,  // HLSLBaseType::Float2,
+    HLSLTypeDimension::Vector3,  // HLSLBaseType::Float3,
+    HLSLTypeDimension::Vector4,  // HLSLBaseType::Float4,
+    HLSLTypeDimension::Matrix2x2,// HLSLBaseType::Float2x2,
+    HLSLTypeDimension::Matrix3x3,// HLSLBaseType::Float3x3,
+    HLSLTypeDimension::Matrix4x4,// HLSLBaseType::Float4x4,
+    HLSLTypeDimension::Matrix4x3,// HLSLBaseType::Float4x3,
+    HLSLTypeDimension::Matrix4x2,// HLSLBaseType::Float4x2,
+    HLSLTypeDimension::Scalar,   // HLSLBaseType::Half,
+    HLSLTypeDimension::Vector2,  // HLSLBaseType::Half2,
+    HLSLTypeDimension::Vector3,  // HLSLBaseType::Half3,
+    HLSLTypeDimension::Vector4,  // HLSLBaseType::Half4,
+    HLSLTypeDimension::Matrix2x2,// HLSLBaseType::Half2x2,
+    HLSLTypeDimension::Matrix3x3,// HLSLBaseType::Half3x3,
+    HLSLTypeDimension::Matrix4x4,// HLSLBaseType::Half4x4,
+    HLSLTypeDimension::Matrix4x3,// HLSLBaseType::Half4x3,
+    HLSLTypeDimension::Matrix4x2,// HLSLBaseType::Half4x2,
+    HLSLTypeDimension::Scalar,   // HLSLBaseType::Bool,
+    HLSLTypeDimension::Vector2,  // HLSLBaseType::Bool2,
+    HLSLTypeDimension::Vector3,  // HLSLBaseType::Bool3,
+    HLSLTypeDimension::Vector4,  // HLSLBaseType::Bool4,
+    HLSLTypeDimension::Scalar,   // HLSLBaseType::Int,
+    HLSLTypeDimension::Vector2,  // HLSLBaseType::Int2,
+    HLSLTypeDimension::Vector3,  // HLSLBaseType::Int3,
+    HLSLTypeDimension::Vector4,  // HLSLBaseType::Int4,
+    HLSLTypeDimension::Scalar,   // HLSLBaseType::Uint,
+    HLSLTypeDimension::Vector2,  // HLSLBaseType::Uint2,
+    HLSLTypeDimension::Vector3,  // HLSLBaseType::Uint3,
+    HLSLTypeDimension::Vector4,  // HLSLBaseType::Uint4,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture,
+    HLSLTypeDimension::None,     // HLSLBaseType::Sampler,           // @@ use type inference to determine sampler type.
+    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2D,
+    HLSLTypeDimension::None,     // HLSLBaseType::Sampler3D,
+    HLSLTypeDimension::None,     // HLSLBaseType::SamplerCube,
+    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2DShadow,
+    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2DMS,
+    HLSLTypeDimension::None,     // HLSLBaseType::Sampler2DArray,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture1D,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture1DArray,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture2D,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture2DArray,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture2DMS,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture2DMSArray,
+    HLSLTypeDimension::None,     // HLSLBaseType::Texture3D,
+    HLSLTypeDimension::None,     // HLSLBaseType::TextureCube,
+    HLSLTypeDimension::None,     // HLSLBaseType::TextureCubeArray,
+    HLSLTypeDimension::None,     // HLSLBaseType::SamplerState,
+    HLSLTypeDimension::None,     // HLSLBaseType::UserDefined,       // struct
+    HLSLTypeDimension::None,     // HLSLBaseType::Expression,        // type argument for defined() sizeof() and typeof().
+    HLSLTypeDimension::None,     // HLSLBaseType::Auto,
+};
 
-        return 1;
-    }
+const HLSLBaseType ScalarBaseType[(int)HLSLBaseType::Count] = {
+    HLSLBaseType::Unknown,       // HLSLBaseType::Unknown,
+    HLSLBaseType::Void,          // HLSLBaseType::Void,
+    HLSLBaseType::Float,         // HLSLBaseType::Float,
+    HLSLBaseType::Float,         // HLSLBaseType::Float2,
+    HLSLBaseType::Float,         // HLSLBaseType::Float3,
+    HLSLBaseType::Float,         // HLSLBaseType::Float4,
+    HLSLBaseType::Float,         // HLSLBaseType::Float2x2,
+    HLSLBaseType::Float,         // HLSLBaseType::Float3x3,
+    HLSLBaseType::Float,         // HLSLBaseType::Float4x4,
+    HLSLBaseType::Float,         // HLSLBaseType::Float4x3,
+    HLSLBaseType::Float,         // HLSLBaseType::Float4x2,
+    HLSLBaseType::Half,          // HLSLBaseType::Half,
+    HLSLBaseType::Half,          // HLSLBaseType::Half2,
+    HLSLBaseType::Half,          // HLSLBaseType::Half3,
+    HLSLBaseType::Half,          // HLSLBaseType::Half4,
+    HLSLBaseType::Half,          // HLSLBaseType::Half2x2,
+    HLSLBaseType::Half,          // HLSLBaseType::Half3x3,
+    HLSLBaseType::Half,          // HLSLBaseType::Half4x4,
+    HLSLBaseType::Half,          // HLSLBaseType::Half4x3,
+    HLSLBaseType::Half,          // HLSLBaseType::Half4x2,
+    HLSLBaseType::Bool,          // HLSLBaseType::Bool,
+    HLSLBaseType::Bool,          // HLSLBaseType::Bool2,
+    HLSLBaseType::Bool,          // HLSLBaseType::Bool3,
+    HLSLBaseType::Bool,          // HLSLBaseType::Bool4,
+    HLSLBaseType::Int,           // HLSLBaseType::Int,
+    HLSLBaseType::Int,           // HLSLBaseType::Int2,
+    HLSLBaseType::Int,           // HLSLBaseType::Int3,
+    HLSLBaseType::Int,           // HLSLBaseType::Int4,
+    HLSLBaseType::Uint,          // HLSLBaseType::Uint,
+    HLSLBaseType::Uint,          // HLSLBaseType::Uint2,
+    HLSLBaseType::Uint,          // HLSLBaseType::Uint3,
+    HLSLBaseType::Uint,          // HLSLBaseType::Uint4,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler,           // @@ use type inference to determine sampler type.
+    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2D,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler3D,
+    HLSLBaseType::Unknown,       // HLSLBaseType::SamplerCube,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2DShadow,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2DMS,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Sampler2DArray,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture1D,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture1DArray,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2D,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2DArray,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2DMS,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture2DMSArray,
+    HLSLBaseType::Unknown,       // HLSLBaseType::Texture3D,
+    HLSLBaseType::Unknown,       // HLSLBaseType::TextureCube,
+    HLSLBaseType::Unknown,       // HLSLBaseType::TextureCubeArray,
+    HLSLBaseType::Unknown,       // HLSLBaseType::SamplerState,
+    HLSLBaseType::Unknown,       // HLSLBaseType::UserDefined,       // struct
+    HLSLBaseType::Unknown,       // HLSLBaseType::Expression,        // type argument for defined() sizeof() and typeof().
+    HLSLBaseType::Unknown,       // HLSLBaseType::Auto,
+};
 
-    return 0;
-}
+#define MAX_NODE_PAGES 4096
 
+HLSLTree::HLSLTree() : m_stringPool()
+{
+    m_NodePages.reserve(MAX_NODE_PAGES);
 
+    m_NodePages.emplace_back();
+    m_firstPage         = &m_NodePages.back();
 
+    m_currentPage       = m_firstPage;
+    m_currentPageOffset = 0;
+    m_nodeCount         = 0;
+    m_threadSafe        = false;
 
-void HLSLTreeVisitor::VisitType(HLSLType & type)
-{
+    m_root              = AddNode<HLSLRoot>(NULL, 1);
 }
 
-void HLSLTreeVisitor::VisitRoot(HLSLRoot * root)
+HLSLTree::~HLSLTree()
 {
-    HLSLStatement * statement = root->statement;
-    while (statement != NULL) {
-        VisitTopLevelStatement(statement);
-        statement = statement->nextStatement;
+    // Destroy in reverse order of construction, nodes may refer to earlier ones.
+    for (size_t i = m_destructors.size(); i > 0; --i)
+    {
+        const Destructor& destructor = m_destructors[i - 1];
+        destructor.destroy(destructor.object);
     }
 }
 
-void HLSLTreeVisitor::VisitTopLevelStatement(HLSLStatement * node)
+void HLSLTree::AllocatePage()
 {
-    if (node->nodeType == HLSLNodeType::Declaration) {
-        VisitDeclaration((HLSLDeclaration *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::Struct) {
-        VisitStruct((HLSLStruct *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::Buffer) {
-        VisitBuffer((HLSLBuffer *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::Function) {
-        VisitFunction((HLSLFunction *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::Technique) {
-        VisitTechnique((HLSLTechnique *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::Pipeline) {
-        VisitPipeline((HLSLPipeline *)node);
+    NodePage* newPage;
+    if (m_NodePages.size() < MAX_NODE_PAGES)
+    {
+        m_NodePages.emplace_back();
+        newPage = &m_NodePages.back();
     }
-    else {
-        ASSERT(0);
+    else
+    {
+        m_overflowPages.emplace_back(new NodePage());
+        newPage = m_overflowPages.back().get();
     }
+
+    m_currentPage->next  = newPage;
+    m_currentPageOffset  = 0;
+    m_currentPage        = newPage;
 }
 
-void HLSLTreeVisitor::VisitStatements(HLSLStatement * statement)
+const char* HLSLTree::AddString(const char* string)
+{   
+    std::unique_lock<std::mutex> lock = Lock();
+    return m_stringPool.AddString(string);
+}
+
+const char* HLSLTree::AddStringFormat(const char* format, ...)
 {
-    while (statement != NULL) {
-        VisitStatement(statement);
-        statement = statement->nextStatement;
-    }
+    std::unique_lock<std::mutex> lock = Lock();
+    va_list args;
+    va_start(args, format);
+    const char * string = m_stringPool.AddStringFormatList(format, args);
+    va_end(args);
+    return string;
 }
 
-void HLSLTreeVisitor::VisitStatement(HLSLStatement * node)
+bool HLSLTree::GetContainsString(const char* string) const
 {
-    // Function statements
-    if (node->nodeType == HLSLNodeType::Declaration) {
-        VisitDeclaration((HLSLDeclaration *)node);
+    std::unique_lock<std::mutex> lock = Lock();
+    return m_stringPool.GetContainsString(string);
+}
+
+HLSLRoot* HLSLTree::GetRoot() const
+{
+    return m_root;
+}
+
+size_t HLSLTree::GetNodeCount() const
+{
+    return m_nodeCount;
+}
+
+void HLSLTree::SetThreadSafe(bool threadSafe)
+{
+    m_threadSafe = threadSafe;
+}
+
+std::unique_lock<std::mutex> HLSLTree::Lock() const
+{
+    return m_threadSafe ? std::unique_lock<std::mutex>(m_mutex) : std::unique_lock<std::mutex>();
+}
+
+const HLSLType* HLSLTree::AddType(const HLSLType& type)
+{
+    std::unique_lock<std::mutex> lock = Lock();
+    auto it = m_types.find(&type);
+    if (it != m_types.end())
+    {
+        return *it;
     }
-    else if (node->nodeType == HLSLNodeType::ExpressionStatement) {
-        VisitExpressionStatement((HLSLExpressionStatement *)node);
+
+    // Canonical types live in the node pages, next to the expressions that reference them.
+    const HLSLType* canonical = new (AllocateMemory(sizeof(HLSLType))) HLSLType(type);
+    m_types.insert(canonical);
+    return canonical;
+}
+
+size_t HLSLTree::TypeHash::operator()(const HLSLType* type) const
+{
+    size_t hash = (size_t)type->baseType;
+    hash = hash * 31 + (size_t)type->samplerType;
+    hash = hash * 31 + (size_t)type->textureType;
+    hash = hash * 31 + std::hash<const void*>()(type->typeName);
+    hash = hash * 31 + (size_t)type->array;
+    hash = hash * 31 + std::hash<const void*>()(type->arraySize);
+    hash = hash * 31 + (size_t)type->flags;
+    hash = hash * 31 + (size_t)type->addressSpace;
+    return hash;
+}
+
+bool HLSLTree::TypeEqual::operator()(const HLSLType* lhs, const HLSLType* rhs) const
+{
+    // Type names are pooled, so pointer comparison is sufficient.
+    return lhs->baseType == rhs->baseType &&
+        lhs->samplerType == rhs->samplerType &&
+        lhs->textureType == rhs->textureType &&
+        lhs->typeName == rhs->typeName &&
+        lhs->array == rhs->array &&
+        lhs->arraySize == rhs->arraySize &&
+        lhs->flags == rhs->flags &&
+        lhs->addressSpace == rhs->addressSpace;
+}
+
+void* HLSLTree::AllocateMemory(size_t size)
+{
+    // Keep every allocation pointer aligned.
+    size = (size + alignof(NodePage*) - 1) & ~(alignof(NodePage*) - 1);
+
+    if (m_currentPageOffset + size > s_nodePageSize)
+    {
+        AllocatePage();
     }
-    else if (node->nodeType == HLSLNodeType::ReturnStatement) {
-        VisitReturnStatement((HLSLReturnStatement *)node);
+    void* buffer = m_currentPage->buffer + m_currentPageOffset;
+    m_currentPageOffset += size;
+    return buffer;
+}
+
+void HLSLTree::InvalidateIndex()
+{
+    m_index.valid = false;
+    m_references.clear();
+    m_intValues.clear();
+    m_floatValues.clear();
+}
+
+const HLSLTree::NameIndex& HLSLTree::GetIndex()
+{
+    if (m_index.valid)
+    {
+        return m_index;
     }
-    else if (node->nodeType == HLSLNodeType::DiscardStatement) {
-        VisitDiscardStatement((HLSLDiscardStatement *)node);
+
+    m_index.functions.clear();
+    m_index.declarations.clear();
+    m_index.structs.clear();
+    m_index.techniques.clear();
+    m_index.pipelines.clear();
+    m_index.buffers.clear();
+
+    // emplace keeps the first statement of a name, matching the order of a walk.
+    for (HLSLStatement * statement = m_root->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        switch (statement->nodeType)
+        {
+        case HLSLNodeType::Function:
+        {
+            HLSLFunction * function = (HLSLFunction *)statement;
+            if (function->name != NULL) m_index.functions.emplace(function->name, function);
+            break;
+        }
+        case HLSLNodeType::Declaration:
+            // "float a, b;" declares b in the nextDeclaration of a.
+            for (HLSLDeclaration * declaration = (HLSLDeclaration *)statement; declaration != NULL; declaration = declaration->nextDeclaration)
+            {
+                if (declaration->name != NULL) m_index.declarations.emplace(declaration->name, GlobalDeclaration{ declaration, NULL });
+            }
+            break;
+        case HLSLNodeType::Struct:
+        {
+            HLSLStruct * structure = (HLSLStruct *)statement;
+            if (structure->name != NULL) m_index.structs.emplace(structure->name, structure);
+            break;
+        }
+        case HLSLNodeType::Technique:
+        {
+            HLSLTechnique * technique = (HLSLTechnique *)statement;
+            if (technique->name != NULL) m_index.techniques.emplace(technique->name, technique);
+            break;
+        }
+        case HLSLNodeType::Pipeline:
+        {
+            HLSLPipeline * pipeline = (HLSLPipeline *)statement;
+            if (pipeline->name != NULL) m_index.pipelines.emplace(pipeline->name, pipeline);
+            break;
+        }
+        case HLSLNodeType::Buffer:
+        {
+            HLSLBuffer * buffer = (HLSLBuffer *)statement;
+            if (buffer->name != NULL) m_index.buffers.emplace(buffer->name, buffer);
+
+            for (HLSLStatement * field = buffer->field; field != NULL; field = field->nextStatement)
+            {
+                ASSERT(field->nodeType == HLSLNodeType::Declaration);
+                for (HLSLDeclaration * declaration = (HLSLDeclaration *)field; declaration != NULL; declaration = declaration->nextDeclaration)
+                {
+                    if (declaration->name != NULL) m_index.declarations.emplace(declaration->name, GlobalDeclaration{ declaration, buffer });
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
     }
-    else if (node->nodeType == HLSLNodeType::BreakStatement) {
-        VisitBreakStatement((HLSLBreakStatement *)node);
+
+    m_index.valid = true;
+    return m_index;
+}
+
+template <class T>
+T * HLSLTree::FindInIndex(const std::unordered_map<std::string_view, T *>& map, const char * name)
+{
+    if (name == NULL)
+    {
+        return NULL;
     }
-    else if (node->nodeType == HLSLNodeType::ContinueStatement) {
-        VisitContinueStatement((HLSLContinueStatement *)node);
+    auto it = map.find(name);
+    return it != map.end() ? it->second : NULL;
+}
+
+// @@ This doesn't do any parameter matching. Simply returns the first function with that name.
+HLSLFunction * HLSLTree::FindFunction(const char * name)
+{
+    return FindInIndex(GetIndex().functions, name);
+}
+
+HLSLDeclaration * HLSLTree::FindGlobalDeclaration(const char * name, HLSLBuffer ** buffer_out/*=NULL*/)
+{
+    const NameIndex& index = GetIndex();
+    auto it = name != NULL ? index.declarations.find(name) : index.declarations.end();
+    if (it == index.declarations.end())
+    {
+        if (buffer_out) *buffer_out = NULL;
+        return NULL;
     }
-    else if (node->nodeType == HLSLNodeType::IfStatement) {
-        VisitIfStatement((HLSLIfStatement *)node);
+
+    if (buffer_out) *buffer_out = it->second.buffer;
+    return it->second.declaration;
+}
+
+HLSLStruct * HLSLTree::FindGlobalStruct(const char * name)
+{
+    return FindInIndex(GetIndex().structs, name);
+}
+
+HLSLTechnique * HLSLTree::FindTechnique(const char * name)
+{
+    return FindInIndex(GetIndex().techniques, name);
+}
+
+HLSLPipeline * HLSLTree::FindFirstPipeline()
+{
+    return FindNextPipeline(NULL);
+}
+
+HLSLPipeline * HLSLTree::FindNextPipeline(HLSLPipeline * current)
+{
+    HLSLStatement * statement = current ? current : m_root->statement;
+    while (statement != NULL)
+    {
+        if (statement->nodeType == HLSLNodeType::Pipeline)
+        {
+            return (HLSLPipeline *)statement;
+        }
+
+        statement = statement->nextStatement;
     }
-    else if (node->nodeType == HLSLNodeType::ForStatement) {
-        VisitForStatement((HLSLForStatement *)node);
+
+    return NULL;
+}
+
+HLSLPipeline * HLSLTree::FindPipeline(const char * name)
+{
+    return FindInIndex(GetIndex().pipelines, name);
+}
+
+HLSLBuffer * HLSLTree::FindBuffer(const char * name)
+{
+    return FindInIndex(GetIndex().buffers, name);
+}
+
+class ReferenceCollector : public HLSLIterativeTreeVisitor<ReferenceCollector>
+{
+public:
+    HLSLReferences * references = NULL;
+
+    bool EnterNode(HLSLNode * node)
+    {
+        if (node->nodeType == HLSLNodeType::FunctionCall)
+        {
+            references->functions.push_back(((HLSLFunctionCall *)node)->function);
+        }
+        else if (node->nodeType == HLSLNodeType::IdentifierExpression)
+        {
+            HLSLIdentifierExpression * identifier = (HLSLIdentifierExpression *)node;
+            if (identifier->global && identifier->name != NULL)
+            {
+                references->globals.push_back(identifier->name);
+            }
+        }
+        return true;
     }
-    else if (node->nodeType == HLSLNodeType::BlockStatement) {
-        VisitBlockStatement((HLSLBlockStatement *)node);
+
+    void VisitType(const HLSLType & type)
+    {
+        if (type.baseType == HLSLBaseType::UserDefined && type.typeName != NULL)
+        {
+            references->types.push_back(type.typeName);
+        }
     }
-    else {
-        ASSERT(0);
+};
+
+template <class T>
+static void RemoveDuplicates(std::vector<T>& values)
+{
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+
+const HLSLReferences& HLSLTree::GetReferences(const HLSLStatement * statement)
+{
+    auto it = m_references.find(statement);
+    if (it != m_references.end())
+    {
+        return it->second;
     }
+
+    HLSLReferences& references = m_references[statement];
+
+    // The visitor doesn't modify the tree. It is kept to reuse its stack.
+    static thread_local ReferenceCollector collector;
+    collector.references = &references;
+    collector.Walk(const_cast<HLSLStatement *>(statement));
+
+    RemoveDuplicates(references.functions);
+    RemoveDuplicates(references.globals);
+    RemoveDuplicates(references.types);
+    return references;
 }
 
-void HLSLTreeVisitor::VisitDeclaration(HLSLDeclaration * node)
+
+
+bool HLSLTree::GetExpressionValue(HLSLExpression * expression, int & value)
 {
-    VisitType(node->type);
-    /*do {
-        VisitExpression(node->assignment);
-        node = node->nextDeclaration;
-    } while (node);*/
-    if (node->assignment != NULL) {
-        VisitExpression(node->assignment);
+    ASSERT (expression != NULL);
+
+    // Literals are cheaper to read again than to look up.
+    if (expression->nodeType == HLSLNodeType::LiteralExpression)
+    {
+        return EvaluateExpression(expression, value);
     }
-    if (node->nextDeclaration != NULL) {
-        VisitDeclaration(node->nextDeclaration);
+
+    auto it = m_intValues.find(expression);
+    if (it == m_intValues.end())
+    {
+        IntValue result;
+        result.value = 0;
+        result.valid = EvaluateExpression(expression, result.value);
+        it = m_intValues.emplace(expression, result).first;
     }
+
+    value = it->second.value;
+    return it->second.valid;
 }
 
-void HLSLTreeVisitor::VisitStruct(HLSLStruct * node)
+int HLSLTree::GetExpressionValue(HLSLExpression * expression, float values[4])
 {
-    HLSLStructField * field = node->field;
-    while (field != NULL) {
-        VisitStructField(field);
-        field = field->nextField;
+    ASSERT (expression != NULL);
+
+    if (expression->nodeType == HLSLNodeType::LiteralExpression)
+    {
+        return EvaluateExpression(expression, values);
     }
+
+    auto it = m_floatValues.find(expression);
+    if (it == m_floatValues.end())
+    {
+        FloatValue result = {};
+        result.dimension = EvaluateExpression(expression, result.values);
+        it = m_floatValues.emplace(expression, result).first;
+    }
+
+    for (int i = 0; i < it->second.dimension; i++) values[i] = it->second.values[i];
+    return it->second.dimension;
 }
 
-void HLSLTreeVisitor::VisitStructField(HLSLStructField * node)
+/** The types the integer variant of GetExpressionValue evaluates. */
+static bool IsIntegerScalar(const HLSLType & type)
 {
-    VisitType(node->type);
+    return (type.baseType == HLSLBaseType::Int || type.baseType == HLSLBaseType::Bool) && !type.array;
 }
 
-void HLSLTreeVisitor::VisitBuffer(HLSLBuffer * node)
+// Comparisons of floats, or of a float and an integer, are evaluated on floats.
+bool HLSLTree::EvaluateComparison(HLSLBinaryExpression * expression, int & value)
 {
-    HLSLDeclaration * field = node->field;
-    while (field != NULL) {
-        ASSERT(field->nodeType == HLSLNodeType::Declaration);
-        VisitDeclaration(field);
-        ASSERT(field->nextDeclaration == NULL);
-        field = (HLSLDeclaration *)field->nextStatement;
+    float values1[4], values2[4];
+    if (GetExpressionValue(expression->expression1, values1) != 1 ||
+        GetExpressionValue(expression->expression2, values2) != 1)
+    {
+        return false;
+    }
+
+    switch (expression->binaryOp)
+    {
+        case HLSLBinaryOp::Less:            value = values1[0] < values2[0]; return true;
+        case HLSLBinaryOp::Greater:         value = values1[0] > values2[0]; return true;
+        case HLSLBinaryOp::LessEqual:       value = values1[0] <= values2[0]; return true;
+        case HLSLBinaryOp::GreaterEqual:    value = values1[0] >= values2[0]; return true;
+        case HLSLBinaryOp::Equal:           value = values1[0] == values2[0]; return true;
+        case HLSLBinaryOp::NotEqual:        value = values1[0] != values2[0]; return true;
+        default:                            return false;
     }
 }
 
-/*void HLSLTreeVisitor::VisitBufferField(HLSLBufferField * node)
+// Conditions may be integers or floats, anything but zero is true.
+bool HLSLTree::GetConditionValue(HLSLExpression * condition, bool & value)
 {
-    VisitType(node->type);
-}*/
+    int intValue;
+    if (GetExpressionValue(condition, intValue))
+    {
+        value = intValue != 0;
+        return true;
+    }
 
-void HLSLTreeVisitor::VisitFunction(HLSLFunction * node)
+    float values[4];
+    if (GetExpressionValue(condition, values) == 1)
+    {
+        value = values[0] != 0;
+        return true;
+    }
+    return false;
+}
+
+bool HLSLTree::EvaluateExpression(HLSLExpression * expression, int & value)
 {
-    VisitType(node->returnType);
 
-    HLSLArgument * argument = node->argument;
-    while (argument != NULL) {
-        VisitArgument(argument);
-        argument = argument->nextArgument;
+    // Expression must be constant.
+    if ((expression->expressionType->flags & (int)HLSLTypeFlags::Const) == 0)
+    {
+        return false;
+    }
+
+    // We are expecting an integer scalar. @@ Add support for type conversion from other scalar types.
+    if (expression->expressionType->baseType != HLSLBaseType::Int &&
+        expression->expressionType->baseType != HLSLBaseType::Bool)
+    {
+        return false;
+    }
+
+    if (expression->expressionType->array) 
+    {
+        return false;
     }
 
-    VisitStatements(node->statement);
+    if (expression->nodeType == HLSLNodeType::BinaryExpression) 
+    {
+        HLSLBinaryExpression * binaryExpression = (HLSLBinaryExpression *)expression;
+
+        if (IsCompareOp(binaryExpression->binaryOp) &&
+            (!IsIntegerScalar(*binaryExpression->expression1->expressionType) || !IsIntegerScalar(*binaryExpression->expression2->expressionType)))
+        {
+            return EvaluateComparison(binaryExpression, value);
+        }
+
+        int value1, value2;
+        if (!GetExpressionValue(binaryExpression->expression1, value1) ||
+            !GetExpressionValue(binaryExpression->expression2, value2))
+        {
+            return false;
+        }
+
+        switch(binaryExpression->binaryOp)
+        {
+            case HLSLBinaryOp::And:
+                value = value1 && value2;
+                return true;
+            case HLSLBinaryOp::Or:
+                value = value1 || value2;
+                return true;
+            case HLSLBinaryOp::Add:
+                value = value1 + value2;
+                return true;
+            case HLSLBinaryOp::Sub:
+                value = value1 - value2;
+                return true;
+            case HLSLBinaryOp::Mul:
+                value = value1 * value2;
+                return true;
+            case HLSLBinaryOp::Div:
+                if (value2 == 0) return false;
+                value = value1 / value2;
+                return true;
+            case HLSLBinaryOp::Less:
+                value = value1 < value2;
+                return true;
+            case HLSLBinaryOp::Greater:
+                value = value1 > value2;
+                return true;
+            case HLSLBinaryOp::LessEqual:
+                value = value1 <= value2;
+                return true;
+            case HLSLBinaryOp::GreaterEqual:
+                value = value1 >= value2;
+                return true;
+            case HLSLBinaryOp::Equal:
+                value = value1 == value2;
+                return true;
+            case HLSLBinaryOp::NotEqual:
+                value = value1 != value2;
+                return true;
+            case HLSLBinaryOp::BitAnd:
+                value = value1 & value2;
+                return true;
+            case HLSLBinaryOp::BitOr:
+                value = value1 | value2;
+                return true;
+            case HLSLBinaryOp::BitXor:
+                value = value1 ^ value2;
+                return true;
+            case HLSLBinaryOp::Assign:
+            case HLSLBinaryOp::AddAssign:
+            case HLSLBinaryOp::SubAssign:
+            case HLSLBinaryOp::MulAssign:
+            case HLSLBinaryOp::DivAssign:
+            case HLSLBinaryOp::Count:
+                // IC: These are not valid on non-constant expressions and should fail earlier when querying expression value.
+                return false;
+        }
+    }
+    else if (expression->nodeType == HLSLNodeType::UnaryExpression) 
+    {
+        HLSLUnaryExpression * unaryExpression = (HLSLUnaryExpression *)expression;
+
+        if (!GetExpressionValue(unaryExpression->expression, value))
+        {
+            return false;
+        }
+
+        switch(unaryExpression->unaryOp)
+        {
+            case HLSLUnaryOp::Negative:
+                value = -value;
+                return true;
+            case HLSLUnaryOp::Positive:
+                // nop.
+                return true;
+            case HLSLUnaryOp::Not:
+                value = !value;
+                return true;
+            case HLSLUnaryOp::BitNot:
+                value = ~value;
+                return true;
+            case HLSLUnaryOp::PostDecrement:
+            case HLSLUnaryOp::PostIncrement:
+            case HLSLUnaryOp::PreDecrement:
+            case HLSLUnaryOp::PreIncrement:
+            case HLSLUnaryOp::Count:
+                // IC: These are not valid on non-constant expressions and should fail earlier when querying expression value.
+                return false;
+        }
+    }
+    else if (expression->nodeType == HLSLNodeType::ConditionalExpression)
+    {
+        HLSLConditionalExpression * conditional = (HLSLConditionalExpression *)expression;
+
+        bool condition;
+        if (!GetConditionValue(conditional->condition, condition))
+        {
+            return false;
+        }
+        return GetExpressionValue(condition ? conditional->trueExpression : conditional->falseExpression, value);
+    }
+    else if (expression->nodeType == HLSLNodeType::IdentifierExpression)
+    {
+        HLSLIdentifierExpression * identifier = (HLSLIdentifierExpression *)expression;
+
+        // Locals and arguments may hide a global of the same name.
+        HLSLDeclaration * declaration = identifier->global ? FindGlobalDeclaration(identifier->name) : NULL;
+        if (declaration == NULL) 
+        {
+            return false;
+        }
+        if ((declaration->type.flags & (int)HLSLTypeFlags::Const) == 0 || declaration->assignment == NULL)
+        {
+            return false;
+        }
+
+        return GetExpressionValue(declaration->assignment, value);
+    }
+    else if (expression->nodeType == HLSLNodeType::LiteralExpression) 
+    {
+        HLSLLiteralExpression * literal = (HLSLLiteralExpression *)expression;
+   
+        if (literal->expressionType->baseType == HLSLBaseType::Int) value = literal->iValue;
+        else if (literal->expressionType->baseType == HLSLBaseType::Bool) value = (int)literal->bValue;
+        else return false;
+        
+        return true;
+    }
+
+    return false;
+}
+
+bool HLSLTree::NeedsFunction(const char* name)
+{
+    // Early out
+    if (!GetContainsString(name))
+        return false;
+
+    for (HLSLStatement * statement = m_root->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        if (statement->hidden)
+            continue;
+
+        for (const HLSLFunction * function : GetReferences(statement).functions)
+        {
+            if (String_Equal(name, function->name))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+int GetVectorDimension(const HLSLType & type)
+{
+    if (type.baseType >= HLSLBaseType::FirstNumeric &&
+        type.baseType <= HLSLBaseType::LastNumeric)
+    {
+        if (type.baseType == HLSLBaseType::Float || type.baseType == HLSLBaseType::Half) return 1;
+        if (type.baseType == HLSLBaseType::Float2 || type.baseType == HLSLBaseType::Half2) return 2;
+        if (type.baseType == HLSLBaseType::Float3 || type.baseType == HLSLBaseType::Half3) return 3;
+        if (type.baseType == HLSLBaseType::Float4 || type.baseType == HLSLBaseType::Half4) return 4;
+
+    }
+    return 0;
+}
+
+// Returns dimension, 0 if invalid.
+int HLSLTree::EvaluateExpression(HLSLExpression * expression, float values[4])
+{
+
+    // Expression must be constant.
+    if ((expression->expressionType->flags & (int)HLSLTypeFlags::Const) == 0)
+    {
+        return 0;
+    }
+
+    if (expression->expressionType->baseType == HLSLBaseType::Int ||
+        expression->expressionType->baseType == HLSLBaseType::Bool)
+    {
+        int int_value;
+        if (GetExpressionValue(expression, int_value)) {
+            for (int i = 0; i < 4; i++) values[i] = (float)int_value;   // @@ Warn if conversion is not exact.
+            return 1;
+        }
+
+        return 0;
+    }
+    if (expression->expressionType->baseType >= HLSLBaseType::FirstInteger && expression->expressionType->baseType <= HLSLBaseType::LastInteger)
+    {
+        // @@ Add support for uints?
+        // @@ Add support for int vectors?
+        return 0;
+    }
+    if (expression->expressionType->baseType > HLSLBaseType::LastNumeric)
+    {
+        return 0;
+    }
+
+    // @@ Not supported yet, but we may need it?
+    if (expression->expressionType->array) 
+    {
+        return false;
+    }
+
+    if (expression->nodeType == HLSLNodeType::BinaryExpression) 
+    {
+        HLSLBinaryExpression * binaryExpression = (HLSLBinaryExpression *)expression;
+        int dim = GetVectorDimension(*binaryExpression->expressionType);
+
+        float values1[4], values2[4];
+        int dim1 = GetExpressionValue(binaryExpression->expression1, values1);
+        int dim2 = GetExpressionValue(binaryExpression->expression2, values2);
+
+        if (dim1 == 0 || dim2 == 0)
+        {
+            return 0;
+        }
+
+        if (dim1 != dim2)
+        {
+            // Brodacast scalar to vector size.
+            if (dim1 == 1)
+            {
+                for (int i = 1; i < dim2; i++) values1[i] = values1[0];
+                dim1 = dim2;
+            }
+            else if (dim2 == 1)
+            {
+                for (int i = 1; i < dim1; i++) values2[i] = values2[0];
+                dim2 = dim1;
+            }
+            else
+            {
+                return 0;
+            }
+        }
+        // Matrices have no dimension.
+        if (dim != dim1)
+        {
+            return 0;
+        }
+
+        switch(binaryExpression->binaryOp)
+        {
+            case HLSLBinaryOp::Add:
+                for (int i = 0; i < dim; i++) values[i] = values1[i] + values2[i];
+                return dim;
+            case HLSLBinaryOp::Sub:
+                for (int i = 0; i < dim; i++) values[i] = values1[i] - values2[i];
+                return dim;
+            case HLSLBinaryOp::Mul:
+                for (int i = 0; i < dim; i++) values[i] = values1[i] * values2[i];
+                return dim;
+            case HLSLBinaryOp::Div:
+                for (int i = 0; i < dim; i++) values[i] = values1[i] / values2[i];
+                return dim;
+            default:
+                return 0;
+        }
+    }
+    else if (expression->nodeType == HLSLNodeType::UnaryExpression) 
+    {
+        HLSLUnaryExpression * unaryExpression = (HLSLUnaryExpression *)expression;
+        int dim = GetVectorDimension(*unaryExpression->expressionType);
+
+        int dim1 = GetExpressionValue(unaryExpression->expression, values);
+        if (dim1 == 0 || dim != dim1)
+        {
+            return 0;
+        }
+
+        switch(unaryExpression->unaryOp)
+        {
+            case HLSLUnaryOp::Negative:
+                for (int i = 0; i < dim; i++) values[i] = -values[i];
+                return dim;
+            case HLSLUnaryOp::Positive:
+                // nop.
+                return dim;
+            default:
+                return 0;
+        }
+    }
+    else if (expression->nodeType == HLSLNodeType::ConstructorExpression)
+    {
+        HLSLConstructorExpression * constructor = (HLSLConstructorExpression *)expression;
+
+        int dim = GetVectorDimension(*constructor->expressionType);
+
+        int idx = 0;
+        HLSLExpression * arg = constructor->argument;
+        while (arg != NULL)
+        {
+            float tmp[4];
+            int n = GetExpressionValue(arg, tmp);
+            if (n == 0 || idx + n > dim)
+            {
+                // Constructors are flagged constant even when their arguments aren't.
+                return 0;
+            }
+            for (int i = 0; i < n; i++) values[idx + i] = tmp[i];
+            idx += n;
+
+            arg = arg->nextExpression;
+        }
+        if (dim != idx)
+        {
+            return 0;
+        }
+
+        return dim;
+    }
+    else if (expression->nodeType == HLSLNodeType::ConditionalExpression)
+    {
+        HLSLConditionalExpression * conditional = (HLSLConditionalExpression *)expression;
+
+        bool condition;
+        if (!GetConditionValue(conditional->condition, condition))
+        {
+            return 0;
+        }
+        int dim = GetExpressionValue(condition ? conditional->trueExpression : conditional->falseExpression, values);
+        return dim == GetVectorDimension(*conditional->expressionType) ? dim : 0;
+    }
+    else if (expression->nodeType == HLSLNodeType::IdentifierExpression)
+    {
+        HLSLIdentifierExpression * identifier = (HLSLIdentifierExpression *)expression;
+
+        HLSLDeclaration * declaration = identifier->global ? FindGlobalDeclaration(identifier->name) : NULL;
+        if (declaration == NULL) 
+        {
+            return 0;
+        }
+        if ((declaration->type.flags & (int)HLSLTypeFlags::Const) == 0 || declaration->assignment == NULL)
+        {
+            return 0;
+        }
+
+        return GetExpressionValue(declaration->assignment, values);
+    }
+    else if (expression->nodeType == HLSLNodeType::LiteralExpression)
+    {
+        HLSLLiteralExpression * literal = (HLSLLiteralExpression *)expression;
+
+        if (literal->expressionType->baseType == HLSLBaseType::Float) values[0] = literal->fValue;
+        else if (literal->expressionType->baseType == HLSLBaseType::Half) values[0] = literal->fValue;
+        else if (literal->expressionType->baseType == HLSLBaseType::Bool) values[0] = literal->bValue;
+        else if (literal->expressionType->baseType == HLSLBaseType::Int) values[0] = (float)literal->iValue;  // @@ Warn if conversion is not exact.
+        else return 0;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+
+void HLSLTreeVisitor::VisitType(const HLSLType & type)
+{
+}
+
+void HLSLTreeVisitor::VisitRoot(HLSLRoot * root)
+{
+    HLSLStatement * statement = root->statement;
+    while (statement != NULL) {
+        VisitTopLevelStatement(statement);
+        statement = statement->nextStatement;
+    }
+}
+
+void HLSLTreeVisitor::VisitTopLevelStatement(HLSLStatement * node)
+{
+    if (node->nodeType == HLSLNodeType::Declaration) {
+        VisitDeclaration((HLSLDeclaration *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::Struct) {
+        VisitStruct((HLSLStruct *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::Buffer) {
+        VisitBuffer((HLSLBuffer *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::Function) {
+        VisitFunction((HLSLFunction *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::Technique) {
+        VisitTechnique((HLSLTechnique *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::Pipeline) {
+        VisitPipeline((HLSLPipeline *)node);
+    }
+    else {
+        ASSERT(0);
+    }
+}
+
+void HLSLTreeVisitor::VisitStatements(HLSLStatement * statement)
+{
+    while (statement != NULL) {
+        VisitStatement(statement);
+        statement = statement->nextStatement;
+    }
+}
+
+void HLSLTreeVisitor::VisitStatement(HLSLStatement * node)
+{
+    // Function statements
+    if (node->nodeType == HLSLNodeType::Declaration) {
+        VisitDeclaration((HLSLDeclaration *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ExpressionStatement) {
+        VisitExpressionStatement((HLSLExpressionStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ReturnStatement) {
+        VisitReturnStatement((HLSLReturnStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::DiscardStatement) {
+        VisitDiscardStatement((HLSLDiscardStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::BreakStatement) {
+        VisitBreakStatement((HLSLBreakStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ContinueStatement) {
+        VisitContinueStatement((HLSLContinueStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::IfStatement) {
+        VisitIfStatement((HLSLIfStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ForStatement) {
+        VisitForStatement((HLSLForStatement *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::BlockStatement) {
+        VisitBlockStatement((HLSLBlockStatement *)node);
+    }
+    else {
+        ASSERT(0);
+    }
+}
+
+void HLSLTreeVisitor::VisitDeclaration(HLSLDeclaration * node)
+{
+    VisitType(node->type);
+    /*do {
+        VisitExpression(node->assignment);
+        node = node->nextDeclaration;
+    } while (node);*/
+    // Array initializers are lists.
+    for (HLSLExpression * value = node->assignment; value != NULL; value = value->nextExpression) {
+        VisitExpression(value);
+    }
+    if (node->nextDeclaration != NULL) {
+        VisitDeclaration(node->nextDeclaration);
+    }
+}
+
+void HLSLTreeVisitor::VisitStruct(HLSLStruct * node)
+{
+    HLSLStructField * field = node->field;
+    while (field != NULL) {
+        VisitStructField(field);
+        field = field->nextField;
+    }
+}
+
+void HLSLTreeVisitor::VisitStructField(HLSLStructField * node)
+{
+    VisitType(node->type);
+}
+
+void HLSLTreeVisitor::VisitBuffer(HLSLBuffer * node)
+{
+    HLSLDeclaration * field = node->field;
+    while (field != NULL) {
+        ASSERT(field->nodeType == HLSLNodeType::Declaration);
+        VisitDeclaration(field);    // Visits the other variables of "float a, b;" as well.
+        field = (HLSLDeclaration *)field->nextStatement;
+    }
+}
+
+/*void HLSLTreeVisitor::VisitBufferField(HLSLBufferField * node)
+{
+    VisitType(node->type);
+}*/
+
+void HLSLTreeVisitor::VisitFunction(HLSLFunction * node)
+{
+    VisitType(node->returnType);
+
+    HLSLArgument * argument = node->argument;
+    while (argument != NULL) {
+        VisitArgument(argument);
+        argument = argument->nextArgument;
+    }
+
+    VisitStatements(node->statement);
+}
+
+void HLSLTreeVisitor::VisitArgument(HLSLArgument * node)
+{
+    VisitType(node->type);
+    if (node->defaultValue != NULL) {
+        VisitExpression(node->defaultValue);
+    }
+}
+
+void HLSLTreeVisitor::VisitExpressionStatement(HLSLExpressionStatement * node)
+{
+    VisitExpression(node->expression);
+}
+
+void HLSLTreeVisitor::VisitExpression(HLSLExpression * node)
+{
+    VisitType(*node->expressionType);
+
+    if (node->nodeType == HLSLNodeType::UnaryExpression) {
+        VisitUnaryExpression((HLSLUnaryExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::BinaryExpression) {
+        VisitBinaryExpression((HLSLBinaryExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ConditionalExpression) {
+        VisitConditionalExpression((HLSLConditionalExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::CastingExpression) {
+        VisitCastingExpression((HLSLCastingExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::LiteralExpression) {
+        VisitLiteralExpression((HLSLLiteralExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::IdentifierExpression) {
+        VisitIdentifierExpression((HLSLIdentifierExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ConstructorExpression) {
+        VisitConstructorExpression((HLSLConstructorExpression *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::MemberAccess) {
+        VisitMemberAccess((HLSLMemberAccess *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::ArrayAccess) {
+        VisitArrayAccess((HLSLArrayAccess *)node);
+    }
+    else if (node->nodeType == HLSLNodeType::FunctionCall) {
+        VisitFunctionCall((HLSLFunctionCall *)node);
+    }
+    // Acoget-TODO: This was missing. Did adding it break anything?
+    else if (node->nodeType == HLSLNodeType::SamplerState) {
+        VisitSamplerState((HLSLSamplerState *)node);
+    }
+    else {
+        ASSERT(0);
+    }
+}
+
+void HLSLTreeVisitor::VisitReturnStatement(HLSLReturnStatement * node)
+{
+    VisitExpression(node->expression);
+}
+
+void HLSLTreeVisitor::VisitDiscardStatement(HLSLDiscardStatement * node) {}
+void HLSLTreeVisitor::VisitBreakStatement(HLSLBreakStatement * node) {}
+void HLSLTreeVisitor::VisitContinueStatement(HLSLContinueStatement * node) {}
+
+void HLSLTreeVisitor::VisitIfStatement(HLSLIfStatement * node)
+{
+    VisitExpression(node->condition);
+    VisitStatements(node->statement);
+    if (node->elseStatement) {
+        VisitStatements(node->elseStatement);
+    }
+}
+
+void HLSLTreeVisitor::VisitForStatement(HLSLForStatement * node)
+{
+    if (node->initialization) {
+        VisitDeclaration(node->initialization);
+    }
+    if (node->condition) {
+        VisitExpression(node->condition);
+    }
+    if (node->increment) {
+        VisitExpression(node->increment);
+    }
+    VisitStatements(node->statement);
+}
+
+void HLSLTreeVisitor::VisitBlockStatement(HLSLBlockStatement * node)
+{
+    VisitStatements(node->statement);
+}
+
+void HLSLTreeVisitor::VisitUnaryExpression(HLSLUnaryExpression * node)
+{
+    VisitExpression(node->expression);
+}
+
+void HLSLTreeVisitor::VisitBinaryExpression(HLSLBinaryExpression * node)
+{
+    VisitExpression(node->expression1);
+    VisitExpression(node->expression2);
+}
+
+void HLSLTreeVisitor::VisitConditionalExpression(HLSLConditionalExpression * node)
+{
+    VisitExpression(node->condition);
+    VisitExpression(node->falseExpression);
+    VisitExpression(node->trueExpression);
+}
+
+void HLSLTreeVisitor::VisitCastingExpression(HLSLCastingExpression * node)
+{
+    VisitType(node->type);
+    VisitExpression(node->expression);
+}
+
+void HLSLTreeVisitor::VisitLiteralExpression(HLSLLiteralExpression * node) {}
+void HLSLTreeVisitor::VisitIdentifierExpression(HLSLIdentifierExpression * node) {}
+
+void HLSLTreeVisitor::VisitConstructorExpression(HLSLConstructorExpression * node)
+{
+    HLSLExpression * argument = node->argument;
+    while (argument != NULL) {
+        VisitExpression(argument);
+        argument = argument->nextExpression;
+    }
+}
+
+void HLSLTreeVisitor::VisitMemberAccess(HLSLMemberAccess * node)
+{
+    VisitExpression(node->object);
+}
+
+void HLSLTreeVisitor::VisitArrayAccess(HLSLArrayAccess * node)
+{
+    VisitExpression(node->array);
+    VisitExpression(node->index);
+}
+
+void HLSLTreeVisitor::VisitFunctionCall(HLSLFunctionCall * node)
+{
+    HLSLExpression * argument = node->argument;
+    while (argument != NULL) {
+        VisitExpression(argument);
+        argument = argument->nextExpression;
+    }
+}
+
+void HLSLTreeVisitor::VisitStateAssignment(HLSLStateAssignment * node) {}
+
+void HLSLTreeVisitor::VisitSamplerState(HLSLSamplerState * node)
+{
+    HLSLStateAssignment * stateAssignment = node->stateAssignments;
+    while (stateAssignment != NULL) {
+        VisitStateAssignment(stateAssignment);
+        stateAssignment = stateAssignment->nextStateAssignment;
+    }
+}
+
+void HLSLTreeVisitor::VisitPass(HLSLPass * node)
+{
+    HLSLStateAssignment * stateAssignment = node->stateAssignments;
+    while (stateAssignment != NULL) {
+        VisitStateAssignment(stateAssignment);
+        stateAssignment = stateAssignment->nextStateAssignment;
+    }
+}
+
+void HLSLTreeVisitor::VisitTechnique(HLSLTechnique * node)
+{
+    HLSLPass * pass = node->passes;
+    while (pass != NULL) {
+        VisitPass(pass);
+        pass = pass->nextPass;
+    }
+}
+
+void HLSLTreeVisitor::VisitPipeline(HLSLPipeline * node)
+{
+    // @@ ?
+}
+
+void HLSLTreeVisitor::VisitFunctions(HLSLRoot * root)
+{
+    HLSLStatement * statement = root->statement;
+    while (statement != NULL) {
+        if (statement->nodeType == HLSLNodeType::Function) {
+            VisitFunction((HLSLFunction *)statement);
+        }
+
+        statement = statement->nextStatement;
+    }
+}
+
+void HLSLTreeVisitor::VisitParameters(HLSLRoot * root)
+{
+    HLSLStatement * statement = root->statement;
+    while (statement != NULL) {
+        if (statement->nodeType == HLSLNodeType::Declaration) {
+            VisitDeclaration((HLSLDeclaration *)statement);
+        }
+
+        statement = statement->nextStatement;
+    }
+}
+
+
+HLSLReachability::HLSLReachability(HLSLTree * tree, const char * const * entryNames, int entryCount)
+{
+    m_entryCount = entryCount;
+    m_wordCount = (entryCount + s_wordBits - 1) / s_wordBits;
+
+    // Nodes for the statements that can be hidden, "float a, b;" fields included.
+    for (HLSLStatement * statement = tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        m_statements.push_back(statement);
+
+        if (statement->nodeType == HLSLNodeType::Buffer)
+        {
+            for (HLSLStatement * field = ((HLSLBuffer *)statement)->field; field != NULL; field = field->nextStatement)
+            {
+                ASSERT(field->nodeType == HLSLNodeType::Declaration);
+                for (HLSLDeclaration * declaration = (HLSLDeclaration *)field; declaration != NULL; declaration = declaration->nextDeclaration)
+                {
+                    m_statements.push_back(declaration);
+                }
+            }
+        }
+    }
+
+    // Sorted by address for FindNode, cheaper to build than a hash map.
+    std::sort(m_statements.begin(), m_statements.end());
+    m_bits.assign(m_statements.size() * m_wordCount, 0);
+
+    for (int i = 0; i < entryCount; ++i)
+    {
+        uint32_t node = FindNode(tree->FindFunction(entryNames[i]));
+        if (node != s_noNode)
+        {
+            GetBits(node)[i / s_wordBits] |= Word(1) << (i % s_wordBits);
+        }
+    }
+
+    Propagate(tree);
+}
+
+int HLSLReachability::GetEntryCount() const
+{
+    return m_entryCount;
+}
+
+bool HLSLReachability::IsUsed(const HLSLStatement * statement, int entry) const
+{
+    ASSERT(entry >= 0 && entry < m_entryCount);
+
+    uint32_t node = FindNode(statement);
+    if (node == s_noNode)
+    {
+        return false;
+    }
+    return (GetBits(node)[entry / s_wordBits] >> (entry % s_wordBits)) & 1;
+}
+
+void HLSLReachability::HideUnused(int entry/*=-1*/) const
+{
+    ASSERT(entry >= -1 && entry < m_entryCount);
+
+    for (uint32_t node = 0; node < m_statements.size(); ++node)
+    {
+        const Word* bits = GetBits(node);
+        bool used = false;
+        if (entry >= 0)
+        {
+            used = (bits[entry / s_wordBits] >> (entry % s_wordBits)) & 1;
+        }
+        else
+        {
+            for (int word = 0; word < m_wordCount; ++word)
+            {
+                used = used || bits[word] != 0;
+            }
+        }
+        m_statements[node]->hidden = !used;
+    }
+}
+
+uint32_t HLSLReachability::FindNode(const HLSLStatement * statement) const
+{
+    auto it = std::lower_bound(m_statements.begin(), m_statements.end(), statement);
+    if (it == m_statements.end() || *it != statement)
+    {
+        return s_noNode;
+    }
+    return (uint32_t)(it - m_statements.begin());
+}
+
+void HLSLReachability::Propagate(HLSLTree * tree)
+{
+    // The references of the statements reached from the entry points, as nodes.
+    std::vector<uint32_t> edges;
+    std::vector<uint32_t> firstEdge(m_statements.size() + 1, 0);
+    std::vector<uint32_t> endEdge(m_statements.size(), 0);
+
+    auto addEdge = [&](const HLSLStatement * target)
+    {
+        uint32_t node = target != NULL ? FindNode(target) : s_noNode;
+        if (node != s_noNode)   // Intrinsics aren't part of the tree.
+        {
+            edges.push_back(node);
+        }
+    };
+
+    auto addEdges = [&](uint32_t node)
+    {
+        HLSLStatement * statement = m_statements[node];
+        firstEdge[node] = (uint32_t)edges.size();
+
+        if (statement->nodeType == HLSLNodeType::Function)
+        {
+            addEdge(((HLSLFunction *)statement)->forward);
+        }
+
+        const HLSLReferences& references = tree->GetReferences(statement);
+        for (const HLSLFunction * function : references.functions)
+        {
+            addEdge(function);
+        }
+        for (const char * name : references.globals)
+        {
+            addEdge(tree->FindGlobalDeclaration(name));
+        }
+        for (const char * name : references.types)
+        {
+            addEdge(tree->FindGlobalStruct(name));
+        }
+
+        endEdge[node] = (uint32_t)edges.size();
+    };
+
+    // Depth first walk from the entry points, giving the nodes in post order.
+    const uint32_t unvisited = ~0u;
+    std::vector<uint32_t> rank(m_statements.size(), unvisited);
+    std::vector<uint32_t> order;
+    std::vector<std::pair<uint32_t, uint32_t>> stack;     // Node and next edge.
+
+    for (uint32_t entry = 0; entry < m_statements.size(); ++entry)
+    {
+        const Word* bits = GetBits(entry);
+        bool isEntry = false;
+        for (int word = 0; word < m_wordCount; ++word)
+        {
+            isEntry = isEntry || bits[word] != 0;
+        }
+        if (!isEntry || rank[entry] != unvisited)
+        {
+            continue;
+        }
+
+        rank[entry] = 0;
+        addEdges(entry);
+        stack.push_back(std::make_pair(entry, firstEdge[entry]));
+
+        while (!stack.empty())
+        {
+            uint32_t node = stack.back().first;
+            uint32_t edge = stack.back().second;
+            if (edge < endEdge[node])
+            {
+                ++stack.back().second;
+
+                uint32_t target = edges[edge];
+                if (rank[target] == unvisited)
+                {
+                    rank[target] = 0;
+                    addEdges(target);
+                    stack.push_back(std::make_pair(target, firstEdge[target]));
+                }
+            }
+            else
+            {
+                stack.pop_back();
+                rank[node] = (uint32_t)order.size();
+                order.push_back(node);
+            }
+        }
+    }
+
+    // In reverse post order the statements get all the bits of their callers
+    // before passing them on, unless a cycle leads back to them: those are
+    // passed on again afterwards.
+    std::vector<uint32_t> pending;
+    std::vector<bool> isPending(m_statements.size(), false);
+
+    auto pass = [&](uint32_t node, bool ordered)
+    {
+        const Word* bits = GetBits(node);
+        for (uint32_t edge = firstEdge[node]; edge < endEdge[node]; ++edge)
+        {
+            uint32_t target = edges[edge];
+            Word* targetBits = GetBits(target);
+            bool changed = false;
+            for (int word = 0; word < m_wordCount; ++word)
+            {
+                changed = changed || (bits[word] & ~targetBits[word]) != 0;
+                targetBits[word] |= bits[word];
+            }
+
+            bool passed = !ordered || rank[target] >= rank[node];
+            if (changed && passed && !isPending[target])
+            {
+                isPending[target] = true;
+                pending.push_back(target);
+            }
+        }
+    };
+
+    for (size_t i = order.size(); i-- > 0;)
+    {
+        pass(order[i], true);
+    }
+
+    while (!pending.empty())
+    {
+        uint32_t node = pending.back();
+        pending.pop_back();
+        isPending[node] = false;
+        pass(node, false);
+    }
+
+    // Buffers are used through their fields.
+    for (HLSLStatement * statement = tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        if (statement->nodeType == HLSLNodeType::Buffer)
+        {
+            Word* bufferBits = GetBits(FindNode(statement));
+            for (HLSLStatement * field = ((HLSLBuffer *)statement)->field; field != NULL; field = field->nextStatement)
+            {
+                for (HLSLDeclaration * declaration = (HLSLDeclaration *)field; declaration != NULL; declaration = declaration->nextDeclaration)
+                {
+                    const Word* bits = GetBits(FindNode(declaration));
+                    for (int word = 0; word < m_wordCount; ++word)
+                    {
+                        bufferBits[word] |= bits[word];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void PruneTree(HLSLTree* tree, const char* entryName0, const char* entryName1/*=NULL*/)
+{
+    const char* entryNames[] = { entryName0, entryName1 };
+    PruneTree(tree, entryNames, entryName1 != NULL ? 2 : 1);
+}
+
+void PruneTree(HLSLTree* tree, const char* const* entryNames, int entryCount)
+{
+    HLSLReachability reachability(tree, entryNames, entryCount);
+    reachability.HideUnused();
+}
+
+
+void SortTree(HLSLTree * tree)
+{
+    // Stable sort so that statements are in this order:
+    // structs, declarations, functions, techniques.
+	// but their relative order is preserved.
+
+    HLSLRoot* root = tree->GetRoot();
+
+    HLSLStatement* structs = NULL;
+    HLSLStatement* lastStruct = NULL;
+    HLSLStatement* constDeclarations = NULL;
+    HLSLStatement* lastConstDeclaration = NULL;
+    HLSLStatement* declarations = NULL;
+    HLSLStatement* lastDeclaration = NULL;
+    HLSLStatement* functions = NULL;
+    HLSLStatement* lastFunction = NULL;
+    HLSLStatement* other = NULL;
+    HLSLStatement* lastOther = NULL;
+
+    HLSLStatement* statement = root->statement;
+    while (statement != NULL) {
+        HLSLStatement* nextStatement = statement->nextStatement;
+        statement->nextStatement = NULL;
+
+        if (statement->nodeType == HLSLNodeType::Struct) {
+            if (structs == NULL) structs = statement;
+            if (lastStruct != NULL) lastStruct->nextStatement = statement;
+            lastStruct = statement;
+        }
+        else if (statement->nodeType == HLSLNodeType::Declaration || statement->nodeType == HLSLNodeType::Buffer) {
+            if (statement->nodeType == HLSLNodeType::Declaration && (((HLSLDeclaration *)statement)->type.flags & (int)HLSLTypeFlags::Const)) {
+                if (constDeclarations == NULL) constDeclarations = statement;
+                if (lastConstDeclaration != NULL) lastConstDeclaration->nextStatement = statement;
+                lastConstDeclaration = statement;
+            }
+            else {
+                if (declarations == NULL) declarations = statement;
+                if (lastDeclaration != NULL) lastDeclaration->nextStatement = statement;
+                lastDeclaration = statement;
+            }
+        }
+        else if (statement->nodeType == HLSLNodeType::Function) {
+            if (functions == NULL) functions = statement;
+            if (lastFunction != NULL) lastFunction->nextStatement = statement;
+            lastFunction = statement;
+        }
+        else {
+            if (other == NULL) other = statement;
+            if (lastOther != NULL) lastOther->nextStatement = statement;
+            lastOther = statement;
+        }
+
+        statement = nextStatement;
+    }
+
+    // Chain all the statements in the order that we want.
+    HLSLStatement * firstStatement = structs;
+    HLSLStatement * lastStatement = lastStruct;
+
+    if (constDeclarations != NULL) {
+        if (firstStatement == NULL) firstStatement = constDeclarations;
+        else lastStatement->nextStatement = constDeclarations;
+        lastStatement = lastConstDeclaration;
+    }
+
+    if (declarations != NULL) {
+        if (firstStatement == NULL) firstStatement = declarations;
+        else lastStatement->nextStatement = declarations;
+        lastStatement = lastDeclaration;
+    }
+
+    if (functions != NULL) {
+        if (firstStatement == NULL) firstStatement = functions;
+        else lastStatement->nextStatement = functions;
+        lastStatement = lastFunction;
+    }
+
+    if (other != NULL) {
+        if (firstStatement == NULL) firstStatement = other;
+        else lastStatement->nextStatement = other;
+        lastStatement = lastOther;
+    }
+
+    root->statement = firstStatement;
+    tree->InvalidateIndex();
+}
+
+
+
+
+
+// First and last can be the same.
+void AddStatements(HLSLRoot * root, HLSLStatement * before, HLSLStatement * first, HLSLStatement * last)
+{
+    if (before == NULL) {
+        last->nextStatement = root->statement;
+        root->statement = first;
+    }
+    else {
+        last->nextStatement = before->nextStatement;
+        before->nextStatement = first;
+    }
+}
+
+void AddSingleStatement(HLSLRoot * root, HLSLStatement * before, HLSLStatement * statement)
+{
+    AddStatements(root, before, statement, statement);
+}
+
+
+
+// @@ This is very game-specific. Should be moved to pipeline_parser or somewhere else.
+void GroupParameters(HLSLTree * tree)
+{
+    // Sort parameters based on semantic and group them in cbuffers.
+
+    HLSLRoot* root = tree->GetRoot();
+
+    HLSLDeclaration * firstPerItemDeclaration = NULL;
+    HLSLDeclaration * lastPerItemDeclaration = NULL;
+
+    HLSLDeclaration * instanceDataDeclaration = NULL;
+
+    HLSLDeclaration * firstPerPassDeclaration = NULL;
+    HLSLDeclaration * lastPerPassDeclaration = NULL;
+
+    HLSLDeclaration * firstPerItemSampler = NULL;
+    HLSLDeclaration * lastPerItemSampler = NULL;
+
+    HLSLDeclaration * firstPerPassSampler = NULL;
+    HLSLDeclaration * lastPerPassSampler = NULL;
+
+    HLSLStatement * statementBeforeBuffers = NULL;
+    
+    HLSLStatement* previousStatement = NULL;
+    HLSLStatement* statement = root->statement;
+    while (statement != NULL)
+    {
+        HLSLStatement* nextStatement = statement->nextStatement;
+
+        if (statement->nodeType == HLSLNodeType::Struct) // Do not remove this, or it will mess the else clause below.
+        {   
+            statementBeforeBuffers = statement;
+        }
+        else if (statement->nodeType == HLSLNodeType::Declaration)
+        {
+            HLSLDeclaration* declaration = (HLSLDeclaration*)statement;
+
+            // We insert buffers after the last const declaration.
+            if ((declaration->type.flags & (int)HLSLTypeFlags::Const) != 0)
+            {
+                statementBeforeBuffers = statement;
+            }
+
+            // Do not move samplers or static/const parameters.
+            if ((declaration->type.flags & ((int)HLSLTypeFlags::Static | (int)HLSLTypeFlags::Const)) == 0)
+            {
+                // Unlink statement.
+                statement->nextStatement = NULL;
+                if (previousStatement != NULL) previousStatement->nextStatement = nextStatement;
+                else root->statement = nextStatement;
+
+                while(declaration != NULL)
+                {
+                    HLSLDeclaration* nextDeclaration = declaration->nextDeclaration;
+
+                    if (declaration->semantic != NULL && String_EqualNoCase(declaration->semantic, "PER_INSTANCED_ITEM"))
+                    {
+                        ASSERT(instanceDataDeclaration == NULL);
+                        instanceDataDeclaration = declaration;
+                    }
+                    else
+                    {
+                        // Select group based on type and semantic.
+                        HLSLDeclaration ** first, ** last;
+                        if (declaration->semantic == NULL || String_EqualNoCase(declaration->semantic, "PER_ITEM") || String_EqualNoCase(declaration->semantic, "PER_MATERIAL"))
+                        {
+                            if (IsSamplerType(declaration->type))
+                            {
+                                first = &firstPerItemSampler;
+                                last = &lastPerItemSampler;
+                            }
+                            else
+                            {
+                                first = &firstPerItemDeclaration;
+                                last = &lastPerItemDeclaration;
+                            }
+                        }
+                        else
+                        {
+                            if (IsSamplerType(declaration->type))
+                            {
+                                first = &firstPerPassSampler;
+                                last = &lastPerPassSampler;
+                            }
+                            else
+                            {
+                                first = &firstPerPassDeclaration;
+                                last = &lastPerPassDeclaration;
+                            }
+                        }
+
+                        // Add declaration to new list.
+                        if (*first == NULL) *first = declaration;
+                        else (*last)->nextStatement = declaration;
+                        *last = declaration;
+                    }
+
+                    // Unlink from declaration list.
+                    declaration->nextDeclaration = NULL;
+
+                    // Reset attributes.
+                    declaration->registerName = NULL;
+                    //declaration->semantic = NULL;         // @@ Don't do this!
+
+                    declaration = nextDeclaration;
+                }
+            }
+        }
+        /*else
+        {
+            if (statementBeforeBuffers == NULL) {
+                // This is the location where we will insert our buffers.
+                statementBeforeBuffers = previousStatement;
+            }
+        }*/
+
+        if (statement->nextStatement == nextStatement) {
+            previousStatement = statement;
+        }
+        statement = nextStatement;
+    }
+
+
+    // Add instance data declaration at the end of the per_item buffer.
+    if (instanceDataDeclaration != NULL)
+    {
+        if (firstPerItemDeclaration == NULL) firstPerItemDeclaration = instanceDataDeclaration;
+        else lastPerItemDeclaration->nextStatement = instanceDataDeclaration;
+    }
+
+
+    // Add samplers.
+    if (firstPerItemSampler != NULL) {
+        AddStatements(root, statementBeforeBuffers, firstPerItemSampler, lastPerItemSampler);
+        statementBeforeBuffers = lastPerItemSampler;
+    }
+    if (firstPerPassSampler != NULL) {
+        AddStatements(root, statementBeforeBuffers, firstPerPassSampler, lastPerPassSampler);
+        statementBeforeBuffers = lastPerPassSampler;
+    }
+
+
+    // @@ We are assuming per_item and per_pass buffers don't already exist. @@ We should assert on that.
+
+    if (firstPerItemDeclaration != NULL)
+    {
+        // Create buffer statement.
+        HLSLBuffer * perItemBuffer = tree->AddNode<HLSLBuffer>(firstPerItemDeclaration->fileName, firstPerItemDeclaration->line-1);
+        perItemBuffer->name = tree->AddString("per_item");
+        perItemBuffer->registerName = tree->AddString("b0");
+        perItemBuffer->field = firstPerItemDeclaration;
+        
+        // Set declaration buffer pointers.
+        HLSLDeclaration * field = perItemBuffer->field;
+        while (field != NULL)
+        {
+            field->buffer = perItemBuffer;
+            field = (HLSLDeclaration *)field->nextStatement;
+        }
+
+        // Add buffer to statements.
+        AddSingleStatement(root, statementBeforeBuffers, perItemBuffer);
+        statementBeforeBuffers = perItemBuffer;
+    }
+
+    if (firstPerPassDeclaration != NULL)
+    {
+        // Create buffer statement.
+        HLSLBuffer * perPassBuffer = tree->AddNode<HLSLBuffer>(firstPerPassDeclaration->fileName, firstPerPassDeclaration->line-1);
+        perPassBuffer->name = tree->AddString("per_pass");
+        perPassBuffer->registerName = tree->AddString("b1");
+        perPassBuffer->field = firstPerPassDeclaration;
+
+        // Set declaration buffer pointers.
+        HLSLDeclaration * field = perPassBuffer->field;
+        while (field != NULL)
+        {
+            field->buffer = perPassBuffer;
+            field = (HLSLDeclaration *)field->nextStatement;
+        }
+        
+        // Add buffer to statements.
+        AddSingleStatement(root, statementBeforeBuffers, perPassBuffer);
+    }
+
+    tree->InvalidateIndex();
+}
+
+
+class FindArgumentVisitor : public HLSLIterativeTreeVisitor<FindArgumentVisitor>
+{
+public:
+    bool found;
+    const char * name;
+
+	FindArgumentVisitor()
+	{
+		found = false;
+		name  = NULL;
+	}
+
+    bool FindArgument(const char * name, HLSLFunction * function)
+    {
+        this->found = false;
+        this->name = name;
+        WalkList(function->statement);
+        return found;
+    }
+
+    bool EnterNode(HLSLNode * node)
+    {
+        if (node->nodeType == HLSLNodeType::IdentifierExpression && ((HLSLIdentifierExpression *)node)->name == name)
+        {
+            found = true;
+            Stop();
+        }
+        return true;
+    }
+};
+
+
+void HideUnusedArguments(HLSLFunction * function)
+{
+    FindArgumentVisitor visitor;
+ 
+    // For each argument.
+    HLSLArgument * arg = function->argument;
+    while (arg != NULL)
+    {
+        if (!visitor.FindArgument(arg->name, function))
+        {
+            arg->hidden = true;
+        }
+
+        arg = arg->nextArgument;
+    }
+}
+
+bool EmulateAlphaTest(HLSLTree* tree, const char* entryName, float alphaRef/*=0.5*/)
+{
+    // Find all return statements of this entry point.
+    HLSLFunction* entry = tree->FindFunction(entryName);
+    if (entry != NULL)
+    {
+        HLSLStatement ** ptr = &entry->statement;
+        HLSLStatement * statement = entry->statement;
+        while (statement != NULL)
+        {
+            if (statement->nodeType == HLSLNodeType::ReturnStatement)
+            {
+                HLSLReturnStatement * returnStatement = (HLSLReturnStatement *)statement;
+                HLSLBaseType returnType = returnStatement->expression->expressionType->baseType;
+                
+                // Build statement: "if (%s.a < 0.5) discard;"
+
+                HLSLDiscardStatement * discard = tree->AddNode<HLSLDiscardStatement>(statement->fileName, statement->line);
+                
+                HLSLExpression * alpha = NULL;
+                if (returnType == HLSLBaseType::Float4 || returnType == HLSLBaseType::Half4)
+                {
+                    // @@ If return expression is a constructor, grab 4th argument.
+                    // That's not as easy, since we support 'float4(float3, float)' or 'float4(float, float3)', extracting
+                    // the latter is not that easy.
+                    /*if (returnStatement->expression->nodeType == HLSLNodeType::ConstructorExpression) {
+                        HLSLConstructorExpression * constructor = (HLSLConstructorExpression *)returnStatement->expression;
+                        //constructor->
+                    }
+                    */
+                    
+                    if (alpha == NULL) {
+                        HLSLMemberAccess * access = tree->AddNode<HLSLMemberAccess>(statement->fileName, statement->line);
+                        access->expressionType = tree->AddType(HLSLType(HLSLBaseType::Float));
+                        access->object = returnStatement->expression;     // @@ Is reference OK? Or should we clone expression?
+                        access->field = tree->AddString("a");
+                        access->swizzle = true;
+                        
+                        alpha = access;
+                    }
+                }
+                else if (returnType == HLSLBaseType::Float || returnType == HLSLBaseType::Half)
+                {
+                    alpha = returnStatement->expression;     // @@ Is reference OK? Or should we clone expression?
+                }
+                else
+                {
+                    return false;
+                }
+                
+                HLSLLiteralExpression * threshold = tree->AddNode<HLSLLiteralExpression>(statement->fileName, statement->line);
+                threshold->expressionType = tree->AddType(HLSLType(HLSLBaseType::Float));
+                threshold->fValue = alphaRef;
+                threshold->type = HLSLBaseType::Float;
+                
+                HLSLBinaryExpression * condition = tree->AddNode<HLSLBinaryExpression>(statement->fileName, statement->line);
+                condition->expressionType = tree->AddType(HLSLType(HLSLBaseType::Bool));
+                condition->binaryOp = HLSLBinaryOp::Less;
+                condition->expression1 = alpha;
+                condition->expression2 = threshold;
+
+                // Insert statement.
+                HLSLIfStatement * st = tree->AddNode<HLSLIfStatement>(statement->fileName, statement->line);
+                st->condition = condition;
+                st->statement = discard;
+                st->nextStatement = statement;
+                *ptr = st;
+            }
+        
+            ptr = &statement->nextStatement;
+            statement = statement->nextStatement;
+        }
+    }
+
+    tree->InvalidateIndex();
+    return true;
+}
+
+// Iterative, argument lists and nested expressions of generated shaders can be very long.
+bool NeedsFlattening(HLSLExpression * expr, int level = 0) {
+    std::vector<std::pair<HLSLExpression *, int>> stack;
+    stack.emplace_back(expr, level);
+    while (!stack.empty()) {
+        expr = stack.back().first;
+        level = stack.back().second;
+        stack.pop_back();
+
+        // The expression and the ones following it in its list.
+        for (; expr != NULL; expr = expr->nextExpression) {
+            if (expr->nodeType == HLSLNodeType::UnaryExpression) {
+                HLSLUnaryExpression * unaryExpr = (HLSLUnaryExpression *)expr;
+                stack.emplace_back(unaryExpr->expression, level+1);
+            }
+            else if (expr->nodeType == HLSLNodeType::BinaryExpression) {
+                HLSLBinaryExpression * binaryExpr = (HLSLBinaryExpression *)expr;
+                if (!IsAssignOp(binaryExpr->binaryOp)) {
+                    stack.emplace_back(binaryExpr->expression1, level+1);
+                }
+                stack.emplace_back(binaryExpr->expression2, level+1);
+            }
+            else if (expr->nodeType == HLSLNodeType::ConditionalExpression) {
+                HLSLConditionalExpression * conditionalExpr = (HLSLConditionalExpression *)expr;
+                stack.emplace_back(conditionalExpr->condition, level+1);
+                stack.emplace_back(conditionalExpr->trueExpression, level+1);
+                stack.emplace_back(conditionalExpr->falseExpression, level+1);
+            }
+            else if (expr->nodeType == HLSLNodeType::CastingExpression) {
+                HLSLCastingExpression * castingExpr = (HLSLCastingExpression *)expr;
+                stack.emplace_back(castingExpr->expression, level+1);
+            }
+            else if (expr->nodeType == HLSLNodeType::LiteralExpression) {
+            }
+            else if (expr->nodeType == HLSLNodeType::IdentifierExpression) {
+            }
+            else if (expr->nodeType == HLSLNodeType::ConstructorExpression) {
+                HLSLConstructorExpression * constructorExpr = (HLSLConstructorExpression *)expr;
+                stack.emplace_back(constructorExpr->argument, level+1);
+            }
+            else if (expr->nodeType == HLSLNodeType::MemberAccess) {
+                // The expressions following a member access are checked one level deeper.
+                ++level;
+            }
+            else if (expr->nodeType == HLSLNodeType::ArrayAccess) {
+                HLSLArrayAccess * arrayAccess = (HLSLArrayAccess *)expr;
+                stack.emplace_back(arrayAccess->array, level+1);
+                stack.emplace_back(arrayAccess->index, level+1);
+            }
+            else if (expr->nodeType == HLSLNodeType::FunctionCall) {
+                HLSLFunctionCall * functionCall = (HLSLFunctionCall *)expr;
+                if (functionCall->function->numOutputArguments > 0) {
+                    if (level > 0) {
+                        return true;
+                    }
+                }
+                stack.emplace_back(functionCall->argument, level+1);
+            }
+            else {
+                //assert(false);
+                break;
+            }
+        }
+    }
+    return false;
+}
+
+
+struct StatementList {
+    HLSLStatement * head = NULL;
+    HLSLStatement * tail = NULL;
+    void append(HLSLStatement * st) {
+        if (head == NULL) {
+            tail = head = st;
+        }
+        tail->nextStatement = st;
+        tail = st;
+    }
+};
+
+/** Declares the local name where node is, with value as initial value unless NULL. */
+static HLSLDeclaration * AddLocalDeclaration(HLSLTree * tree, const HLSLNode * node, const char * name, const HLSLType & type, HLSLExpression * value)
+{
+    HLSLDeclaration * declaration = tree->AddNode<HLSLDeclaration>(node->fileName, node->line);
+    declaration->name = name;
+    declaration->type = type;
+    declaration->assignment = value;
+    return declaration;
+}
+
+/** Declares the local name holding the value of expr, which becomes its initial value. */
+static HLSLDeclaration * AddTemporaryDeclaration(HLSLTree * tree, const char * name, HLSLExpression * expr)
+{
+    assert(expr->expressionType->baseType != HLSLBaseType::Void);
+    return AddLocalDeclaration(tree, expr, name, *expr->expressionType, expr);
+}
+
+/** Names the local declared by AddTemporaryDeclaration, in place of expr. */
+static HLSLIdentifierExpression * AddTemporaryIdentifier(HLSLTree * tree, const HLSLDeclaration * declaration, const HLSLExpression * expr)
+{
+    HLSLIdentifierExpression * ident = tree->AddNode<HLSLIdentifierExpression>(expr->fileName, expr->line);
+    ident->name = declaration->name;
+    ident->expressionType = tree->AddType(declaration->type);
+    return ident;
+}
+
+
+    class ExpressionFlattener : public HLSLStaticTreeVisitor<ExpressionFlattener>
+    {
+    public:
+        HLSLTree * m_tree;
+        int tmp_index;
+        HLSLStatement ** statement_pointer;
+        HLSLFunction * current_function;
+        
+        ExpressionFlattener()
+        {
+            m_tree = NULL;
+            tmp_index = 0;
+            statement_pointer = NULL;
+            current_function = NULL;
+        }
+        
+        void FlattenExpressions(HLSLTree * tree)
+        {
+            m_tree = tree;
+            VisitRoot(tree->GetRoot());
+        }
+
+        // Visit all statements updating the statement_pointer so that we can insert and replace statements. @@ Add this to the default visitor?
+        void VisitFunction(HLSLFunction * node)
+        {
+            current_function = node;
+            statement_pointer = &node->statement;
+            VisitStatements(node->statement);
+            statement_pointer = NULL;
+            current_function = NULL;
+        }
+
+        void VisitIfStatement(HLSLIfStatement * node)
+        {
+            // Else-if chains are followed in a loop, so long chains don't overflow the stack.
+            while (true) {
+                if (NeedsFlattening(node->condition, 1)) {
+                    assert(false);  // @@ Add statements before if statement.
+                }
+
+                statement_pointer = &node->statement;
+                VisitStatements(node->statement);
+
+                HLSLStatement * elseStatement = node->elseStatement;
+                if (elseStatement != NULL && elseStatement->nodeType == HLSLNodeType::IfStatement && elseStatement->nextStatement == NULL) {
+                    node = (HLSLIfStatement *)elseStatement;
+                    continue;
+                }
+                if (elseStatement) {
+                    statement_pointer = &node->elseStatement;
+                    VisitStatements(node->elseStatement);
+                }
+                break;
+            }
+        }
+        
+        void VisitForStatement(HLSLForStatement * node)
+        {
+            if (NeedsFlattening(node->initialization->assignment, 1)) {
+                assert(false);  // @@ Add statements before for statement.
+            }
+            if (NeedsFlattening(node->condition, 1) || NeedsFlattening(node->increment, 1)) {
+                assert(false);  // @@ These are tricky to implement. Need to handle all loop exits.
+            }
+
+            statement_pointer = &node->statement;
+            VisitStatements(node->statement);
+        }
+        
+        void VisitBlockStatement(HLSLBlockStatement * node)
+        {
+            statement_pointer = &node->statement;
+            VisitStatements(node->statement);
+        }
+        
+        void VisitStatements(HLSLStatement * statement)
+        {
+            while (statement != NULL) {
+                VisitStatement(statement);
+                statement_pointer = &statement->nextStatement;
+                statement = statement->nextStatement;
+            }
+        }
+
+        // This is usually a function call or assignment.
+        void VisitExpressionStatement(HLSLExpressionStatement * node)
+        {
+            if (NeedsFlattening(node->expression, 0))
+            {
+                StatementList statements;
+                Flatten(node->expression, statements, false);
+                
+                // Link beginning of statement list.
+                *statement_pointer = statements.head;
+
+                // Link end of statement list.
+                HLSLStatement * tail = statements.tail;
+                tail->nextStatement = node->nextStatement;
+                
+                // Update statement pointer.
+                statement_pointer = &tail->nextStatement;
+                
+                // @@ Delete node?
+            }
+        }
+
+        void VisitDeclaration(HLSLDeclaration * node)
+        {
+            // Skip global declarations.
+            if (statement_pointer == NULL) return;
+            
+            if (NeedsFlattening(node->assignment, 1))
+            {
+                StatementList statements;
+                HLSLIdentifierExpression * ident = Flatten(node->assignment, statements, true);
+                
+                // @@ Delete node->assignment?
+                
+                node->assignment = ident;
+                statements.append(node);
+                
+                // Link beginning of statement list.
+                *statement_pointer = statements.head;
+                
+                // Link end of statement list.
+                HLSLStatement * tail = statements.tail;
+                tail->nextStatement = node->nextStatement;
+                
+                // Update statement pointer.
+                statement_pointer = &tail->nextStatement;
+            }
+        }
+
+        void VisitReturnStatement(HLSLReturnStatement * node)
+        {
+            if (NeedsFlattening(node->expression, 1))
+            {
+                StatementList statements;
+                HLSLIdentifierExpression * ident = Flatten(node->expression, statements, true);
+
+                // @@ Delete node->expression?
+                
+                node->expression = ident;
+                statements.append(node);
+                
+                // Link beginning of statement list.
+                *statement_pointer = statements.head;
+                
+                // Link end of statement list.
+                HLSLStatement * tail = statements.tail;
+                tail->nextStatement = node->nextStatement;
+                
+                // Update statement pointer.
+                statement_pointer = &tail->nextStatement;
+            }
+        }
+
+        
+        HLSLDeclaration * BuildTemporaryDeclaration(HLSLExpression * expr)
+        {
+            return AddTemporaryDeclaration(m_tree, m_tree->AddStringFormat("tmp%d", tmp_index++), expr);
+        }
+
+        HLSLExpressionStatement * BuildExpressionStatement(HLSLExpression * expr)
+        {
+            HLSLExpressionStatement * statement = m_tree->AddNode<HLSLExpressionStatement>(expr->fileName, expr->line);
+            statement->expression = expr;
+            return statement;
+        }
+
+        HLSLIdentifierExpression * AddExpressionStatement(HLSLExpression * expr, StatementList & statements, bool wantIdent)
+        {
+            if (wantIdent) {
+                HLSLDeclaration * declaration = BuildTemporaryDeclaration(expr);
+                statements.append(declaration);
+                return AddTemporaryIdentifier(m_tree, declaration, expr);
+            }
+            else {
+                HLSLExpressionStatement * statement = BuildExpressionStatement(expr);
+                statements.append(statement);
+                return NULL;
+            }
+        }
+        
+        HLSLIdentifierExpression * Flatten(HLSLExpression * expr, StatementList & statements, bool wantIdent = true)
+        {
+            if (!NeedsFlattening(expr, wantIdent)) {
+                return AddExpressionStatement(expr, statements, wantIdent);
+            }
+            
+            if (expr->nodeType == HLSLNodeType::UnaryExpression) {
+                assert(expr->nextExpression == NULL);
+                
+                HLSLUnaryExpression * unaryExpr = (HLSLUnaryExpression *)expr;
+                
+                HLSLIdentifierExpression * tmp = Flatten(unaryExpr->expression, statements, true);
+                
+                HLSLUnaryExpression * newUnaryExpr = m_tree->AddNode<HLSLUnaryExpression>(unaryExpr->fileName, unaryExpr->line);
+                newUnaryExpr->unaryOp = unaryExpr->unaryOp;
+                newUnaryExpr->expression = tmp;
+                newUnaryExpr->expressionType = unaryExpr->expressionType;
+
+                return AddExpressionStatement(newUnaryExpr, statements, wantIdent);
+            }
+            else if (expr->nodeType == HLSLNodeType::BinaryExpression) {
+                assert(expr->nextExpression == NULL);
+                
+                HLSLBinaryExpression * binaryExpr = (HLSLBinaryExpression *)expr;
+                
+                if (IsAssignOp(binaryExpr->binaryOp)) {
+                    // Flatten right hand side only.
+                    HLSLIdentifierExpression * tmp2 = Flatten(binaryExpr->expression2, statements, true);
+                    
+                    HLSLBinaryExpression * newBinaryExpr = m_tree->AddNode<HLSLBinaryExpression>(binaryExpr->fileName, binaryExpr->line);
+                    newBinaryExpr->binaryOp = binaryExpr->binaryOp;
+                    newBinaryExpr->expression1 = binaryExpr->expression1;
+                    newBinaryExpr->expression2 = tmp2;
+                    newBinaryExpr->expressionType = binaryExpr->expressionType;
+                    
+                    return AddExpressionStatement(newBinaryExpr, statements, wantIdent);
+                }
+                else {
+                    HLSLIdentifierExpression * tmp1 = Flatten(binaryExpr->expression1, statements, true);
+                    HLSLIdentifierExpression * tmp2 = Flatten(binaryExpr->expression2, statements, true);
+
+                    HLSLBinaryExpression * newBinaryExpr = m_tree->AddNode<HLSLBinaryExpression>(binaryExpr->fileName, binaryExpr->line);
+                    newBinaryExpr->binaryOp = binaryExpr->binaryOp;
+                    newBinaryExpr->expression1 = tmp1;
+                    newBinaryExpr->expression2 = tmp2;
+                    newBinaryExpr->expressionType = binaryExpr->expressionType;
+                    
+                    return AddExpressionStatement(newBinaryExpr, statements, wantIdent);
+                }
+            }
+            else if (expr->nodeType == HLSLNodeType::ConditionalExpression) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::CastingExpression) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::LiteralExpression) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::IdentifierExpression) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::ConstructorExpression) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::MemberAccess) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::ArrayAccess) {
+                assert(false);
+            }
+            else if (expr->nodeType == HLSLNodeType::FunctionCall) {
+                HLSLFunctionCall * functionCall = (HLSLFunctionCall *)expr;
+
+                // @@ Output function as is?
+                // @@ We have to flatten function arguments! This is tricky, need to handle input/output arguments.
+                assert(!NeedsFlattening(functionCall->argument));
+                
+                return AddExpressionStatement(expr, statements, wantIdent);
+            }
+            else {
+                assert(false);
+            }
+            return NULL;
+        }
+    };
+
+    
+void FlattenExpressions(HLSLTree* tree) {
+    ExpressionFlattener flattener;
+    flattener.FlattenExpressions(tree);
+    tree->InvalidateIndex();
 }
 
-void HLSLTreeVisitor::VisitArgument(HLSLArgument * node)
-{
-    VisitType(node->type);
-    if (node->defaultValue != NULL) {
-        VisitExpression(node->defaultValue);
-    }
+void FlattenExpressions(HLSLTree* tree, HLSLFunction* function) {
+    ExpressionFlattener flattener;
+    flattener.m_tree = tree;
+    flattener.VisitFunction(function);
 }
 
-void HLSLTreeVisitor::VisitExpressionStatement(HLSLExpressionStatement * node)
+/** Calls visit with a reference to each expression right below node. */
+template <class Visit>
+static void ForEachChildExpression(HLSLNode * node, Visit visit)
 {
-    VisitExpression(node->expression);
+    switch (node->nodeType)
+    {
+    case HLSLNodeType::Declaration:
+        for (HLSLExpression ** value = &static_cast<HLSLDeclaration *>(node)->assignment; *value != NULL; value = &(*value)->nextExpression)
+        {
+            visit(*value);
+        }
+        break;
+    case HLSLNodeType::Argument:
+        if (static_cast<HLSLArgument *>(node)->defaultValue != NULL) visit(static_cast<HLSLArgument *>(node)->defaultValue);
+        break;
+    case HLSLNodeType::ExpressionStatement:
+        if (static_cast<HLSLExpressionStatement *>(node)->expression != NULL) visit(static_cast<HLSLExpressionStatement *>(node)->expression);
+        break;
+    case HLSLNodeType::ReturnStatement:
+        if (static_cast<HLSLReturnStatement *>(node)->expression != NULL) visit(static_cast<HLSLReturnStatement *>(node)->expression);
+        break;
+    case HLSLNodeType::IfStatement:
+        if (static_cast<HLSLIfStatement *>(node)->condition != NULL) visit(static_cast<HLSLIfStatement *>(node)->condition);
+        break;
+    case HLSLNodeType::ForStatement:
+        {
+            HLSLForStatement * forStatement = static_cast<HLSLForStatement *>(node);
+            if (forStatement->condition != NULL) visit(forStatement->condition);
+            if (forStatement->increment != NULL) visit(forStatement->increment);
+            break;
+        }
+    case HLSLNodeType::UnaryExpression:
+        visit(static_cast<HLSLUnaryExpression *>(node)->expression);
+        break;
+    case HLSLNodeType::BinaryExpression:
+        visit(static_cast<HLSLBinaryExpression *>(node)->expression1);
+        visit(static_cast<HLSLBinaryExpression *>(node)->expression2);
+        break;
+    case HLSLNodeType::ConditionalExpression:
+        visit(static_cast<HLSLConditionalExpression *>(node)->condition);
+        visit(static_cast<HLSLConditionalExpression *>(node)->trueExpression);
+        visit(static_cast<HLSLConditionalExpression *>(node)->falseExpression);
+        break;
+    case HLSLNodeType::CastingExpression:
+        visit(static_cast<HLSLCastingExpression *>(node)->expression);
+        break;
+    case HLSLNodeType::MemberAccess:
+        visit(static_cast<HLSLMemberAccess *>(node)->object);
+        break;
+    case HLSLNodeType::ArrayAccess:
+        visit(static_cast<HLSLArrayAccess *>(node)->array);
+        visit(static_cast<HLSLArrayAccess *>(node)->index);
+        break;
+    case HLSLNodeType::ConstructorExpression:
+        for (HLSLExpression ** argument = &static_cast<HLSLConstructorExpression *>(node)->argument; *argument != NULL; argument = &(*argument)->nextExpression)
+        {
+            visit(*argument);
+        }
+        break;
+    case HLSLNodeType::FunctionCall:
+        for (HLSLExpression ** argument = &static_cast<HLSLFunctionCall *>(node)->argument; *argument != NULL; argument = &(*argument)->nextExpression)
+        {
+            visit(*argument);
+        }
+        break;
+    default:
+        break;
+    }
 }
 
-void HLSLTreeVisitor::VisitExpression(HLSLExpression * node)
+/**
+ * Returns true if evaluating the expression, besides those below it, may write
+ * a variable. Given the functions of the shader, the callees aren't read, as
+ * their bodies may be changing on other threads.
+ */
+static bool HasSideEffect(const HLSLNode * node, const HLSLFunctionSet * shaderFunctions = NULL)
 {
-    VisitType(node->expressionType);
-
-    if (node->nodeType == HLSLNodeType::UnaryExpression) {
-        VisitUnaryExpression((HLSLUnaryExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::BinaryExpression) {
-        VisitBinaryExpression((HLSLBinaryExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::ConditionalExpression) {
-        VisitConditionalExpression((HLSLConditionalExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::CastingExpression) {
-        VisitCastingExpression((HLSLCastingExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::LiteralExpression) {
-        VisitLiteralExpression((HLSLLiteralExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::IdentifierExpression) {
-        VisitIdentifierExpression((HLSLIdentifierExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::ConstructorExpression) {
-        VisitConstructorExpression((HLSLConstructorExpression *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::MemberAccess) {
-        VisitMemberAccess((HLSLMemberAccess *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::ArrayAccess) {
-        VisitArrayAccess((HLSLArrayAccess *)node);
-    }
-    else if (node->nodeType == HLSLNodeType::FunctionCall) {
-        VisitFunctionCall((HLSLFunctionCall *)node);
+    if (node->nodeType == HLSLNodeType::BinaryExpression)
+    {
+        return IsAssignOp(static_cast<const HLSLBinaryExpression *>(node)->binaryOp);
     }
-    // Acoget-TODO: This was missing. Did adding it break anything?
-    else if (node->nodeType == HLSLNodeType::SamplerState) {
-        VisitSamplerState((HLSLSamplerState *)node);
+    else if (node->nodeType == HLSLNodeType::UnaryExpression)
+    {
+        HLSLUnaryOp unaryOp = static_cast<const HLSLUnaryExpression *>(node)->unaryOp;
+        return unaryOp == HLSLUnaryOp::PreIncrement || unaryOp == HLSLUnaryOp::PreDecrement ||
+            unaryOp == HLSLUnaryOp::PostIncrement || unaryOp == HLSLUnaryOp::PostDecrement;
     }
-    else {
-        ASSERT(0);
+    else if (node->nodeType == HLSLNodeType::FunctionCall)
+    {
+        // Intrinsics have no body. The functions of the shader may write static globals.
+        const HLSLFunction * function = static_cast<const HLSLFunctionCall *>(node)->function;
+        if (shaderFunctions != NULL)
+        {
+            return shaderFunctions->count(function) > 0 ||
+                function->numOutputArguments > 0 || function->returnType.baseType == HLSLBaseType::Void;
+        }
+        return function->statement != NULL || function->forward != NULL ||
+            function->numOutputArguments > 0 || function->returnType.baseType == HLSLBaseType::Void;
     }
+    return false;
 }
 
-void HLSLTreeVisitor::VisitReturnStatement(HLSLReturnStatement * node)
+/** Finds the expressions that may write a variable. */
+class SideEffectFinder : public HLSLIterativeTreeVisitor<SideEffectFinder>
 {
-    VisitExpression(node->expression);
-}
-
-void HLSLTreeVisitor::VisitDiscardStatement(HLSLDiscardStatement * node) {}
-void HLSLTreeVisitor::VisitBreakStatement(HLSLBreakStatement * node) {}
-void HLSLTreeVisitor::VisitContinueStatement(HLSLContinueStatement * node) {}
+public:
+    bool                        found = false;
+    const HLSLFunctionSet *     shaderFunctions = NULL;     // See HasSideEffect.
 
-void HLSLTreeVisitor::VisitIfStatement(HLSLIfStatement * node)
-{
-    VisitExpression(node->condition);
-    VisitStatements(node->statement);
-    if (node->elseStatement) {
-        VisitStatements(node->elseStatement);
+    bool EnterNode(HLSLNode * node)
+    {
+        found = HasSideEffect(node, shaderFunctions);
+        if (found)
+        {
+            Stop();
+        }
+        return true;
     }
-}
+};
 
-void HLSLTreeVisitor::VisitForStatement(HLSLForStatement * node)
+/**
+ * Replaces the largest constant expressions by literals, see FoldConstants.
+ * Nodes are left after the nodes below them, so each value is computed once
+ * from the cached values of the operands, and conditionals are resolved once
+ * their condition is folded.
+ */
+class ConstantFolder : public HLSLIterativeTreeVisitor<ConstantFolder>
 {
-    if (node->initialization) {
-        VisitDeclaration(node->initialization);
-    }
-    if (node->condition) {
-        VisitExpression(node->condition);
-    }
-    if (node->increment) {
-        VisitExpression(node->increment);
-    }
-    VisitStatements(node->statement);
-}
+public:
+    HLSLTree *  tree = NULL;
+    int         foldedCount = 0;
 
-void HLSLTreeVisitor::VisitBlockStatement(HLSLBlockStatement * node)
-{
-    VisitStatements(node->statement);
-}
+    bool EnterNode(HLSLNode * node)
+    {
+        m_marks.push_back(m_constants.size());
+        return true;
+    }
 
-void HLSLTreeVisitor::VisitUnaryExpression(HLSLUnaryExpression * node)
-{
-    VisitExpression(node->expression);
-}
+    void LeaveNode(HLSLNode * node)
+    {
+        // The constants left since the node was entered are the expressions right below it.
+        size_t mark = m_marks.back();
+        m_marks.pop_back();
 
-void HLSLTreeVisitor::VisitBinaryExpression(HLSLBinaryExpression * node)
-{
-    VisitExpression(node->expression1);
-    VisitExpression(node->expression2);
-}
+        // Conditionals were left with their literal conditions folded, the branch taken replaces them.
+        // Constant conditionals are folded whole with the other constants.
+        ForEachChildExpression(node, [&](HLSLExpression *& expression)
+        {
+            if (expression->nodeType == HLSLNodeType::ConditionalExpression &&
+                std::find(m_constants.begin() + mark, m_constants.end(), expression) == m_constants.end() &&
+                SelectBranch(expression) && IsFolded(expression))
+            {
+                m_constants.push_back(expression);
+            }
+        });
 
-void HLSLTreeVisitor::VisitConditionalExpression(HLSLConditionalExpression * node)
-{
-    VisitExpression(node->condition);
-    VisitExpression(node->falseExpression);
-    VisitExpression(node->trueExpression);
-}
+        bool constantOperands = true;
+        m_constantSlots.clear();
+        ForEachChildExpression(node, [&](HLSLExpression *& expression)
+        {
+            if (std::find(m_constants.begin() + mark, m_constants.end(), expression) != m_constants.end())
+            {
+                m_constantSlots.push_back(&expression);
+            }
+            else
+            {
+                constantOperands = false;
+            }
+        });
+        m_constants.resize(mark);
 
-void HLSLTreeVisitor::VisitCastingExpression(HLSLCastingExpression * node)
-{
-    VisitType(node->type);
-    VisitExpression(node->expression);
-}
+        if (constantOperands && IsExpressionNode(node->nodeType) && IsConstant(static_cast<HLSLExpression *>(node)))
+        {
+            // The node above folds the whole expression.
+            m_constants.push_back(static_cast<HLSLExpression *>(node));
+            return;
+        }
 
-void HLSLTreeVisitor::VisitLiteralExpression(HLSLLiteralExpression * node) {}
-void HLSLTreeVisitor::VisitIdentifierExpression(HLSLIdentifierExpression * node) {}
+        if (node->nodeType == HLSLNodeType::Declaration && !m_constantSlots.empty())
+        {
+            HLSLDeclaration * declaration = static_cast<HLSLDeclaration *>(node);
+            int flags = (int)HLSLTypeFlags::Static | (int)HLSLTypeFlags::Const;
+            if ((declaration->type.flags & flags) == flags)
+            {
+                m_constantDeclarations.insert(declaration);
+            }
+        }
 
-void HLSLTreeVisitor::VisitConstructorExpression(HLSLConstructorExpression * node)
-{
-    HLSLExpression * argument = node->argument;
-    while (argument != NULL) {
-        VisitExpression(argument);
-        argument = argument->nextExpression;
+        // The slot of an argument is in the argument before it, which is replaced after it.
+        for (size_t i = m_constantSlots.size(); i > 0; --i)
+        {
+            Fold(*m_constantSlots[i - 1]);
+        }
     }
-}
 
-void HLSLTreeVisitor::VisitMemberAccess(HLSLMemberAccess * node)
-{
-    VisitExpression(node->object);
-}
+private:
 
-void HLSLTreeVisitor::VisitArrayAccess(HLSLArrayAccess * node)
-{
-    VisitExpression(node->array);
-    VisitExpression(node->index);
-}
+    bool IsConstant(HLSLExpression * expression)
+    {
+        const HLSLType & type = *expression->expressionType;
+        if ((type.flags & (int)HLSLTypeFlags::Const) == 0 || type.array)
+        {
+            return false;
+        }
 
-void HLSLTreeVisitor::VisitFunctionCall(HLSLFunctionCall * node)
-{
-    HLSLExpression * argument = node->argument;
-    while (argument != NULL) {
-        VisitExpression(argument);
-        argument = argument->nextExpression;
+        if (expression->nodeType == HLSLNodeType::IdentifierExpression)
+        {
+            // Globals that aren't static are uniforms, the application can change them.
+            HLSLIdentifierExpression * identifier = static_cast<HLSLIdentifierExpression *>(expression);
+            HLSLDeclaration * declaration = identifier->global ? tree->FindGlobalDeclaration(identifier->name) : NULL;
+            if (declaration == NULL || m_constantDeclarations.count(declaration) == 0)
+            {
+                return false;
+            }
+        }
+
+        if (type.baseType == HLSLBaseType::Int || type.baseType == HLSLBaseType::Bool)
+        {
+            int value;
+            return tree->GetExpressionValue(expression, value);
+        }
+
+        float values[4];
+        int dimension = tree->GetExpressionValue(expression, values);
+        for (int i = 0; i < dimension; i++)
+        {
+            // Infinities and NaNs have no literal.
+            if (!std::isfinite(values[i])) return false;
+        }
+        return dimension > 0;
     }
-}
 
-void HLSLTreeVisitor::VisitStateAssignment(HLSLStateAssignment * node) {}
+    HLSLLiteralExpression * AddLiteral(const HLSLExpression * expression, HLSLBaseType baseType)
+    {
+        HLSLLiteralExpression * literal = tree->AddNode<HLSLLiteralExpression>(expression->fileName, expression->line);
+        literal->type = baseType;
+        HLSLType type(baseType);
+        type.flags = (int)HLSLTypeFlags::Const;
+        literal->expressionType = tree->AddType(type);
+        return literal;
+    }
 
-void HLSLTreeVisitor::VisitSamplerState(HLSLSamplerState * node)
-{
-    HLSLStateAssignment * stateAssignment = node->stateAssignments;
-    while (stateAssignment != NULL) {
-        VisitStateAssignment(stateAssignment);
-        stateAssignment = stateAssignment->nextStateAssignment;
+    static bool IsFolded(const HLSLExpression * expression)
+    {
+        if (expression->nodeType == HLSLNodeType::ConstructorExpression)
+        {
+            for (const HLSLExpression * argument = static_cast<const HLSLConstructorExpression *>(expression)->argument; argument != NULL; argument = argument->nextExpression)
+            {
+                if (argument->nodeType != HLSLNodeType::LiteralExpression) return false;
+            }
+            return true;
+        }
+        return expression->nodeType == HLSLNodeType::LiteralExpression;
     }
-}
 
-void HLSLTreeVisitor::VisitPass(HLSLPass * node)
-{
-    HLSLStateAssignment * stateAssignment = node->stateAssignments;
-    while (stateAssignment != NULL) {
-        VisitStateAssignment(stateAssignment);
-        stateAssignment = stateAssignment->nextStateAssignment;
+    /** Replaces a conditional on a literal by the branch taken, when the other branch has no side effect and the types agree. */
+    bool SelectBranch(HLSLExpression *& expression)
+    {
+        HLSLConditionalExpression * conditional = static_cast<HLSLConditionalExpression *>(expression);
+        if (conditional->condition->nodeType != HLSLNodeType::LiteralExpression)
+        {
+            return false;
+        }
+
+        const HLSLLiteralExpression * literal = static_cast<const HLSLLiteralExpression *>(conditional->condition);
+        bool condition;
+        switch (literal->type)
+        {
+        case HLSLBaseType::Bool:    condition = literal->bValue; break;
+        case HLSLBaseType::Int:     condition = literal->iValue != 0; break;
+        case HLSLBaseType::Float:
+        case HLSLBaseType::Half:    condition = literal->fValue != 0; break;
+        default:                    return false;
+        }
+
+        // The parser gives conditionals the type of their true branch, a branch of
+        // another type would need a conversion HLSL may not do.
+        HLSLExpression * taken = condition ? conditional->trueExpression : conditional->falseExpression;
+        const HLSLType & type = *conditional->expressionType;
+        const HLSLType & takenType = *taken->expressionType;
+        if (takenType.baseType != type.baseType || takenType.array != type.array || !String_Equal(takenType.typeName, type.typeName))
+        {
+            return false;
+        }
+
+        // Both branches are evaluated, the one not taken may not write anything.
+        m_sideEffects.found = false;
+        m_sideEffects.Walk(condition ? conditional->falseExpression : conditional->trueExpression);
+        if (m_sideEffects.found)
+        {
+            return false;
+        }
+
+        taken->nextExpression = conditional->nextExpression;
+        expression = taken;
+        ++foldedCount;
+        return true;
     }
-}
 
-void HLSLTreeVisitor::VisitTechnique(HLSLTechnique * node)
-{
-    HLSLPass * pass = node->passes;
-    while (pass != NULL) {
-        VisitPass(pass);
-        pass = pass->nextPass;
+    void Fold(HLSLExpression *& expression)
+    {
+        if (IsFolded(expression))
+        {
+            return;
+        }
+
+        HLSLBaseType baseType = expression->expressionType->baseType;
+        HLSLExpression * folded;
+        if (baseType == HLSLBaseType::Int || baseType == HLSLBaseType::Bool)
+        {
+            int value;
+            tree->GetExpressionValue(expression, value);
+
+            HLSLLiteralExpression * literal = AddLiteral(expression, baseType);
+            if (baseType == HLSLBaseType::Bool) literal->bValue = value != 0;
+            else literal->iValue = value;
+            folded = literal;
+        }
+        else
+        {
+            float values[4];
+            int dimension = tree->GetExpressionValue(expression, values);
+
+            HLSLBaseType scalarType = ScalarBaseType[(int)baseType];
+            HLSLLiteralExpression * literals[4];
+            for (int i = 0; i < dimension; i++)
+            {
+                literals[i] = AddLiteral(expression, scalarType);
+                literals[i]->fValue = values[i];
+            }
+
+            if (dimension == 1)
+            {
+                folded = literals[0];
+            }
+            else
+            {
+                HLSLConstructorExpression * constructor = tree->AddNode<HLSLConstructorExpression>(expression->fileName, expression->line);
+                constructor->type.baseType = baseType;
+                constructor->expressionType = expression->expressionType;
+                constructor->argument = literals[0];
+                for (int i = 1; i < dimension; i++) literals[i - 1]->nextExpression = literals[i];
+                folded = constructor;
+            }
+        }
+
+        folded->nextExpression = expression->nextExpression;
+        expression = folded;
+        ++foldedCount;
     }
-}
 
-void HLSLTreeVisitor::VisitPipeline(HLSLPipeline * node)
+    std::vector<const HLSLExpression *>         m_constants;    // Constant expressions left, not folded yet.
+    std::vector<size_t>                         m_marks;        // Size of m_constants when each node was entered.
+    std::unordered_set<const HLSLDeclaration *> m_constantDeclarations;
+    std::vector<HLSLExpression **>              m_constantSlots;
+    SideEffectFinder                            m_sideEffects;
+};
+
+int FoldConstants(HLSLTree* tree)
 {
-    // @@ ?
+    ConstantFolder folder;
+    folder.tree = tree;
+    folder.Walk(tree->GetRoot());
+
+    tree->InvalidateIndex();
+    return folder.foldedCount;
 }
 
-void HLSLTreeVisitor::VisitFunctions(HLSLRoot * root)
+/**
+ * Adds delta to the uses of the local variables named below the nodes it
+ * walks, and counts the statements. Names are pooled, so their pointers
+ * identify them.
+ */
+class LocalUseCounter : public HLSLIterativeTreeVisitor<LocalUseCounter>
 {
-    HLSLStatement * statement = root->statement;
-    while (statement != NULL) {
-        if (statement->nodeType == HLSLNodeType::Function) {
-            VisitFunction((HLSLFunction *)statement);
-        }
+public:
+    std::unordered_map<const char *, int> * uses = NULL;
+    int     delta = 1;
+    int     statementCount = 0;
 
-        statement = statement->nextStatement;
+    bool EnterNode(HLSLNode * node)
+    {
+        if (node->nodeType == HLSLNodeType::IdentifierExpression && !static_cast<HLSLIdentifierExpression *>(node)->global)
+        {
+            (*uses)[static_cast<HLSLIdentifierExpression *>(node)->name] += delta;
+        }
+        else if (IsStatementNode(node->nodeType))
+        {
+            ++statementCount;
+        }
+        return true;
     }
-}
+};
 
-void HLSLTreeVisitor::VisitParameters(HLSLRoot * root)
+/** Returns the variable an assignment writes, NULL if not known. */
+static const char * GetAssignedName(const HLSLExpression * expression)
 {
-    HLSLStatement * statement = root->statement;
-    while (statement != NULL) {
-        if (statement->nodeType == HLSLNodeType::Declaration) {
-            VisitDeclaration((HLSLDeclaration *)statement);
-        }
-
-        statement = statement->nextStatement;
+    while (expression->nodeType == HLSLNodeType::MemberAccess || expression->nodeType == HLSLNodeType::ArrayAccess)
+    {
+        expression = expression->nodeType == HLSLNodeType::MemberAccess ?
+            static_cast<const HLSLMemberAccess *>(expression)->object : static_cast<const HLSLArrayAccess *>(expression)->array;
     }
+    return expression->nodeType == HLSLNodeType::IdentifierExpression ? static_cast<const HLSLIdentifierExpression *>(expression)->name : NULL;
 }
 
-
-class ResetHiddenFlagVisitor : public HLSLTreeVisitor
+/**
+ * Removes the dead code of a function, see EliminateDeadCode. The statement
+ * lists are walked with an explicit stack, long else if chains don't recurse.
+ */
+class DeadCodeEliminator
 {
 public:
-    virtual void VisitTopLevelStatement(HLSLStatement * statement)
+    DeadCodeEliminator(HLSLTree * tree, const HLSLFunctionSet * shaderFunctions)
     {
-        statement->hidden = true;
+        m_tree = tree;
+        m_counter.uses = &m_uses;
+        m_sideEffects.shaderFunctions = shaderFunctions;
+    }
 
-        if (statement->nodeType == HLSLNodeType::Buffer)
+    int EliminateDeadCode(HLSLFunction * function)
+    {
+        m_counter.delta = 1;
+        m_counter.WalkList(function->statement);
+        m_counter.delta = -1;
+        m_counter.statementCount = 0;
+
+        RemoveUnreachableStatements(&function->statement);
+        while (RemoveUnusedLocals(&function->statement))
         {
-            VisitBuffer((HLSLBuffer*)statement);
         }
+        return m_counter.statementCount;
     }
 
-    // Hide buffer fields.
-    virtual void VisitDeclaration(HLSLDeclaration * node)
+private:
+
+    /** Gets the value of a literal condition, FoldConstants makes the constant conditions literals. */
+    static bool GetLiteralCondition(const HLSLExpression * condition, bool & value)
     {
-        node->hidden = true;
+        if (condition->nodeType != HLSLNodeType::LiteralExpression)
+        {
+            return false;
+        }
+        const HLSLLiteralExpression * literal = static_cast<const HLSLLiteralExpression *>(condition);
+        switch (literal->type)
+        {
+        case HLSLBaseType::Bool:    value = literal->bValue; return true;
+        case HLSLBaseType::Int:     value = literal->iValue != 0; return true;
+        case HLSLBaseType::Float:
+        case HLSLBaseType::Half:    value = literal->fValue != 0.0f; return true;
+        default:                    return false;
+        }
     }
 
-    virtual void VisitArgument(HLSLArgument * node)
+    static bool IsTerminator(HLSLNodeType nodeType)
     {
-        node->hidden = false;   // Arguments are visible by default.
+        return nodeType == HLSLNodeType::ReturnStatement || nodeType == HLSLNodeType::DiscardStatement ||
+            nodeType == HLSLNodeType::BreakStatement || nodeType == HLSLNodeType::ContinueStatement;
     }
-};
 
-class MarkVisibleStatementsVisitor : public HLSLTreeVisitor
-{
-public:
-    HLSLTree * tree;
-    MarkVisibleStatementsVisitor(HLSLTree * tree) : tree(tree) {}
+    /**
+     * Collects the links to the statements below first, in program order.
+     * Nested lists come right after the statement holding them.
+     */
+    void CollectLinks(HLSLStatement ** first)
+    {
+        m_links.clear();
+        m_stack.assign(1, first);
+        while (!m_stack.empty())
+        {
+            HLSLStatement ** link = m_stack.back();
+            m_stack.pop_back();
+            HLSLStatement * statement = *link;
+            if (statement == NULL)
+            {
+                continue;
+            }
+
+            m_links.push_back(link);
+            m_stack.push_back(&statement->nextStatement);
+            switch (statement->nodeType)
+            {
+            case HLSLNodeType::IfStatement:
+                m_stack.push_back(&static_cast<HLSLIfStatement *>(statement)->elseStatement);
+                m_stack.push_back(&static_cast<HLSLIfStatement *>(statement)->statement);
+                break;
+            case HLSLNodeType::ForStatement:
+                m_stack.push_back(&static_cast<HLSLForStatement *>(statement)->statement);
+                break;
+            case HLSLNodeType::BlockStatement:
+                m_stack.push_back(&static_cast<HLSLBlockStatement *>(statement)->statement);
+                break;
+            default:
+                break;
+            }
+        }
+    }
 
-    virtual void VisitFunction(HLSLFunction * node)
+    /** Replaces the ifs on literal conditions by the branch taken, and drops the statements after a jump. */
+    void RemoveUnreachableStatements(HLSLStatement ** first)
     {
-        node->hidden = false;
-        HLSLTreeVisitor::VisitFunction(node);
+        m_stack.assign(1, first);
+        while (!m_stack.empty())
+        {
+            HLSLStatement ** link = m_stack.back();
+            m_stack.pop_back();
+
+            while (*link != NULL)
+            {
+                HLSLStatement * statement = *link;
+                if (statement->nodeType == HLSLNodeType::IfStatement)
+                {
+                    HLSLIfStatement * ifStatement = static_cast<HLSLIfStatement *>(statement);
+                    bool condition;
+                    if (GetLiteralCondition(ifStatement->condition, condition))
+                    {
+                        m_counter.Walk(ifStatement->condition);
+                        m_counter.WalkList(condition ? ifStatement->elseStatement : ifStatement->statement);
+                        ++m_counter.statementCount;
 
-        if (node->forward)
-            VisitFunction(node->forward);
+                        // The branch taken is checked again in place of the if.
+                        *link = Splice(ifStatement, condition ? ifStatement->statement : ifStatement->elseStatement);
+                        continue;
+                    }
+                    m_stack.push_back(&ifStatement->statement);
+                    m_stack.push_back(&ifStatement->elseStatement);
+                }
+                else if (statement->nodeType == HLSLNodeType::ForStatement)
+                {
+                    m_stack.push_back(&static_cast<HLSLForStatement *>(statement)->statement);
+                }
+                else if (statement->nodeType == HLSLNodeType::BlockStatement)
+                {
+                    m_stack.push_back(&static_cast<HLSLBlockStatement *>(statement)->statement);
+                }
+                else if (IsTerminator(statement->nodeType) && statement->nextStatement != NULL)
+                {
+                    m_counter.WalkList(statement->nextStatement);
+                    statement->nextStatement = NULL;
+                }
+                link = &statement->nextStatement;
+            }
+        }
     }
 
-    virtual void VisitFunctionCall(HLSLFunctionCall * node)
+    /**
+     * Returns the branch of ifStatement followed by the statements after it.
+     * A branch declaring variables goes in a block, its declarations stay in
+     * their scope.
+     */
+    HLSLStatement * Splice(HLSLIfStatement * ifStatement, HLSLStatement * branch)
     {
-        HLSLTreeVisitor::VisitFunctionCall(node);
+        HLSLStatement * next = ifStatement->nextStatement;
+        if (branch == NULL)
+        {
+            return next;
+        }
+
+        HLSLStatement * last = branch;
+        bool declares = false;
+        for (HLSLStatement * statement = branch; statement != NULL; statement = statement->nextStatement)
+        {
+            declares = declares || statement->nodeType == HLSLNodeType::Declaration;
+            last = statement;
+        }
 
-        if (node->function->hidden)
+        if (declares)
         {
-            VisitFunction(const_cast<HLSLFunction*>(node->function));
+            HLSLBlockStatement * block = m_tree->AddNode<HLSLBlockStatement>(ifStatement->fileName, ifStatement->line);
+            block->statement = branch;
+            block->nextStatement = next;
+            return block;
         }
+        last->nextStatement = next;
+        return branch;
     }
 
-    virtual void VisitIdentifierExpression(HLSLIdentifierExpression * node)
+    bool IsUnused(const HLSLDeclaration * declaration)
     {
-        HLSLTreeVisitor::VisitIdentifierExpression(node);
-
-        if (node->global)
+        for (; declaration != NULL; declaration = declaration->nextDeclaration)
         {
-            HLSLDeclaration * declaration = tree->FindGlobalDeclaration(node->name);
-            if (declaration != NULL && declaration->hidden)
+            auto it = m_uses.find(declaration->name);
+            if (it != m_uses.end() && it->second > 0)
+            {
+                return false;
+            }
+            m_sideEffects.found = false;
+            m_sideEffects.WalkList(declaration->assignment);
+            if (m_sideEffects.found)
             {
-                declaration->hidden = false;
-                VisitDeclaration(declaration);
+                return false;
             }
         }
+        return true;
     }
 
-    virtual void VisitType(HLSLType & type)
+    /**
+     * Removes the declarations of locals never named, whose initial values
+     * have no side effects. Returns true if it removed one. Going backwards,
+     * the locals only used by the ones removed are removed as well.
+     */
+    bool RemoveUnusedLocals(HLSLStatement ** first)
     {
-        if (type.baseType == HLSLBaseType::UserDefined)
+        CollectLinks(first);
+
+        bool removed = false;
+        for (size_t i = m_links.size(); i > 0; --i)
         {
-            HLSLStruct * globalStruct = tree->FindGlobalStruct(type.typeName);
-            if (globalStruct != NULL)
+            HLSLStatement ** link = m_links[i - 1];
+            HLSLStatement * statement = *link;
+            if (statement->nodeType == HLSLNodeType::Declaration && IsUnused(static_cast<HLSLDeclaration *>(statement)))
             {
-                globalStruct->hidden = false;
-                VisitStruct(globalStruct);
+                m_counter.Walk(statement);
+                *link = statement->nextStatement;
+                removed = true;
             }
         }
+        return removed;
     }
 
+    HLSLTree *                              m_tree;
+    std::unordered_map<const char *, int>   m_uses;         // Identifiers naming each local.
+    LocalUseCounter                         m_counter;      // Removes the uses of the statements dropped.
+    SideEffectFinder                        m_sideEffects;
+    std::vector<HLSLStatement **>           m_stack;
+    std::vector<HLSLStatement **>           m_links;
 };
 
+void GetShaderFunctions(HLSLTree* tree, HLSLFunctionSet& functions)
+{
+    functions.clear();
+    for (HLSLStatement* statement = tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        if (statement->nodeType == HLSLNodeType::Function)
+        {
+            functions.insert(static_cast<HLSLFunction*>(statement));
+        }
+    }
+}
+
+int EliminateDeadCode(HLSLTree* tree, HLSLFunction* function)
+{
+    DeadCodeEliminator eliminator(tree, NULL);
+    return eliminator.EliminateDeadCode(function);
+}
 
-void PruneTree(HLSLTree* tree, const char* entryName0, const char* entryName1/*=NULL*/)
+int EliminateDeadCode(HLSLTree* tree, HLSLFunction* function, const HLSLFunctionSet& shaderFunctions)
 {
-    HLSLRoot* root = tree->GetRoot();
+    DeadCodeEliminator eliminator(tree, &shaderFunctions);
+    return eliminator.EliminateDeadCode(function);
+}
 
-    // Reset all flags.
-    ResetHiddenFlagVisitor reset;
-    reset.VisitRoot(root);
+/** Collects the names a function reads or declares, and those of the functions it calls. */
+class NameCollector : public HLSLIterativeTreeVisitor<NameCollector>
+{
+public:
+    std::unordered_set<const char *> names;
+    std::unordered_set<const char *> declaredNames;     // Of its locals and arguments.
 
-    // Mark all the statements necessary for these entrypoints.
-    HLSLFunction* entry = tree->FindFunction(entryName0);
-    if (entry != NULL)
+    bool EnterNode(HLSLNode * node)
+    {
+        switch (node->nodeType)
+        {
+        case HLSLNodeType::IdentifierExpression:    names.insert(static_cast<HLSLIdentifierExpression *>(node)->name); break;
+        case HLSLNodeType::Declaration:             names.insert(static_cast<HLSLDeclaration *>(node)->name); declaredNames.insert(static_cast<HLSLDeclaration *>(node)->name); break;
+        case HLSLNodeType::Argument:                names.insert(static_cast<HLSLArgument *>(node)->name); declaredNames.insert(static_cast<HLSLArgument *>(node)->name); break;
+        case HLSLNodeType::FunctionCall:            names.insert(static_cast<HLSLFunctionCall *>(node)->function->name); break;
+        default:                                    break;
+        }
+        return true;
+    }
+};
+
+/**
+ * Replaces the repeated expressions of a function by temporaries, see
+ * EliminateCommonSubexpressions. The expressions of a statement list are
+ * numbered first, equal numbers meaning equal values, and the repeats are
+ * counted. Then the values counted twice or more get a temporary, declared
+ * before the statement computing them first. Below a repeat, nothing is
+ * counted nor replaced, the whole expression is.
+ */
+class CommonSubexpressionEliminator
+{
+public:
+    CommonSubexpressionEliminator(HLSLTree * tree, const HLSLFunctionSet * shaderFunctions)
     {
-        MarkVisibleStatementsVisitor mark(tree);
-        mark.VisitFunction(entry);
+        m_tree = tree;
+        m_sideEffects.shaderFunctions = shaderFunctions;
+        m_function = NULL;
+        m_numberCount = 0;
+        m_temporaryCount = 0;
+        m_eliminatedCount = 0;
+        m_counts.assign(1, 0);  // Numbers start at one.
     }
 
-    if (entryName1 != NULL)
+    int EliminateCommonSubexpressions(HLSLFunction * function)
     {
-        entry = tree->FindFunction(entryName1);
-        if (entry != NULL)
+        m_function = function;
+        m_lists.assign(1, &function->statement);
+        while (!m_lists.empty())
         {
-            MarkVisibleStatementsVisitor mark(tree);
-            mark.VisitFunction(entry);
+            HLSLStatement ** first = m_lists.back();
+            m_lists.pop_back();
+            NumberStatements(first);
+            ReplaceRepeats();
         }
+        return m_eliminatedCount;
     }
 
-    // Mark buffers visible, if any of their fields is visible.
-    HLSLStatement * statement = root->statement;
-    while (statement != NULL)
+private:
+
+    /** Expressions read by a statement, numbered together. */
+    struct Statement
     {
-        if (statement->nodeType == HLSLNodeType::Buffer)
+        HLSLStatement **    link;       // To the statement, the temporaries go there.
+        size_t              firstRoot;
+        size_t              endRoot;
+    };
+
+    /** An expression AddRoot enters, or leaves once its children are numbered. */
+    struct Visit
+    {
+        HLSLExpression *    expression;
+        size_t              index;      // In m_numbers, s_entering before it's entered.
+        size_t              childCount;
+    };
+
+    struct Replace
+    {
+        HLSLExpression **   slot;
+        size_t              index;
+        size_t              owner;      // In m_owners.
+    };
+
+    static const size_t s_entering = (size_t)-1;
+
+    struct KeyHash
+    {
+        size_t operator()(const std::vector<uintptr_t> & key) const
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for (uintptr_t value : key)
+            {
+                hash = (hash ^ (uint64_t)value) * 1099511628211ull;
+            }
+            return (size_t)hash;
+        }
+    };
+
+    /** Returns true for the expressions worth a temporary, the computations of a number rather than reads of a variable. */
+    static bool IsComputed(const HLSLExpression * expression)
+    {
+        const HLSLType & type = *expression->expressionType;
+        if (type.array || type.baseType < HLSLBaseType::FirstNumeric || type.baseType > HLSLBaseType::LastNumeric)
         {
-            HLSLBuffer* buffer = (HLSLBuffer*)statement;
+            return false;
+        }
 
-            HLSLDeclaration* field = buffer->field;
-            while (field != NULL)
+        switch (expression->nodeType)
+        {
+        case HLSLNodeType::UnaryExpression:
+        case HLSLNodeType::BinaryExpression:
+        case HLSLNodeType::ConditionalExpression:
+        case HLSLNodeType::CastingExpression:
+        case HLSLNodeType::FunctionCall:
+            return true;
+        case HLSLNodeType::ConstructorExpression:
+            // Folded constants are constructors of literals.
+            for (const HLSLExpression * argument = static_cast<const HLSLConstructorExpression *>(expression)->argument; argument != NULL; argument = argument->nextExpression)
             {
-                ASSERT(field->nodeType == HLSLNodeType::Declaration);
-                if (!field->hidden)
-                {
-                    buffer->hidden = false;
-                    break;
-                }
-                field = (HLSLDeclaration*)field->nextStatement;
+                if (argument->nodeType != HLSLNodeType::LiteralExpression) return true;
             }
+            return false;
+        case HLSLNodeType::MemberAccess:
+        case HLSLNodeType::ArrayAccess:
+            while (expression->nodeType == HLSLNodeType::MemberAccess || expression->nodeType == HLSLNodeType::ArrayAccess)
+            {
+                expression = expression->nodeType == HLSLNodeType::MemberAccess ?
+                    static_cast<const HLSLMemberAccess *>(expression)->object : static_cast<const HLSLArrayAccess *>(expression)->array;
+            }
+            return expression->nodeType != HLSLNodeType::IdentifierExpression;
+        default:
+            return false;
         }
+    }
 
-        statement = statement->nextStatement;
+    bool HasSideEffects(HLSLExpression * expression)
+    {
+        m_sideEffects.found = false;
+        m_sideEffects.WalkList(expression);
+        return m_sideEffects.found;
     }
-}
 
+    /**
+     * Numbers the expressions the statements of the list read, until the
+     * statements whose effects aren't known: the branches, the loops and the
+     * calls to the functions of the shader. Their own lists are queued.
+     */
+    void NumberStatements(HLSLStatement ** first)
+    {
+        m_keys.clear();
+        m_numbers.clear();
+        m_sizes.clear();
+        m_statements.clear();
+        m_roots.clear();
 
-void SortTree(HLSLTree * tree)
-{
-    // Stable sort so that statements are in this order:
-    // structs, declarations, functions, techniques.
-	// but their relative order is preserved.
+        for (HLSLStatement ** link = first; *link != NULL; link = &(*link)->nextStatement)
+        {
+            HLSLStatement * statement = *link;
+            size_t firstRoot = m_roots.size();
+            bool unknownEffects = false;
 
-    HLSLRoot* root = tree->GetRoot();
+            switch (statement->nodeType)
+            {
+            case HLSLNodeType::Declaration:
+                for (HLSLDeclaration * declaration = static_cast<HLSLDeclaration *>(statement); declaration != NULL; declaration = declaration->nextDeclaration)
+                {
+                    if (HasSideEffects(declaration->assignment))
+                    {
+                        unknownEffects = true;
+                    }
+                    else
+                    {
+                        for (HLSLExpression ** value = &declaration->assignment; *value != NULL; value = &(*value)->nextExpression)
+                        {
+                            AddRoot(value);
+                        }
+                    }
+                    // The temporaries go before the statement, the variables it declares can't be read from them.
+                    m_statementNames.push_back(declaration->name);
+                    ++m_versions[declaration->name];
+                }
+                m_statementNames.clear();
+                break;
+            case HLSLNodeType::ExpressionStatement:
+                {
+                    HLSLExpression * expression = static_cast<HLSLExpressionStatement *>(statement)->expression;
+                    HLSLBinaryExpression * assignment = expression->nodeType == HLSLNodeType::BinaryExpression && IsAssignOp(static_cast<HLSLBinaryExpression *>(expression)->binaryOp) ?
+                        static_cast<HLSLBinaryExpression *>(expression) : NULL;
+                    const char * name = assignment != NULL ? GetAssignedName(assignment->expression1) : NULL;
+                    if (name != NULL && !HasSideEffects(assignment->expression1) && !HasSideEffects(assignment->expression2))
+                    {
+                        AddRoot(&assignment->expression2);
+                        ++m_versions[name];
+                    }
+                    else
+                    {
+                        unknownEffects = HasSideEffects(expression);
+                    }
+                    break;
+                }
+            case HLSLNodeType::ReturnStatement:
+                {
+                    HLSLReturnStatement * returnStatement = static_cast<HLSLReturnStatement *>(statement);
+                    if (returnStatement->expression != NULL && !HasSideEffects(returnStatement->expression))
+                    {
+                        AddRoot(&returnStatement->expression);
+                    }
+                    break;
+                }
+            case HLSLNodeType::IfStatement:
+                {
+                    HLSLIfStatement * ifStatement = static_cast<HLSLIfStatement *>(statement);
+                    if (!HasSideEffects(ifStatement->condition))
+                    {
+                        AddRoot(&ifStatement->condition);
+                    }
+                    m_lists.push_back(&ifStatement->statement);
+                    m_lists.push_back(&ifStatement->elseStatement);
+                    unknownEffects = true;
+                    break;
+                }
+            case HLSLNodeType::ForStatement:
+                m_lists.push_back(&static_cast<HLSLForStatement *>(statement)->statement);
+                unknownEffects = true;
+                break;
+            case HLSLNodeType::BlockStatement:
+                m_lists.push_back(&static_cast<HLSLBlockStatement *>(statement)->statement);
+                unknownEffects = true;
+                break;
+            case HLSLNodeType::DiscardStatement:
+            case HLSLNodeType::BreakStatement:
+            case HLSLNodeType::ContinueStatement:
+                break;
+            default:
+                unknownEffects = true;
+                break;
+            }
 
-    HLSLStatement* structs = NULL;
-    HLSLStatement* lastStruct = NULL;
-    HLSLStatement* constDeclarations = NULL;
-    HLSLStatement* lastConstDeclaration = NULL;
-    HLSLStatement* declarations = NULL;
-    HLSLStatement* lastDeclaration = NULL;
-    HLSLStatement* functions = NULL;
-    HLSLStatement* lastFunction = NULL;
-    HLSLStatement* other = NULL;
-    HLSLStatement* lastOther = NULL;
+            if (m_roots.size() > firstRoot)
+            {
+                m_statements.push_back({ link, firstRoot, m_roots.size() });
+                CountRepeats(m_statements.back());
+            }
+            if (unknownEffects)
+            {
+                // The values computed so far are lost, the next expressions get new numbers.
+                m_keys.clear();
+            }
+        }
+    }
 
-    HLSLStatement* statement = root->statement;
-    while (statement != NULL) {
-        HLSLStatement* nextStatement = statement->nextStatement;
-        statement->nextStatement = NULL;
+    /**
+     * Numbers the expression at slot and those below it, which come first: the
+     * number of an expression is made of theirs. The expressions are visited
+     * from the top and the last of a list first, m_numbers and m_sizes are in
+     * that order.
+     */
+    void AddRoot(HLSLExpression ** slot)
+    {
+        m_roots.emplace_back(slot, m_numbers.size());
 
-        if (statement->nodeType == HLSLNodeType::Struct) {
-            if (structs == NULL) structs = statement;
-            if (lastStruct != NULL) lastStruct->nextStatement = statement;
-            lastStruct = statement;
-        }
-        else if (statement->nodeType == HLSLNodeType::Declaration || statement->nodeType == HLSLNodeType::Buffer) {
-            if (statement->nodeType == HLSLNodeType::Declaration && (((HLSLDeclaration *)statement)->type.flags & (int)HLSLTypeFlags::Const)) {
-                if (constDeclarations == NULL) constDeclarations = statement;
-                if (lastConstDeclaration != NULL) lastConstDeclaration->nextStatement = statement;
-                lastConstDeclaration = statement;
+        m_numberStack.assign(1, { *slot, s_entering, 0 });
+        while (!m_numberStack.empty())
+        {
+            Visit visit = m_numberStack.back();
+            m_numberStack.pop_back();
+            if (visit.index == s_entering)
+            {
+                size_t leave = m_numberStack.size();
+                m_numberStack.push_back({ visit.expression, m_numbers.size(), 0 });
+                m_numbers.push_back(0);
+                m_sizes.push_back(0);
+                ForEachChildExpression(visit.expression, [&](HLSLExpression *& child) { m_numberStack.push_back({ child, s_entering, 0 }); });
+                m_numberStack[leave].childCount = m_numberStack.size() - leave - 1;
             }
-            else {
-                if (declarations == NULL) declarations = statement;
-                if (lastDeclaration != NULL) lastDeclaration->nextStatement = statement;
-                lastDeclaration = statement;
+            else
+            {
+                // The numbers of the children are the last ones left, from the last child.
+                size_t firstChild = m_childNumbers.size() - visit.childCount;
+                int number = GetNumber(visit.expression, m_childNumbers.data() + firstChild, visit.childCount);
+                m_childNumbers.resize(firstChild);
+                m_childNumbers.push_back(number);
+                m_numbers[visit.index] = number;
+                m_sizes[visit.index] = m_numbers.size() - visit.index;
             }
         }
-        else if (statement->nodeType == HLSLNodeType::Function) {
-            if (functions == NULL) functions = statement;
-            if (lastFunction != NULL) lastFunction->nextStatement = statement;
-            lastFunction = statement;
-        }
-        else {
-            if (other == NULL) other = statement;
-            if (lastOther != NULL) lastOther->nextStatement = statement;
-            lastOther = statement;
+        m_childNumbers.clear();
+    }
+
+    /** Gets the children of the expression visited at index, with their own index, in the order of ForEachChildExpression. */
+    void GetChildren(HLSLExpression * expression, size_t index)
+    {
+        m_children.clear();
+        ForEachChildExpression(expression, [&](HLSLExpression *& child) { m_children.emplace_back(&child, 0); });
+        size_t childIndex = index + 1;
+        for (size_t i = m_children.size(); i > 0; --i)
+        {
+            m_children[i - 1].second = childIndex;
+            childIndex += m_sizes[childIndex];
         }
+    }
 
-        statement = nextStatement;
+    /**
+     * Counts the values of a statement from the top, in the order
+     * ReplaceRepeats replaces them: the expressions of a list from the last,
+     * whose link is in the one before.
+     */
+    void CountRepeats(const Statement & statement)
+    {
+        m_countStack.assign(m_roots.begin() + statement.firstRoot, m_roots.begin() + statement.endRoot);
+        while (!m_countStack.empty())
+        {
+            HLSLExpression * expression = *m_countStack.back().first;
+            size_t index = m_countStack.back().second;
+            m_countStack.pop_back();
+            if (IsComputed(expression) && m_counts[m_numbers[index]]++ > 0)
+            {
+                continue;
+            }
+            GetChildren(expression, index);
+            m_countStack.insert(m_countStack.end(), m_children.begin(), m_children.end());
+        }
     }
 
-    // Chain all the statements in the order that we want.
-    HLSLStatement * firstStatement = structs;
-    HLSLStatement * lastStatement = lastStruct;
+    int GetNumber(const HLSLExpression * expression, const int * childNumbers, size_t childCount)
+    {
+        m_key.clear();
+        m_key.push_back((uintptr_t)expression->nodeType);
+        m_key.push_back((uintptr_t)expression->expressionType);
 
-    if (constDeclarations != NULL) {
-        if (firstStatement == NULL) firstStatement = constDeclarations;
-        else lastStatement->nextStatement = constDeclarations;
-        lastStatement = lastConstDeclaration;
-    }
+        bool known = true;
+        switch (expression->nodeType)
+        {
+        case HLSLNodeType::IdentifierExpression:
+            {
+                const char * name = static_cast<const HLSLIdentifierExpression *>(expression)->name;
+                known = std::find(m_statementNames.begin(), m_statementNames.end(), name) == m_statementNames.end();
+                m_key.push_back((uintptr_t)name);
+                m_key.push_back((uintptr_t)m_versions[name]);
+                break;
+            }
+        case HLSLNodeType::LiteralExpression:
+            {
+                const HLSLLiteralExpression * literal = static_cast<const HLSLLiteralExpression *>(expression);
+                m_key.push_back((uintptr_t)literal->type);
+                m_key.push_back(literal->type == HLSLBaseType::Bool ? (uintptr_t)literal->bValue : (uintptr_t)(uint32_t)literal->iValue);
+                break;
+            }
+        case HLSLNodeType::UnaryExpression:
+            m_key.push_back((uintptr_t)static_cast<const HLSLUnaryExpression *>(expression)->unaryOp);
+            break;
+        case HLSLNodeType::BinaryExpression:
+            m_key.push_back((uintptr_t)static_cast<const HLSLBinaryExpression *>(expression)->binaryOp);
+            break;
+        case HLSLNodeType::MemberAccess:
+            {
+                // The arguments of the method calls, like the samples of a texture object, aren't kept.
+                const HLSLMemberAccess * memberAccess = static_cast<const HLSLMemberAccess *>(expression);
+                HLSLBaseType objectType = memberAccess->object->expressionType->baseType;
+                known = objectType == HLSLBaseType::UserDefined || (objectType >= HLSLBaseType::FirstNumeric && objectType <= HLSLBaseType::LastNumeric);
+                m_key.push_back((uintptr_t)memberAccess->field);
+                break;
+            }
+        case HLSLNodeType::FunctionCall:
+            m_key.push_back((uintptr_t)static_cast<const HLSLFunctionCall *>(expression)->function);
+            break;
+        case HLSLNodeType::ConditionalExpression:
+        case HLSLNodeType::CastingExpression:
+        case HLSLNodeType::ConstructorExpression:
+        case HLSLNodeType::ArrayAccess:
+            break;
+        default:
+            known = false;
+            break;
+        }
+
+        if (!known)
+        {
+            // Equal to nothing else.
+            m_counts.push_back(0);
+            return ++m_numberCount;
+        }
 
-    if (declarations != NULL) {
-        if (firstStatement == NULL) firstStatement = declarations;
-        else lastStatement->nextStatement = declarations;
-        lastStatement = lastDeclaration;
+        m_key.insert(m_key.end(), childNumbers, childNumbers + childCount);
+        auto inserted = m_keys.emplace(m_key, m_numberCount + 1);
+        if (inserted.second)
+        {
+            m_counts.push_back(0);
+            ++m_numberCount;
+        }
+        return inserted.first->second;
     }
 
-    if (functions != NULL) {
-        if (firstStatement == NULL) firstStatement = functions;
-        else lastStatement->nextStatement = functions;
-        lastStatement = lastFunction;
-    }
+    /**
+     * Declares the temporaries of the values NumberStatements counted more
+     * than once, and replaces the expressions computing them. A temporary goes
+     * right before the statement, or the temporary, reading it first.
+     */
+    void ReplaceRepeats()
+    {
+        for (const Statement & statement : m_statements)
+        {
+            m_owners.assign(1, statement.link);
+            for (size_t i = statement.firstRoot; i < statement.endRoot; ++i)
+            {
+                m_replaceStack.push_back({ m_roots[i].first, m_roots[i].second, 0 });
+            }
 
-    if (other != NULL) {
-        if (firstStatement == NULL) firstStatement = other;
-        else lastStatement->nextStatement = other;
-        lastStatement = lastOther;
-    }
+            while (!m_replaceStack.empty())
+            {
+                Replace replace = m_replaceStack.back();
+                m_replaceStack.pop_back();
 
-    root->statement = firstStatement;
-}
+                HLSLExpression * expression = *replace.slot;
+                int number = m_numbers[replace.index];
+                if (IsComputed(expression) && m_counts[number] > 1)
+                {
+                    HLSLDeclaration *& temporary = m_temporaries[number];
+                    HLSLExpression * next = expression->nextExpression;
+                    if (temporary != NULL)
+                    {
+                        *replace.slot = AddTemporaryIdentifier(m_tree, temporary, expression);
+                        (*replace.slot)->nextExpression = next;
+                        ++m_eliminatedCount;
+                        continue;
+                    }
 
+                    // The first one is the initial value of the temporary.
+                    expression->nextExpression = NULL;
+                    temporary = AddTemporaryDeclaration(m_tree, GetTemporaryName(), expression);
+                    temporary->type.flags = 0;
+                    *replace.slot = AddTemporaryIdentifier(m_tree, temporary, expression);
+                    (*replace.slot)->nextExpression = next;
+
+                    HLSLStatement ** link = m_owners[replace.owner];
+                    temporary->nextStatement = *link;
+                    *link = temporary;
+                    m_owners[replace.owner] = &temporary->nextStatement;
+                    m_owners.push_back(link);
+                    replace.owner = m_owners.size() - 1;
+                }
 
+                GetChildren(expression, replace.index);
+                for (const auto & child : m_children)
+                {
+                    m_replaceStack.push_back({ child.first, child.second, replace.owner });
+                }
+            }
+        }
+        m_temporaries.clear();
+    }
 
+    const char * GetTemporaryName()
+    {
+        if (m_temporaryCount == 0)
+        {
+            // Most functions have no temporary.
+            NameCollector collector;
+            collector.Walk(m_function);
+            m_names.swap(collector.names);
+        }
 
+        const char * name;
+        do
+        {
+            name = m_tree->AddStringFormat("cse%d", m_temporaryCount++);
+        }
+        while (m_names.count(name) > 0);
+        return name;
+    }
+
+    HLSLTree *                                                  m_tree;
+    HLSLFunction *                                              m_function;
+    int                                                         m_numberCount;
+    int                                                         m_temporaryCount;
+    int                                                         m_eliminatedCount;
+    std::unordered_set<const char *>                            m_names;            // Named in the function.
+    std::unordered_map<const char *, int>                       m_versions;         // Of each variable, increased when it's written.
+    std::vector<const char *>                                   m_statementNames;   // Declared by the statement numbered.
+    std::unordered_map<std::vector<uintptr_t>, int, KeyHash>    m_keys;             // Number of each expression, from its operation and operands.
+    std::vector<int>                                            m_numbers;          // Of the expressions of the statement list, in the order AddRoot visits them.
+    std::vector<size_t>                                         m_sizes;            // Of each expression with those below it, in the same order.
+    std::vector<int>                                            m_counts;           // Of each number, the repeats below a repeat aren't counted.
+    std::unordered_map<int, HLSLDeclaration *>                  m_temporaries;
+    std::vector<HLSLStatement **>                               m_lists;            // Statement lists left.
+    std::vector<Statement>                                      m_statements;
+    std::vector<std::pair<HLSLExpression **, size_t>>           m_roots;            // With their index in m_numbers.
+    std::vector<HLSLStatement **>                               m_owners;           // Link to each statement the expressions replaced are in.
+    std::vector<uintptr_t>                                      m_key;
+    std::vector<Visit>                                          m_numberStack;
+    std::vector<int>                                            m_childNumbers;
+    std::vector<std::pair<HLSLExpression **, size_t>>           m_children;
+    std::vector<std::pair<HLSLExpression **, size_t>>           m_countStack;
+    std::vector<Replace>                                        m_replaceStack;
+    SideEffectFinder                                            m_sideEffects;
+};
 
-// First and last can be the same.
-void AddStatements(HLSLRoot * root, HLSLStatement * before, HLSLStatement * first, HLSLStatement * last)
+int EliminateCommonSubexpressions(HLSLTree* tree, HLSLFunction* function)
 {
-    if (before == NULL) {
-        last->nextStatement = root->statement;
-        root->statement = first;
-    }
-    else {
-        last->nextStatement = before->nextStatement;
-        before->nextStatement = first;
-    }
+    CommonSubexpressionEliminator eliminator(tree, NULL);
+    return eliminator.EliminateCommonSubexpressions(function);
 }
 
-void AddSingleStatement(HLSLRoot * root, HLSLStatement * before, HLSLStatement * statement)
+int EliminateCommonSubexpressions(HLSLTree* tree, HLSLFunction* function, const HLSLFunctionSet& shaderFunctions)
 {
-    AddStatements(root, before, statement, statement);
+    CommonSubexpressionEliminator eliminator(tree, &shaderFunctions);
+    return eliminator.EliminateCommonSubexpressions(function);
 }
 
-
-
-// @@ This is very game-specific. Should be moved to pipeline_parser or somewhere else.
-void GroupParameters(HLSLTree * tree)
+/** Returns the definition of a function, NULL if the shader only declares it. */
+static HLSLFunction * GetDefinition(const HLSLFunction * function)
 {
-    // Sort parameters based on semantic and group them in cbuffers.
-
-    HLSLRoot* root = tree->GetRoot();
-
-    HLSLDeclaration * firstPerItemDeclaration = NULL;
-    HLSLDeclaration * lastPerItemDeclaration = NULL;
-
-    HLSLDeclaration * instanceDataDeclaration = NULL;
+    return const_cast<HLSLFunction *>(function->statement != NULL ? function : function->forward);
+}
 
-    HLSLDeclaration * firstPerPassDeclaration = NULL;
-    HLSLDeclaration * lastPerPassDeclaration = NULL;
+/** Collects the definitions of the functions called below the nodes it walks. */
+class CalleeCollector : public HLSLIterativeTreeVisitor<CalleeCollector>
+{
+public:
+    std::vector<HLSLFunction *> callees;
 
-    HLSLDeclaration * firstPerItemSampler = NULL;
-    HLSLDeclaration * lastPerItemSampler = NULL;
+    bool EnterNode(HLSLNode * node)
+    {
+        if (node->nodeType == HLSLNodeType::FunctionCall)
+        {
+            HLSLFunction * callee = GetDefinition(static_cast<HLSLFunctionCall *>(node)->function);
+            if (callee != NULL)
+            {
+                callees.push_back(callee);
+            }
+        }
+        return true;
+    }
+};
 
-    HLSLDeclaration * firstPerPassSampler = NULL;
-    HLSLDeclaration * lastPerPassSampler = NULL;
+/** Counts the nodes it walks, up to one above the limit. */
+class NodeCounter : public HLSLIterativeTreeVisitor<NodeCounter>
+{
+public:
+    int     nodeCount = 0;
+    int     limit = 0;
 
-    HLSLStatement * statementBeforeBuffers = NULL;
-    
-    HLSLStatement* previousStatement = NULL;
-    HLSLStatement* statement = root->statement;
-    while (statement != NULL)
+    bool EnterNode(HLSLNode * node)
     {
-        HLSLStatement* nextStatement = statement->nextStatement;
-
-        if (statement->nodeType == HLSLNodeType::Struct) // Do not remove this, or it will mess the else clause below.
-        {   
-            statementBeforeBuffers = statement;
-        }
-        else if (statement->nodeType == HLSLNodeType::Declaration)
+        if (++nodeCount > limit)
         {
-            HLSLDeclaration* declaration = (HLSLDeclaration*)statement;
+            Stop();
+        }
+        return true;
+    }
+};
 
-            // We insert buffers after the last const declaration.
-            if ((declaration->type.flags & (int)HLSLTypeFlags::Const) != 0)
+/**
+ * Inlines the calls to small functions, see InlineFunctions. The functions
+ * are visited callees first, so that the bodies copied have their own calls
+ * inlined already. A body is only copied if it's below the size limit, so
+ * the recursive functions below walk a bounded number of nodes; the callers
+ * are walked with explicit stacks.
+ */
+class FunctionInliner
+{
+public:
+    FunctionInliner(HLSLTree * tree, int maxNodeCount)
+    {
+        m_tree = tree;
+        m_maxNodeCount = maxNodeCount;
+        m_caller = NULL;
+        m_callerNamesCollected = false;
+        m_nameCount = 0;
+        m_inlinedCount = 0;
+        m_returnInPlace = false;
+        m_insert = NULL;
+        m_returnValue = NULL;
+    }
+
+    int InlineFunctions()
+    {
+        std::vector<std::pair<HLSLFunction *, bool>> stack;    // With true once its callees are pushed.
+        for (HLSLStatement * statement = m_tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+        {
+            if (statement->nodeType != HLSLNodeType::Function || static_cast<HLSLFunction *>(statement)->statement == NULL)
             {
-                statementBeforeBuffers = statement;
+                continue;
             }
 
-            // Do not move samplers or static/const parameters.
-            if ((declaration->type.flags & ((int)HLSLTypeFlags::Static | (int)HLSLTypeFlags::Const)) == 0)
+            stack.emplace_back(static_cast<HLSLFunction *>(statement), false);
+            while (!stack.empty())
             {
-                // Unlink statement.
-                statement->nextStatement = NULL;
-                if (previousStatement != NULL) previousStatement->nextStatement = nextStatement;
-                else root->statement = nextStatement;
-
-                while(declaration != NULL)
+                HLSLFunction * function = stack.back().first;
+                bool calleesDone = stack.back().second;
+                stack.pop_back();
+                if (calleesDone)
                 {
-                    HLSLDeclaration* nextDeclaration = declaration->nextDeclaration;
-
-                    if (declaration->semantic != NULL && String_EqualNoCase(declaration->semantic, "PER_INSTANCED_ITEM"))
-                    {
-                        ASSERT(instanceDataDeclaration == NULL);
-                        instanceDataDeclaration = declaration;
-                    }
-                    else
+                    InlineCalls(function);
+                    AnalyzeCallee(function);
+                }
+                else if (m_entered.insert(function).second)
+                {
+                    // A recursive call, which HLSL doesn't allow, reaches a function not analyzed yet and is left alone.
+                    stack.emplace_back(function, true);
+                    CalleeCollector collector;
+                    collector.WalkList(function->statement);
+                    for (HLSLFunction * callee : collector.callees)
                     {
-                        // Select group based on type and semantic.
-                        HLSLDeclaration ** first, ** last;
-                        if (declaration->semantic == NULL || String_EqualNoCase(declaration->semantic, "PER_ITEM") || String_EqualNoCase(declaration->semantic, "PER_MATERIAL"))
+                        if (m_entered.count(callee) == 0)
                         {
-                            if (IsSamplerType(declaration->type))
-                            {
-                                first = &firstPerItemSampler;
-                                last = &lastPerItemSampler;
-                            }
-                            else
-                            {
-                                first = &firstPerItemDeclaration;
-                                last = &lastPerItemDeclaration;
-                            }
-                        }
-                        else
-                        {
-                            if (IsSamplerType(declaration->type))
-                            {
-                                first = &firstPerPassSampler;
-                                last = &lastPerPassSampler;
-                            }
-                            else
-                            {
-                                first = &firstPerPassDeclaration;
-                                last = &lastPerPassDeclaration;
-                            }
+                            stack.emplace_back(callee, false);
                         }
-
-                        // Add declaration to new list.
-                        if (*first == NULL) *first = declaration;
-                        else (*last)->nextStatement = declaration;
-                        *last = declaration;
                     }
+                }
+            }
+        }
+        return m_inlinedCount;
+    }
 
-                    // Unlink from declaration list.
-                    declaration->nextDeclaration = NULL;
+private:
 
-                    // Reset attributes.
-                    declaration->registerName = NULL;
-                    //declaration->semantic = NULL;         // @@ Don't do this!
+    /** What inlining the calls to a function needs to know about it. */
+    struct Callee
+    {
+        bool                        inlinable = false;
+        bool                        writesGlobals = false;  // Or may, through the functions it calls.
+        std::vector<const char *>   freeNames;              // Read but not declared by the function: globals and the functions it calls.
+        std::vector<bool>           writtenArguments;       // In the order of the arguments.
+    };
 
-                    declaration = nextDeclaration;
-                }
-            }
+    /** A name of the callee in the body copied, replaced by a local or by the constant value of an argument. */
+    struct Rename
+    {
+        const char *        name;
+        const char *        newName;
+        HLSLExpression *    value;
+    };
+
+    /** An output argument, written back once the body is inlined. */
+    struct WriteBack
+    {
+        HLSLExpression *            target;
+        const HLSLDeclaration *     local;
+    };
+
+    /**
+     * Records whether the calls to a function can be inlined. Its body must be
+     * small, end with its only return, and be made of the statements and
+     * expressions CloneStatements copies. The locals declared static keep their
+     * value across the calls and can't be copied.
+     */
+    void AnalyzeCallee(HLSLFunction * function)
+    {
+        Callee & callee = m_callees[function];
+
+        NodeCounter counter;
+        counter.limit = m_maxNodeCount;
+        counter.WalkList(function->statement);
+        if (counter.nodeCount > m_maxNodeCount)
+        {
+            return;
         }
-        /*else
+
+        m_scope.clear();
+        for (const HLSLArgument * argument = function->argument; argument != NULL; argument = argument->nextArgument)
         {
-            if (statementBeforeBuffers == NULL) {
-                // This is the location where we will insert our buffers.
-                statementBeforeBuffers = previousStatement;
+            if (argument->type.array)
+            {
+                return;
             }
-        }*/
-
-        if (statement->nextStatement == nextStatement) {
-            previousStatement = statement;
+            m_scope.push_back(argument->name);
         }
-        statement = nextStatement;
+        m_argumentCount = m_scope.size();
+        callee.writtenArguments.assign(m_argumentCount, false);
+        callee.inlinable = AnalyzeStatements(function->statement, callee, true);
     }
 
-
-    // Add instance data declaration at the end of the per_item buffer.
-    if (instanceDataDeclaration != NULL)
+    bool AnalyzeStatements(const HLSLStatement * statement, Callee & callee, bool top)
     {
-        if (firstPerItemDeclaration == NULL) firstPerItemDeclaration = instanceDataDeclaration;
-        else lastPerItemDeclaration->nextStatement = instanceDataDeclaration;
+        size_t scope = m_scope.size();
+        for (; statement != NULL; statement = statement->nextStatement)
+        {
+            switch (statement->nodeType)
+            {
+            case HLSLNodeType::Declaration:
+                if (!AnalyzeDeclaration(static_cast<const HLSLDeclaration *>(statement), callee)) return false;
+                break;
+            case HLSLNodeType::ExpressionStatement:
+                if (!AnalyzeExpression(static_cast<const HLSLExpressionStatement *>(statement)->expression, callee)) return false;
+                break;
+            case HLSLNodeType::ReturnStatement:
+                {
+                    const HLSLExpression * expression = static_cast<const HLSLReturnStatement *>(statement)->expression;
+                    if (!top || statement->nextStatement != NULL || (expression != NULL && !AnalyzeExpression(expression, callee))) return false;
+                    break;
+                }
+            case HLSLNodeType::DiscardStatement:
+            case HLSLNodeType::BreakStatement:
+            case HLSLNodeType::ContinueStatement:
+                break;
+            case HLSLNodeType::IfStatement:
+                {
+                    const HLSLIfStatement * ifStatement = static_cast<const HLSLIfStatement *>(statement);
+                    if (!AnalyzeExpression(ifStatement->condition, callee) ||
+                        !AnalyzeStatements(ifStatement->statement, callee, false) ||
+                        !AnalyzeStatements(ifStatement->elseStatement, callee, false)) return false;
+                    break;
+                }
+            case HLSLNodeType::ForStatement:
+                {
+                    const HLSLForStatement * forStatement = static_cast<const HLSLForStatement *>(statement);
+                    size_t forScope = m_scope.size();
+                    if ((forStatement->initialization != NULL && !AnalyzeDeclaration(forStatement->initialization, callee)) ||
+                        (forStatement->condition != NULL && !AnalyzeExpression(forStatement->condition, callee)) ||
+                        (forStatement->increment != NULL && !AnalyzeExpression(forStatement->increment, callee)) ||
+                        !AnalyzeStatements(forStatement->statement, callee, false)) return false;
+                    m_scope.resize(forScope);
+                    break;
+                }
+            case HLSLNodeType::BlockStatement:
+                if (!AnalyzeStatements(static_cast<const HLSLBlockStatement *>(statement)->statement, callee, false)) return false;
+                break;
+            default:
+                return false;
+            }
+        }
+        m_scope.resize(scope);
+        return true;
     }
 
-
-    // Add samplers.
-    if (firstPerItemSampler != NULL) {
-        AddStatements(root, statementBeforeBuffers, firstPerItemSampler, lastPerItemSampler);
-        statementBeforeBuffers = lastPerItemSampler;
-    }
-    if (firstPerPassSampler != NULL) {
-        AddStatements(root, statementBeforeBuffers, firstPerPassSampler, lastPerPassSampler);
-        statementBeforeBuffers = lastPerPassSampler;
+    bool AnalyzeDeclaration(const HLSLDeclaration * declaration, Callee & callee)
+    {
+        for (; declaration != NULL; declaration = declaration->nextDeclaration)
+        {
+            if ((declaration->type.flags & (int)HLSLTypeFlags::Static) != 0)
+            {
+                return false;
+            }
+            for (const HLSLExpression * value = declaration->assignment; value != NULL; value = value->nextExpression)
+            {
+                if (!AnalyzeExpression(value, callee)) return false;
+            }
+            m_scope.push_back(declaration->name);
+        }
+        return true;
     }
 
-
-    // @@ We are assuming per_item and per_pass buffers don't already exist. @@ We should assert on that.
-
-    if (firstPerItemDeclaration != NULL)
+    bool AnalyzeExpression(const HLSLExpression * expression, Callee & callee)
     {
-        // Create buffer statement.
-        HLSLBuffer * perItemBuffer = tree->AddNode<HLSLBuffer>(firstPerItemDeclaration->fileName, firstPerItemDeclaration->line-1);
-        perItemBuffer->name = tree->AddString("per_item");
-        perItemBuffer->registerName = tree->AddString("b0");
-        perItemBuffer->field = firstPerItemDeclaration;
-        
-        // Set declaration buffer pointers.
-        HLSLDeclaration * field = perItemBuffer->field;
-        while (field != NULL)
+        switch (expression->nodeType)
         {
-            field->buffer = perItemBuffer;
-            field = (HLSLDeclaration *)field->nextStatement;
+        case HLSLNodeType::IdentifierExpression:
+            {
+                const char * name = static_cast<const HLSLIdentifierExpression *>(expression)->name;
+                if (FindInScope(name) == m_scope.size() && std::find(callee.freeNames.begin(), callee.freeNames.end(), name) == callee.freeNames.end())
+                {
+                    callee.freeNames.push_back(name);
+                }
+                break;
+            }
+        case HLSLNodeType::UnaryExpression:
+            if (HasSideEffect(expression))
+            {
+                MarkWritten(static_cast<const HLSLUnaryExpression *>(expression)->expression, callee);
+            }
+            break;
+        case HLSLNodeType::BinaryExpression:
+            if (HasSideEffect(expression))
+            {
+                MarkWritten(static_cast<const HLSLBinaryExpression *>(expression)->expression1, callee);
+            }
+            break;
+        case HLSLNodeType::FunctionCall:
+            {
+                const HLSLFunctionCall * call = static_cast<const HLSLFunctionCall *>(expression);
+                const HLSLExpression * value = call->argument;
+                for (const HLSLArgument * argument = call->function->argument; argument != NULL && value != NULL; argument = argument->nextArgument, value = value->nextExpression)
+                {
+                    if (argument->modifier == HLSLArgumentModifier::Out || argument->modifier == HLSLArgumentModifier::Inout)
+                    {
+                        MarkWritten(value, callee);
+                    }
+                }
+                if (std::find(callee.freeNames.begin(), callee.freeNames.end(), call->function->name) == callee.freeNames.end())
+                {
+                    callee.freeNames.push_back(call->function->name);
+                }
+                callee.writesGlobals = callee.writesGlobals || HasSideEffect(call);
+                break;
+            }
+        case HLSLNodeType::LiteralExpression:
+        case HLSLNodeType::ConditionalExpression:
+        case HLSLNodeType::CastingExpression:
+        case HLSLNodeType::ConstructorExpression:
+        case HLSLNodeType::MemberAccess:
+        case HLSLNodeType::ArrayAccess:
+            break;
+        default:
+            return false;
         }
 
-        // Add buffer to statements.
-        AddSingleStatement(root, statementBeforeBuffers, perItemBuffer);
-        statementBeforeBuffers = perItemBuffer;
+        bool analyzed = true;
+        ForEachChildExpression(const_cast<HLSLExpression *>(expression), [&](HLSLExpression *& child) { analyzed = analyzed && AnalyzeExpression(child, callee); });
+        return analyzed;
     }
 
-    if (firstPerPassDeclaration != NULL)
+    /** Returns the index in m_scope of the innermost declaration of name, its size if there's none. */
+    size_t FindInScope(const char * name) const
     {
-        // Create buffer statement.
-        HLSLBuffer * perPassBuffer = tree->AddNode<HLSLBuffer>(firstPerPassDeclaration->fileName, firstPerPassDeclaration->line-1);
-        perPassBuffer->name = tree->AddString("per_pass");
-        perPassBuffer->registerName = tree->AddString("b1");
-        perPassBuffer->field = firstPerPassDeclaration;
-
-        // Set declaration buffer pointers.
-        HLSLDeclaration * field = perPassBuffer->field;
-        while (field != NULL)
+        for (size_t i = m_scope.size(); i > 0; --i)
         {
-            field->buffer = perPassBuffer;
-            field = (HLSLDeclaration *)field->nextStatement;
+            if (m_scope[i - 1] == name)
+            {
+                return i - 1;
+            }
         }
-        
-        // Add buffer to statements.
-        AddSingleStatement(root, statementBeforeBuffers, perPassBuffer);
+        return m_scope.size();
     }
-}
-
-
-class FindArgumentVisitor : public HLSLTreeVisitor
-{
-public:
-    bool found;
-    const char * name;
 
-	FindArgumentVisitor()
-	{
-		found = false;
-		name  = NULL;
-	}
-
-    bool FindArgument(const char * name, HLSLFunction * function)
+    void MarkWritten(const HLSLExpression * target, Callee & callee)
     {
-        this->found = false;
-        this->name = name;
-        VisitStatements(function->statement);
-        return found;
+        const char * name = GetAssignedName(target);
+        size_t index = name != NULL ? FindInScope(name) : m_scope.size();
+        if (index < m_argumentCount)
+        {
+            callee.writtenArguments[index] = true;
+        }
+        else if (index == m_scope.size())
+        {
+            callee.writesGlobals = true;
+        }
     }
-    
-    virtual void VisitStatements(HLSLStatement * statement) override
+
+    /** Inlines the calls of the statements of a function, from the first list to the nested ones. */
+    void InlineCalls(HLSLFunction * function)
     {
-        while (statement != NULL && !found)
+        m_caller = function;
+        m_callerNamesCollected = false;
+        m_nameCount = 0;
+
+        m_lists.assign(1, &function->statement);
+        while (!m_lists.empty())
         {
-            VisitStatement(statement);
-            statement = statement->nextStatement;
+            HLSLStatement ** link = m_lists.back();
+            m_lists.pop_back();
+            while (*link != NULL)
+            {
+                link = InlineStatementCalls(link);
+            }
         }
     }
 
-    virtual void VisitIdentifierExpression(HLSLIdentifierExpression * node) override
+    /**
+     * Calls visit with a reference to each expression a statement evaluates
+     * before it executes, where the calls can be inlined. The assignment of an
+     * expression statement is left out, its operands are evaluated first.
+     * Declarations of several variables are left alone, the next ones may read
+     * the first ones.
+     */
+    template <class Visit>
+    static void ForEachRoot(HLSLStatement * statement, Visit visit)
     {
-        if (node->name == name)
+        switch (statement->nodeType)
         {
-            found = true;
+        case HLSLNodeType::Declaration:
+            if (static_cast<HLSLDeclaration *>(statement)->nextDeclaration == NULL)
+            {
+                ForEachChildExpression(statement, visit);
+            }
+            break;
+        case HLSLNodeType::ExpressionStatement:
+            {
+                HLSLExpression *& expression = static_cast<HLSLExpressionStatement *>(statement)->expression;
+                if (expression->nodeType == HLSLNodeType::BinaryExpression && IsAssignOp(static_cast<HLSLBinaryExpression *>(expression)->binaryOp))
+                {
+                    visit(static_cast<HLSLBinaryExpression *>(expression)->expression1);
+                    visit(static_cast<HLSLBinaryExpression *>(expression)->expression2);
+                }
+                else
+                {
+                    visit(expression);
+                }
+                break;
+            }
+        case HLSLNodeType::ReturnStatement:
+        case HLSLNodeType::IfStatement:
+            ForEachChildExpression(statement, visit);
+            break;
+        default:
+            break;
         }
     }
-};
-
 
-void HideUnusedArguments(HLSLFunction * function)
-{
-    FindArgumentVisitor visitor;
- 
-    // For each argument.
-    HLSLArgument * arg = function->argument;
-    while (arg != NULL)
+    /**
+     * Inlines the calls of the statement at link, if all the calls to the
+     * functions of the shader it makes can be and it has no other side effects:
+     * the bodies go before the statement, which must see the same values.
+     * Returns the link to the next statement.
+     */
+    HLSLStatement ** InlineStatementCalls(HLSLStatement ** link)
     {
-        if (!visitor.FindArgument(arg->name, function))
+        HLSLStatement * statement = *link;
+        switch (statement->nodeType)
         {
-            arg->hidden = true;
+        case HLSLNodeType::IfStatement:
+            m_lists.push_back(&static_cast<HLSLIfStatement *>(statement)->statement);
+            m_lists.push_back(&static_cast<HLSLIfStatement *>(statement)->elseStatement);
+            break;
+        case HLSLNodeType::ForStatement:
+            m_lists.push_back(&static_cast<HLSLForStatement *>(statement)->statement);
+            break;
+        case HLSLNodeType::BlockStatement:
+            m_lists.push_back(&static_cast<HLSLBlockStatement *>(statement)->statement);
+            break;
+        default:
+            break;
         }
 
-        arg = arg->nextArgument;
+        m_calls.clear();
+        m_effectCount = 0;
+        ForEachRoot(statement, [&](HLSLExpression *& root) { CollectCalls(root); });
+        if (m_calls.empty() || m_effectCount > 0)
+        {
+            return &statement->nextStatement;
+        }
+
+        // A call making the whole statement leaves nothing to evaluate after its body.
+        HLSLExpression * expression = statement->nodeType == HLSLNodeType::ExpressionStatement ? static_cast<HLSLExpressionStatement *>(statement)->expression : NULL;
+        const HLSLFunctionCall * discarded = expression != NULL && expression->nodeType == HLSLNodeType::FunctionCall ? static_cast<HLSLFunctionCall *>(expression) : NULL;
+
+        // Without writes back nor to globals, the values a return reads are the same where the call was.
+        m_returnInPlace = true;
+        for (const HLSLFunctionCall * call : m_calls)
+        {
+            const HLSLFunction * function = GetDefinition(call->function);
+            m_returnInPlace = m_returnInPlace && function->numOutputArguments == 0 && !m_callees[function].writesGlobals;
+        }
+
+        m_insert = link;
+        m_results.clear();
+        for (HLSLFunctionCall * call : m_calls)
+        {
+            // The calls in its arguments are evaluated first, their bodies are already inlined.
+            for (HLSLExpression ** argument = &call->argument; *argument != NULL; argument = &(*argument)->nextExpression)
+            {
+                ReplaceInlinedCalls(argument);
+            }
+            m_results[call] = InlineCall(call, call != discarded);
+        }
+
+        if (discarded != NULL && m_results.count(discarded) > 0)
+        {
+            *m_insert = statement->nextStatement;
+            return m_insert;
+        }
+        ForEachRoot(statement, [&](HLSLExpression *& root) { ReplaceInlinedCalls(&root); });
+        return &statement->nextStatement;
     }
-}
 
-bool EmulateAlphaTest(HLSLTree* tree, const char* entryName, float alphaRef/*=0.5*/)
-{
-    // Find all return statements of this entry point.
-    HLSLFunction* entry = tree->FindFunction(entryName);
-    if (entry != NULL)
+    /**
+     * Appends the calls below root that can be inlined to m_calls, in the order
+     * they're evaluated, and counts the other expressions with side effects.
+     * The operands of ?:, && and || may not be evaluated, nothing below them
+     * is inlined.
+     */
+    void CollectCalls(HLSLExpression * root)
     {
-        HLSLStatement ** ptr = &entry->statement;
-        HLSLStatement * statement = entry->statement;
-        while (statement != NULL)
+        m_walkStack.assign(1, std::make_pair(root, false));
+        while (!m_walkStack.empty())
         {
-            if (statement->nodeType == HLSLNodeType::ReturnStatement)
-            {
-                HLSLReturnStatement * returnStatement = (HLSLReturnStatement *)statement;
-                HLSLBaseType returnType = returnStatement->expression->expressionType.baseType;
-                
-                // Build statement: "if (%s.a < 0.5) discard;"
+            HLSLExpression * expression = m_walkStack.back().first;
+            bool left = m_walkStack.back().second;
+            m_walkStack.pop_back();
 
-                HLSLDiscardStatement * discard = tree->AddNode<HLSLDiscardStatement>(statement->fileName, statement->line);
-                
-                HLSLExpression * alpha = NULL;
-                if (returnType == HLSLBaseType::Float4 || returnType == HLSLBaseType::Half4)
-                {
-                    // @@ If return expression is a constructor, grab 4th argument.
-                    // That's not as easy, since we support 'float4(float3, float)' or 'float4(float, float3)', extracting
-                    // the latter is not that easy.
-                    /*if (returnStatement->expression->nodeType == HLSLNodeType::ConstructorExpression) {
-                        HLSLConstructorExpression * constructor = (HLSLConstructorExpression *)returnStatement->expression;
-                        //constructor->
-                    }
-                    */
-                    
-                    if (alpha == NULL) {
-                        HLSLMemberAccess * access = tree->AddNode<HLSLMemberAccess>(statement->fileName, statement->line);
-                        access->expressionType = HLSLType(HLSLBaseType::Float);
-                        access->object = returnStatement->expression;     // @@ Is reference OK? Or should we clone expression?
-                        access->field = tree->AddString("a");
-                        access->swizzle = true;
-                        
-                        alpha = access;
-                    }
-                }
-                else if (returnType == HLSLBaseType::Float || returnType == HLSLBaseType::Half)
+            if (left)
+            {
+                HLSLFunctionCall * call = static_cast<HLSLFunctionCall *>(expression);
+                if (IsInlinable(call))
                 {
-                    alpha = returnStatement->expression;     // @@ Is reference OK? Or should we clone expression?
+                    m_calls.push_back(call);
                 }
-                else
+                else if (HasSideEffect(call))
                 {
-                    return false;
+                    ++m_effectCount;
                 }
-                
-                HLSLLiteralExpression * threshold = tree->AddNode<HLSLLiteralExpression>(statement->fileName, statement->line);
-                threshold->expressionType = HLSLType(HLSLBaseType::Float);
-                threshold->fValue = alphaRef;
-                threshold->type = HLSLBaseType::Float;
-                
-                HLSLBinaryExpression * condition = tree->AddNode<HLSLBinaryExpression>(statement->fileName, statement->line);
-                condition->expressionType = HLSLType(HLSLBaseType::Bool);
-                condition->binaryOp = HLSLBinaryOp::Less;
-                condition->expression1 = alpha;
-                condition->expression2 = threshold;
+                continue;
+            }
 
-                // Insert statement.
-                HLSLIfStatement * st = tree->AddNode<HLSLIfStatement>(statement->fileName, statement->line);
-                st->condition = condition;
-                st->statement = discard;
-                st->nextStatement = statement;
-                *ptr = st;
+            if (expression->nodeType == HLSLNodeType::ConditionalExpression || (expression->nodeType == HLSLNodeType::BinaryExpression &&
+                (static_cast<HLSLBinaryExpression *>(expression)->binaryOp == HLSLBinaryOp::And || static_cast<HLSLBinaryExpression *>(expression)->binaryOp == HLSLBinaryOp::Or)))
+            {
+                m_sideEffects.found = false;
+                m_sideEffects.Walk(expression);
+                m_effectCount += m_sideEffects.found ? 1 : 0;
+                continue;
             }
-        
-            ptr = &statement->nextStatement;
-            statement = statement->nextStatement;
+
+            if (expression->nodeType == HLSLNodeType::FunctionCall)
+            {
+                m_walkStack.emplace_back(expression, true);
+            }
+            else if (HasSideEffect(expression))
+            {
+                ++m_effectCount;
+            }
+
+            // The first child on top.
+            size_t firstChild = m_walkStack.size();
+            ForEachChildExpression(expression, [&](HLSLExpression *& child) { m_walkStack.emplace_back(child, false); });
+            std::reverse(m_walkStack.begin() + firstChild, m_walkStack.end());
         }
     }
 
-    return true;
-}
+    /**
+     * Returns true if the call can be inlined in the current function: the
+     * callee was analyzed inlinable, the globals it reads aren't hidden by the
+     * locals of the caller, all its arguments are given, and the output ones
+     * can be read and written again without side effects.
+     */
+    bool IsInlinable(const HLSLFunctionCall * call)
+    {
+        const HLSLFunction * function = GetDefinition(call->function);
+        auto it = function != NULL ? m_callees.find(function) : m_callees.end();
+        if (it == m_callees.end() || !it->second.inlinable)
+        {
+            return false;
+        }
 
-bool NeedsFlattening(HLSLExpression * expr, int level = 0) {
-    if (expr == NULL) {
-        return false;
-    }
-    if (expr->nodeType == HLSLNodeType::UnaryExpression) {
-        HLSLUnaryExpression * unaryExpr = (HLSLUnaryExpression *)expr;
-        return NeedsFlattening(unaryExpr->expression, level+1) || NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::BinaryExpression) {
-        HLSLBinaryExpression * binaryExpr = (HLSLBinaryExpression *)expr;
-        if (IsAssignOp(binaryExpr->binaryOp)) {
-            return NeedsFlattening(binaryExpr->expression2, level+1) || NeedsFlattening(expr->nextExpression, level);
+        CollectCallerNames();
+        for (const char * name : it->second.freeNames)
+        {
+            if (m_callerDeclaredNames.count(name) > 0)
+            {
+                return false;
+            }
         }
-        else {
-            return NeedsFlattening(binaryExpr->expression1, level+1) || NeedsFlattening(binaryExpr->expression2, level+1) || NeedsFlattening(expr->nextExpression, level);
+
+        const HLSLExpression * value = call->argument;
+        for (const HLSLArgument * argument = function->argument; argument != NULL; argument = argument->nextArgument, value = value->nextExpression)
+        {
+            if (value == NULL)
+            {
+                return false;
+            }
+            if (argument->modifier == HLSLArgumentModifier::Out || argument->modifier == HLSLArgumentModifier::Inout)
+            {
+                m_sideEffects.found = false;
+                m_sideEffects.Walk(const_cast<HLSLExpression *>(value));
+                if (m_sideEffects.found)
+                {
+                    return false;
+                }
+            }
         }
+        return value == NULL;
     }
-    else if (expr->nodeType == HLSLNodeType::ConditionalExpression) {
-        HLSLConditionalExpression * conditionalExpr = (HLSLConditionalExpression *)expr;
-        return NeedsFlattening(conditionalExpr->condition, level+1) || NeedsFlattening(conditionalExpr->trueExpression, level+1) || NeedsFlattening(conditionalExpr->falseExpression, level+1) || NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::CastingExpression) {
-        HLSLCastingExpression * castingExpr = (HLSLCastingExpression *)expr;
-        return NeedsFlattening(castingExpr->expression, level+1) || NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::LiteralExpression) {
-        return NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::IdentifierExpression) {
-        return NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::ConstructorExpression) {
-        HLSLConstructorExpression * constructorExpr = (HLSLConstructorExpression *)expr;
-        return NeedsFlattening(constructorExpr->argument, level+1) || NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::MemberAccess) {
-        return NeedsFlattening(expr->nextExpression, level+1);
-    }
-    else if (expr->nodeType == HLSLNodeType::ArrayAccess) {
-        HLSLArrayAccess * arrayAccess = (HLSLArrayAccess *)expr;
-        return NeedsFlattening(arrayAccess->array, level+1) || NeedsFlattening(arrayAccess->index, level+1) || NeedsFlattening(expr->nextExpression, level);
-    }
-    else if (expr->nodeType == HLSLNodeType::FunctionCall) {
-        HLSLFunctionCall * functionCall = (HLSLFunctionCall *)expr;
-        if (functionCall->function->numOutputArguments > 0) {
-            if (level > 0) {
-                return true;
+
+    /** Replaces the calls below the expression at slot by the values InlineCall returned, the last expressions of a list first. */
+    void ReplaceInlinedCalls(HLSLExpression ** slot)
+    {
+        m_replaceStack.assign(1, slot);
+        while (!m_replaceStack.empty())
+        {
+            slot = m_replaceStack.back();
+            m_replaceStack.pop_back();
+
+            HLSLExpression * expression = *slot;
+            if (expression->nodeType == HLSLNodeType::FunctionCall)
+            {
+                auto it = m_results.find(static_cast<HLSLFunctionCall *>(expression));
+                if (it != m_results.end())
+                {
+                    it->second->nextExpression = expression->nextExpression;
+                    *slot = it->second;
+                    continue;
+                }
             }
+            ForEachChildExpression(expression, [&](HLSLExpression *& child) { m_replaceStack.push_back(&child); });
         }
-        return NeedsFlattening(functionCall->argument, level+1) || NeedsFlattening(expr->nextExpression, level);
     }
-    else {
-        //assert(false);
-        return false;
-    }
-}
 
+    /**
+     * Inserts the body of the callee at m_insert: the locals holding its
+     * arguments, a copy of its statements, the local holding its return value
+     * and the writes of its output arguments. The input arguments the callee
+     * doesn't write are replaced by their value when it's a constant, for
+     * FoldConstants to use, or a local of the caller. Returns the value of the
+     * call, the expression returned when the body is only its return and
+     * m_returnInPlace is set, else the local holding it. NULL if wantResult is
+     * false.
+     */
+    HLSLExpression * InlineCall(HLSLFunctionCall * call, bool wantResult)
+    {
+        const HLSLFunction * function = GetDefinition(call->function);
+        const Callee & callee = m_callees[function];
+        CollectCallerNames();
+        m_callerNames.insert(callee.freeNames.begin(), callee.freeNames.end());
+
+        // The arguments are the caller's expressions, none is renamed before they're all moved.
+        std::vector<Rename> renames;
+        std::vector<WriteBack> writeBacks;
+        HLSLExpression * value = call->argument;
+        size_t index = 0;
+        for (const HLSLArgument * argument = function->argument; argument != NULL; argument = argument->nextArgument, ++index)
+        {
+            HLSLExpression * next = value->nextExpression;
+            value->nextExpression = NULL;
 
-struct StatementList {
-    HLSLStatement * head = NULL;
-    HLSLStatement * tail = NULL;
-    void append(HLSLStatement * st) {
-        if (head == NULL) {
-            tail = head = st;
+            if (argument->modifier == HLSLArgumentModifier::Out)
+            {
+                const HLSLDeclaration * local = AddLocal(call, argument->type, NULL);
+                writeBacks.push_back({ value, local });
+                renames.push_back({ argument->name, local->name, NULL });
+            }
+            else if (argument->modifier == HLSLArgumentModifier::Inout)
+            {
+                HLSLExpression * target = CloneExpression(value);
+                const HLSLDeclaration * local = AddLocal(call, argument->type, value);
+                writeBacks.push_back({ target, local });
+                renames.push_back({ argument->name, local->name, NULL });
+            }
+            else if (!callee.writtenArguments[index] && (IsConstant(value) || IsCallerVariable(value)) && IsSameValueType(*value->expressionType, argument->type))
+            {
+                renames.push_back({ argument->name, NULL, value });
+            }
+            else
+            {
+                const HLSLDeclaration * local = AddLocal(call, argument->type, value);
+                renames.push_back({ argument->name, local->name, NULL });
+            }
+            value = next;
         }
-        tail->nextStatement = st;
-        tail = st;
-    }
-};
 
+        m_renames.swap(renames);
+        m_returnValue = NULL;
+        HLSLStatement * body = CloneStatements(function->statement);
+        m_renames.clear();
+        while (body != NULL)
+        {
+            HLSLStatement * next = body->nextStatement;
+            Insert(body);
+            body = next;
+        }
 
-    class ExpressionFlattener : public HLSLTreeVisitor
-    {
-    public:
-        HLSLTree * m_tree;
-        int tmp_index;
-        HLSLStatement ** statement_pointer;
-        HLSLFunction * current_function;
-        
-        ExpressionFlattener()
+        HLSLExpression * result = NULL;
+        if (m_returnValue != NULL && wantResult && m_returnInPlace && function->statement->nodeType == HLSLNodeType::ReturnStatement &&
+            IsSameValueType(*m_returnValue->expressionType, function->returnType))
         {
-            m_tree = NULL;
-            tmp_index = 0;
-            statement_pointer = NULL;
-            current_function = NULL;
+            // A body made of its return becomes an expression of the caller, folded with it.
+            result = m_returnValue;
         }
-        
-        void FlattenExpressions(HLSLTree * tree)
+        else if (m_returnValue != NULL && wantResult)
         {
-            m_tree = tree;
-            VisitRoot(tree->GetRoot());
+            const HLSLDeclaration * local = AddLocal(call, function->returnType, m_returnValue);
+            result = AddTemporaryIdentifier(m_tree, local, call);
+        }
+        else if (m_returnValue != NULL && HasSideEffects(m_returnValue))
+        {
+            Insert(AddExpressionStatement(m_returnValue));
         }
 
-        // Visit all statements updating the statement_pointer so that we can insert and replace statements. @@ Add this to the default visitor?
-        virtual void VisitFunction(HLSLFunction * node) override
+        for (const WriteBack & writeBack : writeBacks)
         {
-            current_function = node;
-            statement_pointer = &node->statement;
-            VisitStatements(node->statement);
-            statement_pointer = NULL;
-            current_function = NULL;
+            HLSLBinaryExpression * assignment = m_tree->AddNode<HLSLBinaryExpression>(call->fileName, call->line);
+            assignment->binaryOp = HLSLBinaryOp::Assign;
+            assignment->expression1 = writeBack.target;
+            assignment->expression2 = AddTemporaryIdentifier(m_tree, writeBack.local, call);
+            assignment->expressionType = writeBack.target->expressionType;
+            Insert(AddExpressionStatement(assignment));
+        }
+
+        ++m_inlinedCount;
+        return result;
+    }
+
+    /**
+     * Returns true if a value of the first type can stand for one of the
+     * second: the same type, or scalars with a decimal point, which the parser
+     * gives to the literals.
+     */
+    static bool IsSameValueType(const HLSLType & valueType, const HLSLType & type)
+    {
+        auto isFloatScalar = [](HLSLBaseType baseType) { return baseType == HLSLBaseType::Float || baseType == HLSLBaseType::Half; };
+        if (valueType.array || type.array)
+        {
+            return false;
+        }
+        if (valueType.baseType == type.baseType)
+        {
+            return type.baseType != HLSLBaseType::UserDefined || valueType.typeName == type.typeName;
         }
+        return isFloatScalar(valueType.baseType) && isFloatScalar(type.baseType);
+    }
 
-        virtual void VisitIfStatement(HLSLIfStatement * node) override
+    /** Returns true for the small expressions of literals, like the constants FoldConstants leaves, which may be copied. */
+    bool IsConstant(HLSLExpression * expression)
+    {
+        int nodeCount = 0;
+        m_replaceStack.assign(1, &expression);
+        while (!m_replaceStack.empty())
         {
-            if (NeedsFlattening(node->condition, 1)) {
-                assert(false);  // @@ Add statements before if statement.
+            HLSLExpression * node = *m_replaceStack.back();
+            m_replaceStack.pop_back();
+            switch (node->nodeType)
+            {
+            case HLSLNodeType::LiteralExpression:
+            case HLSLNodeType::ConstructorExpression:
+            case HLSLNodeType::CastingExpression:
+            case HLSLNodeType::ConditionalExpression:
+                break;
+            case HLSLNodeType::UnaryExpression:
+            case HLSLNodeType::BinaryExpression:
+                if (HasSideEffect(node)) return false;
+                break;
+            default:
+                return false;
             }
-            
-            statement_pointer = &node->statement;
-            VisitStatements(node->statement);
-            if (node->elseStatement) {
-                statement_pointer = &node->elseStatement;
-                VisitStatements(node->elseStatement);
+            if (++nodeCount > m_maxNodeCount)
+            {
+                return false;
             }
+            ForEachChildExpression(node, [&](HLSLExpression *& child) { m_replaceStack.push_back(&child); });
         }
-        
-        virtual void VisitForStatement(HLSLForStatement * node) override
-        {
-            if (NeedsFlattening(node->initialization->assignment, 1)) {
-                assert(false);  // @@ Add statements before for statement.
-            }
-            if (NeedsFlattening(node->condition, 1) || NeedsFlattening(node->increment, 1)) {
-                assert(false);  // @@ These are tricky to implement. Need to handle all loop exits.
-            }
+        return true;
+    }
 
-            statement_pointer = &node->statement;
-            VisitStatements(node->statement);
-        }
-        
-        virtual void VisitBlockStatement(HLSLBlockStatement * node) override
-        {
-            statement_pointer = &node->statement;
-            VisitStatements(node->statement);
-        }
-        
-        virtual void VisitStatements(HLSLStatement * statement) override
+    /** Returns true for the locals and arguments of the caller: the callee can't write them, its output arguments are written back after its body. */
+    bool IsCallerVariable(const HLSLExpression * expression) const
+    {
+        if (expression->nodeType != HLSLNodeType::IdentifierExpression)
         {
-            while (statement != NULL) {
-                VisitStatement(statement);
-                statement_pointer = &statement->nextStatement;
-                statement = statement->nextStatement;
-            }
+            return false;
         }
+        const HLSLIdentifierExpression * identifier = static_cast<const HLSLIdentifierExpression *>(expression);
+        return !identifier->global && m_callerDeclaredNames.count(identifier->name) > 0;
+    }
 
-        // This is usually a function call or assignment.
-        virtual void VisitExpressionStatement(HLSLExpressionStatement * node) override
+    bool HasSideEffects(HLSLExpression * expression)
+    {
+        m_sideEffects.found = false;
+        m_sideEffects.Walk(expression);
+        return m_sideEffects.found;
+    }
+
+    /** Copies a list of statements of the callee, with its locals renamed. The return, last of the body, leaves its copied value in m_returnValue. */
+    HLSLStatement * CloneStatements(const HLSLStatement * statement)
+    {
+        size_t scope = m_renames.size();
+        HLSLStatement * first = NULL;
+        HLSLStatement ** link = &first;
+        for (; statement != NULL; statement = statement->nextStatement)
         {
-            if (NeedsFlattening(node->expression, 0))
+            HLSLStatement * copy = NULL;
+            switch (statement->nodeType)
             {
-                StatementList statements;
-                Flatten(node->expression, statements, false);
-                
-                // Link beginning of statement list.
-                *statement_pointer = statements.head;
-
-                // Link end of statement list.
-                HLSLStatement * tail = statements.tail;
-                tail->nextStatement = node->nextStatement;
-                
-                // Update statement pointer.
-                statement_pointer = &tail->nextStatement;
-                
-                // @@ Delete node?
+            case HLSLNodeType::Declaration:
+                copy = CloneDeclaration(static_cast<const HLSLDeclaration *>(statement));
+                break;
+            case HLSLNodeType::ExpressionStatement:
+                {
+                    HLSLExpressionStatement * expressionStatement = CopyNode(static_cast<const HLSLExpressionStatement *>(statement));
+                    expressionStatement->expression = CloneExpression(expressionStatement->expression);
+                    copy = expressionStatement;
+                    break;
+                }
+            case HLSLNodeType::ReturnStatement:
+                {
+                    const HLSLExpression * expression = static_cast<const HLSLReturnStatement *>(statement)->expression;
+                    m_returnValue = expression != NULL ? CloneExpression(expression) : NULL;
+                    continue;
+                }
+            case HLSLNodeType::DiscardStatement:
+                copy = CopyNode(static_cast<const HLSLDiscardStatement *>(statement));
+                break;
+            case HLSLNodeType::BreakStatement:
+                copy = CopyNode(static_cast<const HLSLBreakStatement *>(statement));
+                break;
+            case HLSLNodeType::ContinueStatement:
+                copy = CopyNode(static_cast<const HLSLContinueStatement *>(statement));
+                break;
+            case HLSLNodeType::IfStatement:
+                {
+                    HLSLIfStatement * ifStatement = CopyNode(static_cast<const HLSLIfStatement *>(statement));
+                    ifStatement->condition = CloneExpression(ifStatement->condition);
+                    ifStatement->statement = CloneStatements(ifStatement->statement);
+                    ifStatement->elseStatement = CloneStatements(ifStatement->elseStatement);
+                    copy = ifStatement;
+                    break;
+                }
+            case HLSLNodeType::ForStatement:
+                {
+                    HLSLForStatement * forStatement = CopyNode(static_cast<const HLSLForStatement *>(statement));
+                    size_t forScope = m_renames.size();
+                    if (forStatement->initialization != NULL) forStatement->initialization = CloneDeclaration(forStatement->initialization);
+                    if (forStatement->condition != NULL) forStatement->condition = CloneExpression(forStatement->condition);
+                    if (forStatement->increment != NULL) forStatement->increment = CloneExpression(forStatement->increment);
+                    forStatement->statement = CloneStatements(forStatement->statement);
+                    m_renames.resize(forScope);
+                    copy = forStatement;
+                    break;
+                }
+            case HLSLNodeType::BlockStatement:
+                {
+                    HLSLBlockStatement * blockStatement = CopyNode(static_cast<const HLSLBlockStatement *>(statement));
+                    blockStatement->statement = CloneStatements(blockStatement->statement);
+                    copy = blockStatement;
+                    break;
+                }
+            default:
+                ASSERT(false);  // AnalyzeStatements refused it.
+                break;
             }
+            copy->nextStatement = NULL;
+            *link = copy;
+            link = &copy->nextStatement;
         }
+        m_renames.resize(scope);
+        return first;
+    }
 
-        virtual void VisitDeclaration(HLSLDeclaration * node) override
+    HLSLDeclaration * CloneDeclaration(const HLSLDeclaration * declaration)
+    {
+        HLSLDeclaration * first = NULL;
+        HLSLDeclaration ** link = &first;
+        for (; declaration != NULL; declaration = declaration->nextDeclaration)
         {
-            // Skip global declarations.
-            if (statement_pointer == NULL) return;
-            
-            if (NeedsFlattening(node->assignment, 1))
+            HLSLDeclaration * copy = CopyNode(declaration);
+            HLSLExpression ** value = &copy->assignment;
+            for (const HLSLExpression * original = declaration->assignment; original != NULL; original = original->nextExpression)
             {
-                StatementList statements;
-                HLSLIdentifierExpression * ident = Flatten(node->assignment, statements, true);
-                
-                // @@ Delete node->assignment?
-                
-                node->assignment = ident;
-                statements.append(node);
-                
-                // Link beginning of statement list.
-                *statement_pointer = statements.head;
-                
-                // Link end of statement list.
-                HLSLStatement * tail = statements.tail;
-                tail->nextStatement = node->nextStatement;
-                
-                // Update statement pointer.
-                statement_pointer = &tail->nextStatement;
+                *value = CloneExpression(original);
+                value = &(*value)->nextExpression;
             }
+            *value = NULL;
+
+            copy->name = GetNewName();
+            m_renames.push_back({ declaration->name, copy->name, NULL });
+            copy->nextDeclaration = NULL;
+            *link = copy;
+            link = &copy->nextDeclaration;
         }
+        return first;
+    }
 
-        virtual void VisitReturnStatement(HLSLReturnStatement * node) override
+    /** Copies an expression and those below it. The copy is followed by the same expression as the original, the lists below are copied whole. */
+    HLSLExpression * CloneExpression(const HLSLExpression * expression)
+    {
+        HLSLExpression * copy = NULL;
+        switch (expression->nodeType)
         {
-            if (NeedsFlattening(node->expression, 1))
+        case HLSLNodeType::IdentifierExpression:
             {
-                StatementList statements;
-                HLSLIdentifierExpression * ident = Flatten(node->expression, statements, true);
-
-                // @@ Delete node->expression?
-                
-                node->expression = ident;
-                statements.append(node);
-                
-                // Link beginning of statement list.
-                *statement_pointer = statements.head;
-                
-                // Link end of statement list.
-                HLSLStatement * tail = statements.tail;
-                tail->nextStatement = node->nextStatement;
-                
-                // Update statement pointer.
-                statement_pointer = &tail->nextStatement;
+                const char * name = static_cast<const HLSLIdentifierExpression *>(expression)->name;
+                for (size_t i = m_renames.size(); i > 0; --i)
+                {
+                    const Rename & rename = m_renames[i - 1];
+                    if (rename.name == name)
+                    {
+                        if (rename.value != NULL)
+                        {
+                            // The value is an expression of the caller, the names of the callee don't apply.
+                            const HLSLExpression * value = rename.value;
+                            std::vector<Rename> renames;
+                            renames.swap(m_renames);
+                            copy = CloneExpression(value);
+                            m_renames.swap(renames);
+                        }
+                        else
+                        {
+                            HLSLIdentifierExpression * identifier = CopyNode(static_cast<const HLSLIdentifierExpression *>(expression));
+                            identifier->name = rename.newName;
+                            identifier->global = false;
+                            copy = identifier;
+                        }
+                        copy->nextExpression = expression->nextExpression;
+                        return copy;
+                    }
+                }
+                copy = CopyNode(static_cast<const HLSLIdentifierExpression *>(expression));
+                break;
             }
+        case HLSLNodeType::LiteralExpression:       copy = CopyNode(static_cast<const HLSLLiteralExpression *>(expression)); break;
+        case HLSLNodeType::UnaryExpression:         copy = CopyNode(static_cast<const HLSLUnaryExpression *>(expression)); break;
+        case HLSLNodeType::BinaryExpression:        copy = CopyNode(static_cast<const HLSLBinaryExpression *>(expression)); break;
+        case HLSLNodeType::ConditionalExpression:   copy = CopyNode(static_cast<const HLSLConditionalExpression *>(expression)); break;
+        case HLSLNodeType::CastingExpression:       copy = CopyNode(static_cast<const HLSLCastingExpression *>(expression)); break;
+        case HLSLNodeType::ConstructorExpression:   copy = CopyNode(static_cast<const HLSLConstructorExpression *>(expression)); break;
+        case HLSLNodeType::MemberAccess:            copy = CopyNode(static_cast<const HLSLMemberAccess *>(expression)); break;
+        case HLSLNodeType::ArrayAccess:             copy = CopyNode(static_cast<const HLSLArrayAccess *>(expression)); break;
+        case HLSLNodeType::FunctionCall:            copy = CopyNode(static_cast<const HLSLFunctionCall *>(expression)); break;
+        default:
+            ASSERT(false);  // AnalyzeExpression refused it.
+            break;
         }
 
-        
-        HLSLDeclaration * BuildTemporaryDeclaration(HLSLExpression * expr)
+        // Each child copied is followed by the next original one, which the list walk copies in turn.
+        bool constantOperands = true;
+        ForEachChildExpression(copy, [&](HLSLExpression *& child)
         {
-            assert(expr->expressionType.baseType != HLSLBaseType::Void);
-            
-            HLSLDeclaration * declaration = m_tree->AddNode<HLSLDeclaration>(expr->fileName, expr->line);
-            declaration->name = m_tree->AddStringFormat("tmp%d", tmp_index++);
-            declaration->type = expr->expressionType;
-            declaration->assignment = expr;
-            
-            //HLSLIdentifierExpression * ident = (HLSLIdentifierExpression *)expr;
-            
-            return declaration;
-        }
-
-        HLSLExpressionStatement * BuildExpressionStatement(HLSLExpression * expr)
+            child = CloneExpression(child);
+            constantOperands = constantOperands && (child->expressionType->flags & (int)HLSLTypeFlags::Const) != 0;
+        });
+
+        // The operations on the arguments replaced by constants are constant, as the parser types them, for FoldConstants.
+        bool operation = expression->nodeType == HLSLNodeType::UnaryExpression || expression->nodeType == HLSLNodeType::BinaryExpression ||
+            expression->nodeType == HLSLNodeType::ConditionalExpression;
+        if (operation && constantOperands && !HasSideEffect(copy) && (copy->expressionType->flags & (int)HLSLTypeFlags::Const) == 0)
         {
-            HLSLExpressionStatement * statement = m_tree->AddNode<HLSLExpressionStatement>(expr->fileName, expr->line);
-            statement->expression = expr;
-            return statement;
+            HLSLType type = *copy->expressionType;
+            type.flags |= (int)HLSLTypeFlags::Const;
+            copy->expressionType = m_tree->AddType(type);
         }
+        return copy;
+    }
 
-        HLSLIdentifierExpression * AddExpressionStatement(HLSLExpression * expr, StatementList & statements, bool wantIdent)
-        {
-            if (wantIdent) {
-                HLSLDeclaration * declaration = BuildTemporaryDeclaration(expr);
-                statements.append(declaration);
-                
-                HLSLIdentifierExpression * ident = m_tree->AddNode<HLSLIdentifierExpression>(expr->fileName, expr->line);
-                ident->name = declaration->name;
-                ident->expressionType = declaration->type;
-                return ident;
-            }
-            else {
-                HLSLExpressionStatement * statement = BuildExpressionStatement(expr);
-                statements.append(statement);
-                return NULL;
-            }
-        }
-        
-        HLSLIdentifierExpression * Flatten(HLSLExpression * expr, StatementList & statements, bool wantIdent = true)
-        {
-            if (!NeedsFlattening(expr, wantIdent)) {
-                return AddExpressionStatement(expr, statements, wantIdent);
-            }
-            
-            if (expr->nodeType == HLSLNodeType::UnaryExpression) {
-                assert(expr->nextExpression == NULL);
-                
-                HLSLUnaryExpression * unaryExpr = (HLSLUnaryExpression *)expr;
-                
-                HLSLIdentifierExpression * tmp = Flatten(unaryExpr->expression, statements, true);
-                
-                HLSLUnaryExpression * newUnaryExpr = m_tree->AddNode<HLSLUnaryExpression>(unaryExpr->fileName, unaryExpr->line);
-                newUnaryExpr->unaryOp = unaryExpr->unaryOp;
-                newUnaryExpr->expression = tmp;
-                newUnaryExpr->expressionType = unaryExpr->expressionType;
+    template <class T>
+    T * CopyNode(const T * node)
+    {
+        T * copy = m_tree->AddNode<T>(node->fileName, node->line);
+        *copy = *node;
+        return copy;
+    }
 
-                return AddExpressionStatement(newUnaryExpr, statements, wantIdent);
-            }
-            else if (expr->nodeType == HLSLNodeType::BinaryExpression) {
-                assert(expr->nextExpression == NULL);
-                
-                HLSLBinaryExpression * binaryExpr = (HLSLBinaryExpression *)expr;
-                
-                if (IsAssignOp(binaryExpr->binaryOp)) {
-                    // Flatten right hand side only.
-                    HLSLIdentifierExpression * tmp2 = Flatten(binaryExpr->expression2, statements, true);
-                    
-                    HLSLBinaryExpression * newBinaryExpr = m_tree->AddNode<HLSLBinaryExpression>(binaryExpr->fileName, binaryExpr->line);
-                    newBinaryExpr->binaryOp = binaryExpr->binaryOp;
-                    newBinaryExpr->expression1 = binaryExpr->expression1;
-                    newBinaryExpr->expression2 = tmp2;
-                    newBinaryExpr->expressionType = binaryExpr->expressionType;
-                    
-                    return AddExpressionStatement(newBinaryExpr, statements, wantIdent);
-                }
-                else {
-                    HLSLIdentifierExpression * tmp1 = Flatten(binaryExpr->expression1, statements, true);
-                    HLSLIdentifierExpression * tmp2 = Flatten(binaryExpr->expression2, statements, true);
+    /** Declares a new local at m_insert, for a temporary of an inlined call. */
+    const HLSLDeclaration * AddLocal(const HLSLNode * node, const HLSLType & type, HLSLExpression * value)
+    {
+        HLSLDeclaration * declaration = AddLocalDeclaration(m_tree, node, GetNewName(), type, value);
+        declaration->type.flags = 0;
+        Insert(declaration);
+        return declaration;
+    }
 
-                    HLSLBinaryExpression * newBinaryExpr = m_tree->AddNode<HLSLBinaryExpression>(binaryExpr->fileName, binaryExpr->line);
-                    newBinaryExpr->binaryOp = binaryExpr->binaryOp;
-                    newBinaryExpr->expression1 = tmp1;
-                    newBinaryExpr->expression2 = tmp2;
-                    newBinaryExpr->expressionType = binaryExpr->expressionType;
-                    
-                    return AddExpressionStatement(newBinaryExpr, statements, wantIdent);
-                }
-            }
-            else if (expr->nodeType == HLSLNodeType::ConditionalExpression) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::CastingExpression) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::LiteralExpression) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::IdentifierExpression) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::ConstructorExpression) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::MemberAccess) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::ArrayAccess) {
-                assert(false);
-            }
-            else if (expr->nodeType == HLSLNodeType::FunctionCall) {
-                HLSLFunctionCall * functionCall = (HLSLFunctionCall *)expr;
+    HLSLExpressionStatement * AddExpressionStatement(HLSLExpression * expression)
+    {
+        HLSLExpressionStatement * statement = m_tree->AddNode<HLSLExpressionStatement>(expression->fileName, expression->line);
+        statement->expression = expression;
+        return statement;
+    }
 
-                // @@ Output function as is?
-                // @@ We have to flatten function arguments! This is tricky, need to handle input/output arguments.
-                assert(!NeedsFlattening(functionCall->argument));
-                
-                return AddExpressionStatement(expr, statements, wantIdent);
-            }
-            else {
-                assert(false);
-            }
-            return NULL;
+    void Insert(HLSLStatement * statement)
+    {
+        statement->nextStatement = *m_insert;
+        *m_insert = statement;
+        m_insert = &statement->nextStatement;
+    }
+
+    void CollectCallerNames()
+    {
+        if (!m_callerNamesCollected)
+        {
+            NameCollector collector;
+            collector.Walk(m_caller);
+            m_callerNames.swap(collector.names);
+            m_callerDeclaredNames.swap(collector.declaredNames);
+            m_callerNamesCollected = true;
         }
-    };
+    }
 
-    
-void FlattenExpressions(HLSLTree* tree) {
-    ExpressionFlattener flattener;
-    flattener.FlattenExpressions(tree);
+    /** Returns a name the caller doesn't use yet, nor the globals of the callees inlined into it. */
+    const char * GetNewName()
+    {
+        CollectCallerNames();
+        const char * name;
+        do
+        {
+            name = m_tree->AddStringFormat("inl%d", m_nameCount++);
+        }
+        while (m_callerNames.count(name) > 0);
+        m_callerNames.insert(name);
+        m_callerDeclaredNames.insert(name);
+        return name;
+    }
+
+    HLSLTree *                                                      m_tree;
+    int                                                             m_maxNodeCount;
+    HLSLFunction *                                                  m_caller;
+    bool                                                            m_callerNamesCollected;
+    int                                                             m_nameCount;
+    int                                                             m_inlinedCount;
+    int                                                             m_effectCount;      // Expressions of the statement with side effects, the calls inlined aside.
+    size_t                                                          m_argumentCount;    // Of the callee analyzed, first in m_scope.
+    std::unordered_set<const HLSLFunction *>                        m_entered;
+    std::unordered_map<const HLSLFunction *, Callee>                m_callees;          // Once their own calls are inlined.
+    std::unordered_set<const char *>                                m_callerNames;
+    std::unordered_set<const char *>                                m_callerDeclaredNames;
+    std::vector<const char *>                                       m_scope;            // Arguments and locals of the callee analyzed.
+    std::vector<Rename>                                             m_renames;
+    std::vector<HLSLStatement **>                                   m_lists;            // Statement lists of the caller left.
+    std::vector<HLSLFunctionCall *>                                 m_calls;
+    std::unordered_map<const HLSLFunctionCall *, HLSLExpression *>  m_results;
+    std::vector<std::pair<HLSLExpression *, bool>>                  m_walkStack;        // With true once the children are walked.
+    std::vector<HLSLExpression **>                                  m_replaceStack;
+    bool                                                            m_returnInPlace;    // For the calls of the statement.
+    HLSLStatement **                                                m_insert;           // Where the next statement inlined goes.
+    HLSLExpression *                                                m_returnValue;
+    SideEffectFinder                                                m_sideEffects;
+};
+
+int InlineFunctions(HLSLTree* tree, int maxNodeCount)
+{
+    FunctionInliner inliner(tree, maxNodeCount);
+    int inlinedCount = inliner.InlineFunctions();
+    tree->InvalidateIndex();
+    return inlinedCount;
 }
 
 } // M4
-
@@ -4,7 +4,14 @@
 //#include "Engine/StringPool.h"
 #include "Engine.h"
 
+#include <memory>
+#include <mutex>
 #include <new>
+#include <stdint.h>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace M4
 {
@@ -45,6 +52,8 @@ enum class HLSLNodeType
     Attribute,
     Pipeline,
     Stage,
+
+    Count
 };
 
 enum class HLSLTypeDimension
@@ -58,7 +67,9 @@ enum class HLSLTypeDimension
     Matrix3x3,
     Matrix4x4,
     Matrix4x3,
-    Matrix4x2
+    Matrix4x2,
+
+    Count
 };
     
 enum class HLSLBaseType
@@ -217,6 +228,8 @@ enum class HLSLBinaryOp
     SubAssign,
     MulAssign,
     DivAssign,
+
+    Count
 };
 
 inline bool IsCompareOp( HLSLBinaryOp op )
@@ -252,6 +265,55 @@ inline bool IsAssignOp( HLSLBinaryOp op )
         op == HLSLBinaryOp::DivAssign;
 }
 
+/** Returns true for the node types deriving from HLSLStatement. */
+inline bool IsStatementNode(HLSLNodeType nodeType)
+{
+    switch (nodeType)
+    {
+    case HLSLNodeType::Declaration:
+    case HLSLNodeType::Struct:
+    case HLSLNodeType::Buffer:
+    case HLSLNodeType::Function:
+    case HLSLNodeType::ExpressionStatement:
+    case HLSLNodeType::ReturnStatement:
+    case HLSLNodeType::DiscardStatement:
+    case HLSLNodeType::BreakStatement:
+    case HLSLNodeType::ContinueStatement:
+    case HLSLNodeType::IfStatement:
+    case HLSLNodeType::ForStatement:
+    case HLSLNodeType::BlockStatement:
+    case HLSLNodeType::Technique:
+    case HLSLNodeType::Pipeline:
+    case HLSLNodeType::Stage:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** Returns true for the node types deriving from HLSLExpression. */
+inline bool IsExpressionNode(HLSLNodeType nodeType)
+{
+    switch (nodeType)
+    {
+    case HLSLNodeType::Expression:
+    case HLSLNodeType::UnaryExpression:
+    case HLSLNodeType::BinaryExpression:
+    case HLSLNodeType::ConditionalExpression:
+    case HLSLNodeType::CastingExpression:
+    case HLSLNodeType::LiteralExpression:
+    case HLSLNodeType::IdentifierExpression:
+    case HLSLNodeType::ConstructorExpression:
+    case HLSLNodeType::MemberAccess:
+    case HLSLNodeType::ArrayAccess:
+    case HLSLNodeType::FunctionCall:
+    case HLSLNodeType::SamplerState:
+        return true;
+    default:
+        return false;
+    }
+}
+
     
 enum class HLSLUnaryOp
 {
@@ -263,6 +325,8 @@ enum class HLSLUnaryOp
     PostIncrement,  // x++
     PostDecrement,  // x++
     BitNot,         // ~x
+
+    Count
 };
 
 enum class HLSLArgumentModifier
@@ -273,6 +337,8 @@ enum class HLSLArgumentModifier
     Inout,
     Uniform,
     Const,
+
+    Count
 };
 
 enum class HLSLTypeFlags
@@ -307,6 +373,8 @@ enum class HLSLAttributeType
     Branch,
     Flatten,
     NoFastMath,
+
+    Count
 };
 
 enum class HLSLAddressSpace
@@ -316,9 +384,13 @@ enum class HLSLAddressSpace
     Device,
     Thread,
     Shared,
+
+    Count
 };
 
 
+class JSONWriter;
+
 struct HLSLNode;
 struct HLSLRoot;
 struct HLSLStatement;
@@ -339,6 +411,25 @@ struct HLSLFunctionCall;
 struct HLSLArrayAccess;
 struct HLSLAttribute;
 
+/** Returns true if a node of the specified type can be referenced through a T*. */
+template <class T>
+inline bool IsNodeOfType(HLSLNodeType nodeType)
+{
+    return nodeType == T::s_type;
+}
+
+template <>
+inline bool IsNodeOfType<HLSLStatement>(HLSLNodeType nodeType)
+{
+    return IsStatementNode(nodeType);
+}
+
+template <>
+inline bool IsNodeOfType<HLSLExpression>(HLSLNodeType nodeType)
+{
+    return IsExpressionNode(nodeType);
+}
+
 struct HLSLType
 {
     explicit HLSLType(HLSLBaseType _baseType = HLSLBaseType::Unknown)
@@ -361,7 +452,8 @@ struct HLSLType
     int                 flags;
     HLSLAddressSpace    addressSpace;
 
-    virtual nlohmann::json      ConvertToJSON();
+    virtual nlohmann::json      ConvertToJSON() const;
+    void                        WriteJSON(JSONWriter& writer) const;
 };
 
 inline bool IsTextureType(const HLSLType& type)
@@ -393,6 +485,7 @@ struct HLSLNode
     int                         line = 0;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true);
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true);
 };
 
 struct HLSLRoot : public HLSLNode
@@ -402,6 +495,7 @@ struct HLSLRoot : public HLSLNode
     HLSLStatement*      statement;          // First statement.
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLStatement : public HLSLNode
@@ -417,6 +511,7 @@ struct HLSLStatement : public HLSLNode
     mutable bool        hidden;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLAttribute : public HLSLNode
@@ -433,6 +528,7 @@ struct HLSLAttribute : public HLSLNode
     HLSLAttribute*      nextAttribute;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLDeclaration : public HLSLStatement
@@ -458,6 +554,7 @@ struct HLSLDeclaration : public HLSLStatement
     HLSLBuffer*         buffer;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLStruct : public HLSLStatement
@@ -472,6 +569,7 @@ struct HLSLStruct : public HLSLStatement
     HLSLStructField*    field;              // First field in the structure.
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLStructField : public HLSLNode
@@ -493,6 +591,7 @@ struct HLSLStructField : public HLSLNode
     bool                hidden;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 
 };
 
@@ -513,6 +612,7 @@ struct HLSLBuffer : public HLSLStatement
     HLSLDeclaration*    field;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 
@@ -543,6 +643,7 @@ struct HLSLFunction : public HLSLStatement
     HLSLFunction*       forward; // Which HLSLFunction this one forward-declares
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** Declaration of an argument to a function. */
@@ -569,6 +670,7 @@ struct HLSLArgument : public HLSLNode
     bool                    hidden;
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** A expression which forms a complete statement. */
@@ -580,6 +682,8 @@ struct HLSLExpressionStatement : public HLSLStatement
         expression = NULL;
     }
     HLSLExpression*     expression;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLReturnStatement : public HLSLStatement
@@ -590,6 +694,8 @@ struct HLSLReturnStatement : public HLSLStatement
         expression = NULL;
     }
     HLSLExpression*     expression;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLDiscardStatement : public HLSLStatement
@@ -621,6 +727,8 @@ struct HLSLIfStatement : public HLSLStatement
     HLSLStatement*      statement;
     HLSLStatement*      elseStatement;
     bool                isStatic;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLForStatement : public HLSLStatement
@@ -637,6 +745,8 @@ struct HLSLForStatement : public HLSLStatement
     HLSLExpression*     condition;
     HLSLExpression*     increment;
     HLSLStatement*      statement;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLBlockStatement : public HLSLStatement
@@ -647,6 +757,8 @@ struct HLSLBlockStatement : public HLSLStatement
         statement = NULL;
     }
     HLSLStatement*      statement;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 
@@ -656,12 +768,14 @@ struct HLSLExpression : public HLSLNode
     static const HLSLNodeType s_type = HLSLNodeType::Expression;
     HLSLExpression()
     {
+        expressionType = NULL;
         nextExpression = NULL;
     }
-    HLSLType            expressionType;
+    const HLSLType*     expressionType; // Canonical instance owned by the tree, see HLSLTree::AddType.
     HLSLExpression*     nextExpression; // Used when the expression is part of a list, like in a function call.
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLUnaryExpression : public HLSLExpression
@@ -673,6 +787,8 @@ struct HLSLUnaryExpression : public HLSLExpression
     }
     HLSLUnaryOp         unaryOp;
     HLSLExpression*     expression;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLBinaryExpression : public HLSLExpression
@@ -686,6 +802,8 @@ struct HLSLBinaryExpression : public HLSLExpression
     HLSLBinaryOp        binaryOp;
     HLSLExpression*     expression1;
     HLSLExpression*     expression2;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** ? : construct */
@@ -701,6 +819,8 @@ struct HLSLConditionalExpression : public HLSLExpression
     HLSLExpression*     condition;
     HLSLExpression*     trueExpression;
     HLSLExpression*     falseExpression;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLCastingExpression : public HLSLExpression
@@ -712,6 +832,8 @@ struct HLSLCastingExpression : public HLSLExpression
     }
     HLSLType            type;
     HLSLExpression*     expression;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** Float, integer, boolean, etc. literal constant. */
@@ -727,6 +849,7 @@ struct HLSLLiteralExpression : public HLSLExpression
     };
 
     virtual nlohmann::json      ConvertToJSON(bool bNodeType = true) override;
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** An identifier, typically a variable name or structure field name. */
@@ -740,6 +863,8 @@ struct HLSLIdentifierExpression : public HLSLExpression
     }
     const char*         name;
     bool                global; // This is a global variable.
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** float2(1, 2) */
@@ -752,6 +877,8 @@ struct HLSLConstructorExpression : public HLSLExpression
 	}
     HLSLType            type;
     HLSLExpression*     argument;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** object.member **/
@@ -767,6 +894,8 @@ struct HLSLMemberAccess : public HLSLExpression
     HLSLExpression*     object;
     const char*         field;
     bool                swizzle;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 /** array[index] **/
@@ -780,6 +909,8 @@ struct HLSLArrayAccess : public HLSLExpression
 	}
     HLSLExpression*     array;
     HLSLExpression*     index;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLFunctionCall : public HLSLExpression
@@ -794,6 +925,8 @@ struct HLSLFunctionCall : public HLSLExpression
     const HLSLFunction* function;
     HLSLExpression*     argument;
     int                 numArguments;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLStateAssignment : public HLSLNode
@@ -814,6 +947,8 @@ struct HLSLStateAssignment : public HLSLNode
         const char *        sValue;
     };
     HLSLStateAssignment*    nextStateAssignment;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLSamplerState : public HLSLExpression // @@ Does this need to be an expression? Does it have a type? I guess type is useful.
@@ -827,6 +962,8 @@ struct HLSLSamplerState : public HLSLExpression // @@ Does this need to be an ex
 
     int                     numStateAssignments;
     HLSLStateAssignment*    stateAssignments;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLPass : public HLSLNode
@@ -844,6 +981,8 @@ struct HLSLPass : public HLSLNode
     int                     numStateAssignments;
     HLSLStateAssignment*    stateAssignments;
     HLSLPass*               nextPass;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLTechnique : public HLSLStatement
@@ -859,6 +998,8 @@ struct HLSLTechnique : public HLSLStatement
     const char*         name;
     int                 numPasses;
     HLSLPass*           passes;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLPipeline : public HLSLStatement
@@ -874,6 +1015,8 @@ struct HLSLPipeline : public HLSLStatement
     const char*             name;
     int                     numStateAssignments;
     HLSLStateAssignment*    stateAssignments;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 struct HLSLStage : public HLSLStatement
@@ -891,9 +1034,24 @@ struct HLSLStage : public HLSLStatement
     HLSLStatement*          statement;
     HLSLDeclaration*        inputs;
     HLSLDeclaration*        outputs;
+
+    virtual void                WriteJSON(JSONWriter& writer, bool bNodeType = true) override;
 };
 
 
+/**
+ * What a statement refers to, without following the references: the functions
+ * it calls, intrinsics included, the names of the global identifiers it reads
+ * and of the user defined types it uses. Each entry appears once, in no
+ * particular order.
+ */
+struct HLSLReferences
+{
+    std::vector<const HLSLFunction*>    functions;
+    std::vector<const char*>            globals;
+    std::vector<const char*>            types;
+};
+
 /**
  * Abstract syntax tree for parsed HLSL code.
  */
@@ -903,6 +1061,11 @@ class HLSLTree
 public:
 
     explicit HLSLTree();
+    ~HLSLTree();
+
+    // Nodes point into the tree's pages, so the tree can't be copied.
+    HLSLTree(const HLSLTree&) = delete;
+    HLSLTree& operator=(const HLSLTree&) = delete;
 
     /** Adds a string to the string pool used by the tree. */
     const char* AddString(const char* string);
@@ -911,20 +1074,55 @@ public:
     /** Returns true if the string is contained within the tree. */
     bool GetContainsString(const char* string) const;
 
+    /**
+     * Returns the canonical instance of the specified type. Types are interned
+     * like strings, so two interned types are equal iff their pointers are.
+     */
+    const HLSLType* AddType(const HLSLType& type);
+
     /** Returns the root block in the tree */
     HLSLRoot* GetRoot() const;
 
-    /** Adds a new node to the tree with the specified type. */
+    /** Number of nodes added to the tree, the root included. */
+    size_t GetNodeCount() const;
+
+    /**
+     * Makes AddString, AddStringFormat, GetContainsString, AddType and AddNode
+     * safe to call from several threads at once, for passes transforming
+     * functions in parallel. The other methods, the lookups included, still
+     * aren't. Off by default since every call then takes a lock.
+     */
+    void SetThreadSafe(bool threadSafe);
+
+    /**
+     * Adds a new node to the tree with the specified type. Nodes are destroyed
+     * with the tree; only the types that are not trivially destructible pay
+     * for having their destructor registered.
+     */
     template <class T>
     T* AddNode(const char* fileName, int line)
     {
-        HLSLNode* node = new (AllocateMemory(sizeof(T))) T();
+        static_assert(alignof(T) <= alignof(NodePage*), "Node pages don't align nodes beyond pointer alignment");
+
+        std::unique_lock<std::mutex> lock = Lock();
+        T* object = new (AllocateMemory(sizeof(T))) T();
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            m_destructors.push_back({ &DestroyNode<T>, object });
+        }
+        ++m_nodeCount;
+
+        HLSLNode* node = object;
         node->nodeType  = T::s_type;
         node->fileName  = fileName;
         node->line      = line;
-        return static_cast<T*>(node);
+        return object;
     }
 
+    /**
+     * The named lookups return the first top level match, like a walk of the
+     * statements would, through a name index built on first use.
+     */
     HLSLFunction * FindFunction(const char * name);
     HLSLDeclaration * FindGlobalDeclaration(const char * name, HLSLBuffer ** buffer_out = NULL);
     HLSLStruct * FindGlobalStruct(const char * name);
@@ -934,6 +1132,28 @@ public:
     HLSLPipeline * FindPipeline(const char * name);
     HLSLBuffer * FindBuffer(const char * name);
 
+    /**
+     * References of a function, global declaration, buffer or struct, computed
+     * on first use. A declaration includes the declarations that follow it in
+     * "float a, b;", a buffer includes all of its fields, a function doesn't
+     * include its forward declaration or definition. Together they form the
+     * call graph walked by PruneTree and NeedsFunction.
+     */
+    const HLSLReferences& GetReferences(const HLSLStatement * statement);
+
+    /**
+     * Drops the name index, the references and the expression values. The
+     * tree transformations do it themselves, code that adds, removes or
+     * renames top level statements or buffer fields, or changes function
+     * bodies or expressions, directly has to call it before the next lookup.
+     */
+    void InvalidateIndex();
+
+    /**
+     * Value of a constant expression, computed on first use and kept until
+     * the index is invalidated. The float variant returns the dimension of the
+     * value, 0 if the expression has none.
+     */
     bool GetExpressionValue(HLSLExpression * expression, int & value);
     int GetExpressionValue(HLSLExpression * expression, float values[4]);
 
@@ -944,6 +1164,14 @@ private:
     void* AllocateMemory(size_t size);
     void  AllocatePage();
 
+    bool EvaluateExpression(HLSLExpression * expression, int & value);
+    int EvaluateExpression(HLSLExpression * expression, float values[4]);
+    bool EvaluateComparison(HLSLBinaryExpression * expression, int & value);
+    bool GetConditionValue(HLSLExpression * condition, bool & value);
+
+    /** Locks the tree in thread safe mode, see SetThreadSafe. */
+    std::unique_lock<std::mutex> Lock() const;
+
 private:
 
     static const size_t s_nodePageSize = 1024 * 4;
@@ -954,14 +1182,84 @@ private:
         char        buffer[s_nodePageSize];
     };
 
+    struct Destructor
+    {
+        void        (*destroy)(void* object);
+        void*       object;
+    };
+
+    template <class T>
+    static void DestroyNode(void* object)
+    {
+        static_cast<T*>(object)->~T();
+    }
+
+    struct TypeHash
+    {
+        size_t operator()(const HLSLType* type) const;
+    };
+
+    struct TypeEqual
+    {
+        bool operator()(const HLSLType* lhs, const HLSLType* rhs) const;
+    };
+
+    struct GlobalDeclaration
+    {
+        HLSLDeclaration*    declaration;
+        HLSLBuffer*         buffer;
+    };
+
+    /** Top level statements by name, first match only. */
+    struct NameIndex
+    {
+        bool                                                        valid = false;
+        std::unordered_map<std::string_view, HLSLFunction*>         functions;
+        std::unordered_map<std::string_view, GlobalDeclaration>     declarations;
+        std::unordered_map<std::string_view, HLSLStruct*>           structs;
+        std::unordered_map<std::string_view, HLSLTechnique*>        techniques;
+        std::unordered_map<std::string_view, HLSLPipeline*>         pipelines;
+        std::unordered_map<std::string_view, HLSLBuffer*>           buffers;
+    };
+
+    const NameIndex& GetIndex();
+
+    template <class T>
+    static T* FindInIndex(const std::unordered_map<std::string_view, T*>& map, const char* name);
+
     StringPool      m_stringPool;
     HLSLRoot*       m_root;
 
+    std::unordered_set<const HLSLType*, TypeHash, TypeEqual> m_types;
+
+    /** Results of GetExpressionValue, failures included. */
+    struct IntValue
+    {
+        bool        valid;
+        int         value;
+    };
+    struct FloatValue
+    {
+        int         dimension;
+        float       values[4];
+    };
+
+    NameIndex       m_index;
+    std::unordered_map<const HLSLStatement*, HLSLReferences> m_references;
+    std::unordered_map<const HLSLExpression*, IntValue> m_intValues;
+    std::unordered_map<const HLSLExpression*, FloatValue> m_floatValues;
+
     NodePage*       m_firstPage;
     NodePage*       m_currentPage;
     size_t          m_currentPageOffset;
+    size_t          m_nodeCount;
+
+    bool                m_threadSafe;
+    mutable std::mutex  m_mutex;
 
     std::vector<NodePage> m_NodePages;
+    std::vector<std::unique_ptr<NodePage>> m_overflowPages;     // Once m_NodePages is full, it must not move.
+    std::vector<Destructor> m_destructors;
 };
 
 
@@ -969,7 +1267,7 @@ private:
 class HLSLTreeVisitor
 {
 public:
-    virtual void VisitType(HLSLType & type);
+    virtual void VisitType(const HLSLType & type);
 
     virtual void VisitRoot(HLSLRoot * node);
     virtual void VisitTopLevelStatement(HLSLStatement * node);
@@ -1017,13 +1315,140 @@ public:
 };
 
 
+/**
+ * The statements used by each entry point of a list, the top level statements
+ * and buffer fields PruneTree would leave visible for that entry point alone.
+ * All the entry points are computed at once, in a single walk of the references
+ * of the tree which carries one bit per entry point. A buffer is used by the
+ * entry points using one of its fields. Entry points missing from the tree use
+ * nothing.
+ *
+ * The tree must not change while the reachability is in use.
+ */
+class HLSLReachability
+{
+
+public:
+
+    HLSLReachability(HLSLTree * tree, const char * const * entryNames, int entryCount);
+
+    int GetEntryCount() const;
+
+    /** Returns false for statements other than top level statements and buffer fields. */
+    bool IsUsed(const HLSLStatement * statement, int entry) const;
+
+    /**
+     * Hides the top level statements and buffer fields the entry point doesn't
+     * use, or that none of the entry points use for -1, and shows the others.
+     */
+    void HideUnused(int entry = -1) const;
+
+private:
+
+    typedef uint64_t Word;
+    static const int s_wordBits = 64;
+    static const uint32_t s_noNode = ~0u;
+
+    Word* GetBits(uint32_t node) { return m_bits.data() + node * m_wordCount; }
+    const Word* GetBits(uint32_t node) const { return m_bits.data() + node * m_wordCount; }
+
+    uint32_t FindNode(const HLSLStatement * statement) const;
+    void Propagate(HLSLTree * tree);
+
+    int                             m_entryCount;
+    int                             m_wordCount;
+    std::vector<HLSLStatement*>     m_statements;   // Sorted by address, the bits of each follow in m_bits.
+    std::vector<Word>               m_bits;
+
+};
+
+
 // Tree transformations:
 extern void PruneTree(HLSLTree* tree, const char* entryName0, const char* entryName1 = NULL);
+extern void PruneTree(HLSLTree* tree, const char* const* entryNames, int entryCount);
 extern void SortTree(HLSLTree* tree);
 extern void GroupParameters(HLSLTree* tree);
 extern void HideUnusedArguments(HLSLFunction * function);
 extern bool EmulateAlphaTest(HLSLTree* tree, const char* entryName, float alphaRef = 0.5f);
 extern void FlattenExpressions(HLSLTree* tree);
+
+/**
+ * Replaces the constant expressions GetExpressionValue evaluates by literals,
+ * or by constructors of literals for vectors. Comparisons involving floats
+ * are evaluated on floats. Conditionals on a constant condition are replaced
+ * by the branch taken when it has the type of the conditional and the other
+ * branch has no side effect. Static const globals fold to their value, other
+ * globals are uniforms the application can set. Returns the number of
+ * expressions replaced.
+ */
+extern int FoldConstants(HLSLTree* tree);
+
+/**
+ * Flattens the expressions of a single function, naming its temporaries from
+ * tmp0. Runs on different functions in parallel when the tree is thread safe,
+ * see HLSLTree::SetThreadSafe. Doesn't invalidate the index of the tree.
+ */
+extern void FlattenExpressions(HLSLTree* tree, HLSLFunction* function);
+
+/** The functions declared at the top level of a tree, see GetShaderFunctions. */
+typedef std::unordered_set<const HLSLFunction*> HLSLFunctionSet;
+
+/**
+ * Gets the functions of the shader, definitions and prototypes. The function
+ * passes running in parallel take them before starting, since the bodies of
+ * the callees change on the other threads.
+ */
+extern void GetShaderFunctions(HLSLTree* tree, HLSLFunctionSet& functions);
+
+/**
+ * Removes the dead code of a function definition. Ifs on literal conditions
+ * are replaced by the branch taken, statements after a return, discard, break
+ * or continue are dropped, and so are the declarations of locals never named
+ * whose values have no side effects. FoldConstants turns the conditions on
+ * static consts into literals. Returns the number of statements removed.
+ */
+extern int EliminateDeadCode(HLSLTree* tree, HLSLFunction* function);
+
+/**
+ * Removes the dead code like above, taking the calls to the shaderFunctions,
+ * from GetShaderFunctions, as side effects without reading the callees. Runs
+ * on different functions in parallel like FlattenExpressions.
+ */
+extern int EliminateDeadCode(HLSLTree* tree, HLSLFunction* function, const HLSLFunctionSet& shaderFunctions);
+
+/**
+ * Computes the expressions repeated in a function definition once. Within a
+ * list of statements, up to the next statement branching or calling a function
+ * of the shader, the equal expressions reading the same values are replaced
+ * by a local declared before the first of them. Only operations without side
+ * effects are considered, intrinsics included, so repeated samples of a
+ * texture are shared. Returns the number of expressions replaced, besides the
+ * first of each value.
+ */
+extern int EliminateCommonSubexpressions(HLSLTree* tree, HLSLFunction* function);
+
+/**
+ * Computes the repeated expressions once like above, with the shaderFunctions
+ * of EliminateDeadCode. Runs on different functions in parallel like
+ * FlattenExpressions.
+ */
+extern int EliminateCommonSubexpressions(HLSLTree* tree, HLSLFunction* function, const HLSLFunctionSet& shaderFunctions);
+
+/**
+ * Inlines the calls to the functions of the shader whose body has at most
+ * maxNodeCount nodes and ends with its only return. The arguments and the
+ * return value go through new locals, the out and inout arguments are written
+ * back after the body; input arguments given as constants and never written
+ * are replaced by their value, for FoldConstants. The calls of declarations,
+ * assignments, returns and if conditions are inlined, the bodies going before
+ * the statement; for an else if, in the else before the nested if. The calls
+ * of a statement are only inlined if it has no other side effects, as its
+ * expressions are evaluated after the bodies. The functions are transformed callees first, so
+ * that inlined bodies have their own calls inlined. Returns the number of calls
+ * inlined. FoldConstants and EliminateDeadCode then work across the former
+ * calls; PruneTree hides the functions no longer called.
+ */
+extern int InlineFunctions(HLSLTree* tree, int maxNodeCount = 40);
     
 } // M4
 
@@ -0,0 +1,607 @@
+//#include "Engine/Assert.h"
+#include "Engine.h"
+
+#include "JSONWriter.h"
+#include "OutputFile.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace M4
+{
+
+JSONWriter::JSONWriter(JSONFormat format)
+{
+    m_format    = format;
+    m_file      = NULL;
+    m_error     = false;
+    m_pendingHeaders = 0;
+    m_afterKey  = false;
+    m_compact   = false;
+    m_fullTree  = false;
+    m_indent    = true;
+    m_baseDepth = 0;
+
+    m_memberFilter      = NULL;
+    m_memberFilterDepth = 0;
+    m_skipNext          = false;
+    m_skipNesting       = 0;
+}
+
+JSONWriter::JSONWriter(OutputFile* file, JSONFormat format)
+{
+    m_format    = format;
+    m_file      = file;
+    m_error     = false;
+    m_pendingHeaders = 0;
+    m_afterKey  = false;
+    m_compact   = false;
+    m_fullTree  = false;
+    m_indent    = true;
+    m_baseDepth = 0;
+
+    m_memberFilter      = NULL;
+    m_memberFilterDepth = 0;
+    m_skipNext          = false;
+    m_skipNesting       = 0;
+    m_buffer.reserve(s_chunkSize * 2);
+}
+
+JSONWriter::~JSONWriter()
+{
+    Flush();
+}
+
+void JSONWriter::SetCompact(bool compact)
+{
+    m_compact = compact;
+}
+
+bool JSONWriter::GetCompact() const
+{
+    return m_compact;
+}
+
+void JSONWriter::SetIndent(bool indent)
+{
+    m_indent = indent;
+}
+
+bool JSONWriter::GetIndent() const
+{
+    return m_indent;
+}
+
+void JSONWriter::SetFullTree(bool fullTree)
+{
+    m_fullTree = fullTree;
+}
+
+bool JSONWriter::GetFullTree() const
+{
+    return m_fullTree;
+}
+
+void JSONWriter::SetMemberFilter(const std::unordered_set<std::string_view>* keys, size_t depth)
+{
+    m_memberFilter      = keys;
+    m_memberFilterDepth = depth;
+}
+
+void JSONWriter::SetBaseDepth(size_t depth)
+{
+    m_baseDepth = depth;
+}
+
+JSONFormat JSONWriter::GetFormat() const
+{
+    return m_format;
+}
+
+void JSONWriter::BeginObject()
+{
+    BeginScope('{', -1);
+}
+
+void JSONWriter::EndObject()
+{
+    EndScope('}');
+}
+
+void JSONWriter::BeginArray()
+{
+    BeginScope('[', -1);
+}
+
+void JSONWriter::BeginArray(uint32_t count)
+{
+    BeginScope('[', count);
+}
+
+void JSONWriter::EndArray()
+{
+    EndScope(']');
+}
+
+void JSONWriter::Key(const char* key)
+{
+    if (m_skipNesting > 0)
+    {
+        return;
+    }
+
+    ASSERT(!m_scopes.empty() && m_scopes.back().isObject);
+
+    if (m_memberFilter != NULL && GetDepth() == m_memberFilterDepth && m_memberFilter->count(key) == 0)
+    {
+        m_skipNext = true;
+        return;
+    }
+
+    BeginElement();
+    if (m_format == JSONFormat::Text)
+    {
+        m_buffer += '"';
+        m_buffer += key;
+        m_buffer += IsIndented() ? "\": " : "\":";
+    }
+    else
+    {
+        WriteBinaryString(key);
+    }
+    m_afterKey = true;
+}
+
+void JSONWriter::String(const char* value)
+{
+    String(std::string_view(value));
+}
+
+void JSONWriter::String(std::string_view value)
+{
+    if (SkipValue()) return;
+    BeginValue();
+    if (m_format != JSONFormat::Text)
+    {
+        WriteBinaryString(value);
+        return;
+    }
+
+    m_buffer += '"';
+
+    // Same escapes as nlohmann::json. Invalid UTF-8 is copied as is where
+    // nlohmann::json would throw.
+    static const char hexDigits[] = "0123456789abcdef";
+    for (char c : value)
+    {
+        switch (c)
+        {
+        case '\b':  m_buffer += "\\b"; break;
+        case '\t':  m_buffer += "\\t"; break;
+        case '\n':  m_buffer += "\\n"; break;
+        case '\f':  m_buffer += "\\f"; break;
+        case '\r':  m_buffer += "\\r"; break;
+        case '"':   m_buffer += "\\\""; break;
+        case '\\':  m_buffer += "\\\\"; break;
+        default:
+            if ((unsigned char)c <= 0x1F)
+            {
+                m_buffer += "\\u00";
+                m_buffer += hexDigits[(unsigned char)c >> 4];
+                m_buffer += hexDigits[(unsigned char)c & 0xF];
+            }
+            else
+            {
+                m_buffer += c;
+            }
+            break;
+        }
+    }
+
+    m_buffer += '"';
+}
+
+void JSONWriter::Bool(bool value)
+{
+    if (SkipValue()) return;
+    BeginValue();
+    switch (m_format)
+    {
+    case JSONFormat::Text:
+        m_buffer += value ? "true" : "false";
+        break;
+    case JSONFormat::CBOR:
+        m_buffer += (char)(value ? 0xF5 : 0xF4);
+        break;
+    case JSONFormat::MessagePack:
+        m_buffer += (char)(value ? 0xC3 : 0xC2);
+        break;
+    }
+}
+
+void JSONWriter::Int(int value)
+{
+    if (SkipValue()) return;
+    BeginValue();
+    switch (m_format)
+    {
+    case JSONFormat::Text:
+        {
+            char buffer[16];
+            int length = snprintf(buffer, sizeof(buffer), "%d", value);
+            m_buffer.append(buffer, length);
+        }
+        break;
+    case JSONFormat::CBOR:
+        if (value >= 0)
+        {
+            WriteCBORHead(0, (uint32_t)value);
+        }
+        else
+        {
+            WriteCBORHead(1, (uint32_t)(-(value + 1)));
+        }
+        break;
+    case JSONFormat::MessagePack:
+        // Smallest encoding that fits, like nlohmann::json::to_msgpack.
+        if (value >= 0)
+        {
+            if (value < 128)            WriteBigEndian(value, 1);
+            else if (value <= 0xFF)     { m_buffer += (char)0xCC; WriteBigEndian(value, 1); }
+            else if (value <= 0xFFFF)   { m_buffer += (char)0xCD; WriteBigEndian(value, 2); }
+            else                        { m_buffer += (char)0xCE; WriteBigEndian(value, 4); }
+        }
+        else
+        {
+            if (value >= -32)           WriteBigEndian((uint8_t)value, 1);
+            else if (value >= -128)     { m_buffer += (char)0xD0; WriteBigEndian((uint8_t)value, 1); }
+            else if (value >= -32768)   { m_buffer += (char)0xD1; WriteBigEndian((uint16_t)value, 2); }
+            else                        { m_buffer += (char)0xD2; WriteBigEndian((uint32_t)value, 4); }
+        }
+        break;
+    }
+}
+
+void JSONWriter::Float(double value)
+{
+    if (SkipValue()) return;
+    BeginValue();
+    if (m_format == JSONFormat::Text)
+    {
+        if (!isfinite(value))
+        {
+            m_buffer += "null";
+            return;
+        }
+
+        // Shortest round-tripping representation, like nlohmann::json.
+        char buffer[64];
+        char* end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), value);
+        m_buffer.append(buffer, end - buffer);
+        return;
+    }
+
+    if (m_format == JSONFormat::CBOR && !isfinite(value))
+    {
+        // Half precision NaN and infinities, like nlohmann::json::to_cbor.
+        m_buffer += (char)0xF9;
+        m_buffer += (char)(isnan(value) ? 0x7E : (signbit(value) ? 0xFC : 0x7C));
+        m_buffer += (char)0x00;
+        return;
+    }
+
+    // Single precision when it is exact, which is always the case for HLSL values.
+    float single = (float)value;
+    if ((double)single == value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        m_buffer += (char)(m_format == JSONFormat::CBOR ? 0xFA : 0xCA);
+        WriteBigEndian(bits, 4);
+    }
+    else
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        m_buffer += (char)(m_format == JSONFormat::CBOR ? 0xFB : 0xCB);
+        WriteBigEndian(bits, 8);
+    }
+}
+
+void JSONWriter::WriteEncoded(std::string_view value)
+{
+    if (SkipValue()) return;
+    BeginValue();
+
+    if (m_file != NULL && value.size() >= s_chunkSize && CanFlush())
+    {
+        // Goes out with the pending output in a single write.
+        std::string_view parts[] = { m_buffer, value };
+        if (!m_error && !m_file->Write(parts, 2))
+        {
+            m_error = true;
+        }
+        m_buffer.clear();
+        return;
+    }
+
+    m_buffer.append(value.data(), value.size());
+    FlushIfFull();
+}
+
+bool JSONWriter::Flush()
+{
+    // Binary containers are patched when they end, so they have to stay in the buffer until then.
+    if (!CanFlush())
+    {
+        return !m_error;
+    }
+
+    if (m_file != NULL && !m_buffer.empty())
+    {
+        if (!m_error && !m_file->Write(m_buffer))
+        {
+            m_error = true;
+        }
+        m_buffer.clear();
+    }
+    return !m_error;
+}
+
+bool JSONWriter::EndRecord()
+{
+    ASSERT(m_scopes.empty());
+
+    if (m_format == JSONFormat::Text)
+    {
+        m_buffer += '\n';
+    }
+    return Flush();
+}
+
+const std::string& JSONWriter::GetBuffer() const
+{
+    return m_buffer;
+}
+
+std::string JSONWriter::ReleaseBuffer()
+{
+    std::string buffer;
+    buffer.swap(m_buffer);
+    return buffer;
+}
+
+size_t JSONWriter::GetDepth() const
+{
+    return m_baseDepth + m_scopes.size();
+}
+
+bool JSONWriter::IsIndented() const
+{
+    return m_indent && !m_compact;
+}
+
+bool JSONWriter::CanFlush() const
+{
+    return m_pendingHeaders == 0;
+}
+
+/** Returns true if the next scalar value belongs to a filtered member. */
+bool JSONWriter::SkipValue()
+{
+    if (m_skipNesting > 0)
+    {
+        return true;
+    }
+    if (m_skipNext)
+    {
+        m_skipNext = false;
+        return true;
+    }
+    return false;
+}
+
+void JSONWriter::BeginValue()
+{
+    if (m_afterKey)
+    {
+        m_afterKey = false;
+    }
+    else if (!m_scopes.empty())
+    {
+        BeginElement();
+    }
+}
+
+void JSONWriter::BeginElement()
+{
+    Scope& scope = m_scopes.back();
+    if (m_format == JSONFormat::Text)
+    {
+        if (IsIndented())
+        {
+            m_buffer += scope.count != 0 ? ",\n" : "\n";
+            m_buffer.append(GetDepth() * 2, ' ');
+        }
+        else
+        {
+            if (scope.count != 0) m_buffer += ',';
+        }
+    }
+    scope.count++;
+}
+
+void JSONWriter::BeginScope(char open, int64_t size)
+{
+    if (m_skipNesting > 0 || m_skipNext)
+    {
+        m_skipNext = false;
+        m_skipNesting++;
+        return;
+    }
+
+    BeginValue();
+
+    Scope scope;
+    scope.isObject  = open == '{';
+    scope.count     = 0;
+    scope.size      = size;
+    scope.offset    = m_buffer.size();
+
+    if (m_format == JSONFormat::Text)
+    {
+        m_buffer += open;
+    }
+    else if (size >= 0)
+    {
+        WriteBinaryHead(scope.isObject, (uint32_t)size);
+    }
+    else
+    {
+        m_buffer.append(s_maxHeaderSize, '\0');
+        m_pendingHeaders++;
+    }
+
+    m_scopes.push_back(scope);
+}
+
+void JSONWriter::EndScope(char close)
+{
+    if (m_skipNesting > 0)
+    {
+        m_skipNesting--;
+        return;
+    }
+
+    ASSERT(!m_scopes.empty() && m_scopes.back().isObject == (close == '}') && !m_afterKey);
+
+    Scope scope = m_scopes.back();
+    m_scopes.pop_back();
+
+    ASSERT(scope.size < 0 || scope.size == scope.count);
+
+    if (m_format == JSONFormat::Text)
+    {
+        if (scope.count != 0 && IsIndented())
+        {
+            m_buffer += '\n';
+            m_buffer.append(GetDepth() * 2, ' ');
+        }
+        m_buffer += close;
+    }
+    else if (scope.size < 0)
+    {
+        // Encode the header now that the size is known and close the gap if it is shorter than reserved.
+        size_t contentOffset = scope.offset + s_maxHeaderSize;
+        size_t contentSize = m_buffer.size() - contentOffset;
+
+        // The header is encoded at the end of the buffer and then moved into place.
+        size_t end = m_buffer.size();
+        WriteBinaryHead(scope.isObject, scope.count);
+
+        char header[s_maxHeaderSize];
+        size_t headerSize = m_buffer.size() - end;
+        memcpy(header, m_buffer.data() + end, headerSize);
+
+        char* data = &m_buffer[0];
+        memmove(data + scope.offset + headerSize, data + contentOffset, contentSize);
+        memcpy(data + scope.offset, header, headerSize);
+        m_buffer.resize(scope.offset + headerSize + contentSize);
+        m_pendingHeaders--;
+    }
+
+    FlushIfFull();
+}
+
+void JSONWriter::FlushIfFull()
+{
+    if (m_file != NULL && m_buffer.size() >= s_chunkSize)
+    {
+        Flush();
+    }
+}
+
+void JSONWriter::WriteBinaryString(std::string_view value)
+{
+    if (m_format == JSONFormat::CBOR)
+    {
+        WriteCBORHead(3, (uint32_t)value.size());
+    }
+    else if (value.size() < 32)
+    {
+        m_buffer += (char)(0xA0 | value.size());
+    }
+    else if (value.size() <= 0xFF)
+    {
+        m_buffer += (char)0xD9;
+        WriteBigEndian(value.size(), 1);
+    }
+    else if (value.size() <= 0xFFFF)
+    {
+        m_buffer += (char)0xDA;
+        WriteBigEndian(value.size(), 2);
+    }
+    else
+    {
+        m_buffer += (char)0xDB;
+        WriteBigEndian(value.size(), 4);
+    }
+    m_buffer.append(value.data(), value.size());
+}
+
+void JSONWriter::WriteBinaryHead(bool isObject, uint32_t count)
+{
+    if (m_format == JSONFormat::CBOR)
+    {
+        WriteCBORHead(isObject ? 5 : 4, count);
+    }
+    else if (count < 16)
+    {
+        m_buffer += (char)((isObject ? 0x80 : 0x90) | count);
+    }
+    else if (count <= 0xFFFF)
+    {
+        m_buffer += (char)(isObject ? 0xDE : 0xDC);
+        WriteBigEndian(count, 2);
+    }
+    else
+    {
+        m_buffer += (char)(isObject ? 0xDF : 0xDD);
+        WriteBigEndian(count, 4);
+    }
+}
+
+void JSONWriter::WriteCBORHead(int majorType, uint32_t value)
+{
+    char initialByte = (char)(majorType << 5);
+    if (value < 24)
+    {
+        m_buffer += (char)(initialByte | value);
+    }
+    else if (value <= 0xFF)
+    {
+        m_buffer += (char)(initialByte | 24);
+        WriteBigEndian(value, 1);
+    }
+    else if (value <= 0xFFFF)
+    {
+        m_buffer += (char)(initialByte | 25);
+        WriteBigEndian(value, 2);
+    }
+    else
+    {
+        m_buffer += (char)(initialByte | 26);
+        WriteBigEndian(value, 4);
+    }
+}
+
+void JSONWriter::WriteBigEndian(uint64_t value, int size)
+{
+    for (int i = size - 1; i >= 0; --i)
+    {
+        m_buffer += (char)(value >> (i * 8));
+    }
+}
+
+} // M4
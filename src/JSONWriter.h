@@ -0,0 +1,192 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include "Engine.h"
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace M4
+{
+
+class OutputFile;
+
+enum class JSONFormat
+{
+    Text,           // Same text as nlohmann::json::dump(2).
+    CBOR,           // RFC 8949, readable with nlohmann::json::from_cbor.
+    MessagePack,    // Readable with nlohmann::json::from_msgpack.
+};
+
+/**
+ * Streaming JSON writer, producing a document without building it first.
+ * Output accumulates in a buffer which is either kept in memory or written
+ * to a file in large chunks, the buffer being reused between them.
+ *
+ * Callers are responsible for writing object members in sorted key order, as
+ * nlohmann::json objects are ordered maps.
+ *
+ * The binary formats use definite container lengths, which are patched in
+ * when a container ends unless the size was given when it began, so their
+ * output is only flushed while every open container has a known size.
+ */
+class JSONWriter
+{
+
+public:
+
+    /** Writes into an in-memory buffer, see GetBuffer. */
+    explicit JSONWriter(JSONFormat format = JSONFormat::Text);
+
+    /** Streams into the file. The file is not closed by the writer. */
+    explicit JSONWriter(OutputFile* file, JSONFormat format = JSONFormat::Text);
+
+    ~JSONWriter();
+
+    JSONWriter(const JSONWriter&) = delete;
+    JSONWriter& operator=(const JSONWriter&) = delete;
+
+    /**
+     * Compact output has no whitespace, and nodes leave out members holding
+     * default values. Defaults to false.
+     */
+    void SetCompact(bool compact);
+    bool GetCompact() const;
+
+    /**
+     * Text output is indented by default. Without indentation, which compact
+     * output implies, every value is written on a single line.
+     */
+    void SetIndent(bool indent);
+    bool GetIndent() const;
+
+    /**
+     * Full tree output adds function bodies, the members of every statement
+     * and expression node and the source location of each node. The statements
+     * of function bodies, blocks, branches and loops are written as arrays.
+     * Defaults to false, which only describes the declarations.
+     */
+    void SetFullTree(bool fullTree);
+    bool GetFullTree() const;
+
+    /**
+     * Restricts the members of the objects at the specified nesting depth
+     * (1 being the outermost value) to the listed keys. Other members and
+     * their values are dropped. Passing NULL removes the filter.
+     */
+    void SetMemberFilter(const std::unordered_set<std::string_view>* keys, size_t depth);
+
+    /**
+     * Depth at which the output is going to be inserted into another document
+     * with WriteEncoded. Offsets the indentation and the member filter depth.
+     * Defaults to 0.
+     */
+    void SetBaseDepth(size_t depth);
+
+    JSONFormat GetFormat() const;
+
+    /** Number of containers enclosing the next value, base depth included. */
+    size_t GetDepth() const;
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    /**
+     * Starts an array of the specified number of elements. Binary formats write
+     * its header right away, so the output can be flushed while it is open.
+     */
+    void BeginArray(uint32_t count);
+
+    /** Starts an object member. Keys are written verbatim. */
+    void Key(const char* key);
+
+    void String(const char* value);
+    void String(std::string_view value);
+    void Bool(bool value);
+    void Int(int value);
+    void Float(double value);
+
+    /**
+     * Writes a value already encoded by another writer with the same format,
+     * compact mode and a base depth matching the current nesting. Large values
+     * are written to the file along with the buffer, without being copied.
+     */
+    void WriteEncoded(std::string_view value);
+
+    /**
+     * Writes the buffered output to the file. Binary output is held back while
+     * a container of unknown size is open. Returns false if writing failed.
+     */
+    bool Flush();
+
+    /**
+     * Ends a top level value of a record stream: text records are terminated
+     * with a newline, and the output is written to the file right away.
+     * Returns false if writing failed.
+     */
+    bool EndRecord();
+
+    /** Returns the output written so far, when not streaming into a file. */
+    const std::string& GetBuffer() const;
+
+    /** Moves the output written so far out of the writer. */
+    std::string ReleaseBuffer();
+
+private:
+
+    bool IsIndented() const;
+    bool CanFlush() const;
+    bool SkipValue();
+    void BeginValue();
+    void BeginElement();
+    void BeginScope(char open, int64_t size);
+    void EndScope(char close);
+    void FlushIfFull();
+
+    void WriteBinaryString(std::string_view value);
+    void WriteBinaryHead(bool isObject, uint32_t count);
+    void WriteCBORHead(int majorType, uint32_t value);
+    void WriteBigEndian(uint64_t value, int size);
+
+private:
+
+    static const size_t s_chunkSize = 64 * 1024;
+
+    // Room reserved in front of binary containers for their final header.
+    static const size_t s_maxHeaderSize = 5;
+
+    struct Scope
+    {
+        bool            isObject;
+        uint32_t        count;
+        int64_t         size;       // Given when the scope began, or -1.
+        size_t          offset;     // Of the reserved header, binary formats only.
+    };
+
+    JSONFormat          m_format;
+    std::string         m_buffer;
+    OutputFile*         m_file;
+    bool                m_error;
+
+    std::vector<Scope>  m_scopes;
+    size_t              m_pendingHeaders;   // Binary scopes whose header is patched in when they end.
+    size_t              m_baseDepth;
+    bool                m_afterKey;
+    bool                m_compact;
+    bool                m_fullTree;
+    bool                m_indent;
+
+    const std::unordered_set<std::string_view>* m_memberFilter;
+    size_t              m_memberFilterDepth;
+    bool                m_skipNext;         // The value of a filtered member follows.
+    int                 m_skipNesting;      // Depth within a filtered value.
+
+};
+
+} // M4
+
+#endif
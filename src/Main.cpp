@@ -1,9 +1,37 @@
 #include "HLSLParser.h"
+#include "HLSLEnumNames.h"
+#include "HLSLPassManager.h"
+#include "JSONWriter.h"
+#include "OutputFile.h"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <random>
+#include <string.h>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+
+// Bump whenever the analysis output changes, so stale cache entries are never returned.
+static const char* const _analysisVersion = "hlslparser-analysis-3";
+
+static const uintmax_t _defaultCacheSize = 64 * 1024 * 1024;
+
+// One byte per lookup, past this size the statistics move to a single older file.
+static const long _maxStatisticsSize = 1024 * 1024;
+
+// Below this many top level statements, starting threads costs more than it saves.
+static const size_t _minParallelStatements = 64;
+
+// Statements rendered by the workers before their output is written, bounding the memory it holds.
+static const size_t _parallelWindowSize = 4096;
 
 std::string ReadFile( const char* fileName )
 {
@@ -13,27 +41,915 @@ std::string ReadFile( const char* fileName )
 	return buffer.str();
 }
 
+struct OutputFormat
+{
+	const char*     name;
+	M4::JSONFormat  format;
+	const char*     extension;
+};
+
+static const OutputFormat _outputFormats[] =
+{
+	{ "json",       M4::JSONFormat::Text,           ".analysis" },
+	{ "cbor",       M4::JSONFormat::CBOR,           ".analysis.cbor" },
+	{ "msgpack",    M4::JSONFormat::MessagePack,    ".analysis.msgpack" },
+};
+
+const OutputFormat* FindOutputFormat( const char* name )
+{
+	for( const OutputFormat& outputFormat : _outputFormats )
+	{
+		if( M4::String_Equal( outputFormat.name, name ) )
+		{
+			return &outputFormat;
+		}
+	}
+	return NULL;
+}
+
+std::string GetAnalysisName( const char* fileName, const OutputFormat& outputFormat )
+{
+	return std::string( fileName ) + outputFormat.extension;
+}
+
+/**
+ * Content-addressed cache of analysis results. Entries are keyed by the input
+ * bytes, the output version and the command line options, plus the file name
+ * when the output holds it, written atomically and evicted in least recently
+ * used order once the directory grows too big.
+ */
+class ParseCache
+{
+public:
+
+	ParseCache( const char* directory, uintmax_t maxSize ) : m_directory( directory ), m_maxSize( maxSize )
+	{
+		std::error_code error;
+		std::filesystem::create_directories( m_directory, error );
+	}
+
+	/** The options must hold every command line setting that affects the analysis. */
+	std::string GetKey( const std::string& source, const std::string& options ) const
+	{
+		// 64 bit FNV-1a over every input, the size is appended to make collisions even less likely.
+		uint64_t hash = 14695981039346656037ull;
+		hash = Hash( hash, _analysisVersion, strlen( _analysisVersion ) + 1 );
+		hash = Hash( hash, options.data(), options.size() + 1 );
+		hash = Hash( hash, source.data(), source.size() );
+
+		char key[64];
+		snprintf( key, sizeof(key), "%016llx-%llx", (unsigned long long)hash, (unsigned long long)source.size() );
+		return key;
+	}
+
+	/** Copies the entry to the file, which is replaced. */
+	bool Find( const std::string& key, const std::filesystem::path& outputPath )
+	{
+		const std::filesystem::path path = GetEntryPath( key );
+
+		std::error_code error;
+		if( !std::filesystem::copy_file( path, outputPath, std::filesystem::copy_options::overwrite_existing, error ) )
+		{
+			RecordStatistic( 'm' );
+			return false;
+		}
+
+		// Mark the entry as recently used.
+		std::filesystem::last_write_time( path, std::filesystem::file_time_type::clock::now(), error );
+
+		RecordStatistic( 'h' );
+		return true;
+	}
+
+	bool Find( const std::string& key, std::string& analysis )
+	{
+		const std::filesystem::path path = GetEntryPath( key );
+
+		std::ifstream ifs( path, std::ios::binary );
+		if( !ifs )
+		{
+			RecordStatistic( 'm' );
+			return false;
+		}
+
+		std::stringstream buffer;
+		buffer << ifs.rdbuf();
+		analysis = buffer.str();
+
+		// Mark the entry as recently used.
+		std::error_code error;
+		std::filesystem::last_write_time( path, std::filesystem::file_time_type::clock::now(), error );
+
+		RecordStatistic( 'h' );
+		return true;
+	}
+
+	void Store( const std::string& key, const std::string& analysis )
+	{
+		const std::filesystem::path tempPath = GetTempPath( key );
+		{
+			std::ofstream ofs( tempPath, std::ios::binary );
+			ofs.write( analysis.data(), analysis.size() );
+			if( !ofs )
+			{
+				ofs.close();
+				std::error_code error;
+				std::filesystem::remove( tempPath, error );
+				return;
+			}
+		}
+
+		Commit( key, tempPath );
+	}
+
+	/** Stores a copy of an analysis already written to a file. */
+	void Store( const std::string& key, const std::filesystem::path& analysisPath )
+	{
+		const std::filesystem::path tempPath = GetTempPath( key );
+
+		std::error_code error;
+		if( !std::filesystem::copy_file( analysisPath, tempPath, error ) )
+		{
+			std::filesystem::remove( tempPath, error );
+			return;
+		}
+
+		Commit( key, tempPath );
+	}
+
+	void PrintStatistics() const
+	{
+		uintmax_t hits = 0;
+		uintmax_t misses = 0;
+
+		for( const char* name : { "statistics.1", "statistics" } )
+		{
+			std::ifstream ifs( m_directory / name, std::ios::binary );
+			char c;
+			while( ifs.get( c ) )
+			{
+				if( c == 'h' ) hits++;
+				else if( c == 'm' ) misses++;
+			}
+		}
+
+		uintmax_t entries = 0;
+		uintmax_t size = 0;
+		std::error_code error;
+		for( const auto& entry : std::filesystem::directory_iterator( m_directory, error ) )
+		{
+			if( entry.path().extension() == ".analysis" )
+			{
+				entries++;
+				size += entry.file_size( error );
+			}
+		}
+
+		fprintf( stderr, "cache: %ju hits, %ju misses, %ju entries, %ju bytes\n", hits, misses, entries, size );
+	}
+
+private:
+
+	static uint64_t Hash( uint64_t hash, const void* data, size_t size )
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>( data );
+		for( size_t i = 0; i < size; ++i )
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::filesystem::path GetEntryPath( const std::string& key ) const
+	{
+		return m_directory / ( key + ".analysis" );
+	}
+
+	// Entries are written to a private file and renamed into place, so concurrent
+	// invocations never observe a partially written entry.
+	std::filesystem::path GetTempPath( const std::string& key ) const
+	{
+		std::random_device random;
+		char suffix[32];
+		snprintf( suffix, sizeof(suffix), ".%08x.tmp", (unsigned)random() );
+		return m_directory / ( key + suffix );
+	}
+
+	void Commit( const std::string& key, const std::filesystem::path& tempPath )
+	{
+		std::error_code error;
+		std::filesystem::rename( tempPath, GetEntryPath( key ), error );
+		if( error )
+		{
+			// Another invocation stored the same entry first.
+			std::filesystem::remove( tempPath, error );
+		}
+
+		Trim();
+	}
+
+	void RecordStatistic( char c ) const
+	{
+		// Single byte appends don't interleave between concurrent invocations.
+		const std::filesystem::path path = m_directory / "statistics";
+		FILE* file = NULL;
+		fopen_s( &file, path.string().c_str(), "ab" );
+		if( file == NULL )
+		{
+			return;
+		}
+		fputc( c, file );
+		const long size = ftell( file );
+		fclose( file );
+
+		// Rotate the full file, the statistics cover the last one or two files. A lookup
+		// recorded by another invocation while it's renamed may land in either.
+		if( size >= _maxStatisticsSize )
+		{
+			std::error_code error;
+			std::filesystem::rename( path, m_directory / "statistics.1", error );
+		}
+	}
+
+	/** Evicts the least recently used entries until the cache fits in its size limit. */
+	void Trim() const
+	{
+		struct Entry
+		{
+			std::filesystem::path               path;
+			std::filesystem::file_time_type     time;
+			uintmax_t                           size;
+		};
+
+		std::vector<Entry> entries;
+		uintmax_t totalSize = 0;
+
+		std::error_code error;
+		for( const auto& entry : std::filesystem::directory_iterator( m_directory, error ) )
+		{
+			if( entry.path().extension() != ".analysis" )
+			{
+				continue;
+			}
+
+			std::error_code entryError;
+			Entry e = { entry.path(), entry.last_write_time( entryError ), entry.file_size( entryError ) };
+			if( !entryError )
+			{
+				totalSize += e.size;
+				entries.push_back( e );
+			}
+		}
+
+		if( totalSize <= m_maxSize )
+		{
+			return;
+		}
+
+		std::sort( entries.begin(), entries.end(), []( const Entry& a, const Entry& b ) { return a.time < b.time; } );
+
+		for( const Entry& entry : entries )
+		{
+			if( totalSize <= m_maxSize )
+			{
+				break;
+			}
+
+			// Entries removed concurrently by another invocation are fine.
+			std::filesystem::remove( entry.path, error );
+			totalSize -= entry.size;
+		}
+	}
+
+	std::filesystem::path   m_directory;
+	uintmax_t               m_maxSize;
+};
+
+/** Command line settings restricting what goes into the analysis. */
+struct Projection
+{
+	std::vector<std::string>                entryNames;
+	bool                                    prune = false;      // Leave out the statements unused by the entry points.
+	bool                                    inlineFunctions = false;    // Inline the calls to small functions.
+	bool                                    foldConstants = false;  // Replace the constant expressions by their value.
+	bool                                    eliminateDeadCode = false;  // Remove the dead code of the function bodies.
+	bool                                    eliminateCommonSubexpressions = false;  // Compute the repeated expressions once.
+	std::vector<std::string_view>           kinds;      // Node types of the top level statements, or Entry. Empty selects all.
+	std::unordered_set<std::string_view>    fields;     // Members of the top level statements. Empty keeps all.
+};
+
+void SplitList( const char* list, std::vector<std::string_view>& items )
+{
+	const char* begin = list;
+	while( true )
+	{
+		const char* end = strchr( begin, ',' );
+		std::string_view item = end != NULL ? std::string_view( begin, end - begin ) : std::string_view( begin );
+		if( !item.empty() )
+		{
+			items.push_back( item );
+		}
+		if( end == NULL )
+		{
+			break;
+		}
+		begin = end + 1;
+	}
+}
+
+bool IsEntryPoint( const Projection& projection, M4::HLSLStatement* statement )
+{
+	if( statement->nodeType != M4::HLSLNodeType::Function )
+	{
+		return false;
+	}
+
+	const char* name = static_cast<M4::HLSLFunction*>( statement )->name;
+	for( const std::string& entryName : projection.entryNames )
+	{
+		if( entryName == name )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsSelected( const Projection& projection, M4::HLSLStatement* statement )
+{
+	// Only PruneTree hides top level statements.
+	if( statement->hidden )
+	{
+		return false;
+	}
+
+	if( projection.kinds.empty() )
+	{
+		return true;
+	}
+
+	for( std::string_view kind : projection.kinds )
+	{
+		if( kind == "Entry" )
+		{
+			if( IsEntryPoint( projection, statement ) )
+			{
+				return true;
+			}
+		}
+		else if( kind == GetEnumName( statement->nodeType ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Writes the selected top level statements of the tree as a JSON array. With
+ * more than one job, the statements are rendered into separate buffers on
+ * worker threads and then written in order, giving the same output.
+ */
+void WriteStatements( M4::JSONWriter& writer, M4::HLSLTree& tree, const Projection& projection, unsigned int jobCount )
+{
+	// Statements are the objects inside the array.
+	const size_t depth = writer.GetDepth();
+	const std::unordered_set<std::string_view>* fields = projection.fields.empty() ? NULL : &projection.fields;
+	writer.SetMemberFilter( fields, depth + 2 );
+
+	std::vector<M4::HLSLStatement*> statements;
+	M4::HLSLStatement* nextStatement = tree.GetRoot()->statement;
+	while( nextStatement != nullptr )
+	{
+		if( IsSelected( projection, nextStatement ) )
+		{
+			statements.push_back( nextStatement );
+		}
+		nextStatement = nextStatement->nextStatement;
+	}
+
+	// Sized, so binary output can be flushed between statements.
+	writer.BeginArray( (uint32_t)statements.size() );
+
+	if( jobCount <= 1 || statements.size() < _minParallelStatements )
+	{
+		for( M4::HLSLStatement* statement : statements )
+		{
+			statement->WriteJSON( writer );
+		}
+	}
+	else
+	{
+		std::vector<std::string> elements( std::min( statements.size(), _parallelWindowSize ) );
+		std::atomic<size_t> nextElement;
+		size_t firstElement = 0;
+		size_t endElement = 0;
+		std::exception_ptr error;
+		std::atomic_flag errorSet = ATOMIC_FLAG_INIT;
+
+		auto render = [&]()
+		{
+			try
+			{
+				size_t index;
+				while( ( index = nextElement++ ) < endElement )
+				{
+					M4::JSONWriter element( writer.GetFormat() );
+					element.SetCompact( writer.GetCompact() );
+					element.SetFullTree( writer.GetFullTree() );
+					element.SetIndent( writer.GetIndent() );
+					element.SetBaseDepth( depth + 1 );
+					element.SetMemberFilter( fields, depth + 2 );
+					statements[ index ]->WriteJSON( element );
+					elements[ index - firstElement ] = element.ReleaseBuffer();
+				}
+			}
+			catch( ... )
+			{
+				// Stop the other workers and report the first failure on the calling thread.
+				nextElement = endElement;
+				if( !errorSet.test_and_set() )
+				{
+					error = std::current_exception();
+				}
+			}
+		};
+
+		// The statements are rendered a window at a time, which is written before the next one starts.
+		for( ; firstElement < statements.size(); firstElement = endElement )
+		{
+			endElement = std::min( firstElement + _parallelWindowSize, statements.size() );
+			nextElement = firstElement;
+
+			std::vector<std::thread> workers;
+			for( unsigned int i = 1; i < jobCount; ++i )
+			{
+				workers.emplace_back( render );
+			}
+			render();
+			for( std::thread& worker : workers )
+			{
+				worker.join();
+			}
+			if( error )
+			{
+				std::rethrow_exception( error );
+			}
+
+			for( size_t index = firstElement; index < endElement; ++index )
+			{
+				std::string& element = elements[ index - firstElement ];
+				writer.WriteEncoded( element );
+				std::string().swap( element );
+			}
+		}
+	}
+
+	writer.EndArray();
+	writer.SetMemberFilter( NULL, 0 );
+}
+
 void PrintUsage()
 {
-	std::cerr << "usage: hlslparser [-h] FILENAME ENTRYNAME\n"
+	std::cerr << "usage: hlslparser [-h] [--format FORMAT] [--compact] [--full-tree] [--inline] [--fold] [--dce] [--cse] [--prune] [--select KINDS] [--fields KEYS] [--cache DIR] [--cache-size BYTES] [--cache-stats] [--pass-stats] [--jobs N] [--ndjson OUTPUT] [--ndjson-records RECORDS] FILENAME ENTRYNAME [FILENAME ...]\n"
 		<< "\n"
 		<< "Output HLSL Parsing results to JSON.\n"
 		<< "\n"
 		<< "positional arguments:\n"
-		<< " FILENAME    input file name\n"
-		<< " ENTRYNAME   entry point of the shader\n"
+		<< " FILENAME    input file name, several with --ndjson\n"
+		<< " ENTRYNAME   entry point of the shader, or comma separated entry points\n"
 		<< "\n"
 		<< "optional arguments:\n"
-		<< " -h, --help  show this help message and exit\n";
+		<< " -h, --help          show this help message and exit\n"
+		<< " --format FORMAT     output format: json (default), cbor or msgpack\n"
+		<< " --compact           no indentation, members holding default values are left out\n"
+		<< " --full-tree         output function bodies, every expression and source locations\n"
+		<< " --inline            inline the calls to small functions into their callers\n"
+		<< " --fold              replace constant expressions by their value\n"
+		<< " --dce               remove unreachable statements and unused locals from function bodies\n"
+		<< " --cse               compute the expressions repeated in function bodies once, in locals\n"
+		<< " --prune             leave out the statements and buffer fields unused by the entry points\n"
+		<< " --select KINDS      comma separated node types of the top level statements to output,\n"
+		<< "                     Entry selects the entry point functions\n"
+		<< " --fields KEYS       comma separated members of the top level statements to output\n"
+		<< " --cache DIR         reuse analysis results stored in DIR for unchanged inputs\n"
+		<< " --cache-size BYTES  maximum size of the cache directory (default 64 MiB)\n"
+		<< " --cache-stats       print cache hit/miss statistics of the recent lookups\n"
+		<< " --pass-stats        print the time and nodes of each tree transformation\n"
+		<< " --jobs N            number of threads writing the analysis (default: one per core)\n"
+		<< " --ndjson OUTPUT     write newline delimited JSON records to OUTPUT (- for stdout)\n"
+		<< "                     instead of one analysis file per input\n"
+		<< " --ndjson-records RECORDS\n"
+		<< "                     file (default): one record per input file,\n"
+		<< "                     statement: one record per selected top level statement,\n"
+		<< "                     entry: one record per entry point with the statements it uses\n";
 }
 
-int main( int argc, char* argv[] )
+/** Command line settings applying to every input file. */
+struct Settings
+{
+	const OutputFormat*     outputFormat = &_outputFormats[0];
+	bool                    compact = false;
+	bool                    fullTree = false;
+	bool                    passStatistics = false;
+	unsigned int            jobCount = 1;
+	Projection              projection;
+	std::string             options;    // Every setting affecting the analysis, part of the cache keys.
+};
+
+void ConfigureWriter( M4::JSONWriter& writer, const Settings& settings )
+{
+	writer.SetCompact( settings.compact );
+	writer.SetFullTree( settings.fullTree );
+}
+
+bool ParseFile( const char* fileName, const std::string& source, M4::HLSLTree& tree )
+{
+	M4::HLSLParser parser( fileName, source.data(), source.size() );
+	return parser.Parse( &tree );
+}
+
+/** Returns false if an entry point is missing from the tree. */
+bool GetEntryNames( M4::HLSLTree& tree, const Projection& projection, std::vector<const char*>& entryNames )
+{
+	for( const std::string& entryName : projection.entryNames )
+	{
+		if( tree.FindFunction( entryName.c_str() ) == NULL )
+		{
+			M4::Log_Error( "Entry point %s not found\n", entryName.c_str() );
+			return false;
+		}
+		entryNames.push_back( entryName.c_str() );
+	}
+	return true;
+}
+
+void PrintPassStatistics( const char* fileName, const M4::HLSLPassManager& passManager )
+{
+	for( const M4::HLSLPassStatistics& statistics : passManager.GetStatistics() )
+	{
+		if( statistics.skipped )
+		{
+			fprintf( stderr, "%s: %s skipped\n", fileName, statistics.name );
+		}
+		else
+		{
+			fprintf( stderr, "%s: %s %.3f ms, %zu nodes (+%zu), %zu calls inlined, %zu statements removed, %zu expressions eliminated, %zu visible statements\n", fileName, statistics.name,
+				statistics.milliseconds, statistics.nodeCount, statistics.addedNodes, statistics.inlinedCalls, statistics.removedStatements, statistics.eliminatedExpressions, statistics.visibleStatements );
+			for( const M4::HLSLFunctionStatistics& function : statistics.functions )
+			{
+				fprintf( stderr, "%s: %s %s: %zu statements removed, %zu expressions eliminated\n", fileName, statistics.name,
+					function.name, function.removedStatements, function.eliminatedExpressions );
+			}
+		}
+	}
+}
+
+/**
+ * Inlines the small functions, folds the constants, removes the dead code and
+ * computes the repeated expressions once when asked to, then hides the
+ * statements the entry points don't use when pruning. Returns false if an
+ * entry point is missing.
+ */
+bool TransformTree( const char* fileName, M4::HLSLTree& tree, const Settings& settings, bool prune )
+{
+	const Projection& projection = settings.projection;
+	if( !prune && !projection.inlineFunctions && !projection.foldConstants && !projection.eliminateDeadCode && !projection.eliminateCommonSubexpressions )
+	{
+		return true;
+	}
+
+	std::vector<const char*> entryNames;
+	if( prune && !GetEntryNames( tree, projection, entryNames ) )
+	{
+		return false;
+	}
+
+	M4::HLSLPassManager passManager( &tree );
+	passManager.SetJobCount( settings.jobCount );
+	// Each pass leaves dead code to the next: folded conditions select branches, and pruning
+	// leaves out the globals only used through their value and the functions only called from dead code.
+	// Inlining comes first, the constant arguments then fold in the bodies inlined.
+	if( projection.inlineFunctions )
+	{
+		passManager.AddInlineFunctions();
+	}
+	if( projection.foldConstants )
+	{
+		passManager.AddFoldConstants();
+	}
+	if( projection.eliminateDeadCode )
+	{
+		passManager.AddEliminateDeadCode();
+	}
+	if( projection.eliminateCommonSubexpressions )
+	{
+		passManager.AddEliminateCommonSubexpressions();
+	}
+	if( prune )
+	{
+		passManager.AddPruneTree( entryNames.data(), (int)entryNames.size() );
+	}
+	passManager.Run();
+
+	if( settings.passStatistics )
+	{
+		PrintPassStatistics( fileName, passManager );
+	}
+	return true;
+}
+
+/**
+ * Returns the options keying the cache entries of the file. The full tree
+ * names the file in every node, so its entries are only valid for that file.
+ */
+std::string GetCacheOptions( const char* fileName, const Settings& settings )
+{
+	if( !settings.fullTree )
+	{
+		return settings.options;
+	}
+	return settings.options + fileName + '\0';
+}
+
+/** Writes the analysis of the file next to it. */
+int AnalyzeFile( const char* fileName, const Settings& settings, ParseCache* cache )
+{
+	using namespace M4;
+
+	if (!std::filesystem::exists(fileName))
+	{
+		Log_Error("File does not exits\n");
+		return 1;
+	}
+
+	// Read input file
+	const std::string source = ReadFile( fileName );
+	const std::string analysisName = GetAnalysisName( fileName, *settings.outputFormat );
+
+	std::string cacheKey;
+	if( cache != NULL )
+	{
+		cacheKey = cache->GetKey( source, GetCacheOptions( fileName, settings ) );
+
+		if( cache->Find( cacheKey, std::filesystem::path( analysisName ) ) )
+		{
+			return 0;
+		}
+	}
+
+	// Parse input file
+	HLSLTree tree;
+
+	if( !ParseFile( fileName, source, tree ) )
+	{
+		Log_Error( "Parsing failed, aborting\n" );
+		return 1;
+	}
+
+	if( !TransformTree( fileName, tree, settings, settings.projection.prune ) )
+	{
+		return 1;
+	}
+
+	// The analysis is streamed to the file, the cache gets a copy of the file.
+	OutputFile file;
+	bool written = false;
+	if (file.Open(analysisName.c_str(), settings.outputFormat->format == JSONFormat::Text))
+	{
+		JSONWriter writer(&file, settings.outputFormat->format);
+		ConfigureWriter(writer, settings);
+		WriteStatements(writer, tree, settings.projection, settings.jobCount);
+		written = writer.Flush();
+	}
+	written = file.Close() && written;
+
+	if (!written)
+	{
+		Log_Error("Failed to output analysis\n");
+		return 1;
+	}
+
+	if (cache != NULL)
+	{
+		cache->Store(cacheKey, std::filesystem::path(analysisName));
+	}
+
+	return 0;
+}
+
+void WriteErrorRecord( M4::JSONWriter& writer, const char* fileName, const char* error )
+{
+	writer.BeginObject();
+	writer.Key( "error" );
+	writer.String( error );
+	writer.Key( "file" );
+	writer.String( fileName );
+	writer.EndObject();
+	writer.EndRecord();
+}
+
+/** What each --ndjson record holds. */
+enum class RecordKind
+{
+	File,
+	Statement,
+	Entry,
+};
+
+/**
+ * Writes the records of a file: either {"analysis": [...], "file": ...}, one
+ * {"file": ..., "statement": {...}} per selected top level statement or one
+ * {"analysis": [...], "entry": ..., "file": ...} per entry point, holding the
+ * statements the entry point uses. Files that can't be analyzed get an
+ * {"error": ..., "file": ...} record. Returns false if the file couldn't be
+ * analyzed.
+ */
+bool WriteFileRecords( M4::JSONWriter& writer, const char* fileName, const Settings& settings, ParseCache* cache, RecordKind records )
+{
+	using namespace M4;
+
+	if( !std::filesystem::exists( fileName ) )
+	{
+		Log_Error( "File %s does not exist\n", fileName );
+		WriteErrorRecord( writer, fileName, "File does not exist" );
+		return false;
+	}
+
+	const std::string source = ReadFile( fileName );
+
+	// Only whole analyses are cached, the other records hold the file name.
+	std::string cacheKey;
+	if( cache != NULL && records == RecordKind::File )
+	{
+		cacheKey = cache->GetKey( source, GetCacheOptions( fileName, settings ) + "ndjson" + '\0' );
+
+		std::string analysis;
+		if( cache->Find( cacheKey, analysis ) )
+		{
+			writer.BeginObject();
+			writer.Key( "analysis" );
+			writer.WriteEncoded( analysis );
+			writer.Key( "file" );
+			writer.String( fileName );
+			writer.EndObject();
+			writer.EndRecord();
+			return true;
+		}
+	}
+
+	HLSLTree tree;
+	if( !ParseFile( fileName, source, tree ) )
+	{
+		Log_Error( "Parsing %s failed\n", fileName );
+		WriteErrorRecord( writer, fileName, "Parsing failed" );
+		return false;
+	}
+
+	if( records == RecordKind::Entry )
+	{
+		std::vector<const char*> entryNames;
+		if( !GetEntryNames( tree, settings.projection, entryNames ) )
+		{
+			WriteErrorRecord( writer, fileName, "Entry point not found" );
+			return false;
+		}
+
+		TransformTree( fileName, tree, settings, false );
+
+		// Every entry point is resolved at once, then the tree is pruned for each in turn.
+		HLSLReachability reachability( &tree, entryNames.data(), (int)entryNames.size() );
+		for( int entry = 0; entry < reachability.GetEntryCount(); ++entry )
+		{
+			reachability.HideUnused( entry );
+
+			writer.BeginObject();
+			writer.Key( "analysis" );
+			WriteStatements( writer, tree, settings.projection, settings.jobCount );
+			writer.Key( "entry" );
+			writer.String( entryNames[ entry ] );
+			writer.Key( "file" );
+			writer.String( fileName );
+			writer.EndObject();
+			writer.EndRecord();
+		}
+		return true;
+	}
+
+	if( !TransformTree( fileName, tree, settings, settings.projection.prune ) )
+	{
+		WriteErrorRecord( writer, fileName, "Entry point not found" );
+		return false;
+	}
+
+	if( records == RecordKind::Statement )
+	{
+		const Projection& projection = settings.projection;
+		writer.SetMemberFilter( projection.fields.empty() ? NULL : &projection.fields, 2 );
+
+		for( HLSLStatement* statement = tree.GetRoot()->statement; statement != NULL; statement = statement->nextStatement )
+		{
+			if( IsSelected( projection, statement ) )
+			{
+				writer.BeginObject();
+				writer.Key( "file" );
+				writer.String( fileName );
+				writer.Key( "statement" );
+				statement->WriteJSON( writer );
+				writer.EndObject();
+				writer.EndRecord();
+			}
+		}
+
+		writer.SetMemberFilter( NULL, 0 );
+		return true;
+	}
+
+	writer.BeginObject();
+	writer.Key( "analysis" );
+	if( cache != NULL )
+	{
+		JSONWriter analysis( writer.GetFormat() );
+		ConfigureWriter( analysis, settings );
+		analysis.SetIndent( false );
+		analysis.SetBaseDepth( 1 );
+		WriteStatements( analysis, tree, settings.projection, settings.jobCount );
+		writer.WriteEncoded( analysis.GetBuffer() );
+		cache->Store( cacheKey, analysis.GetBuffer() );
+	}
+	else
+	{
+		WriteStatements( writer, tree, settings.projection, settings.jobCount );
+	}
+	writer.Key( "file" );
+	writer.String( fileName );
+	writer.EndObject();
+	writer.EndRecord();
+	return true;
+}
+
+/**
+ * Writes the records of every file as newline delimited JSON. Each record is
+ * flushed as soon as it is complete, so consumers can follow the output.
+ */
+int WriteRecords( const std::vector<const char*>& fileNames, const char* outputName, const Settings& settings, ParseCache* cache, RecordKind records )
+{
+	M4::OutputFile file;
+	if( M4::String_Equal( outputName, "-" ) )
+	{
+		file.OpenStandardOutput();
+	}
+	else if( !file.Open( outputName, true ) )
+	{
+		M4::Log_Error( "Failed to open %s\n", outputName );
+		return 1;
+	}
+
+	int result = 0;
+	bool written;
+	{
+		M4::JSONWriter writer( &file );
+		ConfigureWriter( writer, settings );
+		writer.SetIndent( false );
+
+		for( const char* fileName : fileNames )
+		{
+			if( !WriteFileRecords( writer, fileName, settings, cache, records ) )
+			{
+				result = 1;
+			}
+		}
+		written = writer.Flush();
+	}
+
+	written = file.Close() && written;
+
+	if( !written )
+	{
+		M4::Log_Error( "Failed to output analysis\n" );
+		return 1;
+	}
+	return result;
+}
+
+/** Runs the command line tool, main is a separate function so the tests can call it. */
+int RunTool( int argc, char* argv[] )
 {
 	using namespace M4;
 
 	// Parse arguments
-	const char* fileName = NULL;
+	std::vector<const char*> fileNames;
 	const char* entryName = NULL;
+	const char* cacheDirectory = NULL;
+	uintmax_t cacheSize = _defaultCacheSize;
+	bool printCacheStatistics = false;
+	const char* recordsName = NULL;
+	RecordKind records = RecordKind::File;
+	Settings settings;
+	settings.jobCount = std::max( std::thread::hardware_concurrency(), 1u );
+	Projection& projection = settings.projection;
+	std::string projectionOptions;
 
 	for( int argn = 1; argn < argc; ++argn )
 	{
@@ -44,9 +960,110 @@ int main( int argc, char* argv[] )
 			PrintUsage();
 			return 0;
 		}
-		else if( fileName == NULL )
+		else if( String_Equal( arg, "--format" ) && argn + 1 < argc )
+		{
+			settings.outputFormat = FindOutputFormat( argv[ ++argn ] );
+			if( settings.outputFormat == NULL )
+			{
+				Log_Error( "Unknown output format %s\n", argv[ argn ] );
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if( String_Equal( arg, "--cache" ) && argn + 1 < argc )
+		{
+			cacheDirectory = argv[ ++argn ];
+		}
+		else if( String_Equal( arg, "--cache-size" ) && argn + 1 < argc )
+		{
+			cacheSize = strtoull( argv[ ++argn ], NULL, 10 );
+		}
+		else if( String_Equal( arg, "--cache-stats" ) )
 		{
-			fileName = arg;
+			printCacheStatistics = true;
+		}
+		else if( String_Equal( arg, "--pass-stats" ) )
+		{
+			settings.passStatistics = true;
+		}
+		else if( String_Equal( arg, "--compact" ) )
+		{
+			settings.compact = true;
+		}
+		else if( String_Equal( arg, "--full-tree" ) )
+		{
+			settings.fullTree = true;
+		}
+		else if( String_Equal( arg, "--jobs" ) && argn + 1 < argc )
+		{
+			settings.jobCount = std::max( atoi( argv[ ++argn ] ), 1 );
+		}
+		else if( String_Equal( arg, "--inline" ) )
+		{
+			projection.inlineFunctions = true;
+			projectionOptions += std::string( "inline" ) + '\0';
+		}
+		else if( String_Equal( arg, "--fold" ) )
+		{
+			projection.foldConstants = true;
+			projectionOptions += std::string( "fold" ) + '\0';
+		}
+		else if( String_Equal( arg, "--dce" ) )
+		{
+			projection.eliminateDeadCode = true;
+			projectionOptions += std::string( "dce" ) + '\0';
+		}
+		else if( String_Equal( arg, "--cse" ) )
+		{
+			projection.eliminateCommonSubexpressions = true;
+			projectionOptions += std::string( "cse" ) + '\0';
+		}
+		else if( String_Equal( arg, "--prune" ) )
+		{
+			projection.prune = true;
+			projectionOptions += std::string( "prune" ) + '\0';
+		}
+		else if( String_Equal( arg, "--select" ) && argn + 1 < argc )
+		{
+			SplitList( argv[ ++argn ], projection.kinds );
+			projectionOptions += std::string( "select=" ) + argv[ argn ] + '\0';
+		}
+		else if( String_Equal( arg, "--fields" ) && argn + 1 < argc )
+		{
+			std::vector<std::string_view> fields;
+			SplitList( argv[ ++argn ], fields );
+			projection.fields.insert( fields.begin(), fields.end() );
+			projectionOptions += std::string( "fields=" ) + argv[ argn ] + '\0';
+		}
+		else if( String_Equal( arg, "--ndjson" ) && argn + 1 < argc )
+		{
+			recordsName = argv[ ++argn ];
+		}
+		else if( String_Equal( arg, "--ndjson-records" ) && argn + 1 < argc )
+		{
+			const char* recordKind = argv[ ++argn ];
+			if( String_Equal( recordKind, "file" ) )
+			{
+				records = RecordKind::File;
+			}
+			else if( String_Equal( recordKind, "statement" ) )
+			{
+				records = RecordKind::Statement;
+			}
+			else if( String_Equal( recordKind, "entry" ) )
+			{
+				records = RecordKind::Entry;
+			}
+			else
+			{
+				Log_Error( "Unknown record kind %s\n", recordKind );
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if( fileNames.empty() )
+		{
+			fileNames.push_back( arg );
 		}
 		else if( entryName == NULL )
 		{
@@ -54,62 +1071,62 @@ int main( int argc, char* argv[] )
 		}
 		else
 		{
-			Log_Error( "Too many arguments\n" );
-			PrintUsage();
-			return 1;
+			fileNames.push_back( arg );
 		}
 	}
 
-	if( fileName == NULL || entryName == NULL )
+	if( fileNames.empty() || entryName == NULL )
 	{
 		Log_Error( "Missing arguments\n" );
 		PrintUsage();
 		return 1;
 	}
 
-	if (!std::filesystem::exists(fileName))
+	if( recordsName == NULL && fileNames.size() > 1 )
 	{
-		Log_Error("File does not exits\n");
+		Log_Error( "Too many arguments\n" );
+		PrintUsage();
 		return 1;
 	}
 
-	// Read input file
-	const std::string source = ReadFile( fileName );
-
-	// Parse input file
-	HLSLParser parser(fileName, source.data(), source.size() );
-	HLSLTree tree;
-
-	if( !parser.Parse( &tree ) )
+	if( recordsName != NULL && settings.outputFormat->format != JSONFormat::Text )
 	{
-		Log_Error( "Parsing failed, aborting\n" );
+		Log_Error( "--ndjson requires the json format\n" );
 		return 1;
 	}
 
-	nlohmann::json output = nlohmann::json::array();
+	std::vector<std::string_view> entryNames;
+	SplitList( entryName, entryNames );
+	projection.entryNames.assign( entryNames.begin(), entryNames.end() );
+	settings.options = std::string( entryName ) + '\0' + settings.outputFormat->name + '\0' + ( settings.compact ? "compact" : "" ) + '\0' + ( settings.fullTree ? "full-tree" : "" ) + '\0' + projectionOptions;
 
-	HLSLStatement* nextStatement = tree.GetRoot()->statement;
-	while (nextStatement != nullptr)
+	std::unique_ptr<ParseCache> cache;
+	if( cacheDirectory != NULL )
 	{
-		output.emplace_back(nextStatement->ConvertToJSON());
-		nextStatement = nextStatement->nextStatement;
+		cache.reset( new ParseCache( cacheDirectory, cacheSize ) );
 	}
 
-	FILE* file = NULL;
-	std::string strOutput = output.dump(2);
-
-	fopen_s(&file, (std::string(fileName) + ".analysis").c_str(), "w");
-
-	if (file != NULL)
+	int result;
+	if( recordsName != NULL )
 	{
-		fprintf(file, "%s", strOutput.c_str());
-		fclose(file);
+		result = WriteRecords( fileNames, recordsName, settings, cache.get(), records );
 	}
 	else
 	{
-		Log_Error("Failed to output analysis\n");
-		return 1;
+		result = AnalyzeFile( fileNames[ 0 ], settings, cache.get() );
 	}
 
-	return 0;
+	if( cache && printCacheStatistics )
+	{
+		cache->PrintStatistics();
+	}
+
+	return result;
+}
+
+#ifndef HLSLPARSER_NO_MAIN
+int main( int argc, char* argv[] )
+{
+	return RunTool( argc, argv );
 }
+#endif
@@ -0,0 +1,162 @@
+//#include "Engine/Assert.h"
+#include "Engine.h"
+
+#include "OutputFile.h"
+
+#if _MSC_VER
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace M4
+{
+
+OutputFile::OutputFile()
+{
+    m_descriptor    = -1;
+    m_owned         = false;
+    m_error         = false;
+}
+
+OutputFile::~OutputFile()
+{
+    Close();
+}
+
+bool OutputFile::Open(const char* fileName, bool text)
+{
+    Close();
+
+#if _MSC_VER
+    int flags = _O_WRONLY | _O_CREAT | _O_TRUNC | (text ? _O_TEXT : _O_BINARY);
+    if (_sopen_s(&m_descriptor, fileName, flags, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+    {
+        m_descriptor = -1;
+    }
+#else
+    m_descriptor = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+
+    m_owned = true;
+    m_error = false;
+    return m_descriptor >= 0;
+}
+
+void OutputFile::OpenStandardOutput()
+{
+    Close();
+
+    m_descriptor    = 1;
+    m_owned         = false;
+    m_error         = false;
+}
+
+bool OutputFile::IsOpen() const
+{
+    return m_descriptor >= 0;
+}
+
+bool OutputFile::Write(std::string_view data)
+{
+    return Write(&data, 1);
+}
+
+bool OutputFile::Write(const std::string_view* parts, size_t count)
+{
+    ASSERT(count <= s_maxParts);
+
+    if (m_descriptor < 0 || m_error)
+    {
+        return false;
+    }
+
+#if _MSC_VER
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* data = parts[i].data();
+        size_t size = parts[i].size();
+        while (size > 0)
+        {
+            unsigned int chunk = size < (1u << 30) ? (unsigned int)size : (1u << 30);
+            int written = _write(m_descriptor, data, chunk);
+            if (written <= 0)
+            {
+                m_error = true;
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+#else
+    struct iovec vectors[s_maxParts];
+    int vectorCount = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!parts[i].empty())
+        {
+            vectors[vectorCount].iov_base = const_cast<char*>(parts[i].data());
+            vectors[vectorCount].iov_len = parts[i].size();
+            ++vectorCount;
+        }
+    }
+
+    struct iovec* vector = vectors;
+    while (vectorCount > 0)
+    {
+        ssize_t written = writev(m_descriptor, vector, vectorCount);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            m_error = true;
+            return false;
+        }
+
+        // A partial write resumes in the middle of a part.
+        size_t remaining = (size_t)written;
+        while (vectorCount > 0 && remaining >= vector->iov_len)
+        {
+            remaining -= vector->iov_len;
+            ++vector;
+            --vectorCount;
+        }
+        if (vectorCount > 0)
+        {
+            vector->iov_base = static_cast<char*>(vector->iov_base) + remaining;
+            vector->iov_len -= remaining;
+        }
+    }
+#endif
+
+    return true;
+}
+
+bool OutputFile::Close()
+{
+    bool closed = !m_error;
+    if (m_descriptor >= 0 && m_owned)
+    {
+#if _MSC_VER
+        closed = _close(m_descriptor) == 0 && closed;
+#else
+        closed = close(m_descriptor) == 0 && closed;
+#endif
+    }
+
+    m_descriptor    = -1;
+    m_owned         = false;
+    m_error         = false;
+    return closed;
+}
+
+} // M4
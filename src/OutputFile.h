@@ -0,0 +1,66 @@
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include "Engine.h"
+
+#include <stddef.h>
+#include <string_view>
+
+namespace M4
+{
+
+/**
+ * Unbuffered output file. Each write hands the caller's buffer straight to the
+ * operating system, retrying only after partial writes, so output that is
+ * already buffered (see JSONWriter) isn't copied again by stdio. Works with
+ * regular files, pipes and the standard output.
+ */
+class OutputFile
+{
+
+public:
+
+    OutputFile();
+
+    /** Closes the file, see Close. */
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    /**
+     * Creates or truncates the file. Text files get the line endings of the
+     * platform. Returns false if the file can't be opened.
+     */
+    bool Open(const char* fileName, bool text);
+
+    /** Writes to the standard output, which is left open by Close. */
+    void OpenStandardOutput();
+
+    bool IsOpen() const;
+
+    /** Returns false if writing failed. */
+    bool Write(std::string_view data);
+
+    /**
+     * Writes the parts in order, with a single gathering system call where the
+     * platform has one. At most s_maxParts parts.
+     */
+    bool Write(const std::string_view* parts, size_t count);
+
+    /** Returns false if closing or any previous write failed. */
+    bool Close();
+
+    static const size_t s_maxParts = 8;
+
+private:
+
+    int     m_descriptor;
+    bool    m_owned;
+    bool    m_error;
+
+};
+
+} // M4
+
+#endif
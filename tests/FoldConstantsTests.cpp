@@ -0,0 +1,147 @@
+#include "Test.h"
+
+using namespace M4;
+
+static const char* const _foldShader =
+    "static const float TWO_PI = 6.2831853;\n"
+    "static const int N = 4;\n"
+    "float4 PSMain(float x : TEXCOORD0) : SV_Target0\n"
+    "{\n"
+    "    int k = 3;\n"
+    "    bool greater = TWO_PI > 7;\n"
+    "    bool greaterEqual = TWO_PI >= 6.28;\n"
+    "    bool mixed = 1 < TWO_PI;\n"
+    "    bool equal = 2.5 == 2.5;\n"
+    "    bool both = TWO_PI > 6 && N == 4;\n"
+    "    float taken = (N > 2) ? x : 0.5;\n"
+    "    float constant = (TWO_PI < 1.0) ? 1.0 : 2.0;\n"
+    "    int integer = (N != 4) ? 1 : N * 2;\n"
+    "    float nested = (N > 2) ? ((N < 1) ? x : 2 * x) : 0;\n"
+    "    float operand = ((N > 2) ? 1.0 : x) * 2;\n"
+    "    float written = (N > 2) ? x : k++;\n"
+    "    float converted = (N < 2) ? 1 : x;\n"
+    "    return float4(taken, constant, nested + operand + written + converted, integer);\n"
+    "}\n";
+
+/** Returns the value the local is declared with. */
+static HLSLExpression* FindInitializer(HLSLFunction* function, const char* name)
+{
+    for (HLSLStatement* statement = function->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        if (statement->nodeType == HLSLNodeType::Declaration && String_Equal(static_cast<HLSLDeclaration*>(statement)->name, name))
+        {
+            return static_cast<HLSLDeclaration*>(statement)->assignment;
+        }
+    }
+    CHECK(!"local not found");
+    return NULL;
+}
+
+static bool IsLiteral(const HLSLExpression* expression, bool value)
+{
+    return expression != NULL && expression->nodeType == HLSLNodeType::LiteralExpression &&
+        static_cast<const HLSLLiteralExpression*>(expression)->type == HLSLBaseType::Bool &&
+        static_cast<const HLSLLiteralExpression*>(expression)->bValue == value;
+}
+
+static bool IsLiteral(const HLSLExpression* expression, int value)
+{
+    return expression != NULL && expression->nodeType == HLSLNodeType::LiteralExpression &&
+        static_cast<const HLSLLiteralExpression*>(expression)->type == HLSLBaseType::Int &&
+        static_cast<const HLSLLiteralExpression*>(expression)->iValue == value;
+}
+
+static bool IsLiteral(const HLSLExpression* expression, float value)
+{
+    // Literals without a suffix are halfs.
+    if (expression == NULL || expression->nodeType != HLSLNodeType::LiteralExpression) return false;
+    const HLSLLiteralExpression* literal = static_cast<const HLSLLiteralExpression*>(expression);
+    return (literal->type == HLSLBaseType::Float || literal->type == HLSLBaseType::Half) && literal->fValue == value;
+}
+
+static bool IsIdentifier(const HLSLExpression* expression, const char* name)
+{
+    return expression != NULL && expression->nodeType == HLSLNodeType::IdentifierExpression &&
+        String_Equal(static_cast<const HLSLIdentifierExpression*>(expression)->name, name);
+}
+
+TEST(FoldConstantsComparesFloats)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _foldShader))
+    {
+        FoldConstants(&tree);
+        HLSLFunction* function = tree.FindFunction("PSMain");
+
+        CHECK(IsLiteral(FindInitializer(function, "greater"), false));
+        CHECK(IsLiteral(FindInitializer(function, "greaterEqual"), true));
+        CHECK(IsLiteral(FindInitializer(function, "mixed"), true));
+        CHECK(IsLiteral(FindInitializer(function, "equal"), true));
+        CHECK(IsLiteral(FindInitializer(function, "both"), true));
+    }
+}
+
+TEST(FoldConstantsSelectsBranches)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _foldShader))
+    {
+        FoldConstants(&tree);
+        HLSLFunction* function = tree.FindFunction("PSMain");
+
+        CHECK(IsIdentifier(FindInitializer(function, "taken"), "x"));
+        CHECK(IsLiteral(FindInitializer(function, "constant"), 2.0f));
+        CHECK(IsLiteral(FindInitializer(function, "integer"), 8));
+        CHECK(IsLiteral(FindInitializer(function, "operand"), 2.0f));
+
+        // Conditionals within the branch taken are resolved too.
+        HLSLExpression* nested = FindInitializer(function, "nested");
+        CHECK(nested != NULL && nested->nodeType == HLSLNodeType::BinaryExpression);
+        CHECK(nested != NULL && IsLiteral(static_cast<HLSLBinaryExpression*>(nested)->expression1, 2));
+        CHECK(nested != NULL && IsIdentifier(static_cast<HLSLBinaryExpression*>(nested)->expression2, "x"));
+
+        // The branch not taken writes k, the conditional stays with its folded condition.
+        HLSLExpression* written = FindInitializer(function, "written");
+        CHECK(written != NULL && written->nodeType == HLSLNodeType::ConditionalExpression);
+        CHECK(written != NULL && IsLiteral(static_cast<HLSLConditionalExpression*>(written)->condition, true));
+
+        // The int conditional would need x converted.
+        HLSLExpression* converted = FindInitializer(function, "converted");
+        CHECK(converted != NULL && converted->nodeType == HLSLNodeType::ConditionalExpression);
+    }
+}
+
+TEST(FoldConstantsLetsDeadCodeGo)
+{
+    const char* const source =
+        "static const float TWO_PI = 6.2831853;\n"
+        "float4 PSMain(float x : TEXCOORD0) : SV_Target0\n"
+        "{\n"
+        "    float f = x;\n"
+        "    if (TWO_PI > 7) f = 1;\n"
+        "    if (TWO_PI > 6) f += 2; else f -= 2;\n"
+        "    return f;\n"
+        "}\n";
+
+    HLSLTree tree;
+    if (ParseSource(&tree, source))
+    {
+        FoldConstants(&tree);
+        HLSLFunction* function = tree.FindFunction("PSMain");
+        EliminateDeadCode(&tree, function);
+
+        // Left with the declaration, the branch taken and the return.
+        HLSLStatement* statement = function->statement;
+        CHECK(statement != NULL && statement->nodeType == HLSLNodeType::Declaration);
+        statement = statement != NULL ? statement->nextStatement : NULL;
+        CHECK(statement != NULL && statement->nodeType == HLSLNodeType::ExpressionStatement);
+        if (statement != NULL && statement->nodeType == HLSLNodeType::ExpressionStatement)
+        {
+            HLSLExpression* expression = static_cast<HLSLExpressionStatement*>(statement)->expression;
+            CHECK(expression->nodeType == HLSLNodeType::BinaryExpression && static_cast<HLSLBinaryExpression*>(expression)->binaryOp == HLSLBinaryOp::AddAssign);
+        }
+        statement = statement != NULL ? statement->nextStatement : NULL;
+        CHECK(statement != NULL && statement->nodeType == HLSLNodeType::ReturnStatement);
+        CHECK(statement != NULL && statement->nextStatement == NULL);
+    }
+}
@@ -0,0 +1,125 @@
+#include "Test.h"
+
+#include "HLSLJSONReader.h"
+
+using namespace M4;
+
+static const char* const _inlineShader =
+    "float Neg(float v)\n"
+    "{\n"
+    "    float r = -v;\n"
+    "    return r * 2;\n"
+    "}\n"
+    "float4 PSMain(float x : TEXCOORD0) : SV_Target0\n"
+    "{\n"
+    "    float acc = x;\n"
+    "    acc = Neg(acc);\n"
+    "    acc += Neg(acc);\n"
+    "    if (x > 0) acc = 1;\n"
+    "    else if (Neg(acc) > 2) acc = 2;\n"
+    "    return acc;\n"
+    "}\n";
+
+/** Returns true if a statement of the list before the statement declares the local named. */
+static bool IsDeclaredBefore(const HLSLStatement* first, const HLSLStatement* statement, const char* name)
+{
+    for (; first != NULL && first != statement; first = first->nextStatement)
+    {
+        if (first->nodeType == HLSLNodeType::Declaration && String_Equal(static_cast<const HLSLDeclaration*>(first)->name, name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Returns true if the expression reads a local of the list declared before the statement. */
+static bool IsInlinedValue(const HLSLStatement* first, const HLSLStatement* statement, const HLSLExpression* expression)
+{
+    return expression != NULL && expression->nodeType == HLSLNodeType::IdentifierExpression &&
+        IsDeclaredBefore(first, statement, static_cast<const HLSLIdentifierExpression*>(expression)->name);
+}
+
+/** Returns the statement of the list after the number of statements of the type. */
+static HLSLStatement* FindStatement(HLSLStatement* statement, HLSLNodeType nodeType, int index = 0)
+{
+    for (; statement != NULL; statement = statement->nextStatement)
+    {
+        if (statement->nodeType == nodeType && index-- == 0)
+        {
+            return statement;
+        }
+    }
+    return NULL;
+}
+
+/** Checks that the else of the if holds the body inlined, then the if reading its value. */
+static void CheckInlinedElseIf(HLSLFunction* function)
+{
+    HLSLIfStatement* ifStatement = static_cast<HLSLIfStatement*>(FindStatement(function->statement, HLSLNodeType::IfStatement));
+    CHECK(ifStatement != NULL);
+    if (ifStatement == NULL)
+    {
+        return;
+    }
+
+    HLSLStatement* elseStatement = ifStatement->elseStatement;
+    HLSLIfStatement* elseIf = static_cast<HLSLIfStatement*>(FindStatement(elseStatement, HLSLNodeType::IfStatement));
+    CHECK(elseStatement != NULL && elseStatement->nodeType == HLSLNodeType::Declaration);
+    CHECK(elseIf != NULL && elseIf->nextStatement == NULL);
+    if (elseIf != NULL)
+    {
+        HLSLExpression* condition = elseIf->condition;
+        CHECK(condition->nodeType == HLSLNodeType::BinaryExpression);
+        CHECK(condition->nodeType == HLSLNodeType::BinaryExpression && IsInlinedValue(elseStatement, elseIf, static_cast<HLSLBinaryExpression*>(condition)->expression1));
+        CHECK(elseIf->statement != NULL && elseIf->statement->nodeType == HLSLNodeType::ExpressionStatement);
+    }
+}
+
+TEST(InlineFunctionsInlinesAssignedCalls)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _inlineShader))
+    {
+        CHECK(InlineFunctions(&tree) == 3);
+        HLSLFunction* function = tree.FindFunction("PSMain");
+
+        // The assignments read the locals holding the values returned, declared before them.
+        const HLSLBinaryOp binaryOps[] = { HLSLBinaryOp::Assign, HLSLBinaryOp::AddAssign };
+        for (int i = 0; i < 2; ++i)
+        {
+            HLSLStatement* statement = FindStatement(function->statement, HLSLNodeType::ExpressionStatement, i);
+            CHECK(statement != NULL);
+            if (statement != NULL)
+            {
+                HLSLExpression* expression = static_cast<HLSLExpressionStatement*>(statement)->expression;
+                CHECK(expression->nodeType == HLSLNodeType::BinaryExpression && static_cast<HLSLBinaryExpression*>(expression)->binaryOp == binaryOps[i]);
+                CHECK(expression->nodeType == HLSLNodeType::BinaryExpression && IsInlinedValue(function->statement, statement, static_cast<HLSLBinaryExpression*>(expression)->expression2));
+            }
+        }
+    }
+}
+
+TEST(InlineFunctionsInlinesElseIfConditions)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _inlineShader))
+    {
+        CHECK(InlineFunctions(&tree) == 3);
+        CheckInlinedElseIf(tree.FindFunction("PSMain"));
+
+        // The full tree holds the if behind the declarations inlined.
+        for (int compact = 0; compact < 2; ++compact)
+        {
+            const std::string analysis = WriteAnalysis(&tree, JSONFormat::Text, compact != 0, true);
+            HLSLTree copy;
+            CHECK(ReadTreeJSON(&copy, analysis.data(), analysis.size()));
+            HLSLFunction* function = copy.FindFunction("PSMain");
+            CHECK(function != NULL);
+            if (function != NULL)
+            {
+                CheckInlinedElseIf(function);
+            }
+        }
+    }
+}
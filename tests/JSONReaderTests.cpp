@@ -0,0 +1,210 @@
+#include "Test.h"
+
+#include "HLSLJSONReader.h"
+#include "HLSLPassManager.h"
+
+#include <string.h>
+#include <utility>
+#include <vector>
+
+using namespace M4;
+
+static const JSONFormat _formats[] = { JSONFormat::Text, JSONFormat::CBOR, JSONFormat::MessagePack };
+
+/** Checks that the tree read back from an analysis of tree is written as the same analysis. */
+static void CheckRoundTrip(HLSLTree* tree, JSONFormat format, bool compact, bool fullTree)
+{
+    const std::string analysis = WriteAnalysis(tree, format, compact, fullTree);
+
+    HLSLTree copy;
+    CHECK(ReadTreeJSON(&copy, analysis.data(), analysis.size(), format));
+    CHECK(WriteAnalysis(&copy, format, compact, fullTree) == analysis);
+}
+
+static void CheckRoundTrips(HLSLTree* tree)
+{
+    for (JSONFormat format : _formats)
+    {
+        for (int compact = 0; compact < 2; ++compact)
+        {
+            for (int fullTree = 0; fullTree < 2; ++fullTree)
+            {
+                CheckRoundTrip(tree, format, compact != 0, fullTree != 0);
+            }
+        }
+    }
+}
+
+TEST(JSONReaderRoundTrip)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _sampleShader))
+    {
+        CheckRoundTrips(&tree);
+    }
+}
+
+TEST(JSONReaderRoundTripTransformed)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _sampleShader))
+    {
+        const char* entryNames[] = { "PSMain" };
+        HLSLPassManager passManager(&tree);
+        passManager.AddInlineFunctions();
+        passManager.AddFoldConstants();
+        passManager.AddEliminateCommonSubexpressions();
+        passManager.AddFlattenExpressions();
+        passManager.AddPruneTree(entryNames, 1);
+        CHECK(passManager.Run());
+        CheckRoundTrips(&tree);
+    }
+}
+
+/** Lists the statements below the statement and those following it, with their line, in source order. */
+static void CollectStatements(const HLSLStatement* statement, std::vector<std::pair<HLSLNodeType, int>>& statements)
+{
+    for (; statement != NULL; statement = statement->nextStatement)
+    {
+        statements.push_back(std::make_pair(statement->nodeType, statement->line));
+        switch (statement->nodeType)
+        {
+        case HLSLNodeType::Function:
+            CollectStatements(static_cast<const HLSLFunction*>(statement)->statement, statements);
+            break;
+        case HLSLNodeType::BlockStatement:
+            CollectStatements(static_cast<const HLSLBlockStatement*>(statement)->statement, statements);
+            break;
+        case HLSLNodeType::IfStatement:
+            CollectStatements(static_cast<const HLSLIfStatement*>(statement)->statement, statements);
+            CollectStatements(static_cast<const HLSLIfStatement*>(statement)->elseStatement, statements);
+            break;
+        case HLSLNodeType::ForStatement:
+            CollectStatements(static_cast<const HLSLForStatement*>(statement)->statement, statements);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+TEST(JSONReaderKeepsEveryBodyStatement)
+{
+    const char* const source =
+        "float4 PSMain(float c : TEXCOORD0) : SV_Target0\n"
+        "{\n"
+        "    float a = 0;\n"
+        "    if (c > 0) { a = 1; a = a * 2; }\n"
+        "    else if (c < -1) { a = 5; a = a - 1; }\n"
+        "    else { a = 3; a = a + 4; }\n"
+        "    for (int i = 0; i < 4; ++i) { a += 1; a *= 2; }\n"
+        "    return a;\n"
+        "}\n";
+
+    const std::vector<std::pair<HLSLNodeType, int>> expected =
+    {
+        { HLSLNodeType::Function, 1 },
+        { HLSLNodeType::Declaration, 3 },
+        { HLSLNodeType::IfStatement, 4 },
+        { HLSLNodeType::ExpressionStatement, 4 },
+        { HLSLNodeType::ExpressionStatement, 4 },
+        { HLSLNodeType::IfStatement, 5 },
+        { HLSLNodeType::ExpressionStatement, 5 },
+        { HLSLNodeType::ExpressionStatement, 5 },
+        { HLSLNodeType::ExpressionStatement, 6 },
+        { HLSLNodeType::ExpressionStatement, 6 },
+        { HLSLNodeType::ForStatement, 7 },
+        { HLSLNodeType::ExpressionStatement, 7 },
+        { HLSLNodeType::ExpressionStatement, 7 },
+        { HLSLNodeType::ReturnStatement, 8 },
+    };
+
+    HLSLTree tree;
+    if (ParseSource(&tree, source))
+    {
+        std::vector<std::pair<HLSLNodeType, int>> statements;
+        CollectStatements(tree.GetRoot()->statement, statements);
+        CHECK(statements == expected);
+
+        for (JSONFormat format : _formats)
+        {
+            for (int compact = 0; compact < 2; ++compact)
+            {
+                const std::string analysis = WriteAnalysis(&tree, format, compact != 0, true);
+
+                HLSLTree copy;
+                CHECK(ReadTreeJSON(&copy, analysis.data(), analysis.size(), format));
+                statements.clear();
+                CollectStatements(copy.GetRoot()->statement, statements);
+                CHECK(statements == expected);
+            }
+        }
+    }
+}
+
+TEST(JSONReaderFullTreeGivesAnalysis)
+{
+    // The tree read from the full tree has everything the plain analysis holds.
+    HLSLTree tree;
+    if (ParseSource(&tree, _sampleShader))
+    {
+        const std::string fullTree = WriteAnalysis(&tree, JSONFormat::Text, false, true);
+
+        HLSLTree copy;
+        CHECK(ReadTreeJSON(&copy, fullTree.data(), fullTree.size()));
+        CHECK(WriteAnalysis(&copy) == WriteAnalysis(&tree));
+    }
+}
+
+TEST(JSONReaderRejectsTruncatedData)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _sampleShader))
+    {
+        for (JSONFormat format : _formats)
+        {
+            const std::string analysis = WriteAnalysis(&tree, format, false, true);
+
+            // Every prefix would take too long on the full tree, a prime stride reaches all the node kinds.
+            for (size_t size = 0; size < analysis.size(); size += 61)
+            {
+                HLSLTree copy;
+                CHECK(!ReadTreeJSON(&copy, analysis.data(), size, format));
+            }
+        }
+    }
+}
+
+TEST(JSONReaderSkipsUnknownMembers)
+{
+    const char* const document = "[{\"nodeType\": \"Declaration\", \"name\": \"x\", \"other\": [1, {\"a\": [true]}], \"more\": 2.5}]";
+    HLSLTree tree;
+    CHECK(ReadTreeJSON(&tree, document, strlen(document)));
+
+    HLSLStatement* statement = tree.GetRoot()->statement;
+    CHECK(statement != NULL && statement->nodeType == HLSLNodeType::Declaration && statement->nextStatement == NULL);
+    CHECK(statement != NULL && String_Equal(static_cast<HLSLDeclaration*>(statement)->name, "x"));
+}
+
+TEST(JSONReaderRejectsOtherData)
+{
+    const char* const documents[] =
+    {
+        "",
+        "{}",
+        "[1, 2]",
+        "[{}]",
+        "[[]]",
+        "[{\"nodeType\": \"Unknown\"}]",
+        "[{\"nodeType\": \"Declaration\", \"name\": 1}]",
+        "[{\"nodeType\": \"Declaration\", \"line\": \"1\"}]",
+        "[{\"nodeType\": \"Declaration\", \"assignments\": [1]}]",
+        "[{\"nodeType\": \"BlockStatement\", \"statements\": {\"nodeType\": \"BreakStatement\"}}]",
+        "[{\"nodeType\": \"Declaration\"}] []",
+    };
+    for (const char* document : documents)
+    {
+        HLSLTree tree;
+        CHECK(!ReadTreeJSON(&tree, document, strlen(document)));
+    }
+}
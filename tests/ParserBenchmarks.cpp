@@ -0,0 +1,67 @@
+#include "Test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+using namespace M4;
+
+static const int _callStatementCount = 40000;
+
+static const int _parseCount = 15;
+
+// Overloaded intrinsic and shader function calls, each resolved by comparing the cast ranks of its candidates.
+static const char* const _overloadedCalls[] =
+{
+    "    f1 += max(f1, 1) + min(i1, f1) + f(f1) + f(i1);\n",
+    "    f2 = lerp(f2, h2, f1) + f(f2) + abs(h2);\n",
+    "    f3 = clamp(f3, 0, 1) + f(f3) + normalize(f3) * dot(f3, h3);\n",
+    "    f4 = mul(f4, m) + f(f4) + saturate(f4) + f(h4.xyz).x;\n",
+    "    f1 += dot(f2, h2) + length(f3) + f(i2).y + step(f1, h1);\n",
+    "    h4 = max(h4, f4) + lerp(h4, f4, h1) + f(h1);\n",
+};
+
+/** A pixel shader whose body is made of overloaded calls, for MatchFunctionCall. */
+static std::string MakeOverloadedCalls()
+{
+    std::string source =
+        "float f(float x) { return x; }\n"
+        "float2 f(float2 x) { return x; }\n"
+        "float3 f(float3 x) { return x; }\n"
+        "float4 f(float4 x) { return x; }\n"
+        "float4x4 m;\n"
+        "float4 PSMain(float4 input : TEXCOORD0) : SV_Target0\n"
+        "{\n"
+        "    int i1 = 1; int2 i2 = 2;\n"
+        "    half h1 = 1; half2 h2 = 2; half3 h3 = 3; half4 h4 = 4;\n"
+        "    float f1 = input.x; float2 f2 = input.xy; float3 f3 = input.xyz; float4 f4 = input;\n";
+    for (int i = 0; i < _callStatementCount; ++i)
+    {
+        source += _overloadedCalls[i % (sizeof(_overloadedCalls) / sizeof(_overloadedCalls[0]))];
+    }
+    source +=
+        "    return f4 + h4 + f1;\n"
+        "}\n";
+    return source;
+}
+
+BENCHMARK(ParseOverloadedCalls)
+{
+    const std::string source = MakeOverloadedCalls();
+
+    double best = 0.0;
+    for (int i = 0; i < _parseCount; ++i)
+    {
+        HLSLTree tree;
+        auto start = std::chrono::steady_clock::now();
+        bool parsed = ParseSource(&tree, source.c_str());
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (!parsed)
+        {
+            return;
+        }
+        best = i == 0 ? milliseconds : std::min(best, milliseconds);
+    }
+
+    printf("ParseOverloadedCalls: %d statements of overloaded calls, best of %d parses: %.1f ms\n", _callStatementCount, _parseCount, best);
+}
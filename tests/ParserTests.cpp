@@ -0,0 +1,211 @@
+#include "Test.h"
+
+#include "HLSLParser.h"
+#include "HLSLPassManager.h"
+
+#include <string.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+using namespace M4;
+
+// The stack of a Windows thread, so the deep inputs are checked against the smallest stack the tool runs on.
+static const size_t _smallStackSize = 1024 * 1024;
+
+static const int _longInputSize = 100000;
+
+static std::string s_errors;
+
+static void RecordError(const char* message)
+{
+    s_errors += message;
+}
+
+/** Parses the source, returning false and the logged errors if it doesn't parse. */
+static bool ParseWithErrors(HLSLTree* tree, const std::string& source, std::string& errors)
+{
+    s_errors.clear();
+    Log_ErrorHandler previous = Log_SetErrorHandler(RecordError);
+    HLSLParser parser("deep.hlsl", source.data(), source.size());
+    bool parsed = parser.Parse(tree);
+    Log_SetErrorHandler(previous);
+    errors = s_errors;
+    return parsed;
+}
+
+#if _WIN32
+static DWORD WINAPI RunThread(void* run)
+{
+    ((void (*)())run)();
+    return 0;
+}
+#else
+static void* RunThread(void* run)
+{
+    ((void (*)())run)();
+    return NULL;
+}
+#endif
+
+/** Runs the function on a thread with a small stack, a stack overflow crashes the tests. */
+static void RunOnSmallStack(void (*run)())
+{
+#if _WIN32
+    HANDLE thread = CreateThread(NULL, _smallStackSize, RunThread, (void*)run, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+    CHECK(thread != NULL);
+    if (thread != NULL)
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+#else
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, _smallStackSize);
+    pthread_t thread;
+    bool started = pthread_create(&thread, &attributes, RunThread, (void*)run) == 0;
+    CHECK(started);
+    if (started)
+    {
+        pthread_join(thread, NULL);
+    }
+    pthread_attr_destroy(&attributes);
+#endif
+}
+
+static std::string Repeat(const char* text, int count)
+{
+    std::string result;
+    result.reserve(strlen(text) * count);
+    for (int i = 0; i < count; ++i)
+    {
+        result += text;
+    }
+    return result;
+}
+
+/** A pixel shader with the body, which assigns f from the input x. */
+static std::string MakeShader(const std::string& declarations, const std::string& body)
+{
+    return declarations +
+        "float4 PSMain(float x : TEXCOORD0, float unused : TEXCOORD1) : SV_Target0\n"
+        "{\n"
+        "    float f = 0;\n" +
+        body +
+        "    return f;\n"
+        "}\n";
+}
+
+/** Parses the shader and runs the passes walking the whole tree, which must neither fail nor overflow the stack. */
+static void CheckLongInput(const std::string& source)
+{
+    HLSLTree tree;
+    std::string errors;
+    CHECK(ParseWithErrors(&tree, source, errors));
+    CHECK(errors.empty());
+
+    const char* entryNames[] = { "PSMain" };
+    HLSLPassManager passManager(&tree);
+    passManager.AddPruneTree(entryNames, 1);
+    passManager.AddHideUnusedArguments();
+    passManager.AddFlattenExpressions();
+    CHECK(passManager.Run());
+
+    HLSLFunction* entry = tree.FindFunction("PSMain");
+    CHECK(entry != NULL && !entry->hidden && entry->statement != NULL);
+}
+
+static void ParseLongSum()
+{
+    CheckLongInput(MakeShader("", "    f = x" + Repeat(" + x", _longInputSize) + ";\n"));
+}
+
+static void ParseManyStatements()
+{
+    CheckLongInput(MakeShader("", Repeat("    f += x;\n", _longInputSize)));
+}
+
+static void ParseLongInitializer()
+{
+    const std::string declarations = "static const float Table[" + std::to_string(_longInputSize) + "] = { 1" + Repeat(", 1", _longInputSize - 1) + " };\n";
+    CheckLongInput(MakeShader(declarations, "    f = Table[(int)x];\n"));
+}
+
+static void ParseLongUnaryChain()
+{
+    // Spaced, so the tokenizer doesn't read decrements.
+    CheckLongInput(MakeShader("", "    f = " + Repeat("- ", _longInputSize) + "x;\n"));
+}
+
+static void ParseLongElseChain()
+{
+    CheckLongInput(MakeShader("", "    if (x < 0) f = 0;\n" + Repeat("    else if (x < 1) f = 1;\n", 20000)));
+}
+
+TEST(ParserHandlesLongSum)
+{
+    RunOnSmallStack(ParseLongSum);
+}
+
+TEST(ParserHandlesManyStatements)
+{
+    RunOnSmallStack(ParseManyStatements);
+}
+
+TEST(ParserHandlesLongInitializer)
+{
+    RunOnSmallStack(ParseLongInitializer);
+}
+
+TEST(ParserHandlesLongUnaryChain)
+{
+    RunOnSmallStack(ParseLongUnaryChain);
+}
+
+TEST(ParserHandlesLongElseChain)
+{
+    RunOnSmallStack(ParseLongElseChain);
+}
+
+static void CheckNestingLimit(const char* open, const char* close)
+{
+    // Below the limit the expression parses.
+    {
+        HLSLTree tree;
+        std::string errors;
+        CHECK(ParseWithErrors(&tree, MakeShader("", "    f = " + Repeat(open, 200) + "x" + Repeat(close, 200) + ";\n"), errors));
+        CHECK(errors.empty());
+    }
+
+    // Past it the parser reports where, instead of overflowing the stack.
+    {
+        HLSLTree tree;
+        std::string errors;
+        CHECK(!ParseWithErrors(&tree, MakeShader("", "    f = " + Repeat(open, 300) + "x" + Repeat(close, 300) + ";\n"), errors));
+        CHECK(errors.find("deep.hlsl(4) : Expression nested too deeply, the limit is 256 levels") != std::string::npos);
+    }
+}
+
+static void ParseNestedParentheses()
+{
+    CheckNestingLimit("(", ")");
+}
+
+static void ParseNestedCalls()
+{
+    CheckNestingLimit("abs(", ")");
+}
+
+TEST(ParserLimitsNestedParentheses)
+{
+    RunOnSmallStack(ParseNestedParentheses);
+}
+
+TEST(ParserLimitsNestedCalls)
+{
+    RunOnSmallStack(ParseNestedCalls);
+}
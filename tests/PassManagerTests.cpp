@@ -0,0 +1,86 @@
+#include "Test.h"
+
+#include "HLSLPassManager.h"
+
+using namespace M4;
+
+// Above the count below which the function passes stay on the calling thread.
+static const int _functionCount = 48;
+
+/**
+ * Functions each calling the one before, with repeated expressions around the
+ * calls, locals only read by their declaration and calls writing a global.
+ */
+static std::string MakeCallChain()
+{
+    std::string source =
+        "static float Total = 0;\n"
+        "float F0(float x)\n"
+        "{\n"
+        "    Total += x;\n"
+        "    return x * x + x * x;\n"
+        "}\n";
+    for (int i = 1; i < _functionCount; ++i)
+    {
+        const std::string callee = "F" + std::to_string(i - 1);
+        source +=
+            "float F" + std::to_string(i) + "(float x)\n"
+            "{\n"
+            "    float a = x * 2 + Total * 3;\n"
+            "    float dead = x * 2 + Total * 3;\n"
+            "    float written = " + callee + "(x);\n"
+            "    float b = " + callee + "(a) + x * 2 + Total * 3;\n"
+            "    return a + b + (x * 2 + Total * 3);\n"
+            "}\n";
+    }
+    source +=
+        "float4 PSMain(float x : TEXCOORD0) : SV_Target0\n"
+        "{\n"
+        "    return F" + std::to_string(_functionCount - 1) + "(x);\n"
+        "}\n";
+    return source;
+}
+
+/** Runs the passes with the job count, returning the full tree and the statistics. */
+static std::string RunPasses(unsigned int jobCount, std::vector<HLSLPassStatistics>& statistics)
+{
+    HLSLTree tree;
+    if (!ParseSource(&tree, MakeCallChain().c_str()))
+    {
+        return std::string();
+    }
+
+    HLSLPassManager passManager(&tree);
+    passManager.SetJobCount(jobCount);
+    passManager.AddEliminateCommonSubexpressions();
+    passManager.AddEliminateDeadCode();
+    CHECK(passManager.Run());
+    statistics = passManager.GetStatistics();
+    return WriteAnalysis(&tree, JSONFormat::Text, false, true);
+}
+
+TEST(PassManagerRunsFunctionPassesInParallel)
+{
+    std::vector<HLSLPassStatistics> expectedStatistics;
+    const std::string expected = RunPasses(1, expectedStatistics);
+    CHECK(expectedStatistics.size() == 2);
+    if (expectedStatistics.size() == 2)
+    {
+        // F0 repeats x * x, the others their first value before the calls, after which Total may have changed. The calls stay.
+        CHECK(expectedStatistics[0].eliminatedExpressions == _functionCount);
+        CHECK(expectedStatistics[1].removedStatements == _functionCount - 1);
+    }
+
+    // The threads change the bodies of the callees they check for side effects, a race shows with -fsanitize=thread.
+    for (int run = 0; run < 8; ++run)
+    {
+        std::vector<HLSLPassStatistics> statistics;
+        CHECK(RunPasses(8, statistics) == expected);
+        CHECK(statistics.size() == expectedStatistics.size());
+        for (size_t i = 0; i < statistics.size() && i < expectedStatistics.size(); ++i)
+        {
+            CHECK(statistics[i].eliminatedExpressions == expectedStatistics[i].eliminatedExpressions);
+            CHECK(statistics[i].removedStatements == expectedStatistics[i].removedStatements);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#include "Test.h"
+
+#include "HLSLPassManager.h"
+#include "HLSLSerializer.h"
+
+using namespace M4;
+
+/** The DOM output of the statements, compared along with the streamed analysis. */
+static nlohmann::json ConvertToJSON(HLSLTree* tree)
+{
+    nlohmann::json output = nlohmann::json::array();
+    for (HLSLStatement* statement = tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        output.push_back(statement->ConvertToJSON());
+    }
+    return output;
+}
+
+/** Checks that the tree read back from the serialization of tree gives the same outputs and serialization. */
+static void CheckRoundTrip(HLSLTree* tree)
+{
+    std::vector<unsigned char> buffer;
+    SerializeTree(tree, buffer);
+
+    HLSLTree copy;
+    CHECK(DeserializeTree(&copy, buffer.data(), buffer.size()));
+    CHECK(ConvertToJSON(&copy) == ConvertToJSON(tree));
+    CHECK(WriteAnalysis(&copy) == WriteAnalysis(tree));
+    CHECK(WriteAnalysis(&copy, JSONFormat::Text, false, true) == WriteAnalysis(tree, JSONFormat::Text, false, true));
+
+    std::vector<unsigned char> again;
+    SerializeTree(&copy, again);
+    CHECK(again == buffer);
+}
+
+TEST(SerializerRoundTrip)
+{
+    HLSLTree tree;
+    if (ParseSource(&tree, _sampleShader))
+    {
+        CheckRoundTrip(&tree);
+    }
+}
+
+TEST(SerializerRoundTripTransformed)
+{
+    // Passes leave hidden statements, temporaries and nodes the parser never makes.
+    HLSLTree tree;
+    if (ParseSource(&tree, _sampleShader))
+    {
+        const char* entryNames[] = { "PSMain" };
+        HLSLPassManager passManager(&tree);
+        passManager.AddInlineFunctions();
+        passManager.AddFoldConstants();
+        passManager.AddEliminateCommonSubexpressions();
+        passManager.AddFlattenExpressions();
+        passManager.AddPruneTree(entryNames, 1);
+        CHECK(passManager.Run());
+        CheckRoundTrip(&tree);
+    }
+}
+
+TEST(SerializerRejectsTruncatedData)
+{
+    HLSLTree tree;
+    if (!ParseSource(&tree, _sampleShader))
+    {
+        return;
+    }
+    std::vector<unsigned char> buffer;
+    SerializeTree(&tree, buffer);
+
+    for (size_t size = 0; size < buffer.size(); ++size)
+    {
+        HLSLTree copy;
+        if (DeserializeTree(&copy, buffer.data(), size))
+        {
+            CHECK(!"truncated data accepted");
+            break;
+        }
+    }
+}
+
+TEST(SerializerRejectsOtherFormats)
+{
+    HLSLTree tree;
+    if (!ParseSource(&tree, _sampleShader))
+    {
+        return;
+    }
+    std::vector<unsigned char> buffer;
+    SerializeTree(&tree, buffer);
+
+    // The magic comes first, then the version.
+    std::vector<unsigned char> magic = buffer;
+    magic[0] = 'X';
+    HLSLTree magicCopy;
+    CHECK(!DeserializeTree(&magicCopy, magic.data(), magic.size()));
+
+    std::vector<unsigned char> version = buffer;
+    version[4] = (unsigned char)(HLSLBinaryVersion + 1);
+    HLSLTree versionCopy;
+    CHECK(!DeserializeTree(&versionCopy, version.data(), version.size()));
+}
+
+TEST(SerializerSurvivesCorruptData)
+{
+    HLSLTree tree;
+    if (!ParseSource(&tree, _sampleShader))
+    {
+        return;
+    }
+    std::vector<unsigned char> buffer;
+    SerializeTree(&tree, buffer);
+
+    // Every byte is replaced in turn. Data still well formed may be accepted, but
+    // indices and node types out of range must be rejected, not followed.
+    for (size_t offset = 0; offset < buffer.size(); ++offset)
+    {
+        for (unsigned char value : { (unsigned char)0x00, (unsigned char)0x7f, (unsigned char)0xff })
+        {
+            std::vector<unsigned char> corrupt = buffer;
+            corrupt[offset] = value;
+            HLSLTree copy;
+            if (DeserializeTree(&copy, corrupt.data(), corrupt.size()))
+            {
+                WriteAnalysis(&copy, JSONFormat::Text, false, true);
+            }
+        }
+    }
+}
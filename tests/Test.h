@@ -0,0 +1,56 @@
+#ifndef HLSL_TEST_H
+#define HLSL_TEST_H
+
+#include "Engine.h"
+
+#include "HLSLTree.h"
+#include "JSONWriter.h"
+
+#include <string>
+
+namespace M4
+{
+
+/**
+ * A test, registered by the TEST macro and run by TestMain.cpp in the order of
+ * registration. Benchmarks, registered by the BENCHMARK macro, print their
+ * timings and only run when asked for.
+ */
+struct Test
+{
+    Test(const char* name, void (*run)(), bool benchmark = false);
+
+    const char*     name;
+    void            (*run)();
+    bool            benchmark;
+    Test*           next;
+};
+
+/** Records a failed check of the running test, which goes on. */
+void FailCheck(const char* file, int line, const char* condition);
+
+/** Parses the source into an empty tree. Fails the test and returns false if it doesn't parse. */
+bool ParseSource(HLSLTree* tree, const char* source, const char* fileName = "test.hlsl");
+
+/** Writes the top level statements as the command line tool writes an analysis. */
+std::string WriteAnalysis(HLSLTree* tree, JSONFormat format = JSONFormat::Text, bool compact = false, bool fullTree = false);
+
+/** Statements, declarations and expressions of most kinds, for the round trip tests. */
+extern const char* const _sampleShader;
+
+} // M4
+
+#define TEST(name) \
+    static void name(); \
+    static M4::Test name##_test(#name, name); \
+    static void name()
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static M4::Test name##_test(#name, name, true); \
+    static void name()
+
+#define CHECK(...) \
+    ((__VA_ARGS__) ? (void)0 : M4::FailCheck(__FILE__, __LINE__, #__VA_ARGS__))
+
+#endif
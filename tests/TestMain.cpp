@@ -0,0 +1,151 @@
+#include "Test.h"
+
+#include "HLSLParser.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace M4
+{
+
+// Constant initialized, so the tests of every file can register before main.
+static Test*    s_firstTest     = NULL;
+static Test**   s_lastTest      = &s_firstTest;
+static int      s_failedChecks  = 0;
+
+Test::Test(const char* name, void (*run)(), bool benchmark)
+{
+    this->name      = name;
+    this->run       = run;
+    this->benchmark = benchmark;
+    this->next      = NULL;
+    *s_lastTest = this;
+    s_lastTest  = &this->next;
+}
+
+void FailCheck(const char* file, int line, const char* condition)
+{
+    fprintf(stderr, "%s(%d) : check failed: %s\n", file, line, condition);
+    ++s_failedChecks;
+}
+
+bool ParseSource(HLSLTree* tree, const char* source, const char* fileName)
+{
+    HLSLParser parser(fileName, source, strlen(source));
+    if (!parser.Parse(tree))
+    {
+        FailCheck(__FILE__, __LINE__, "parser.Parse(tree)");
+        return false;
+    }
+    return true;
+}
+
+std::string WriteAnalysis(HLSLTree* tree, JSONFormat format, bool compact, bool fullTree)
+{
+    size_t count = 0;
+    for (HLSLStatement* statement = tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        ++count;
+    }
+
+    JSONWriter writer(format);
+    writer.SetCompact(compact);
+    writer.SetFullTree(fullTree);
+    writer.BeginArray((uint32_t)count);
+    for (HLSLStatement* statement = tree->GetRoot()->statement; statement != NULL; statement = statement->nextStatement)
+    {
+        statement->WriteJSON(writer);
+    }
+    writer.EndArray();
+    return writer.ReleaseBuffer();
+}
+
+const char* const _sampleShader = R"(
+struct VSIn { float3 pos : POSITION; float2 uv : TEXCOORD0; };
+struct VSOut { float4 pos : SV_Position; float2 uv : TEXCOORD0; };
+namespace NS { struct Inner { float a; }; }
+cbuffer PerFrame : register(b0) { float4x4 ViewProj; float3 LightDir; float Time; };
+cbuffer Unused : register(b1) { float4 Junk; };
+static const int COUNT = 4;
+static const float SCALE = 2.0 * 0.5;
+static const float Table[3] = { 1, 2, 3 };
+float4 Weights[COUNT];
+Texture2D<float4> Albedo : register(t0);
+SamplerState Samp : register(s0);
+sampler2D OldSamp;
+bool Flag;
+float Helper(float x) { return x * SCALE; }
+float Helper(float2 x) { return x.x; }
+float Unused(float x) { return x; }
+void OutFn(float a, out float b) { b = a; }
+float Fwd(float x);
+float Fwd(float x) { return x + 1; }
+VSOut VSMain(VSIn i) {
+  VSOut o;
+  o.pos = mul(float4(i.pos, 1.0), ViewProj);
+  o.uv = i.uv * Helper(Time);
+  float t;
+  OutFn(1.0, t);
+  int k = COUNT * 2 - 1;
+  k--;
+  for (int j = 0; j < COUNT; j++) { o.uv += Weights[j].xy; if (j == 2) break; else continue; }
+  if (Flag) { o.uv = -o.uv; } else o.uv.x = (float)k;
+  o.pos.x = k > 2 ? 1.0h : 0.5h;
+  o.uv.y += Fwd(Table[1]) + t;
+  return o;
+}
+[flatten]
+float4 PSMain(VSOut i) : SV_Target {
+  float4 c = Albedo.Sample(Samp, i.uv);
+  float3 n = normalize(LightDir);
+  float d = dot(n, n) + dot(n, n);
+  if (!Flag && d > 1) { c = 0; }
+  return c * d * tex2D(OldSamp, i.uv);
+  discard;
+}
+)";
+
+} // M4
+
+/**
+ * Runs every test, or those whose name contains the argument, and the
+ * benchmarks instead with --benchmarks first. Returns 1 if a check failed.
+ */
+int main(int argc, char* argv[])
+{
+    using namespace M4;
+
+    int argn = 1;
+    const bool benchmarks = argn < argc && strcmp(argv[argn], "--benchmarks") == 0;
+    argn += benchmarks ? 1 : 0;
+
+    const char* filter = argn < argc ? argv[argn] : NULL;
+    int testCount = 0;
+    int failedCount = 0;
+    for (Test* test = s_firstTest; test != NULL; test = test->next)
+    {
+        if (test->benchmark != benchmarks || (filter != NULL && strstr(test->name, filter) == NULL))
+        {
+            continue;
+        }
+
+        int failedChecks = s_failedChecks;
+        try
+        {
+            test->run();
+        }
+        catch (const std::exception& exception)
+        {
+            fprintf(stderr, "%s: exception: %s\n", test->name, exception.what());
+            ++s_failedChecks;
+        }
+
+        ++testCount;
+        bool failed = s_failedChecks != failedChecks;
+        failedCount += failed ? 1 : 0;
+        printf("%s %s\n", failed ? "FAILED" : "ok    ", test->name);
+    }
+
+    printf("%d tests, %d failed\n", testCount, failedCount);
+    return failedCount > 0 ? 1 : 0;
+}
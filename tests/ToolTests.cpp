@@ -0,0 +1,169 @@
+#include "Test.h"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+// Main.cpp is built without its main function for the tests.
+int RunTool(int argc, char* argv[]);
+
+namespace M4
+{
+
+namespace fs = std::filesystem;
+
+static const char* const _toolShader =
+    "float4 Tint;\n"
+    "float4 PSMain(float4 color : COLOR0) : SV_Target0\n"
+    "{\n"
+    "    return color * Tint;\n"
+    "}\n";
+
+/** Creates an empty directory of its own for the test. */
+static fs::path CreateTestDirectory(const char* name)
+{
+    std::random_device random;
+    const fs::path directory = fs::temp_directory_path() / (std::string("hlslparser-") + name + "-" + std::to_string(random()));
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+    return directory;
+}
+
+static void WriteTextFile(const fs::path& path, const char* text)
+{
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << text;
+}
+
+static std::string ReadTextFile(const fs::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    std::stringstream buffer;
+    buffer << ifs.rdbuf();
+    return buffer.str();
+}
+
+static int Run(const std::vector<std::string>& arguments)
+{
+    std::vector<std::string> strings(1, "hlslparser");
+    strings.insert(strings.end(), arguments.begin(), arguments.end());
+
+    std::vector<char*> argv;
+    for (std::string& string : strings)
+    {
+        argv.push_back(&string[0]);
+    }
+    argv.push_back(NULL);
+    return RunTool((int)strings.size(), argv.data());
+}
+
+static int CountCacheEntries(const fs::path& directory)
+{
+    int count = 0;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory))
+    {
+        if (entry.path().extension() == ".analysis")
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static bool Contains(const std::string& text, const char* part)
+{
+    return text.find(part) != std::string::npos;
+}
+
+TEST(CacheSharesAnalysesOfIdenticalFiles)
+{
+    const fs::path directory = CreateTestDirectory("cache-shared");
+    const fs::path cache = directory / "cache";
+    WriteTextFile(directory / "a.hlsl", _toolShader);
+    WriteTextFile(directory / "c.hlsl", _toolShader);
+
+    CHECK(Run({ "--cache", cache.string(), (directory / "a.hlsl").string(), "PSMain" }) == 0);
+    CHECK(Run({ "--cache", cache.string(), (directory / "c.hlsl").string(), "PSMain" }) == 0);
+
+    // Without the full tree the file name isn't part of the analysis, so both files share an entry.
+    CHECK(CountCacheEntries(cache) == 1);
+    CHECK(ReadTextFile(directory / "a.hlsl.analysis") == ReadTextFile(directory / "c.hlsl.analysis"));
+
+    fs::remove_all(directory);
+}
+
+TEST(CacheKeysFullTreeByFileName)
+{
+    const fs::path directory = CreateTestDirectory("cache-full-tree");
+    const fs::path cache = directory / "cache";
+    WriteTextFile(directory / "a.hlsl", _toolShader);
+    WriteTextFile(directory / "c.hlsl", _toolShader);
+
+    CHECK(Run({ "--full-tree", "--cache", cache.string(), (directory / "a.hlsl").string(), "PSMain" }) == 0);
+    CHECK(Run({ "--full-tree", "--cache", cache.string(), (directory / "c.hlsl").string(), "PSMain" }) == 0);
+    CHECK(CountCacheEntries(cache) == 2);
+
+    const std::string analysis = ReadTextFile(directory / "c.hlsl.analysis");
+    CHECK(Contains(analysis, "c.hlsl\""));
+    CHECK(!Contains(analysis, "a.hlsl\""));
+
+    // Running again hits the entry of the file itself.
+    CHECK(Run({ "--full-tree", "--cache", cache.string(), (directory / "c.hlsl").string(), "PSMain" }) == 0);
+    CHECK(CountCacheEntries(cache) == 2);
+    CHECK(ReadTextFile(directory / "c.hlsl.analysis") == analysis);
+
+    fs::remove_all(directory);
+}
+
+TEST(CacheKeysFullTreeRecordsByFileName)
+{
+    const fs::path directory = CreateTestDirectory("cache-records");
+    const fs::path cache = directory / "cache";
+    const fs::path output = directory / "analysis.ndjson";
+    WriteTextFile(directory / "a.hlsl", _toolShader);
+    WriteTextFile(directory / "c.hlsl", _toolShader);
+
+    // The second pass reads both records from the cache.
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        CHECK(Run({ "--full-tree", "--cache", cache.string(), "--ndjson", output.string(), (directory / "a.hlsl").string(), "PSMain", (directory / "c.hlsl").string() }) == 0);
+        CHECK(CountCacheEntries(cache) == 2);
+
+        const std::string records = ReadTextFile(output);
+        const size_t newline = records.find('\n');
+        CHECK(newline != std::string::npos);
+
+        const std::string first = records.substr(0, newline);
+        const std::string second = records.substr(newline + 1);
+        CHECK(Contains(first, "a.hlsl\"") && !Contains(first, "c.hlsl\""));
+        CHECK(Contains(second, "c.hlsl\"") && !Contains(second, "a.hlsl\""));
+    }
+
+    fs::remove_all(directory);
+}
+
+TEST(CacheRotatesStatistics)
+{
+    const fs::path directory = CreateTestDirectory("cache-statistics");
+    const fs::path cache = directory / "cache";
+    WriteTextFile(directory / "a.hlsl", _toolShader);
+
+    // A statistics file at its size limit, one byte per lookup.
+    fs::create_directories(cache);
+    WriteTextFile(cache / "statistics", std::string(1024 * 1024 - 1, 'h').c_str());
+
+    CHECK(Run({ "--cache", cache.string(), (directory / "a.hlsl").string(), "PSMain" }) == 0);
+    CHECK(fs::file_size(cache / "statistics.1") == 1024 * 1024);
+    CHECK(!fs::exists(cache / "statistics"));
+
+    // The next lookups start a new file.
+    CHECK(Run({ "--cache", cache.string(), (directory / "a.hlsl").string(), "PSMain" }) == 0);
+    CHECK(ReadTextFile(cache / "statistics") == "h");
+    CHECK(fs::file_size(cache / "statistics.1") == 1024 * 1024);
+
+    fs::remove_all(directory);
+}
+
+} // M4